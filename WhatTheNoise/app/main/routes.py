@@ -1,11 +1,22 @@
 import subprocess
 import os
 import shutil
+import socket
+import time
 from pathlib import Path
 from flask import render_template, request, Blueprint
 
 main = Blueprint('main', __name__)
 
+# Control sockets of the recorders (see control_socket.h)
+RECORDER_SOCKETS = ['./app/utils/record_PortAudio.sock', './app/utils/record_ALSA.sock']
+# Shared-memory live rings of each recorder (see live_ring.h): /whatthenoise_Mic1, /whatthenoise_Mic2, ...
+LIVE_RINGS = ['/whatthenoise_pa', '/whatthenoise']
+# Command line the record_ALSA daemon behind RECORDER_SOCKETS[1] was launched with, without the threshold
+DAEMON_CONFIG = './app/utils/record_ALSA.config'
+# Microphones besides Mic1 and Mic2: both recorders take up to 8 devices
+MAX_EXTRA_MICS = 6
+
 def run_command(command, error_message):
     """Executes a command and returns its output if successful, otherwise returns an error message"""
     result = subprocess.run(command, capture_output=True, text=True)
@@ -13,17 +24,109 @@ def run_command(command, error_message):
         return None, f"{error_message}: {result.stderr}"
     return result.stdout.strip(), None
 
+def send_recorder_command(socket_path, command, timeout=60):
+    """Sends a command to a recorder control socket and returns its one-line reply"""
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.settimeout(timeout)
+        sock.connect(socket_path)
+        sock.sendall((command + '\n').encode())
+        reply = b''
+        while not reply.endswith(b'\n'):
+            chunk = sock.recv(1024)
+            if not chunk:
+                break
+            reply += chunk
+    return reply.decode().strip()
+
+def build_program(program):
+    """Brings a program of app/utils up to date with its sources; make returns at once when it already is"""
+    output, error = run_command(['make', '-C', './app/utils', program], f"Error executing make for {program}")
+    return error
+
+def start_recorder(record_command, socket_path, timeout=10):
+    """Launches a recorder driven through its control socket and starts it once its devices are open"""
+    Path(socket_path).unlink(missing_ok=True)
+    record_process = subprocess.Popen(record_command + ['--control', socket_path])
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if record_process.poll() is not None:
+            return 'The recorder exited before starting'
+        if Path(socket_path).exists():
+            try:
+                reply = send_recorder_command(socket_path, 'start')
+                return None if reply.startswith('ok') else reply
+            except OSError:
+                pass
+        time.sleep(0.1)
+    return 'The recorder did not open its control socket'
+
+def start_recorder_session(record_command, socket_path):
+    """Opens a session on the record_ALSA daemon, a state change of a few microseconds.
+
+    The daemon keeps its devices capturing into the pre-roll between sessions. It is only launched
+    again, paying for the device setup, when none is running or its devices or settings differ.
+    The threshold (second to last argument) is changed on the running daemon instead.
+    """
+    threshold = record_command[-2]
+    config = ' '.join(record_command[:-2] + record_command[-1:])
+    config_path = Path(DAEMON_CONFIG)
+    if Path(socket_path).exists():
+        try:
+            if config_path.exists() and config_path.read_text() == config:
+                reply = send_recorder_command(socket_path, f'threshold {threshold}')
+                if reply.startswith('ok'):
+                    reply = send_recorder_command(socket_path, 'start')
+                    return None if reply.startswith('ok') else reply
+        except OSError:
+            # Stale socket of a daemon that is gone: launch a new one
+            pass
+    error = shutdown_daemon(socket_path)
+    if error:
+        return error
+    config_path.write_text(config)
+    return start_recorder(record_command + ['--daemon'], socket_path)
+
+def shutdown_daemon(socket_path):
+    """Shuts down the record_ALSA daemon, if any, so its devices are closed when the reply arrives.
+
+    Needed whenever the daemon will not be reused: it keeps capturing between sessions, and any other
+    recorder would find its devices busy.
+    """
+    Path(DAEMON_CONFIG).unlink(missing_ok=True)
+    if not Path(socket_path).exists():
+        return None
+    try:
+        reply = send_recorder_command(socket_path, 'shutdown')
+        return None if reply.startswith('ok') else reply
+    except OSError:
+        # Stale socket of a daemon that is gone
+        Path(socket_path).unlink(missing_ok=True)
+        return None
+
+def stop_recorders():
+    """Stops the running recorders and returns whether there was any; each reply arrives once its recordings are on disk.
+    The record_ALSA daemon only closes its session and stays up for the next one."""
+    stopped = False
+    for socket_path in RECORDER_SOCKETS:
+        if Path(socket_path).exists():
+            stopped = True
+            try:
+                reply = send_recorder_command(socket_path, 'stop')
+                if not reply.startswith('ok'):
+                    flash(f'Error stopping recording: {reply}', 'error')
+            except OSError as e:
+                flash(f'Error stopping recording: {str(e)}', 'error')
+    return stopped
+
 def get_devices_info():
-    """Gets the ID, name and supported sample rates of single channel audio devices connected to the system"""
-    make_command_devices = ['make', '-C', './app/utils', 'list_devices_info']
+    """Gets the ID, name, supported sample rates and input channels of the audio devices connected to the system"""
     run_command_devices = ['./app/utils/list_devices_info']
     
-    if not Path('./app/utils/list_devices_info.o').exists():
-        output, error = run_command(make_command_devices, "Error executing make for devices")
-        if error:
-            return None, None, error
+    error = build_program('list_devices_info')
+    if error:
+        return None, None, error
     
-    output, error = run_command(run_command_devices, "Error executing list_devices_info.o")
+    output, error = run_command(run_command_devices, "Error executing list_devices_info")
     if error:
         return None, None, error
     
@@ -36,7 +139,11 @@ def get_devices_info():
             mic_id = parts[0].split('ID: ')[1]
             name = parts[1].split('Name: ')[1]
             rates = parts[2].split('Rates: ')[1].split()
-            devices.append(mic_id + ') ' + name)
+            channels = int(parts[3].split('Channels: ')[1]) if len(parts) > 3 else 1
+            label = mic_id + ') ' + name
+            if channels > 1:
+                label += f' [{channels} canales]'
+            devices.append(label)
             all_sample_rates.append(set(map(int, rates)))
     
     common_sample_rates = set.intersection(*all_sample_rates) if all_sample_rates else set()
@@ -64,6 +171,8 @@ from flask import redirect, url_for, flash
 def start_recording():
     mic1 = request.form.get('mic_1')
     mic2 = request.form.get('mic_2')
+    # Optional microphones of a larger array, recorded as Mic3, Mic4, ... by both recorders
+    mic_extra = request.form.getlist('mic_extra')
     sample_rate = request.form.get('sample_rate')
     threshold = request.form.get('threshold')
     silence_precision = request.form.get('silence_precision')
@@ -78,44 +187,56 @@ def start_recording():
         flash('Debe seleccionar al menos una opción: Usar PortAudio o Usar ALSA.', 'error')
         return redirect(url_for('main.recording_config'))
     
-    if mic1 == mic2:
-        flash('Los micrófonos seleccionados deben ser diferentes.', 'error')
+    # Two inputs of the same multichannel interface are recorded by ALSA as Mic1 and Mic2
+    same_device = mic1 == mic2
+    if same_device and (use_portaudio or not mic1.endswith(' canales]')):
+        flash('Los micrófonos seleccionados deben ser diferentes, salvo dos entradas de una interfaz multicanal con ALSA.', 'error')
+        return redirect(url_for('main.recording_config'))
+
+    if len(mic_extra) > MAX_EXTRA_MICS:
+        flash(f'Puede seleccionar como máximo {MAX_EXTRA_MICS} micrófonos adicionales.', 'error')
+        return redirect(url_for('main.recording_config'))
+
+    if mic_extra and (same_device or len(set([mic1, mic2] + mic_extra)) != len(mic_extra) + 2):
+        flash('Los micrófonos adicionales deben ser diferentes entre sí y de los dos primeros.', 'error')
         return redirect(url_for('main.recording_config'))
 
     if use_portaudio:
-        mic1 = mic1.split(' ')[0].strip(")")
-        mic2 = mic2.split(' ')[0].strip(")")
+        mics = [mic.split(' ')[0].strip(")") for mic in [mic1, mic2] + mic_extra]
         
-        make_command = ['make', '-C', './app/utils', 'record_PortAudio']
-        record_command = ['./app/utils/record_PortAudio', mic1, mic2, sample_rate, threshold, silence_precision]
+        record_command = ['./app/utils/record_PortAudio', '--live', LIVE_RINGS[0], *mics, sample_rate, threshold, silence_precision]
         
-        if not Path('./app/utils/record_PortAudio.o').exists():
-            output, error = run_command(make_command, "Error executing make for recording")
-            if error:
-                return error, 500
+        error = build_program('record_PortAudio')
+        if error:
+            return error, 500
+
+        # The record_ALSA daemon would hold the same microphones
+        error = shutdown_daemon(RECORDER_SOCKETS[1])
+        if error:
+            return error, 500
             
-        record_process = subprocess.Popen(record_command)
-        
-        with open('./app/utils/record_PortAudio.pid', 'w') as f:
-            f.write(str(record_process.pid))
+        error = start_recorder(record_command, RECORDER_SOCKETS[0])
+        if error:
+            return error, 500
         
     if use_alsa:
-        mic1 = mic1.split(' ')[6].strip("()")
-        mic2 = mic2.split(' ')[6].strip("()")
+        mics = [mic.split(' ')[6].strip("()") for mic in [mic1, mic2] + mic_extra]
         
-        make_command = ['make', '-C', './app/utils', 'record_ALSA']
-        record_command = ['./app/utils/record_ALSA', mic1, mic2, sample_rate, threshold, silence_precision]
+        if same_device:
+            record_command = ['./app/utils/record_ALSA', '--live', LIVE_RINGS[1], '--channels', '2', mics[0], sample_rate, threshold, silence_precision]
+        else:
+            record_command = ['./app/utils/record_ALSA', '--live', LIVE_RINGS[1], *mics, sample_rate, threshold, silence_precision]
         
-        if not Path('./app/utils/record_ALSA.o').exists():
-            output, error = run_command(make_command, "Error executing make for recording")
-            if error:
-                return error, 500
+        error = build_program('record_ALSA')
+        if error:
+            return error, 500
             
-        record_process = subprocess.Popen(record_command)
-        
-        with open('./app/utils/record_ALSA.pid', 'w') as f:
-            f.write(str(record_process.pid))
+        error = start_recorder_session(record_command, RECORDER_SOCKETS[1])
+        if error:
+            return error, 500
             
+    # The analyzer falls back to numpy for GCC-PHAT if the native engine cannot be built
+    build_program('libgcc_phat.so')
     analysis_process = subprocess.Popen(['python', './app/utils/analyzer.py'])
     with open('./app/utils/analyzer.pid', 'w') as f:
         f.write(str(analysis_process.pid))
@@ -128,28 +249,16 @@ def recording_in_progress():
 
 @main.route('/stop_recording', methods=['POST'])
 def stop_recording():
-    path = ''
-    if Path('./app/utils/record_PortAudio.pid').exists():
-        path = './app/utils/record_PortAudio.pid'
-    elif Path('./app/utils/record_ALSA.pid').exists():
-        path = './app/utils/record_ALSA.pid'
-        
-    if path:
+    if stop_recorders():
         try:
-            with open(path, 'r') as f:
-                pid = int(f.read())
-                
-            os.system(f'kill {pid}')
-            os.remove(path)
-            
-            recording_dir1 = Path('./samples_threads_Mic1')
-            recording_dir2 = Path('./samples_threads_Mic2')
-            
-            if recording_dir1.exists() and recording_dir1.is_dir():
-                shutil.rmtree(recording_dir1)
+            # One directory per microphone of the array: Mic1, Mic2, ...
+            for recording_dir in Path('.').glob('samples_threads_Mic*'):
+                if recording_dir.is_dir():
+                    shutil.rmtree(recording_dir)
 
-            if recording_dir2.exists() and recording_dir2.is_dir():
-                shutil.rmtree(recording_dir2)
+            session_info = Path('./session_info.txt')
+            if session_info.exists():
+                session_info.unlink()
             
         except Exception as e:
             flash(f'Error stopping recording: {str(e)}', 'error')
@@ -169,28 +278,16 @@ def stop_recording():
 
 @main.route('/finish_recording', methods=['POST'])
 def finish_recording():
-    path = ''
-    if Path('./app/utils/record_PortAudio.pid').exists():
-        path = './app/utils/record_PortAudio.pid'
-    elif Path('./app/utils/record_ALSA.pid').exists():
-        path = './app/utils/record_ALSA.pid'
-        
-    if path:
+    if stop_recorders():
         try:
-            with open(path, 'r') as f:
-                pid = int(f.read())
-                
-            os.system(f'kill {pid}')
-            os.remove(path)
-            
-            recording_dir1 = Path('./samples_threads_Mic1')
-            recording_dir2 = Path('./samples_threads_Mic2')
-            
-            if recording_dir1.exists() and recording_dir1.is_dir():
-                shutil.rmtree(recording_dir1)
+            # One directory per microphone of the array: Mic1, Mic2, ...
+            for recording_dir in Path('.').glob('samples_threads_Mic*'):
+                if recording_dir.is_dir():
+                    shutil.rmtree(recording_dir)
 
-            if recording_dir2.exists() and recording_dir2.is_dir():
-                shutil.rmtree(recording_dir2)
+            session_info = Path('./session_info.txt')
+            if session_info.exists():
+                session_info.unlink()
             
         except Exception as e:
             flash(f'Error stopping recording: {str(e)}', 'error')
@@ -25,6 +25,7 @@ function validateForm() {
     const alsaChecked = document.getElementById('alsa').checked;
     const mic1 = document.getElementById('mic1').value;
     const mic2 = document.getElementById('mic2').value;
+    const micExtra = Array.from(document.getElementById('mic_extra').selectedOptions, option => option.value);
 
     if (!portaudioChecked && !alsaChecked) {
         alert('Debe seleccionar al menos una opción: Usar PortAudio o Usar ALSA.');
@@ -36,5 +37,15 @@ function validateForm() {
         return false
     }
 
+    if (micExtra.length > 6) {
+        alert('Puede seleccionar como máximo 6 micrófonos adicionales.');
+        return false;
+    }
+
+    if (micExtra.includes(mic1) || micExtra.includes(mic2)) {
+        alert('Los micrófonos adicionales deben ser diferentes del primero y del segundo.');
+        return false;
+    }
+
     return true;
 }
\ No newline at end of file
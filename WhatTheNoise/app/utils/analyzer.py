@@ -5,23 +5,34 @@ import subprocess
 from scipy.optimize import fsolve
 from watchdog.observers import Observer
 from watchdog.events import FileSystemEventHandler
+from timestamp_file import read_timestamps, RECORD_FILLED
+from event_container import EventContainer, parse_metadata
+from gcc_phat import event_tdoas
 
 start_time = time.strftime('%m%d_%H%M')
+session_info_path = "./session_info.txt"
+# Meters between Mic1 and Mic2
+MIC_DISTANCE = 2.15
 
 class FileHandler(FileSystemEventHandler):
-    def __init__(self, process_file_callback):
+    def __init__(self, process_file_callback, process_container_callback=None):
         self.process_file_callback = process_file_callback
+        self.process_container_callback = process_container_callback
         self.processed_files = set()
 
     def on_closed(self, event):
         if not event.is_directory and event.src_path.endswith('.ts'):
             self.process_file_callback(event.src_path)
+        elif not event.is_directory and event.src_path.endswith('.wtn') and self.process_container_callback:
+            self.process_container_callback(event.src_path)
             
 def get_sound_type(raw_file_path, sample_rate=44100, sample_size=2, threshold=1.2):
     """Determine if the sound is punctual or continuous based on its duration."""
     file_size = os.path.getsize(raw_file_path)
-    num_samples = file_size / sample_size
-    
+    return get_sound_type_from_frames(file_size / sample_size, sample_rate, threshold)
+
+def get_sound_type_from_frames(num_samples, sample_rate=44100, threshold=1.2):
+    """Determine if the sound is punctual or continuous from its number of samples."""
     duration = num_samples / sample_rate
     
     if duration < threshold:
@@ -29,16 +40,77 @@ def get_sound_type(raw_file_path, sample_rate=44100, sample_size=2, threshold=1.
     else:
         return "Sonido continuo"
 
-def calculate_tdoas_over_time(timestamps1, timestamps2, interval_length):
-    """Calculate TDOAs over time using fixed intervals."""
-    min_length = min(len(timestamps1), len(timestamps2))
-    num_intervals = int(min_length / interval_length)
-    tdoas = []
-    for i in range(num_intervals):
-        pos = int(i * interval_length)
-        tdoa = timestamps1[pos] - timestamps2[pos]
-        tdoas.append(tdoa)
-    return tdoas
+def read_session_info(path=session_info_path):
+    """Read the key=value session info written by the recorder, or None if it is not available yet."""
+    if not os.path.exists(path):
+        return None
+    info = {}
+    with open(path, 'r') as f:
+        for line in f:
+            key, sep, value = line.strip().partition('=')
+            if sep:
+                info[key] = value
+    return info
+
+# Raw sample size, ffmpeg input format and numpy dtype of each capture format written in the session info
+SAMPLE_FORMATS = {'S16_LE': (2, 's16le', '<i2'), 'S32_LE': (4, 's32le', '<i4'), 'FLOAT_LE': (4, 'f32le', '<f4')}
+
+def read_time_model(model_file_path):
+    """Read the (t0, rate) time model of a segment as ((seconds, fraction), rate), or None if there is none."""
+    return time_model_from_info(read_session_info(model_file_path))
+
+def read_raw_samples(raw_file_path, dtype):
+    """Samples of a raw segment file, mapped without reading them, or none if it is missing or empty."""
+    if not os.path.exists(raw_file_path) or os.path.getsize(raw_file_path) < np.dtype(dtype).itemsize:
+        return np.zeros(0, dtype=dtype)
+    return np.memmap(raw_file_path, dtype=dtype, mode='r')
+
+def time_model_from_info(info):
+    """(t0, rate) time model from the key=value lines of a model file or container, or None if there is none."""
+    if not info or 't0' not in info or 'rate' not in info:
+        return None
+    seconds, _, fraction = info['t0'].partition('.')
+    return (int(seconds), float('0.' + (fraction or '0'))), float(info['rate'])
+
+def read_segment_gaps(model_file_path):
+    """Read the gaps (offset, frames, filled, cause) of a segment lost to XRUNs or dropped periods."""
+    if not os.path.exists(model_file_path):
+        return []
+    with open(model_file_path, 'r') as f:
+        return segment_gaps_from_info(parse_metadata(f))
+
+def segment_gaps_from_info(info):
+    """Gaps (offset, frames, filled, cause) from the key=value lines of a model file or container."""
+    gaps = []
+    for value in info.get('gap', []):
+        offset, frames, filled, cause = value.split(',')
+        gaps.append((int(offset), int(frames), int(filled), cause))
+    return gaps
+
+def gap_period_mask(gaps, num_periods, frames_per_period):
+    """Boolean mask of the periods that hold real audio, False for periods overlapping a gap."""
+    valid = np.ones(num_periods, dtype=bool)
+    for offset, _, filled, _ in gaps:
+        first = offset // frames_per_period
+        last = (offset + max(filled, 1) - 1) // frames_per_period
+        valid[first:last + 1] = False
+    return valid
+
+def timestamp_time_model(records, sample_rate, offset=0.0):
+    """(t0, rate) time model of a segment without one, from the period timestamps shifted by offset seconds.
+
+    Each timestamp jitters with the delivery of its period, so t0 is the median of what they say."""
+    t0_ns = int(np.median(records['time_ns'] - records['frame_offset'] * (1e9 / sample_rate))) - int(round(offset * 1e9))
+    return (t0_ns // 1000000000, (t0_ns % 1000000000) / 1e9), float(sample_rate)
+
+def calculate_tdoas_over_time(samples1, samples2, model1, model2, interval_length, frames_per_period, valid=None, slack_frames=1):
+    """Calculate TDOAs over time with GCC-PHAT on windows of the samples, one every interval_length periods.
+
+    The time models align the windows of both microphones; slack_frames is how many samples that
+    alignment may be off. Windows over a period marked as not valid (zero-filled after an XRUN) are skipped."""
+    tdoas, _ = event_tdoas(samples1, samples2, model1, model2, MIC_DISTANCE, hop_frames=interval_length * frames_per_period,
+                           valid=valid, frames_per_period=frames_per_period, slack_frames=slack_frames)
+    return list(tdoas)
   
 def calculate_position(tdoa, d, speed_of_sound=343.0):
     """Calculate the position of the sound source based on TDOA."""
@@ -99,13 +171,57 @@ def determine_sound_position(positions, distance_between_mics, movement_threshol
     else:
         return "En movimiento"
     
+def analyze_event(index, samples, records1, records2, models, gaps, frames_per_period, start_skew, sample_rate, num_frames, sound_name, write_sound):
+    """Calculate the type and position of the sound of an event from the samples, timestamp records, time
+    models and gaps of both microphones, log them and encode the sound with write_sound(sound_file_path)."""
+    results_dir = f"./results_{start_time}"
+    sounds_dir = os.path.join(results_dir, "sounds")
+    os.makedirs(sounds_dir, exist_ok=True)
+
+    if len(records1) == 0 or len(records2) == 0:
+        print("No timestamps found.")
+        return False
+
+    # Audio lost to XRUNs is zero-filled by the recorder: keep those periods out of the TDOAs
+    num_periods = min(len(records1), len(records2))
+    valid = gap_period_mask(gaps[0], num_periods, frames_per_period) & \
+            gap_period_mask(gaps[1], num_periods, frames_per_period) & \
+            ((records1['flags'][:num_periods] & RECORD_FILLED) == 0) & \
+            ((records2['flags'][:num_periods] & RECORD_FILLED) == 0)
+
+    # Prefer the sample-accurate time models to align the windows of both microphones: the period
+    # timestamps, compensated by the measured start skew (Mic2 - Mic1), can be off by up to a period
+    model1, model2 = models
+    slack_frames = 1
+    if not (model1 and model2):
+        model1 = timestamp_time_model(records1, sample_rate)
+        model2 = timestamp_time_model(records2, sample_rate, start_skew)
+        slack_frames = frames_per_period
+
+    tdoas = calculate_tdoas_over_time(samples[0], samples[1], model1, model2, 10, frames_per_period, valid, slack_frames)
+
+    if not tdoas:
+        print("No TDOAs calculated.")
+        return False
+
+    positions = [calculate_position(tdoa, MIC_DISTANCE) for tdoa in tdoas]
+
+    sound_type = get_sound_type_from_frames(num_frames, sample_rate)
+
+    sound_position = determine_sound_position(positions, MIC_DISTANCE, MIC_DISTANCE/100)
+
+    log_file_path = os.path.join(results_dir, "results.log")
+    with open(log_file_path, 'a') as log_file:
+        log_file.write(f"{time.strftime('%Y-%m-%d %H:%M:%S')}, {sound_type}, {sound_position}, {sound_name}\n")
+
+    sound_id = f"sound_{index}.mp4"
+    write_sound(os.path.join(sounds_dir, sound_id))
+    return True
+
 def process_file(file_path):
     """Process a file and calculate the type and sound position based on the timestamps read."""
     mic1_dir = "./samples_threads_Mic1"
     mic2_dir = "./samples_threads_Mic2"
-    results_dir = f"./results_{start_time}"
-    sounds_dir = os.path.join(results_dir, "sounds")
-    os.makedirs(sounds_dir, exist_ok=True)
 
     file_name = os.path.basename(file_path)
     index = file_name.split('_')[2].split('.')[0]
@@ -118,53 +234,75 @@ def process_file(file_path):
         raw_file_path = file_path.replace('timestamps_Mic2', 'samples_Mic2').replace('.ts', '.raw')
 
     processed_set_key = (file_path, other_file_path)
+    mic1_ts_path, mic2_ts_path = (file_path, other_file_path) if "Mic1" in file_name else (other_file_path, file_path)
 
     if os.path.exists(other_file_path) and processed_set_key not in file_handler.processed_files:
-        with open(file_path, 'r') as f1, open(other_file_path, 'r') as f2:
-            data1 = f1.read().strip()
-            data2 = f2.read().strip()
-            
-            timestamps1 = np.array([float(line) for line in data1.split('\n') if line])
-            timestamps2 = np.array([float(line) for line in data2.split('\n') if line])
-            
-            if len(timestamps1) == 0 or len(timestamps2) == 0:
-                print("No timestamps found.")
-                return
+        session_info = read_session_info()
+        frames_per_period = int(session_info.get('frames_per_period', 128)) if session_info else 128
 
-            tdoas = calculate_tdoas_over_time(timestamps1, timestamps2, 10)
-            
-            if not tdoas:
-                print("No TDOAs calculated.")
-                return
+        records1, _ = read_timestamps(mic1_ts_path, frames_per_period)
+        records2, _ = read_timestamps(mic2_ts_path, frames_per_period)
 
-            positions = [calculate_position(tdoa, 2.15) for tdoa in tdoas]
-            
-            sound_type = get_sound_type(raw_file_path)
-                
-            sound_position = determine_sound_position(positions, 2.15, 2.15/100)
-            
-            log_file_path = os.path.join(results_dir, "results.log")
-            with open(log_file_path, 'a') as log_file:
-                log_file.write(f"{time.strftime('%Y-%m-%d %H:%M:%S')}, {sound_type}, {sound_position}, {os.path.basename(raw_file_path).replace('.raw', '.mp4')}\n")
-                
-            sound_id = f"sound_{index}.mp4"
-            sound_file_path = os.path.join(sounds_dir, sound_id)
-            ffmpeg_command = ['ffmpeg', '-y', '-f', 's16le', '-ar', '44100', '-ac', '1', '-i', raw_file_path, sound_file_path]
+        start_skew = float(session_info.get('start_skew', 0.0)) if session_info else 0.0
+
+        model1_path = mic1_ts_path.replace('timestamps_', 'model_').replace('.ts', '.tm')
+        model2_path = mic2_ts_path.replace('timestamps_', 'model_').replace('.ts', '.tm')
+        models = (read_time_model(model1_path), read_time_model(model2_path))
+        gaps = (read_segment_gaps(model1_path), read_segment_gaps(model2_path))
+
+        sample_rate = int(session_info.get('sample_rate', 44100)) if session_info else 44100
+        sample_size, ffmpeg_format, sample_dtype = SAMPLE_FORMATS.get(session_info.get('sample_format', 'S16_LE') if session_info else 'S16_LE', SAMPLE_FORMATS['S16_LE'])
+        num_frames = os.path.getsize(raw_file_path) // sample_size
+        samples = tuple(read_raw_samples(ts_path.replace('timestamps_', 'samples_').replace('.ts', '.raw'), sample_dtype)
+                        for ts_path in (mic1_ts_path, mic2_ts_path))
+
+        def write_sound(sound_file_path):
+            ffmpeg_command = ['ffmpeg', '-y', '-f', ffmpeg_format, '-ar', str(sample_rate), '-ac', '1', '-i', raw_file_path, sound_file_path]
             subprocess.run(ffmpeg_command, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
 
+        if not analyze_event(index, samples, records1, records2, models, gaps, frames_per_period, start_skew, sample_rate,
+                             num_frames, os.path.basename(raw_file_path).replace('.raw', '.mp4'), write_sound):
+            return
+
         # Marcar ambos archivos como procesados
         file_handler.processed_files.add(processed_set_key)
         file_handler.processed_files.add((other_file_path, file_path))
+
+def process_container(container_path):
+    """Process the container of an event: both microphones, their time models and gaps come from one file."""
+    if container_path in file_handler.processed_files:
+        return
+    try:
+        container = EventContainer(container_path)
+    except ValueError as error:
+        print(error)
+        return
+
+    channel_info = [container.metadata(channel) for channel in (0, 1)]
+    models = tuple(time_model_from_info(info) for info in channel_info)
+    gaps = tuple(segment_gaps_from_info(info) for info in channel_info)
+
+    def write_sound(sound_file_path):
+        ffmpeg_command = ['ffmpeg', '-y', '-f', container.ffmpeg_format, '-ar', str(container.sample_rate), '-ac', '1', '-i', '-', sound_file_path]
+        subprocess.run(ffmpeg_command, input=container.samples(0).tobytes(), stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    if analyze_event(container.event_id, (container.samples(0), container.samples(1)), container.timestamps(0), container.timestamps(1), models, gaps,
+                     container.frames_per_period, 0.0, container.sample_rate, container.num_frames(0),
+                     f"event_{container.event_id}.mp4", write_sound):
+        file_handler.processed_files.add(container_path)
         
 if __name__ == "__main__":
     mic1_dir = "./samples_threads_Mic1"
     mic2_dir = "./samples_threads_Mic2"
+    events_dir = "./events"
+    os.makedirs(events_dir, exist_ok=True)
 
-    file_handler = FileHandler(process_file)
+    file_handler = FileHandler(process_file, process_container)
     observer = Observer()
 
     observer.schedule(file_handler, mic1_dir, recursive=False)
     observer.schedule(file_handler, mic2_dir, recursive=False)
+    observer.schedule(file_handler, events_dir, recursive=False)
     
     observer.start()
 
@@ -0,0 +1,289 @@
+/**
+ * ******************************
+ * ********* batch_writer.c ********
+ * ******************************
+ *
+ * Implementation of the batched file writer declared in batch_writer.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "batch_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Parses an fsync policy given on the command line.
+ *
+ * @param text "none", "close" or "interval:MS".
+ * @param policy Parsed policy.
+ * @param intervalMs Parsed interval of the INTERVAL policy.
+ * @return 0 on success, -1 if the text is not a valid policy.
+ */
+int batchWriterParseFsync(const char *text, FsyncPolicy *policy, int *intervalMs)
+{
+    if (strcmp(text, "none") == 0)
+    {
+        *policy = FSYNC_NONE;
+        return 0;
+    }
+    if (strcmp(text, "close") == 0)
+    {
+        *policy = FSYNC_CLOSE;
+        return 0;
+    }
+    if (strncmp(text, "interval:", 9) == 0 && atoi(text + 9) > 0)
+    {
+        *policy = FSYNC_INTERVAL;
+        *intervalMs = atoi(text + 9);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Name of an fsync policy, as written in the session info.
+ *
+ * @param policy Policy.
+ * @return "none", "close" or "interval".
+ */
+const char *batchWriterFsyncName(FsyncPolicy policy)
+{
+    return policy == FSYNC_NONE ? "none" : policy == FSYNC_CLOSE ? "close" : "interval";
+}
+
+/**
+ * @brief Current time of the monotonic clock in nanoseconds.
+ */
+static int64_t monotonicNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Creates a file to be written in batches.
+ *
+ * @param writer Pointer to the writer.
+ * @param path Path of the file.
+ * @param preallocBytes Bytes reserved ahead of the data with fallocate, 0 to disable.
+ * @param policy fsync policy.
+ * @param intervalMs Minimum time between syncs of the INTERVAL policy.
+ * @return 0 on success, -1 on failure.
+ */
+int batchWriterOpen(BatchWriter *writer, const char *path, off_t preallocBytes, FsyncPolicy policy, int intervalMs)
+{
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (writer->fd < 0)
+    {
+        return -1;
+    }
+
+    writer->iovCount = 0;
+    writer->copyUsed = 0;
+    writer->pendingBytes = 0;
+    writer->offset = 0;
+    writer->allocated = 0;
+    writer->preallocBytes = preallocBytes;
+    writer->fsyncPolicy = policy;
+    writer->fsyncIntervalNs = (int64_t)intervalMs * 1000000;
+    writer->lastSyncNs = monotonicNs();
+    writer->writeCalls = 0;
+    writer->syncCalls = 0;
+    return 0;
+}
+
+/**
+ * @brief Queues a buffer without copying it. It must stay valid until the next flush.
+ *
+ * Flushes first if the batch is full.
+ *
+ * @param writer Pointer to the writer.
+ * @param data Buffer to write.
+ * @param bytes Size of the buffer.
+ * @return 0 on success, -1 on write error.
+ */
+int batchWriterAdd(BatchWriter *writer, const void *data, size_t bytes)
+{
+    struct iovec *last = writer->iovCount > 0 ? &writer->iov[writer->iovCount - 1] : NULL;
+
+    if (bytes == 0)
+    {
+        return 0;
+    }
+    // Consecutive buffers (the periods of a ring, the copy area) go out as one iovec
+    if (last != NULL && (const unsigned char *)last->iov_base + last->iov_len == data)
+    {
+        last->iov_len += bytes;
+        writer->pendingBytes += bytes;
+        return 0;
+    }
+    if (writer->iovCount == BATCH_WRITER_IOVECS && batchWriterFlush(writer) != 0)
+    {
+        return -1;
+    }
+
+    writer->iov[writer->iovCount].iov_base = (void *)data;
+    writer->iov[writer->iovCount].iov_len = bytes;
+    writer->iovCount++;
+    writer->pendingBytes += bytes;
+    return 0;
+}
+
+/**
+ * @brief Queues a copy of a buffer, for data that does not outlive the call.
+ *
+ * @param writer Pointer to the writer.
+ * @param data Buffer to write.
+ * @param bytes Size of the buffer.
+ * @return 0 on success, -1 on write error.
+ */
+int batchWriterCopy(BatchWriter *writer, const void *data, size_t bytes)
+{
+    // Flushing here, never inside batchWriterAdd(), keeps the copy area intact while it is queued
+    if ((writer->copyUsed + bytes > BATCH_WRITER_COPY_BYTES || writer->iovCount == BATCH_WRITER_IOVECS) &&
+        batchWriterFlush(writer) != 0)
+    {
+        return -1;
+    }
+    if (bytes > BATCH_WRITER_COPY_BYTES)
+    {
+        return batchWriterAdd(writer, data, bytes) == 0 ? batchWriterFlush(writer) : -1;
+    }
+
+    memcpy(writer->copy + writer->copyUsed, data, bytes);
+    writer->copyUsed += bytes;
+    return batchWriterAdd(writer, writer->copy + writer->copyUsed - bytes, bytes);
+}
+
+/**
+ * @brief Reserves space ahead of the data about to be written.
+ *
+ * The reservation keeps the file size, so a file left behind by a crash holds only data.
+ * Filesystems without fallocate just go on without it.
+ *
+ * @param writer Pointer to the writer.
+ */
+static void preallocate(BatchWriter *writer)
+{
+    off_t end = writer->offset + (off_t)writer->pendingBytes;
+
+    if (writer->preallocBytes <= 0 || end <= writer->allocated)
+    {
+        return;
+    }
+
+    off_t length = end - writer->allocated > writer->preallocBytes ? end - writer->allocated : writer->preallocBytes;
+    if (fallocate(writer->fd, FALLOC_FL_KEEP_SIZE, writer->allocated, length) != 0)
+    {
+        writer->preallocBytes = 0;
+        return;
+    }
+    writer->allocated += length;
+}
+
+/**
+ * @brief Writes every queued buffer with writev and syncs the file if the policy asks for it.
+ *
+ * @param writer Pointer to the writer.
+ * @return 0 on success, -1 on write error.
+ */
+int batchWriterFlush(BatchWriter *writer)
+{
+    struct iovec *iov = writer->iov;
+    int count = writer->iovCount;
+
+    if (writer->pendingBytes > 0)
+    {
+        preallocate(writer);
+    }
+
+    while (count > 0)
+    {
+        ssize_t written = writev(writer->fd, iov, count);
+        writer->writeCalls++;
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Could not write recording");
+            writer->iovCount = 0;
+            writer->copyUsed = 0;
+            writer->pendingBytes = 0;
+            return -1;
+        }
+
+        writer->offset += written;
+        // Skip what a short write did take and retry the rest
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (unsigned char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    writer->iovCount = 0;
+    writer->copyUsed = 0;
+    writer->pendingBytes = 0;
+
+    if (writer->fsyncPolicy == FSYNC_INTERVAL)
+    {
+        int64_t now = monotonicNs();
+        if (now - writer->lastSyncNs >= writer->fsyncIntervalNs)
+        {
+            fdatasync(writer->fd);
+            writer->syncCalls++;
+            writer->lastSyncNs = now;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes what is left, releases the unused reservation and closes the file.
+ *
+ * @param writer Pointer to the writer.
+ * @return 0 on success, -1 on failure.
+ */
+int batchWriterClose(BatchWriter *writer)
+{
+    int result = batchWriterFlush(writer);
+
+    if (writer->fd < 0)
+    {
+        return -1;
+    }
+    if (writer->allocated > writer->offset && ftruncate(writer->fd, writer->offset) != 0)
+    {
+        result = -1;
+    }
+    if (writer->fsyncPolicy != FSYNC_NONE)
+    {
+        fdatasync(writer->fd);
+        writer->syncCalls++;
+    }
+    if (close(writer->fd) != 0)
+    {
+        result = -1;
+    }
+    writer->fd = -1;
+    return result;
+}
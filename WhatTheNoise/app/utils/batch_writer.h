@@ -0,0 +1,73 @@
+/**
+ * ******************************
+ * ********* batch_writer.h ********
+ * ******************************
+ *
+ * Output file written in batches with writev. The writer threads queue the
+ * periods of a wakeup straight from the ring slots (no copy) and write them
+ * all with one system call. The file is preallocated with fallocate a few
+ * seconds ahead, so long recordings do not fragment the SD card, and it is
+ * synced according to a configurable fsync policy.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef BATCH_WRITER_H
+#define BATCH_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define BATCH_WRITER_IOVECS 64
+#define BATCH_WRITER_COPY_BYTES 16384
+
+/**
+ * @brief When written data is forced to the storage device.
+ *
+ * NONE leaves it to the kernel, CLOSE syncs each file when it is closed and INTERVAL also
+ * syncs at most every intervalMs while it is being written.
+ */
+typedef enum
+{
+    FSYNC_NONE,
+    FSYNC_CLOSE,
+    FSYNC_INTERVAL
+} FsyncPolicy;
+
+/**
+ * @brief File being written in batches.
+ *
+ * Buffers queued with batchWriterAdd() are referenced, not copied, and must stay valid until the
+ * next batchWriterFlush(). Buffers queued with batchWriterCopy() are copied into copy.
+ */
+typedef struct
+{
+    int fd;
+    struct iovec iov[BATCH_WRITER_IOVECS];
+    int iovCount;
+    unsigned char copy[BATCH_WRITER_COPY_BYTES];
+    size_t copyUsed;
+    size_t pendingBytes;
+    off_t offset;
+    off_t allocated;
+    off_t preallocBytes;
+    FsyncPolicy fsyncPolicy;
+    int64_t fsyncIntervalNs;
+    int64_t lastSyncNs;
+    unsigned long writeCalls;
+    unsigned long syncCalls;
+} BatchWriter;
+
+int batchWriterParseFsync(const char *text, FsyncPolicy *policy, int *intervalMs);
+const char *batchWriterFsyncName(FsyncPolicy policy);
+
+int batchWriterOpen(BatchWriter *writer, const char *path, off_t preallocBytes, FsyncPolicy policy, int intervalMs);
+int batchWriterAdd(BatchWriter *writer, const void *data, size_t bytes);
+int batchWriterCopy(BatchWriter *writer, const void *data, size_t bytes);
+int batchWriterFlush(BatchWriter *writer);
+int batchWriterClose(BatchWriter *writer);
+
+#endif
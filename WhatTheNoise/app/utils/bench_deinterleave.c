@@ -0,0 +1,112 @@
+/**
+ * ******************************
+ * ***** bench_deinterleave.c ******
+ * ******************************
+ *
+ * Microbenchmark of the channel splitter: time per period of the
+ * vectorized kernels against the scalar loop for every channel count and
+ * sample size the recorder captures, after checking that both produce the
+ * same planes.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "deinterleave.h"
+
+#define BENCH_ITERATIONS 100000
+#define MAX_CHANNELS 8
+
+typedef void (*DeinterleaveFunction)(const void *interleaved, void *const *planes, int channels, size_t frames, size_t sampleBytes);
+
+/**
+ * @brief Measures the average time a splitter takes per period.
+ *
+ * @param split Splitter to measure.
+ * @param interleaved Interleaved period.
+ * @param planes One buffer per channel.
+ * @param channels Number of channels.
+ * @param frames Frames per period.
+ * @param sampleBytes Size in bytes of a sample.
+ * @return Nanoseconds per period.
+ */
+static double measure(DeinterleaveFunction split, const void *interleaved, void *const *planes, int channels, size_t frames, size_t sampleBytes)
+{
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int it = 0; it < BENCH_ITERATIONS; it++)
+    {
+        split(interleaved, planes, channels, frames, sampleBytes);
+        __asm__ volatile("" : : "r"(planes[0]) : "memory");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    return ns / BENCH_ITERATIONS;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t frames = argc > 1 ? (size_t)atoi(argv[1]) : 128;
+    const int channelCounts[] = {2, 3, 4, 5, 6, 7, 8};
+    const size_t sampleSizes[] = {2, 4};
+    unsigned char *interleaved = malloc(frames * MAX_CHANNELS * 4);
+    unsigned char *vector = malloc(frames * MAX_CHANNELS * 4);
+    unsigned char *scalar = malloc(frames * MAX_CHANNELS * 4);
+    void *vectorPlanes[MAX_CHANNELS], *scalarPlanes[MAX_CHANNELS];
+
+    if (frames == 0 || interleaved == NULL || vector == NULL || scalar == NULL)
+    {
+        fprintf(stderr, "Usage: %s [frames_per_period]\n", argv[0]);
+        return 1;
+    }
+
+    srand(1);
+    for (size_t i = 0; i < frames * MAX_CHANNELS * 4; i++)
+    {
+        interleaved[i] = (unsigned char)rand();
+    }
+
+    printf("%zu frames/period, %s kernels\n", frames, deinterleaveKernelName());
+
+    for (size_t s = 0; s < sizeof(sampleSizes) / sizeof(sampleSizes[0]); s++)
+    {
+        for (size_t n = 0; n < sizeof(channelCounts) / sizeof(channelCounts[0]); n++)
+        {
+            int channels = channelCounts[n];
+            size_t sampleBytes = sampleSizes[s];
+
+            for (int c = 0; c < channels; c++)
+            {
+                vectorPlanes[c] = vector + c * frames * sampleBytes;
+                scalarPlanes[c] = scalar + c * frames * sampleBytes;
+            }
+            memset(vector, 0, frames * MAX_CHANNELS * 4);
+            memset(scalar, 0xff, frames * MAX_CHANNELS * 4);
+            deinterleave(interleaved, vectorPlanes, channels, frames, sampleBytes);
+            deinterleaveScalar(interleaved, scalarPlanes, channels, frames, sampleBytes);
+            if (memcmp(vector, scalar, channels * frames * sampleBytes) != 0)
+            {
+                fprintf(stderr, "%d x %zu-bit: kernel mismatch.\n", channels, sampleBytes * 8);
+                return 1;
+            }
+
+            double scalarNs = measure(deinterleaveScalar, interleaved, scalarPlanes, channels, frames, sampleBytes);
+            double vectorNs = measure(deinterleave, interleaved, vectorPlanes, channels, frames, sampleBytes);
+
+            printf("  %d x %2zu-bit  scalar: %8.1f ns/period   vector: %8.1f ns/period (x%.1f)\n",
+                   channels, sampleBytes * 8, scalarNs, vectorNs, scalarNs / vectorNs);
+        }
+    }
+
+    free(interleaved);
+    free(vector);
+    free(scalar);
+    return 0;
+}
@@ -0,0 +1,140 @@
+/**
+ * ******************************
+ * ******** bench_detect.c *********
+ * ******************************
+ *
+ * Microbenchmark of the period level detector: time per period of the
+ * vectorized kernel of each sample format against the scalar loop, after
+ * checking that both produce the same levels.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "detect.h"
+
+#define BENCH_PERIODS 1024
+#define BENCH_ITERATIONS 2000
+
+static SampleFormat scalarFormat;
+
+/**
+ * @brief Scalar detector with the signature of the vector kernels.
+ */
+static void detectScalar(const void *samples, size_t frames, int threshold, PeriodLevels *levels)
+{
+    detectPeriodScalar(samples, frames, scalarFormat, threshold, levels);
+}
+
+/**
+ * @brief Measures the average time a detector takes per period.
+ *
+ * @param detect Detector to measure.
+ * @param samples BENCH_PERIODS consecutive periods.
+ * @param periodBytes Size in bytes of a period.
+ * @param frames Frames per period.
+ * @param threshold Trigger threshold.
+ * @return Nanoseconds per period.
+ */
+static double measure(DetectFunction detect, const unsigned char *samples, size_t periodBytes, size_t frames, int threshold)
+{
+    struct timespec start, end;
+    volatile int32_t sink = 0;
+    PeriodLevels levels;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int it = 0; it < BENCH_ITERATIONS; it++)
+    {
+        for (int p = 0; p < BENCH_PERIODS; p++)
+        {
+            detect(samples + (size_t)p * periodBytes, frames, threshold, &levels);
+            sink += levels.peak + levels.firstOver;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    (void)sink;
+
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    return ns / ((double)BENCH_ITERATIONS * BENCH_PERIODS);
+}
+
+/**
+ * @brief Fills the periods with quiet noise and an occasional loud burst, like the signal the recorder sees.
+ *
+ * @param samples Buffer for BENCH_PERIODS periods.
+ * @param frames Frames per period.
+ * @param format Sample format.
+ */
+static void fillSamples(void *samples, size_t frames, SampleFormat format)
+{
+    srand(1);
+    for (size_t i = 0; i < frames * BENCH_PERIODS; i++)
+    {
+        double amplitude = (i / frames) % 16 == 0 ? 1.0 : 0.0625;
+        double value = amplitude * (2.0 * rand() / RAND_MAX - 1.0);
+
+        if (format == SAMPLE_S16)
+        {
+            ((int16_t *)samples)[i] = (int16_t)(value * 32767);
+        }
+        else if (format == SAMPLE_S32)
+        {
+            ((int32_t *)samples)[i] = (int32_t)(value * 2147483647.0);
+        }
+        else
+        {
+            ((float *)samples)[i] = (float)value;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t frames = argc > 1 ? (size_t)atoi(argv[1]) : 128;
+    int threshold = argc > 2 ? atoi(argv[2]) : 32767 / 10;
+    const SampleFormat formats[] = {SAMPLE_S16, SAMPLE_S32, SAMPLE_FLOAT};
+    unsigned char *samples = malloc(frames * BENCH_PERIODS * 4);
+
+    if (frames == 0 || samples == NULL)
+    {
+        fprintf(stderr, "Usage: %s [frames_per_period] [threshold]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%zu frames/period, threshold %d, %s kernels\n", frames, threshold, detectKernelName());
+
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    {
+        SampleFormat format = formats[f];
+        size_t periodBytes = frames * sampleFormatBytes(format);
+        DetectFunction detect = detectForFormat(format);
+
+        fillSamples(samples, frames, format);
+        for (int p = 0; p < BENCH_PERIODS; p++)
+        {
+            PeriodLevels vector, scalar;
+            detect(samples + (size_t)p * periodBytes, frames, threshold, &vector);
+            detectPeriodScalar(samples + (size_t)p * periodBytes, frames, format, threshold, &scalar);
+            if (vector.peak != scalar.peak || vector.sumSquares != scalar.sumSquares || vector.firstOver != scalar.firstOver)
+            {
+                fprintf(stderr, "%s: kernel mismatch at period %d.\n", sampleFormatName(format), p);
+                free(samples);
+                return 1;
+            }
+        }
+
+        scalarFormat = format;
+        double scalarNs = measure(detectScalar, samples, periodBytes, frames, threshold);
+        double vectorNs = measure(detect, samples, periodBytes, frames, threshold);
+
+        printf("  %-8s scalar: %8.1f ns/period   vector: %8.1f ns/period (x%.1f)\n",
+               sampleFormatName(format), scalarNs, vectorNs, scalarNs / vectorNs);
+    }
+
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,215 @@
+/**
+ * ******************************
+ * ********* bench_fft.c *********
+ * ******************************
+ *
+ * Microbenchmark of the real FFT: checks every size against a naive DFT
+ * in double precision and the round trip through the inverse transform,
+ * then measures the time per transform of the FFT and of the naive DFT,
+ * and the throughput of the batch API on the frames of a spectrogram.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fft.h"
+
+#define MIN_SIZE 64
+#define MAX_SIZE 8192
+#define NAIVE_MAX_SIZE 2048 // the naive DFT is O(n^2): only timed up to here
+#define TARGET_NS 2e8       // time spent measuring each case
+#define SPECTROGRAM_SECONDS 2
+#define SPECTROGRAM_RATE 44100
+#define SPECTROGRAM_FRAMES 1024
+#define SPECTROGRAM_HOP 512
+
+/**
+ * @brief Returns the time of the monotonic clock in nanoseconds.
+ */
+static double nowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/**
+ * @brief Naive DFT of real samples, bins 0 to size / 2, in double precision.
+ *
+ * @param input size samples.
+ * @param size Number of samples.
+ * @param spectrum Buffer of size + 2 doubles.
+ */
+static void naiveDft(const float *input, uint32_t size, double *spectrum)
+{
+    for (uint32_t k = 0; k <= size / 2; k++)
+    {
+        double re = 0.0, im = 0.0;
+        for (uint32_t n = 0; n < size; n++)
+        {
+            double angle = -2.0 * M_PI * (double)((uint64_t)k * n % size) / size;
+            re += input[n] * cos(angle);
+            im += input[n] * sin(angle);
+        }
+        spectrum[2 * k] = re;
+        spectrum[2 * k + 1] = im;
+    }
+}
+
+/**
+ * @brief Naive DFT of real samples in single precision with a table of the size, as a baseline to time.
+ *
+ * @param input size samples.
+ * @param size Number of samples.
+ * @param table cos, sin pairs of 2 pi j / size.
+ * @param spectrum Buffer of size + 2 floats.
+ */
+static void naiveDftTable(const float *input, uint32_t size, const float *table, float *spectrum)
+{
+    for (uint32_t k = 0; k <= size / 2; k++)
+    {
+        float re = 0.0f, im = 0.0f;
+        uint32_t j = 0;
+        for (uint32_t n = 0; n < size; n++)
+        {
+            re += input[n] * table[2 * j];
+            im -= input[n] * table[2 * j + 1];
+            j = (j + k) & (size - 1);
+        }
+        spectrum[2 * k] = re;
+        spectrum[2 * k + 1] = im;
+    }
+}
+
+int main(void)
+{
+    float *input = malloc(MAX_SIZE * sizeof(float));
+    float *spectrum = malloc((MAX_SIZE + 2) * sizeof(float));
+    float *output = malloc(MAX_SIZE * sizeof(float));
+    float *table = malloc(2 * MAX_SIZE * sizeof(float));
+    double *reference = malloc((MAX_SIZE + 2) * sizeof(double));
+    int failed = 0;
+
+    if (input == NULL || spectrum == NULL || output == NULL || table == NULL || reference == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    srand(1);
+    for (uint32_t i = 0; i < MAX_SIZE; i++)
+    {
+        input[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+    }
+
+    printf("%s kernels\n", fftKernelName());
+    printf("%6s %12s %12s %12s %14s %9s\n", "size", "max error", "round trip", "fft ns", "naive dft ns", "speedup");
+    for (uint32_t size = MIN_SIZE; size <= MAX_SIZE; size *= 2)
+    {
+        const FftPlan *plan = fftPlanGet(size);
+        double error = 0.0, scale = 0.0, roundTrip = 0.0;
+
+        if (plan == NULL)
+        {
+            fprintf(stderr, "No plan for %u\n", size);
+            return 1;
+        }
+
+        // Accuracy relative to the largest bin, and of the inverse relative to full scale
+        naiveDft(input, size, reference);
+        fftRealForward(plan, input, size, spectrum);
+        for (uint32_t i = 0; i < size + 2; i++)
+        {
+            error = fmax(error, fabs(spectrum[i] - reference[i]));
+            scale = fmax(scale, fabs(reference[i]));
+        }
+        error /= scale;
+        fftRealInverse(plan, spectrum, output);
+        for (uint32_t i = 0; i < size; i++)
+        {
+            roundTrip = fmax(roundTrip, fabs(output[i] - input[i]));
+        }
+        if (error > 1e-5 || roundTrip > 1e-5)
+        {
+            failed = 1;
+        }
+
+        long iterations = 0;
+        double start = nowNs(), elapsed;
+        do
+        {
+            fftRealForward(plan, input, size, spectrum);
+            __asm__ volatile("" : : "r"(spectrum) : "memory");
+            iterations++;
+        } while ((elapsed = nowNs() - start) < TARGET_NS);
+        double fftNs = elapsed / iterations;
+
+        if (size <= NAIVE_MAX_SIZE)
+        {
+            for (uint32_t j = 0; j < size; j++)
+            {
+                table[2 * j] = (float)cos(2.0 * M_PI * j / size);
+                table[2 * j + 1] = (float)sin(2.0 * M_PI * j / size);
+            }
+            iterations = 0;
+            start = nowNs();
+            do
+            {
+                naiveDftTable(input, size, table, spectrum);
+                __asm__ volatile("" : : "r"(spectrum) : "memory");
+                iterations++;
+            } while ((elapsed = nowNs() - start) < TARGET_NS);
+            double naiveNs = elapsed / iterations;
+            printf("%6u %12.2e %12.2e %12.0f %14.0f %8.0fx\n", size, error, roundTrip, fftNs, naiveNs, naiveNs / fftNs);
+        }
+        else
+        {
+            printf("%6u %12.2e %12.2e %12.0f %14s %9s\n", size, error, roundTrip, fftNs, "-", "-");
+        }
+    }
+
+    // Spectrogram of an event: overlapping frames through the batch API
+    size_t samples = (size_t)SPECTROGRAM_SECONDS * SPECTROGRAM_RATE;
+    size_t frames = (samples - SPECTROGRAM_FRAMES) / SPECTROGRAM_HOP + 1;
+    float *signal = malloc(samples * sizeof(float));
+    float *spectra = malloc(frames * (SPECTROGRAM_FRAMES + 2) * sizeof(float));
+    const FftPlan *plan = fftPlanGet(SPECTROGRAM_FRAMES);
+    if (signal == NULL || spectra == NULL || plan == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < samples; i++)
+    {
+        signal[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+    }
+    long iterations = 0;
+    double start = nowNs(), elapsed;
+    do
+    {
+        fftRealForwardBatch(plan, signal, SPECTROGRAM_HOP, SPECTROGRAM_FRAMES, spectra, SPECTROGRAM_FRAMES + 2, frames);
+        __asm__ volatile("" : : "r"(spectra) : "memory");
+        iterations++;
+    } while ((elapsed = nowNs() - start) < TARGET_NS);
+    printf("Spectrogram of %d s: %zu frames of %d, hop %d, %.2f ms (%.0f ns per frame)\n", SPECTROGRAM_SECONDS, frames,
+           SPECTROGRAM_FRAMES, SPECTROGRAM_HOP, elapsed / iterations / 1e6, elapsed / iterations / frames);
+
+    fftPlanCacheClear();
+    free(signal);
+    free(spectra);
+    free(input);
+    free(spectrum);
+    free(output);
+    free(table);
+    free(reference);
+    if (failed)
+    {
+        fprintf(stderr, "Accuracy check failed\n");
+        return 1;
+    }
+    return 0;
+}
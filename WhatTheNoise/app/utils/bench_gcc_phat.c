@@ -0,0 +1,107 @@
+/**
+ * ******************************
+ * ****** bench_gcc_phat.c *******
+ * ******************************
+ *
+ * Microbenchmark of the GCC-PHAT engine: time per window and per event of
+ * the window size and lag range the analyzer uses, after checking that it
+ * finds the delay between two noisy copies of the same signal.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "gcc_phat.h"
+
+#define BENCH_EVENTS 50
+#define EVENT_SECONDS 2
+#define SAMPLE_RATE 44100
+#define WINDOW_FRAMES 1024
+#define HOP_FRAMES 1280       // 10 periods of 128 frames
+#define MIC_DISTANCE 2.15
+#define SPEED_OF_SOUND 343.0
+
+/**
+ * @brief Uniform noise in [-1, 1).
+ */
+static float noise(void)
+{
+    return (float)rand() / ((float)RAND_MAX + 1.0f) * 2.0f - 1.0f;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t frames = (size_t)EVENT_SECONDS * SAMPLE_RATE;
+    uint32_t maxLag = (uint32_t)ceil(MIC_DISTANCE / SPEED_OF_SOUND * SAMPLE_RATE) + 1;
+    int delay = argc > 1 ? atoi(argv[1]) : 113;
+    size_t windows = (frames - WINDOW_FRAMES) / HOP_FRAMES + 1;
+    float *source = malloc((frames + maxLag) * sizeof(float));
+    float *samples1 = malloc(frames * sizeof(float));
+    float *samples2 = malloc(frames * sizeof(float));
+    int64_t *starts = malloc(windows * sizeof(int64_t));
+    double *lags = malloc(windows * sizeof(double));
+    double *peaks = malloc(windows * sizeof(double));
+    GccPhat *phat = gccPhatCreate(WINDOW_FRAMES, maxLag);
+
+    if ((uint32_t)abs(delay) >= maxLag || source == NULL || samples1 == NULL || samples2 == NULL || starts == NULL ||
+        lags == NULL || peaks == NULL || phat == NULL)
+    {
+        fprintf(stderr, "Usage: %s [delay_in_samples, below %u either way]\n", argv[0], maxLag);
+        return 1;
+    }
+
+    // Mic2 hears the source delay samples after Mic1, each with its own noise
+    srand(1);
+    for (size_t i = 0; i < frames + maxLag; i++)
+    {
+        source[i] = noise();
+    }
+    for (size_t i = 0; i < frames; i++)
+    {
+        samples1[i] = source[i + maxLag] + 0.3f * noise();
+        samples2[i] = source[i + maxLag - delay] + 0.3f * noise();
+    }
+    for (size_t i = 0; i < windows; i++)
+    {
+        starts[i] = (int64_t)(i * HOP_FRAMES);
+    }
+
+    size_t estimated = gccPhatEvent(phat, samples1, frames, samples2, frames, starts, starts, windows, lags, peaks);
+    size_t wrong = 0;
+    for (size_t i = 0; i < windows; i++)
+    {
+        wrong += fabs(lags[i] - delay) > 0.5;
+    }
+    printf("%u-point FFT, lags within +-%u, delay %d: %zu/%zu windows estimated, %zu off by more than half a sample\n",
+           phat->fftSize, maxLag, delay, estimated, windows, wrong);
+    if (estimated != windows || wrong != 0)
+    {
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int it = 0; it < BENCH_EVENTS; it++)
+    {
+        gccPhatEvent(phat, samples1, frames, samples2, frames, starts, starts, windows, lags, peaks);
+        __asm__ volatile("" : : "r"(lags) : "memory");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / BENCH_EVENTS;
+    printf("%.1f us per window, %.2f ms per %d s event of %zu windows\n", ns / windows / 1e3, ns / 1e6, EVENT_SECONDS, windows);
+
+    gccPhatDestroy(phat);
+    free(source);
+    free(samples1);
+    free(samples2);
+    free(starts);
+    free(lags);
+    free(peaks);
+    return 0;
+}
@@ -0,0 +1,553 @@
+/**
+ * ******************************
+ * ******** control_socket.c ********
+ * ******************************
+ *
+ * Implementation of the recorder control socket declared in control_socket.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "control_socket.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @brief Name of a state, as reported by the status command.
+ *
+ * @param state Control state.
+ * @return "armed", "recording", "paused", "stopping" or "stopped".
+ */
+const char *controlStateName(ControlState state)
+{
+    static const char *names[] = {"armed", "recording", "paused", "stopping", "stopped"};
+    return names[state];
+}
+
+/**
+ * @brief Asks the main thread to stop, unless it is already stopping.
+ *
+ * @param control Pointer to the control socket.
+ */
+static void requestStop(ControlSocket *control)
+{
+    pthread_mutex_lock(&control->mutex);
+    if (control->state < CONTROL_STOPPING)
+    {
+        control->stopRequested = 1;
+        control->state = CONTROL_STOPPING;
+        pthread_cond_broadcast(&control->cond);
+    }
+    pthread_mutex_unlock(&control->mutex);
+}
+
+/**
+ * @brief Blocks until the main thread has closed every file after a stop.
+ *
+ * @param control Pointer to the control socket.
+ */
+static void waitStopped(ControlSocket *control)
+{
+    pthread_mutex_lock(&control->mutex);
+    while (control->state != CONTROL_STOPPED)
+    {
+        pthread_cond_wait(&control->cond, &control->mutex);
+    }
+    pthread_mutex_unlock(&control->mutex);
+}
+
+/**
+ * @brief Opens a session of a daemon, as soon as its devices are running.
+ *
+ * Capture is already running, so this is only a state change: no device is touched.
+ * Called with the mutex held.
+ *
+ * @param control Pointer to the control socket.
+ * @param reply Buffer for the reply.
+ * @param size Size of the reply buffer.
+ */
+static void openSession(ControlSocket *control, char *reply, size_t size)
+{
+    while (!control->capturing && !control->stopRequested)
+    {
+        pthread_cond_wait(&control->cond, &control->mutex);
+    }
+    if (control->stopRequested)
+    {
+        snprintf(reply, size, "error stopping");
+    }
+    else if (control->beginSession(control->arg) != 0)
+    {
+        snprintf(reply, size, "error could not start");
+    }
+    else
+    {
+        control->state = CONTROL_RECORDING;
+        atomic_store(&control->paused, 0);
+        snprintf(reply, size, "ok recording");
+    }
+}
+
+/**
+ * @brief Closes the session of a daemon, which keeps capturing into the pre-roll.
+ *
+ * @param control Pointer to the control socket.
+ * @param reply Buffer for the reply.
+ * @param size Size of the reply buffer.
+ */
+static void closeSession(ControlSocket *control, char *reply, size_t size)
+{
+    int result = 0;
+
+    pthread_mutex_lock(&control->mutex);
+    if (control->state == CONTROL_RECORDING || control->state == CONTROL_PAUSED)
+    {
+        atomic_store(&control->paused, 1);
+        control->state = CONTROL_STOPPING;
+        pthread_mutex_unlock(&control->mutex);
+        // Only this thread changes the state while a session closes: it cannot be shut down under us
+        result = control->endSession(control->arg);
+        pthread_mutex_lock(&control->mutex);
+        control->state = CONTROL_ARMED;
+        pthread_cond_broadcast(&control->cond);
+    }
+    pthread_mutex_unlock(&control->mutex);
+    snprintf(reply, size, result == 0 ? "ok stopped" : "error the session did not close in time");
+}
+
+/**
+ * @brief Runs one command and writes its reply.
+ *
+ * start, stop and shutdown only reply once they have been carried out.
+ *
+ * @param control Pointer to the control socket.
+ * @param line Command line, without the newline.
+ * @param reply Buffer for the reply.
+ * @param size Size of the reply buffer.
+ */
+static void runCommand(ControlSocket *control, char *line, char *reply, size_t size)
+{
+    char *argument = strchr(line, ' ');
+
+    if (argument != NULL)
+    {
+        *argument++ = '\0';
+    }
+
+    if (strcmp(line, "start") == 0)
+    {
+        pthread_mutex_lock(&control->mutex);
+        if (control->state == CONTROL_ARMED && control->beginSession != NULL)
+        {
+            openSession(control, reply, size);
+        }
+        else if (control->state == CONTROL_ARMED)
+        {
+            control->startRequested = 1;
+            pthread_cond_broadcast(&control->cond);
+            while (control->state == CONTROL_ARMED)
+            {
+                pthread_cond_wait(&control->cond, &control->mutex);
+            }
+            snprintf(reply, size, control->state == CONTROL_RECORDING ? "ok recording" : "error could not start");
+        }
+        else if (control->state == CONTROL_PAUSED)
+        {
+            control->state = CONTROL_RECORDING;
+            atomic_store(&control->paused, 0);
+            snprintf(reply, size, "ok resumed");
+        }
+        else
+        {
+            snprintf(reply, size, control->state == CONTROL_RECORDING ? "ok recording" : "error stopping");
+        }
+        pthread_mutex_unlock(&control->mutex);
+    }
+    else if (strcmp(line, "pause") == 0)
+    {
+        pthread_mutex_lock(&control->mutex);
+        if (control->state == CONTROL_RECORDING || control->state == CONTROL_PAUSED)
+        {
+            control->state = CONTROL_PAUSED;
+            atomic_store(&control->paused, 1);
+            snprintf(reply, size, "ok paused");
+        }
+        else
+        {
+            snprintf(reply, size, "error not recording");
+        }
+        pthread_mutex_unlock(&control->mutex);
+    }
+    else if (strcmp(line, "stop") == 0 && control->endSession != NULL)
+    {
+        closeSession(control, reply, size);
+    }
+    else if (strcmp(line, "stop") == 0 || strcmp(line, "shutdown") == 0)
+    {
+        requestStop(control);
+        waitStopped(control);
+        snprintf(reply, size, "ok %s", strcmp(line, "stop") == 0 ? "stopped" : "shutdown");
+    }
+    else if (strcmp(line, "threshold") == 0)
+    {
+        char *end = NULL;
+        double value = argument != NULL ? strtod(argument, &end) : 0;
+
+        if (argument == NULL || end == argument || *end != '\0' || value <= 0 || value > 1)
+        {
+            snprintf(reply, size, "error threshold must be between 0 and 1");
+        }
+        else if (control->setThreshold == NULL || control->setThreshold(value, control->arg) != 0)
+        {
+            snprintf(reply, size, "error threshold not applied");
+        }
+        else
+        {
+            snprintf(reply, size, "ok threshold=%g", value);
+        }
+    }
+    else if (strcmp(line, "status") == 0)
+    {
+        int length;
+
+        pthread_mutex_lock(&control->mutex);
+        length = snprintf(reply, size, "ok state=%s", controlStateName(control->state));
+        pthread_mutex_unlock(&control->mutex);
+        if (control->status != NULL && length > 0 && (size_t)length + 1 < size)
+        {
+            reply[length] = ' ';
+            control->status(reply + length + 1, size - length - 1, control->arg);
+        }
+    }
+    else
+    {
+        snprintf(reply, size, "error unknown command %.64s", line);
+    }
+}
+
+/**
+ * @brief Handles a pending SIGINT or SIGTERM as a shutdown.
+ *
+ * @param control Pointer to the control socket.
+ */
+static void readSignal(ControlSocket *control)
+{
+    struct signalfd_siginfo info;
+
+    while (read(control->signalFd, &info, sizeof(info)) == sizeof(info))
+    {
+        fprintf(stderr, "Signal %u received, stopping.\n", info.ssi_signo);
+        requestStop(control);
+    }
+}
+
+/**
+ * @brief Serves the commands of a client until it disconnects or the socket is closed.
+ *
+ * @param control Pointer to the control socket.
+ * @param client Connected client.
+ * @return 1 if the socket is being closed, 0 otherwise.
+ */
+static int serveClient(ControlSocket *control, int client)
+{
+    char line[CONTROL_LINE_BYTES];
+    char reply[CONTROL_REPLY_BYTES];
+    size_t used = 0;
+
+    for (;;)
+    {
+        struct pollfd fds[3] = {{client, POLLIN, 0}, {control->wakeFd, POLLIN, 0}, {control->signalFd, POLLIN, 0}};
+
+        if (poll(fds, 3, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            return 1;
+        }
+        if (fds[2].revents & POLLIN)
+        {
+            readSignal(control);
+        }
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            continue;
+        }
+
+        ssize_t count = read(client, line + used, sizeof(line) - 1 - used);
+        if (count <= 0)
+        {
+            return 0;
+        }
+        used += count;
+
+        char *newline;
+        while ((newline = memchr(line, '\n', used)) != NULL)
+        {
+            size_t length = newline - line;
+
+            *newline = '\0';
+            if (length > 0 && line[length - 1] == '\r')
+            {
+                line[length - 1] = '\0';
+            }
+            runCommand(control, line, reply, sizeof(reply) - 1);
+            strcat(reply, "\n");
+            if (send(client, reply, strlen(reply), MSG_NOSIGNAL) < 0)
+            {
+                return 0;
+            }
+            used -= length + 1;
+            memmove(line, newline + 1, used);
+        }
+        if (used == sizeof(line) - 1)
+        {
+            // A command never gets this long: drop the connection rather than misread it
+            return 0;
+        }
+    }
+}
+
+/**
+ * @brief Body of the control thread: accepts one client at a time.
+ *
+ * @param arg Pointer to the control socket.
+ * @return NULL.
+ */
+static void *controlMain(void *arg)
+{
+    ControlSocket *control = (ControlSocket *)arg;
+
+    for (;;)
+    {
+        struct pollfd fds[3] = {{control->listenFd, POLLIN, 0}, {control->wakeFd, POLLIN, 0}, {control->signalFd, POLLIN, 0}};
+
+        if (poll(fds, 3, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error polling the control socket");
+            return NULL;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            return NULL;
+        }
+        if (fds[2].revents & POLLIN)
+        {
+            readSignal(control);
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            int client = accept4(control->listenFd, NULL, NULL, SOCK_CLOEXEC);
+            if (client < 0)
+            {
+                continue;
+            }
+            int closing = serveClient(control, client);
+            close(client);
+            if (closing)
+            {
+                return NULL;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Creates the socket and starts the control thread.
+ *
+ * Call it before any other thread is created: SIGINT and SIGTERM are blocked here so every
+ * thread inherits the mask and the signals reach the control thread as a shutdown.
+ *
+ * @param control Pointer to the control socket.
+ * @param path Path of the socket. A stale socket left at the path is replaced.
+ * @param setThreshold Applies the threshold command. May be NULL.
+ * @param status Adds the counters of the recorder to the status reply. May be NULL.
+ * @param beginSession Opens a session on start. NULL unless the recorder runs as a daemon.
+ * @param endSession Closes the session on stop. NULL unless the recorder runs as a daemon.
+ * @param arg Argument of the handlers.
+ * @return 0 on success, -1 on failure.
+ */
+int controlSocketOpen(ControlSocket *control, const char *path, ControlThresholdHandler setThreshold, ControlStatusHandler status,
+                      ControlSessionHandler beginSession, ControlSessionHandler endSession, void *arg)
+{
+    struct sockaddr_un address;
+    sigset_t signals;
+
+    memset(control, 0, sizeof(*control));
+    control->listenFd = -1;
+    control->wakeFd = -1;
+    control->signalFd = -1;
+    control->state = CONTROL_ARMED;
+    // Between the sessions of a daemon no event may start
+    atomic_init(&control->paused, beginSession != NULL);
+    control->setThreshold = setThreshold;
+    control->status = status;
+    control->beginSession = beginSession;
+    control->endSession = endSession;
+    control->arg = arg;
+    pthread_mutex_init(&control->mutex, NULL);
+    pthread_cond_init(&control->cond, NULL);
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "The control socket path is too long: %s\n", path);
+        return -1;
+    }
+    snprintf(control->path, sizeof(control->path), "%s", path);
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    control->signalFd = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    control->wakeFd = eventfd(0, EFD_CLOEXEC);
+    control->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (control->signalFd < 0 || control->wakeFd < 0 || control->listenFd < 0)
+    {
+        perror("Could not create the control socket");
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path, strlen(path));
+    unlink(path);
+    if (bind(control->listenFd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(control->listenFd, 4) != 0)
+    {
+        perror(path);
+        return -1;
+    }
+    chmod(path, 0600);
+
+    if (pthread_create(&control->thread, NULL, controlMain, control) != 0)
+    {
+        fprintf(stderr, "Error creating the control thread.\n");
+        unlink(path);
+        return -1;
+    }
+    control->threadStarted = 1;
+    return 0;
+}
+
+/**
+ * @brief Blocks until a client sends start or the recorder is asked to stop.
+ *
+ * Not used by a daemon, whose devices start right away.
+ *
+ * @param control Pointer to the control socket.
+ * @return 1 to start capturing, 0 to stop without starting.
+ */
+int controlSocketWaitStart(ControlSocket *control)
+{
+    int start;
+
+    pthread_mutex_lock(&control->mutex);
+    while (!control->startRequested && !control->stopRequested)
+    {
+        pthread_cond_wait(&control->cond, &control->mutex);
+    }
+    start = !control->stopRequested;
+    pthread_mutex_unlock(&control->mutex);
+    return start;
+}
+
+/**
+ * @brief Reports that capture is running, which answers the pending start.
+ *
+ * A daemon stays armed: from now on its sessions can be opened.
+ *
+ * @param control Pointer to the control socket.
+ */
+void controlSocketCapturing(ControlSocket *control)
+{
+    pthread_mutex_lock(&control->mutex);
+    control->capturing = 1;
+    if (control->state == CONTROL_ARMED && control->beginSession == NULL)
+    {
+        control->state = CONTROL_RECORDING;
+    }
+    pthread_cond_broadcast(&control->cond);
+    pthread_mutex_unlock(&control->mutex);
+}
+
+/**
+ * @brief Blocks until a client sends stop, or shutdown, or a SIGINT or SIGTERM arrives.
+ *
+ * The stop of a daemon only closes a session and does not end this wait.
+ *
+ * @param control Pointer to the control socket.
+ */
+void controlSocketWaitStop(ControlSocket *control)
+{
+    pthread_mutex_lock(&control->mutex);
+    while (!control->stopRequested)
+    {
+        pthread_cond_wait(&control->cond, &control->mutex);
+    }
+    pthread_mutex_unlock(&control->mutex);
+}
+
+/**
+ * @brief Answers the pending stop and removes the socket.
+ *
+ * Call it once every file has been closed: that is what the stop reply promises.
+ *
+ * @param control Pointer to the control socket.
+ */
+void controlSocketClose(ControlSocket *control)
+{
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&control->mutex);
+    control->state = CONTROL_STOPPED;
+    pthread_cond_broadcast(&control->cond);
+    pthread_mutex_unlock(&control->mutex);
+
+    if (control->threadStarted)
+    {
+        if (write(control->wakeFd, &one, sizeof(one)) != sizeof(one))
+        {
+            perror("Could not stop the control thread");
+        }
+        pthread_join(control->thread, NULL);
+    }
+    if (control->listenFd >= 0)
+    {
+        close(control->listenFd);
+        unlink(control->path);
+    }
+    if (control->wakeFd >= 0)
+    {
+        close(control->wakeFd);
+    }
+    if (control->signalFd >= 0)
+    {
+        close(control->signalFd);
+    }
+    pthread_cond_destroy(&control->cond);
+    pthread_mutex_destroy(&control->mutex);
+}
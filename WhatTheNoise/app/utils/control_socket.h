@@ -0,0 +1,110 @@
+/**
+ * ******************************
+ * ******** control_socket.h ********
+ * ******************************
+ *
+ * Control plane of the recorders: a Unix socket that takes one command per
+ * line and answers one line, "ok ..." or "error ...".
+ *
+ *   start             starts capturing, or resumes after pause
+ *   pause             stops starting new events; one in progress ends as on silence
+ *   threshold <0..1>  changes the trigger threshold while recording
+ *   status            state and counters of the recorder as key=value pairs
+ *   stop              stops capturing, drains the rings and closes every file;
+ *                     answered once all of it is on disk
+ *   shutdown          same as stop, and the recorder exits
+ *
+ * SIGINT and SIGTERM are turned into a shutdown as well, so a kill no
+ * longer loses the tail of the events being written.
+ *
+ * With session handlers the recorder runs as a daemon: the devices capture
+ * from the moment it is launched, start and stop only open and close a
+ * session, and the process stays up, pre-rolling, until shutdown.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define CONTROL_LINE_BYTES 256
+#define CONTROL_REPLY_BYTES 1024
+
+/**
+ * @brief Life cycle of a recorder driven through the socket.
+ */
+typedef enum
+{
+    CONTROL_ARMED,     // devices open, waiting for start (a daemon: capturing into the pre-roll)
+    CONTROL_RECORDING,
+    CONTROL_PAUSED,
+    CONTROL_STOPPING,  // stop requested, draining
+    CONTROL_STOPPED    // every file closed
+} ControlState;
+
+/**
+ * @brief Applies a new threshold, as a fraction of full scale.
+ *
+ * @return 0 on success, -1 if the recorder refuses it.
+ */
+typedef int (*ControlThresholdHandler)(double threshold, void *arg);
+
+/**
+ * @brief Writes the counters of the recorder as space separated key=value pairs.
+ */
+typedef void (*ControlStatusHandler)(char *reply, size_t size, void *arg);
+
+/**
+ * @brief Opens or closes a session of a daemon. Closing only returns once its files are closed.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+typedef int (*ControlSessionHandler)(void *arg);
+
+/**
+ * @brief Control socket and the state it drives.
+ */
+typedef struct
+{
+    int listenFd;
+    int wakeFd;   // eventfd that makes the control thread quit
+    int signalFd; // SIGINT and SIGTERM, handled as stop
+    char path[108];
+    pthread_t thread;
+    int threadStarted;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    ControlState state;
+    int startRequested;
+    int stopRequested;
+    int capturing;     // the devices are running: a daemon can open sessions
+    atomic_int paused; // read by the capture path on every period
+    ControlThresholdHandler setThreshold;
+    ControlStatusHandler status;
+    ControlSessionHandler beginSession; // NULL unless the recorder is a daemon
+    ControlSessionHandler endSession;
+    void *arg;
+} ControlSocket;
+
+int controlSocketOpen(ControlSocket *control, const char *path, ControlThresholdHandler setThreshold, ControlStatusHandler status,
+                      ControlSessionHandler beginSession, ControlSessionHandler endSession, void *arg);
+int controlSocketWaitStart(ControlSocket *control);
+void controlSocketCapturing(ControlSocket *control);
+void controlSocketWaitStop(ControlSocket *control);
+void controlSocketClose(ControlSocket *control);
+const char *controlStateName(ControlState state);
+
+/**
+ * @brief Whether new events must not be started. Lock-free, safe on the capture path.
+ */
+static inline int controlSocketPaused(ControlSocket *control)
+{
+    return atomic_load_explicit(&control->paused, memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,455 @@
+/**
+ * ******************************
+ * ********* deinterleave.c *********
+ * ******************************
+ *
+ * Implementation of the channel splitter declared in deinterleave.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "deinterleave.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DEINTERLEAVE_KERNEL "avx2"
+#define VECTOR_BYTES 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DEINTERLEAVE_KERNEL "sse2"
+#define VECTOR_BYTES 16
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DEINTERLEAVE_KERNEL "neon"
+#define VECTOR_BYTES 16
+#else
+#define DEINTERLEAVE_KERNEL "scalar"
+#define VECTOR_BYTES 0
+#endif
+
+#define MAX_VECTOR_CHANNELS 8
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+/**
+ * @brief Scalar splitter, also used for the tail of the vector kernels.
+ *
+ * @param interleaved Interleaved samples.
+ * @param planes One output buffer per channel.
+ * @param channels Number of channels.
+ * @param start First frame to split.
+ * @param frames Number of frames.
+ * @param sampleBytes Size in bytes of a sample.
+ */
+ALWAYS_INLINE void deinterleaveTail(const void *interleaved, void *const *planes, int channels, size_t start, size_t frames, size_t sampleBytes)
+{
+    for (int c = 0; c < channels; c++)
+    {
+        if (sampleBytes == 2)
+        {
+            const int16_t *in = (const int16_t *)interleaved + c;
+            int16_t *out = (int16_t *)planes[c];
+            for (size_t i = start; i < frames; i++)
+            {
+                out[i] = in[i * channels];
+            }
+        }
+        else if (sampleBytes == 4)
+        {
+            const int32_t *in = (const int32_t *)interleaved + c;
+            int32_t *out = (int32_t *)planes[c];
+            for (size_t i = start; i < frames; i++)
+            {
+                out[i] = in[i * channels];
+            }
+        }
+        else
+        {
+            const unsigned char *in = (const unsigned char *)interleaved + c * sampleBytes;
+            unsigned char *out = (unsigned char *)planes[c];
+            for (size_t i = start; i < frames; i++)
+            {
+                memcpy(out + i * sampleBytes, in + i * channels * sampleBytes, sampleBytes);
+            }
+        }
+    }
+}
+
+#if defined(__AVX2__)
+typedef __m256i Vector;
+
+ALWAYS_INLINE Vector loadVector(const unsigned char *p)
+{
+    return _mm256_loadu_si256((const __m256i *)p);
+}
+
+ALWAYS_INLINE void storeVector(unsigned char *p, Vector v)
+{
+    _mm256_storeu_si256((__m256i *)p, v);
+}
+
+/**
+ * @brief Loads the first slotBytes (8 or 16) of consecutive frames, frameBytes apart, one after another.
+ */
+ALWAYS_INLINE Vector loadSlots(const unsigned char *p, size_t frameBytes, size_t slotBytes)
+{
+    __m128i low, high;
+
+    if (slotBytes == 8)
+    {
+        low = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)p), _mm_loadl_epi64((const __m128i *)(p + frameBytes)));
+        high = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(p + 2 * frameBytes)),
+                                  _mm_loadl_epi64((const __m128i *)(p + 3 * frameBytes)));
+    }
+    else
+    {
+        low = _mm_loadu_si128((const __m128i *)p);
+        high = _mm_loadu_si128((const __m128i *)(p + frameBytes));
+    }
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+}
+
+/**
+ * @brief Splits two vectors of 16-bit samples into their even and odd samples, in order.
+ */
+ALWAYS_INLINE void split16(Vector a, Vector b, Vector *even, Vector *odd)
+{
+    Vector evenA = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+    Vector evenB = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+    // packs works within 128-bit halves: restore the sample order
+    *even = _mm256_permute4x64_epi64(_mm256_packs_epi32(evenA, evenB), 0xD8);
+    *odd = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16)), 0xD8);
+}
+
+/**
+ * @brief Splits two vectors of 32-bit samples into their even and odd samples, in order.
+ */
+ALWAYS_INLINE void split32(Vector a, Vector b, Vector *even, Vector *odd)
+{
+    __m256 fa = _mm256_castsi256_ps(a);
+    __m256 fb = _mm256_castsi256_ps(b);
+    *even = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0))), 0xD8);
+    *odd = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1))), 0xD8);
+}
+#elif defined(__SSE2__)
+typedef __m128i Vector;
+
+ALWAYS_INLINE Vector loadVector(const unsigned char *p)
+{
+    return _mm_loadu_si128((const __m128i *)p);
+}
+
+ALWAYS_INLINE void storeVector(unsigned char *p, Vector v)
+{
+    _mm_storeu_si128((__m128i *)p, v);
+}
+
+/**
+ * @brief Loads the first 8 bytes of two consecutive frames, frameBytes apart, one after the other.
+ */
+ALWAYS_INLINE Vector loadSlots(const unsigned char *p, size_t frameBytes, size_t slotBytes)
+{
+    (void)slotBytes;
+    return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)p), _mm_loadl_epi64((const __m128i *)(p + frameBytes)));
+}
+
+/**
+ * @brief Splits two vectors of 16-bit samples into their even and odd samples, in order.
+ */
+ALWAYS_INLINE void split16(Vector a, Vector b, Vector *even, Vector *odd)
+{
+    // Sign-extending each half keeps packs from saturating
+    Vector evenA = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+    Vector evenB = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    *even = _mm_packs_epi32(evenA, evenB);
+    *odd = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+}
+
+/**
+ * @brief Splits two vectors of 32-bit samples into their even and odd samples, in order.
+ */
+ALWAYS_INLINE void split32(Vector a, Vector b, Vector *even, Vector *odd)
+{
+    __m128 fa = _mm_castsi128_ps(a);
+    __m128 fb = _mm_castsi128_ps(b);
+    *even = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0)));
+    *odd = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+#elif defined(__ARM_NEON)
+typedef int16x8_t Vector;
+
+ALWAYS_INLINE Vector loadVector(const unsigned char *p)
+{
+    return vreinterpretq_s16_u8(vld1q_u8(p));
+}
+
+ALWAYS_INLINE void storeVector(unsigned char *p, Vector v)
+{
+    vst1q_u8(p, vreinterpretq_u8_s16(v));
+}
+
+/**
+ * @brief Loads the first 8 bytes of two consecutive frames, frameBytes apart, one after the other.
+ */
+ALWAYS_INLINE Vector loadSlots(const unsigned char *p, size_t frameBytes, size_t slotBytes)
+{
+    (void)slotBytes;
+    return vreinterpretq_s16_u8(vcombine_u8(vld1_u8(p), vld1_u8(p + frameBytes)));
+}
+
+/**
+ * @brief Splits two vectors of 16-bit samples into their even and odd samples, in order.
+ */
+ALWAYS_INLINE void split16(Vector a, Vector b, Vector *even, Vector *odd)
+{
+    int16x8x2_t split = vuzpq_s16(a, b);
+    *even = split.val[0];
+    *odd = split.val[1];
+}
+
+/**
+ * @brief Splits two vectors of 32-bit samples into their even and odd samples, in order.
+ */
+ALWAYS_INLINE void split32(Vector a, Vector b, Vector *even, Vector *odd)
+{
+    int32x4x2_t split = vuzpq_s32(vreinterpretq_s32_s16(a), vreinterpretq_s32_s16(b));
+    *even = vreinterpretq_s16_s32(split.val[0]);
+    *odd = vreinterpretq_s16_s32(split.val[1]);
+}
+#endif
+
+#if VECTOR_BYTES > 0
+/**
+ * @brief Splits a block of vectors of lanes interleaved channels, so that vector c holds channel c alone.
+ *
+ * Each stage splits consecutive vectors into their even and odd samples, even halves first: that
+ * halves the channels interleaved in each vector, and after log2(lanes) stages they are apart.
+ *
+ * @param regs lanes vectors, split in place.
+ * @param lanes Number of interleaved channels: 2, 4 or 8.
+ * @param sampleBytes Size in bytes of a sample: 2 or 4.
+ */
+ALWAYS_INLINE void splitBlock(Vector *regs, int lanes, size_t sampleBytes)
+{
+    Vector next[MAX_VECTOR_CHANNELS];
+
+#pragma GCC unroll 3
+    for (int width = 2; width <= lanes; width *= 2)
+    {
+#pragma GCC unroll 4
+        for (int i = 0; i < lanes / 2; i++)
+        {
+            if (sampleBytes == 2)
+            {
+                split16(regs[2 * i], regs[2 * i + 1], &next[i], &next[lanes / 2 + i]);
+            }
+            else
+            {
+                split32(regs[2 * i], regs[2 * i + 1], &next[i], &next[lanes / 2 + i]);
+            }
+        }
+#pragma GCC unroll 8
+        for (int c = 0; c < lanes; c++)
+        {
+            regs[c] = next[c];
+        }
+    }
+}
+
+/**
+ * @brief Splits a period whose channel count is a power of two up to MAX_VECTOR_CHANNELS.
+ *
+ * A block is one vector per channel, which holds VECTOR_BYTES / sampleBytes frames. Always
+ * inlined with constant channels and sample size, so the stages unroll.
+ *
+ * @param interleaved Interleaved samples.
+ * @param planes One output buffer per channel.
+ * @param channels Number of channels: 2, 4 or 8.
+ * @param frames Number of frames.
+ * @param sampleBytes Size in bytes of a sample: 2 or 4.
+ */
+ALWAYS_INLINE void deinterleaveVector(const void *interleaved, void *const *planes, int channels, size_t frames, size_t sampleBytes)
+{
+    const unsigned char *in = (const unsigned char *)interleaved;
+    size_t blockFrames = VECTOR_BYTES / sampleBytes;
+    size_t blocks = frames / blockFrames;
+
+    for (size_t b = 0; b < blocks; b++)
+    {
+        Vector regs[MAX_VECTOR_CHANNELS];
+
+#pragma GCC unroll 8
+        for (int c = 0; c < channels; c++)
+        {
+            regs[c] = loadVector(in + (b * channels + c) * VECTOR_BYTES);
+        }
+        splitBlock(regs, channels, sampleBytes);
+#pragma GCC unroll 8
+        for (int c = 0; c < channels; c++)
+        {
+            storeVector((unsigned char *)planes[c] + b * VECTOR_BYTES, regs[c]);
+        }
+    }
+
+    deinterleaveTail(interleaved, planes, channels, blocks * blockFrames, frames, sampleBytes);
+}
+
+/**
+ * @brief Splits a period of any other channel count up to MAX_VECTOR_CHANNELS.
+ *
+ * Every frame is loaded into a slot of lanes samples, the next power of two: the samples of the
+ * next frame that fill the rest of the slot act as extra channels that are never stored. The
+ * registers then hold the same layout as a period of lanes channels and go through the same
+ * stages. A slot reads past the end of its frame, so the last frame is always left to the tail.
+ *
+ * @param interleaved Interleaved samples.
+ * @param planes One output buffer per channel.
+ * @param channels Number of channels: 3, 5, 6 or 7.
+ * @param lanes Channels of a slot: 4 for 3 channels, 8 for 5 to 7.
+ * @param frames Number of frames.
+ * @param sampleBytes Size in bytes of a sample: 2 or 4.
+ */
+ALWAYS_INLINE void deinterleavePadded(const void *interleaved, void *const *planes, int channels, int lanes, size_t frames, size_t sampleBytes)
+{
+    const unsigned char *in = (const unsigned char *)interleaved;
+    size_t frameBytes = channels * sampleBytes;
+    size_t slotBytes = lanes * sampleBytes;
+    size_t blockFrames = VECTOR_BYTES / sampleBytes;
+    size_t blocks = frames > 0 ? (frames - 1) / blockFrames : 0;
+
+    for (size_t b = 0; b < blocks; b++)
+    {
+        const unsigned char *block = in + b * blockFrames * frameBytes;
+        Vector regs[MAX_VECTOR_CHANNELS];
+
+#pragma GCC unroll 8
+        for (int v = 0; v < lanes; v++)
+        {
+            if (slotBytes >= VECTOR_BYTES)
+            {
+                // A slot spans slotBytes / VECTOR_BYTES vectors
+                size_t parts = slotBytes / VECTOR_BYTES;
+                regs[v] = loadVector(block + (v / parts) * frameBytes + (v % parts) * VECTOR_BYTES);
+            }
+            else
+            {
+                regs[v] = loadSlots(block + v * (VECTOR_BYTES / slotBytes) * frameBytes, frameBytes, slotBytes);
+            }
+        }
+        splitBlock(regs, lanes, sampleBytes);
+#pragma GCC unroll 8
+        for (int c = 0; c < channels; c++)
+        {
+            storeVector((unsigned char *)planes[c] + b * VECTOR_BYTES, regs[c]);
+        }
+    }
+
+    deinterleaveTail(interleaved, planes, channels, blocks * blockFrames, frames, sampleBytes);
+}
+#endif
+
+/**
+ * @brief Splits a period of interleaved samples into one buffer per channel.
+ *
+ * @param interleaved Interleaved samples, frames * channels of them.
+ * @param planes One output buffer per channel, with room for frames samples each.
+ * @param channels Number of channels.
+ * @param frames Number of frames.
+ * @param sampleBytes Size in bytes of a sample.
+ */
+void deinterleave(const void *interleaved, void *const *planes, int channels, size_t frames, size_t sampleBytes)
+{
+    if (channels == 1)
+    {
+        memcpy(planes[0], interleaved, frames * sampleBytes);
+        return;
+    }
+
+#if VECTOR_BYTES > 0
+    // Every case is a separate specialization of the inlined kernels
+    if (sampleBytes == 2)
+    {
+        switch (channels)
+        {
+        case 2:
+            deinterleaveVector(interleaved, planes, 2, frames, 2);
+            return;
+        case 3:
+            deinterleavePadded(interleaved, planes, 3, 4, frames, 2);
+            return;
+        case 4:
+            deinterleaveVector(interleaved, planes, 4, frames, 2);
+            return;
+        case 5:
+            deinterleavePadded(interleaved, planes, 5, 8, frames, 2);
+            return;
+        case 6:
+            deinterleavePadded(interleaved, planes, 6, 8, frames, 2);
+            return;
+        case 7:
+            deinterleavePadded(interleaved, planes, 7, 8, frames, 2);
+            return;
+        case 8:
+            deinterleaveVector(interleaved, planes, 8, frames, 2);
+            return;
+        }
+    }
+    else if (sampleBytes == 4)
+    {
+        switch (channels)
+        {
+        case 2:
+            deinterleaveVector(interleaved, planes, 2, frames, 4);
+            return;
+        case 3:
+            deinterleavePadded(interleaved, planes, 3, 4, frames, 4);
+            return;
+        case 4:
+            deinterleaveVector(interleaved, planes, 4, frames, 4);
+            return;
+        case 5:
+            deinterleavePadded(interleaved, planes, 5, 8, frames, 4);
+            return;
+        case 6:
+            deinterleavePadded(interleaved, planes, 6, 8, frames, 4);
+            return;
+        case 7:
+            deinterleavePadded(interleaved, planes, 7, 8, frames, 4);
+            return;
+        case 8:
+            deinterleaveVector(interleaved, planes, 8, frames, 4);
+            return;
+        }
+    }
+#endif
+
+    deinterleaveScalar(interleaved, planes, channels, frames, sampleBytes);
+}
+
+/**
+ * @brief Splits a period of interleaved samples with the portable scalar loop.
+ *
+ * @param interleaved Interleaved samples, frames * channels of them.
+ * @param planes One output buffer per channel, with room for frames samples each.
+ * @param channels Number of channels.
+ * @param frames Number of frames.
+ * @param sampleBytes Size in bytes of a sample.
+ */
+void deinterleaveScalar(const void *interleaved, void *const *planes, int channels, size_t frames, size_t sampleBytes)
+{
+    deinterleaveTail(interleaved, planes, channels, 0, frames, sampleBytes);
+}
+
+/**
+ * @brief Name of the vector kernels.
+ *
+ * @return "avx2", "sse2", "neon" or "scalar".
+ */
+const char *deinterleaveKernelName(void)
+{
+    return DEINTERLEAVE_KERNEL;
+}
@@ -0,0 +1,26 @@
+/**
+ * ******************************
+ * ********* deinterleave.h *********
+ * ******************************
+ *
+ * Splits the interleaved periods of a multichannel device into one plane
+ * per channel, so every input of the interface goes through the recorder
+ * as if it were a microphone of its own. 2 to 8 channels of 16 or 32-bit
+ * samples use AVX2/SSE2/NEON kernels selected at compile time, the counts
+ * that are not a power of two by loading each frame into a slot of the next
+ * one; any other layout, and the tail of a period, use the scalar loop.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef DEINTERLEAVE_H
+#define DEINTERLEAVE_H
+
+#include <stddef.h>
+
+void deinterleave(const void *interleaved, void *const *planes, int channels, size_t frames, size_t sampleBytes);
+void deinterleaveScalar(const void *interleaved, void *const *planes, int channels, size_t frames, size_t sampleBytes);
+const char *deinterleaveKernelName(void);
+
+#endif
@@ -0,0 +1,431 @@
+/**
+ * ******************************
+ * *********** detect.c ************
+ * ******************************
+ *
+ * Implementation of the period level detector declared in detect.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "detect.h"
+
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DETECT_KERNEL "avx2"
+#define DETECT_LANES 16
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DETECT_KERNEL "sse2"
+#define DETECT_LANES 8
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DETECT_KERNEL "neon"
+#define DETECT_LANES 8
+#else
+#define DETECT_KERNEL "scalar"
+#define DETECT_LANES 1
+#endif
+
+#define FLOAT_SCALE 32767.0f
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+/**
+ * @brief Clamps the threshold to the range a saturated absolute value can exceed.
+ *
+ * @param threshold Trigger threshold.
+ * @return Threshold in [-1, 32767].
+ */
+static inline int clampThreshold(int threshold)
+{
+    return threshold < -1 ? -1 : threshold > 32767 ? 32767 : threshold;
+}
+
+/**
+ * @brief Converts one sample to 16-bit units exactly like the vector loads do.
+ *
+ * @param samples Samples of the period.
+ * @param index Index of the sample.
+ * @param format Sample format.
+ * @return Sample in 16-bit units.
+ */
+ALWAYS_INLINE int32_t sampleAt(const void *samples, size_t index, SampleFormat format)
+{
+    if (format == SAMPLE_S16)
+    {
+        return ((const int16_t *)samples)[index];
+    }
+    if (format == SAMPLE_S32)
+    {
+        return ((const int32_t *)samples)[index] >> 16;
+    }
+
+    float scaled = ((const float *)samples)[index] * FLOAT_SCALE;
+#if defined(__ARM_NEON) && !defined(__SSE2__)
+    long value = (long)scaled; // vcvtq_s32_f32 truncates
+#else
+    long value = lrintf(scaled); // cvtps2dq rounds to nearest
+#endif
+    return value > 32767 ? 32767 : value < -32768 ? -32768 : (int32_t)value;
+}
+
+/**
+ * @brief Scalar detector, also used for the tail of the vector kernels.
+ *
+ * @param samples Samples of the period.
+ * @param start Index of the first sample to process.
+ * @param frames Number of samples of the period.
+ * @param format Sample format.
+ * @param threshold Clamped trigger threshold.
+ * @param levels Levels accumulated so far, updated in place.
+ */
+ALWAYS_INLINE void detectTail(const void *samples, size_t start, size_t frames, SampleFormat format, int threshold, PeriodLevels *levels)
+{
+    for (size_t i = start; i < frames; i++)
+    {
+        int32_t value = sampleAt(samples, i, format);
+        int32_t magnitude = value < 0 ? -value : value;
+
+        if (magnitude > 32767)
+        {
+            magnitude = 32767;
+        }
+        if (magnitude > levels->peak)
+        {
+            levels->peak = magnitude;
+        }
+        if (levels->firstOver < 0 && magnitude > threshold)
+        {
+            levels->firstOver = (int32_t)i;
+        }
+        levels->sumSquares += (uint64_t)(value * value);
+    }
+}
+
+#if defined(__AVX2__)
+/**
+ * @brief Loads DETECT_LANES samples as 16-bit lanes, in order.
+ */
+ALWAYS_INLINE __m256i loadLanes(const void *samples, size_t index, SampleFormat format)
+{
+    if (format == SAMPLE_S16)
+    {
+        return _mm256_loadu_si256((const __m256i *)((const int16_t *)samples + index));
+    }
+
+    __m256i low, high;
+    if (format == SAMPLE_S32)
+    {
+        const int32_t *p = (const int32_t *)samples + index;
+        low = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)p), 16);
+        high = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)(p + 8)), 16);
+    }
+    else
+    {
+        const float *p = (const float *)samples + index;
+        const __m256 scale = _mm256_set1_ps(FLOAT_SCALE);
+        low = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(p), scale));
+        high = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(p + 8), scale));
+    }
+    // packs works within 128-bit halves: restore the sample order
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+}
+#elif defined(__SSE2__)
+/**
+ * @brief Loads DETECT_LANES samples as 16-bit lanes, in order.
+ */
+ALWAYS_INLINE __m128i loadLanes(const void *samples, size_t index, SampleFormat format)
+{
+    if (format == SAMPLE_S16)
+    {
+        return _mm_loadu_si128((const __m128i *)((const int16_t *)samples + index));
+    }
+
+    __m128i low, high;
+    if (format == SAMPLE_S32)
+    {
+        const int32_t *p = (const int32_t *)samples + index;
+        low = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)p), 16);
+        high = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(p + 4)), 16);
+    }
+    else
+    {
+        const float *p = (const float *)samples + index;
+        const __m128 scale = _mm_set1_ps(FLOAT_SCALE);
+        low = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(p), scale));
+        high = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(p + 4), scale));
+    }
+    return _mm_packs_epi32(low, high);
+}
+#elif defined(__ARM_NEON)
+/**
+ * @brief Loads DETECT_LANES samples as 16-bit lanes, in order.
+ */
+ALWAYS_INLINE int16x8_t loadLanes(const void *samples, size_t index, SampleFormat format)
+{
+    if (format == SAMPLE_S16)
+    {
+        return vld1q_s16((const int16_t *)samples + index);
+    }
+
+    int32x4_t low, high;
+    if (format == SAMPLE_S32)
+    {
+        const int32_t *p = (const int32_t *)samples + index;
+        low = vshrq_n_s32(vld1q_s32(p), 16);
+        high = vshrq_n_s32(vld1q_s32(p + 4), 16);
+    }
+    else
+    {
+        const float *p = (const float *)samples + index;
+        low = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(p), FLOAT_SCALE));
+        high = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(p + 4), FLOAT_SCALE));
+    }
+    return vcombine_s16(vqmovn_s32(low), vqmovn_s32(high));
+}
+#endif
+
+/**
+ * @brief Computes the levels of a period in a single vectorized pass.
+ *
+ * Samples are narrowed to 16-bit lanes as they are loaded, so the same loop body serves every
+ * format. Absolute values are saturated (|-32768| = 32767) so they compare as signed 16-bit
+ * lanes. Squares are accumulated in 64-bit lanes, which cannot overflow for any period size.
+ * Always inlined with a constant format, so each public kernel is specialized for it.
+ *
+ * @param samples Samples of the period.
+ * @param frames Number of samples.
+ * @param format Sample format.
+ * @param threshold Trigger threshold (absolute value in 16-bit units).
+ * @param levels Pointer to where the levels will be stored.
+ */
+ALWAYS_INLINE void detectGeneric(const void *samples, size_t frames, SampleFormat format, int threshold, PeriodLevels *levels)
+{
+    size_t i = 0;
+
+    threshold = clampThreshold(threshold);
+    levels->sumSquares = 0;
+    levels->peak = 0;
+    levels->firstOver = -1;
+
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i limit = _mm256_set1_epi16((int16_t)threshold);
+    __m256i peak = zero;
+    __m256i energy = zero;
+
+    for (; i + DETECT_LANES <= frames; i += DETECT_LANES)
+    {
+        __m256i x = loadLanes(samples, i, format);
+        __m256i magnitude = _mm256_max_epi16(x, _mm256_subs_epi16(zero, x));
+        __m256i squares = _mm256_madd_epi16(x, x);
+
+        peak = _mm256_max_epi16(peak, magnitude);
+        energy = _mm256_add_epi64(energy, _mm256_unpacklo_epi32(squares, zero));
+        energy = _mm256_add_epi64(energy, _mm256_unpackhi_epi32(squares, zero));
+
+        if (levels->firstOver < 0)
+        {
+            unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpgt_epi16(magnitude, limit));
+            if (mask != 0)
+            {
+                levels->firstOver = (int32_t)(i + __builtin_ctz(mask) / 2);
+            }
+        }
+    }
+
+    int16_t peakLanes[16];
+    uint64_t energyLanes[4];
+    _mm256_storeu_si256((__m256i *)peakLanes, peak);
+    _mm256_storeu_si256((__m256i *)energyLanes, energy);
+    for (int k = 0; k < 16; k++)
+    {
+        levels->peak = peakLanes[k] > levels->peak ? peakLanes[k] : levels->peak;
+    }
+    levels->sumSquares = energyLanes[0] + energyLanes[1] + energyLanes[2] + energyLanes[3];
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i limit = _mm_set1_epi16((int16_t)threshold);
+    __m128i peak = zero;
+    __m128i energy = zero;
+
+    for (; i + DETECT_LANES <= frames; i += DETECT_LANES)
+    {
+        __m128i x = loadLanes(samples, i, format);
+        __m128i magnitude = _mm_max_epi16(x, _mm_subs_epi16(zero, x));
+        __m128i squares = _mm_madd_epi16(x, x);
+
+        peak = _mm_max_epi16(peak, magnitude);
+        energy = _mm_add_epi64(energy, _mm_unpacklo_epi32(squares, zero));
+        energy = _mm_add_epi64(energy, _mm_unpackhi_epi32(squares, zero));
+
+        if (levels->firstOver < 0)
+        {
+            unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpgt_epi16(magnitude, limit));
+            if (mask != 0)
+            {
+                levels->firstOver = (int32_t)(i + __builtin_ctz(mask) / 2);
+            }
+        }
+    }
+
+    int16_t peakLanes[8];
+    uint64_t energyLanes[2];
+    _mm_storeu_si128((__m128i *)peakLanes, peak);
+    _mm_storeu_si128((__m128i *)energyLanes, energy);
+    for (int k = 0; k < 8; k++)
+    {
+        levels->peak = peakLanes[k] > levels->peak ? peakLanes[k] : levels->peak;
+    }
+    levels->sumSquares = energyLanes[0] + energyLanes[1];
+#elif defined(__ARM_NEON)
+    const int16x8_t limit = vdupq_n_s16((int16_t)threshold);
+    int16x8_t peak = vdupq_n_s16(0);
+    uint64x2_t energy = vdupq_n_u64(0);
+
+    for (; i + DETECT_LANES <= frames; i += DETECT_LANES)
+    {
+        int16x8_t x = loadLanes(samples, i, format);
+        int16x8_t magnitude = vqabsq_s16(x);
+        uint32x4_t squaresLow = vreinterpretq_u32_s32(vmull_s16(vget_low_s16(x), vget_low_s16(x)));
+        uint32x4_t squaresHigh = vreinterpretq_u32_s32(vmull_s16(vget_high_s16(x), vget_high_s16(x)));
+
+        peak = vmaxq_s16(peak, magnitude);
+        energy = vpadalq_u32(energy, squaresLow);
+        energy = vpadalq_u32(energy, squaresHigh);
+
+        if (levels->firstOver < 0)
+        {
+            uint16x8_t over = vcgtq_s16(magnitude, limit);
+            uint64x2_t wide = vreinterpretq_u64_u16(over);
+            if ((vgetq_lane_u64(wide, 0) | vgetq_lane_u64(wide, 1)) != 0)
+            {
+                int16_t lanes[8];
+                vst1q_s16(lanes, magnitude);
+                for (int k = 0; k < 8; k++)
+                {
+                    if (lanes[k] > threshold)
+                    {
+                        levels->firstOver = (int32_t)(i + k);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    int16_t peakLanes[8];
+    vst1q_s16(peakLanes, peak);
+    for (int k = 0; k < 8; k++)
+    {
+        levels->peak = peakLanes[k] > levels->peak ? peakLanes[k] : levels->peak;
+    }
+    levels->sumSquares = vgetq_lane_u64(energy, 0) + vgetq_lane_u64(energy, 1);
+#endif
+
+    detectTail(samples, i, frames, format, threshold, levels);
+}
+
+/**
+ * @brief Computes the levels of a period of S16 samples.
+ *
+ * @param samples Samples of the period.
+ * @param frames Number of samples.
+ * @param threshold Trigger threshold (absolute sample value).
+ * @param levels Pointer to where the levels will be stored.
+ */
+void detectPeriod(const void *samples, size_t frames, int threshold, PeriodLevels *levels)
+{
+    detectGeneric(samples, frames, SAMPLE_S16, threshold, levels);
+}
+
+/**
+ * @brief Computes the levels of a period of S32 samples.
+ *
+ * @param samples Samples of the period.
+ * @param frames Number of samples.
+ * @param threshold Trigger threshold (absolute value in 16-bit units).
+ * @param levels Pointer to where the levels will be stored.
+ */
+void detectPeriodS32(const void *samples, size_t frames, int threshold, PeriodLevels *levels)
+{
+    detectGeneric(samples, frames, SAMPLE_S32, threshold, levels);
+}
+
+/**
+ * @brief Computes the levels of a period of FLOAT samples.
+ *
+ * @param samples Samples of the period.
+ * @param frames Number of samples.
+ * @param threshold Trigger threshold (absolute value in 16-bit units).
+ * @param levels Pointer to where the levels will be stored.
+ */
+void detectPeriodFloat(const void *samples, size_t frames, int threshold, PeriodLevels *levels)
+{
+    detectGeneric(samples, frames, SAMPLE_FLOAT, threshold, levels);
+}
+
+/**
+ * @brief Returns the kernel for a sample format. Chosen once, when the format is configured.
+ *
+ * @param format Sample format.
+ * @return Detector kernel.
+ */
+DetectFunction detectForFormat(SampleFormat format)
+{
+    return format == SAMPLE_S16 ? detectPeriod : format == SAMPLE_S32 ? detectPeriodS32 : detectPeriodFloat;
+}
+
+/**
+ * @brief Computes the levels of a period with the portable scalar loop.
+ *
+ * @param samples Samples of the period.
+ * @param frames Number of samples.
+ * @param format Sample format.
+ * @param threshold Trigger threshold (absolute value in 16-bit units).
+ * @param levels Pointer to where the levels will be stored.
+ */
+void detectPeriodScalar(const void *samples, size_t frames, SampleFormat format, int threshold, PeriodLevels *levels)
+{
+    levels->sumSquares = 0;
+    levels->peak = 0;
+    levels->firstOver = -1;
+    if (format == SAMPLE_S16)
+    {
+        detectTail(samples, 0, frames, SAMPLE_S16, clampThreshold(threshold), levels);
+    }
+    else if (format == SAMPLE_S32)
+    {
+        detectTail(samples, 0, frames, SAMPLE_S32, clampThreshold(threshold), levels);
+    }
+    else
+    {
+        detectTail(samples, 0, frames, SAMPLE_FLOAT, clampThreshold(threshold), levels);
+    }
+}
+
+/**
+ * @brief Name of the vector kernels.
+ *
+ * @return "avx2", "sse2", "neon" or "scalar".
+ */
+const char *detectKernelName(void)
+{
+    return DETECT_KERNEL;
+}
+
+/**
+ * @brief RMS level of a period.
+ *
+ * @param levels Levels of the period.
+ * @param frames Number of samples of the period.
+ * @return RMS value in 16-bit units.
+ */
+double detectRms(const PeriodLevels *levels, size_t frames)
+{
+    return frames > 0 ? sqrt((double)levels->sumSquares / frames) : 0;
+}
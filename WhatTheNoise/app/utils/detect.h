@@ -0,0 +1,53 @@
+/**
+ * ******************************
+ * *********** detect.h ************
+ * ******************************
+ *
+ * Level detector run on every captured period. A single pass computes the
+ * peak, the energy and the first sample over the trigger threshold, with
+ * AVX2/SSE2/NEON kernels selected at compile time and a scalar fallback.
+ * There is one kernel per sample format, so captured periods are never
+ * converted before detection.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef DETECT_H
+#define DETECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sample_format.h"
+
+/**
+ * @brief Levels of one period, in 16-bit sample units whatever the capture format.
+ *
+ * S32 samples count as sample / 65536 and FLOAT samples as sample * 32767. peak is the largest
+ * absolute value, clamped to 32767. sumSquares is the energy of the period and firstOver the
+ * index of the first sample whose absolute value is greater than the threshold, or -1 if
+ * there is none.
+ */
+typedef struct
+{
+    uint64_t sumSquares;
+    int32_t peak;
+    int32_t firstOver;
+} PeriodLevels;
+
+/**
+ * @brief Detector kernel for one sample format.
+ */
+typedef void (*DetectFunction)(const void *samples, size_t frames, int threshold, PeriodLevels *levels);
+
+void detectPeriod(const void *samples, size_t frames, int threshold, PeriodLevels *levels);
+void detectPeriodS32(const void *samples, size_t frames, int threshold, PeriodLevels *levels);
+void detectPeriodFloat(const void *samples, size_t frames, int threshold, PeriodLevels *levels);
+DetectFunction detectForFormat(SampleFormat format);
+
+void detectPeriodScalar(const void *samples, size_t frames, SampleFormat format, int threshold, PeriodLevels *levels);
+const char *detectKernelName(void);
+double detectRms(const PeriodLevels *levels, size_t frames);
+
+#endif
@@ -0,0 +1,378 @@
+/**
+ * ******************************
+ * ******** encode_backlog.c *******
+ * ******************************
+ *
+ * Encodes to FLAC the .raw recordings that have no .flac yet: sessions
+ * recorded with --no-encode, or older ones. Every file is a job of a
+ * work-stealing pool with one worker per core, punctual events (shorter
+ * than the analyzer's 1.2 s) first. The sample rate and format are taken
+ * from the session info unless given on the command line. FLOAT sessions
+ * are refused: FLAC cannot store them losslessly.
+ *
+ * Usage: ./encode_backlog [-j workers] [-r rate] [-f S16|S32|FLOAT] [-t punctual_seconds] [--force] [directory ...]
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flac_encoder.h"
+#include "sample_format.h"
+#include "work_pool.h"
+
+#define SESSION_INFO_FILE "session_info.txt"
+#define DEFAULT_PUNCTUAL_SECONDS 1.2 // same threshold as get_sound_type() in analyzer.py
+#define QUEUE_CAPACITY 16
+#define READ_FRAMES 16384
+
+/**
+ * @brief One .raw file to encode.
+ */
+typedef struct
+{
+    char rawPath[512];
+    char flacPath[512];
+    long long bytes;
+    int priority;
+    int failed;
+} EncodeJob;
+
+int sample_rate = 44100;
+SampleFormat sample_format = SAMPLE_S16;
+size_t sample_bytes;
+FlacEncoder *encoders[WORK_POOL_MAX_WORKERS];
+
+/**
+ * @brief Reads the sample rate and format from the session info, if there is one.
+ *
+ * @return 1 if the session info was found, 0 if not.
+ */
+int readSessionInfo(void)
+{
+    FILE *info = fopen(SESSION_INFO_FILE, "r");
+    char line[256];
+
+    if (info == NULL)
+    {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), info) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, "sample_rate=", 12) == 0)
+        {
+            sample_rate = atoi(line + 12);
+        }
+        else if (strncmp(line, "sample_format=", 14) == 0)
+        {
+            sampleFormatParse(line + 14, &sample_format);
+        }
+    }
+    fclose(info);
+    return 1;
+}
+
+/**
+ * @brief Adds a job for every .raw file of a directory without a .flac (or every one if force is set).
+ *
+ * @param directory Directory to scan.
+ * @param jobs Growing array of jobs.
+ * @param count Number of jobs in the array.
+ * @param capacity Capacity of the array.
+ * @param force Whether to encode files that already have a .flac.
+ * @param punctualSeconds Recordings shorter than this get the higher priority.
+ */
+void collectJobs(const char *directory, EncodeJob **jobs, int *count, int *capacity, int force, double punctualSeconds)
+{
+    DIR *dir = opendir(directory);
+    struct dirent *ent;
+    struct stat st;
+
+    if (dir == NULL)
+    {
+        perror(directory);
+        return;
+    }
+
+    while ((ent = readdir(dir)) != NULL)
+    {
+        size_t length = strlen(ent->d_name);
+        if (length < 5 || strcmp(ent->d_name + length - 4, ".raw") != 0)
+        {
+            continue;
+        }
+        if (*count == *capacity)
+        {
+            *capacity = *capacity > 0 ? *capacity * 2 : 256;
+            *jobs = realloc(*jobs, sizeof(EncodeJob) * *capacity);
+            if (*jobs == NULL)
+            {
+                fprintf(stderr, "Could not allocate the job list.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        EncodeJob *job = &(*jobs)[*count];
+        snprintf(job->rawPath, sizeof(job->rawPath), "%s/%s", directory, ent->d_name);
+        snprintf(job->flacPath, sizeof(job->flacPath), "%s/%.*s.flac", directory, (int)(length - 4), ent->d_name);
+        if (stat(job->rawPath, &st) != 0 || (!force && access(job->flacPath, F_OK) == 0))
+        {
+            continue;
+        }
+        job->bytes = st.st_size;
+        job->priority = (double)st.st_size / sample_bytes / sample_rate < punctualSeconds ? 1 : 0;
+        job->failed = 0;
+        (*count)++;
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Orders jobs by priority, then by path, so punctual events are submitted first.
+ */
+int compareJobs(const void *a, const void *b)
+{
+    const EncodeJob *jobA = (const EncodeJob *)a;
+    const EncodeJob *jobB = (const EncodeJob *)b;
+
+    if (jobA->priority != jobB->priority)
+    {
+        return jobB->priority - jobA->priority;
+    }
+    return strcmp(jobA->rawPath, jobB->rawPath);
+}
+
+/**
+ * @brief Encodes one .raw file. The .flac is written under a temporary name and renamed when complete.
+ *
+ * @param arg Pointer to the EncodeJob.
+ * @param worker Index of the worker, selects its encoder.
+ */
+void encodeJob(void *arg, int worker)
+{
+    EncodeJob *job = (EncodeJob *)arg;
+    FlacEncoder *encoder = encoders[worker];
+    static __thread unsigned char samples[READ_FRAMES * 4];
+    char partPath[520];
+    size_t frames;
+    FILE *raw = fopen(job->rawPath, "rb");
+
+    if (raw == NULL)
+    {
+        perror(job->rawPath);
+        job->failed = 1;
+        return;
+    }
+
+    snprintf(partPath, sizeof(partPath), "%s.part", job->flacPath);
+    if (flacEncoderOpen(encoder, partPath, sample_rate, sample_format) != 0)
+    {
+        fprintf(stderr, "Could not open file %s.\n", partPath);
+        fclose(raw);
+        job->failed = 1;
+        return;
+    }
+
+    while ((frames = fread(samples, sample_bytes, READ_FRAMES, raw)) > 0)
+    {
+        if (flacEncoderWrite(encoder, samples, frames) != 0)
+        {
+            job->failed = 1;
+            break;
+        }
+    }
+    fclose(raw);
+
+    if (flacEncoderClose(encoder) != 0 || job->failed || rename(partPath, job->flacPath) != 0)
+    {
+        fprintf(stderr, "Could not encode %s.\n", job->rawPath);
+        remove(partPath);
+        job->failed = 1;
+    }
+}
+
+/**
+ * @brief Prints the progress of the pool on a single line.
+ */
+void printProgress(unsigned long completed, unsigned long submitted, void *arg)
+{
+    int total = *(int *)arg;
+
+    (void)submitted;
+    printf("\rEncoded %lu/%d files", completed, total);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option longOptions[] = {
+        {"jobs", required_argument, NULL, 'j'},
+        {"rate", required_argument, NULL, 'r'},
+        {"format", required_argument, NULL, 'f'},
+        {"punctual", required_argument, NULL, 't'},
+        {"force", no_argument, NULL, 'F'},
+        {NULL, 0, NULL, 0}};
+    static const char *defaultDirectories[] = {"samples_threads_Mic1", "samples_threads_Mic2"};
+    int workers = workPoolDefaultWorkers();
+    double punctualSeconds = DEFAULT_PUNCTUAL_SECONDS;
+    int force = 0;
+    int rateGiven = 0;
+    int formatGiven = 0;
+    SampleFormat format = SAMPLE_S16;
+    int rate = 0;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "j:r:f:t:F", longOptions, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            workers = atoi(optarg);
+            if (workers < 1 || workers > WORK_POOL_MAX_WORKERS)
+            {
+                fprintf(stderr, "The number of workers must be between 1 and %d.\n", WORK_POOL_MAX_WORKERS);
+                return 1;
+            }
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            rateGiven = 1;
+            break;
+        case 'f':
+            if (sampleFormatParse(optarg, &format) != 0)
+            {
+                fprintf(stderr, "Unknown sample format: %s\n", optarg);
+                return 1;
+            }
+            formatGiven = 1;
+            break;
+        case 't':
+            punctualSeconds = atof(optarg);
+            break;
+        case 'F':
+            force = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j workers] [-r rate] [-f S16|S32|FLOAT] [-t punctual_seconds] [--force] [directory ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // The command line wins over the session info
+    readSessionInfo();
+    if (rateGiven)
+    {
+        sample_rate = rate;
+    }
+    if (formatGiven)
+    {
+        sample_format = format;
+    }
+    if (sample_rate <= 0)
+    {
+        fprintf(stderr, "Invalid sample rate.\n");
+        return 1;
+    }
+    if (!flacEncoderSupports(sample_format))
+    {
+        fprintf(stderr, "FLAC cannot store %s samples losslessly: nothing to encode.\n", sampleFormatName(sample_format));
+        return 1;
+    }
+    sample_bytes = sampleFormatBytes(sample_format);
+
+    EncodeJob *jobs = NULL;
+    int count = 0;
+    int capacity = 0;
+    if (optind < argc)
+    {
+        for (int i = optind; i < argc; i++)
+        {
+            collectJobs(argv[i], &jobs, &count, &capacity, force, punctualSeconds);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < sizeof(defaultDirectories) / sizeof(defaultDirectories[0]); i++)
+        {
+            collectJobs(defaultDirectories[i], &jobs, &count, &capacity, force, punctualSeconds);
+        }
+    }
+
+    if (count == 0)
+    {
+        printf("Nothing to encode.\n");
+        free(jobs);
+        return 0;
+    }
+    qsort(jobs, count, sizeof(EncodeJob), compareJobs);
+
+    if (workers > count)
+    {
+        workers = count;
+    }
+    for (int i = 0; i < workers; i++)
+    {
+        encoders[i] = malloc(sizeof(FlacEncoder));
+        if (encoders[i] == NULL)
+        {
+            fprintf(stderr, "Could not allocate the encoders.\n");
+            return 1;
+        }
+    }
+
+    WorkPool pool;
+    struct timespec start, end;
+    if (workPoolCreate(&pool, workers, QUEUE_CAPACITY, printProgress, &count) != 0)
+    {
+        fprintf(stderr, "Could not start the workers.\n");
+        return 1;
+    }
+    printf("Encoding %d files at %d Hz %s with %d workers\n", count, sample_rate, sampleFormatName(sample_format), workers);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++)
+    {
+        workPoolSubmit(&pool, encodeJob, &jobs[i], jobs[i].priority);
+    }
+    workPoolWait(&pool);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    unsigned long stolen = pool.stolen;
+    workPoolDestroy(&pool);
+
+    long long rawBytes = 0;
+    long long flacBytes = 0;
+    int failed = 0;
+    struct stat st;
+    for (int i = 0; i < count; i++)
+    {
+        rawBytes += jobs[i].bytes;
+        if (jobs[i].failed)
+        {
+            failed++;
+        }
+        else if (stat(jobs[i].flacPath, &st) == 0)
+        {
+            flacBytes += st.st_size;
+        }
+    }
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("\n%d files in %.2f s: %.1f MB raw -> %.1f MB FLAC, %lu jobs stolen, %d failed\n",
+           count - failed, seconds, rawBytes / 1e6, flacBytes / 1e6, stolen, failed);
+
+    for (int i = 0; i < workers; i++)
+    {
+        free(encoders[i]);
+    }
+    free(jobs);
+    return failed > 0;
+}
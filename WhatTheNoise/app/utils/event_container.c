@@ -0,0 +1,167 @@
+/**
+ * ******************************
+ * ******* event_container.c *******
+ * ******************************
+ *
+ * Writer of the event containers declared in event_container.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "event_container.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Creates a container and writes its header.
+ *
+ * @param container Pointer to the container.
+ * @param path Path of the file to create.
+ * @param eventId ID of the event.
+ * @param eventStartNs Start time of the event.
+ * @param channels Number of channels.
+ * @param sampleRate Sample rate.
+ * @param format Sample format of the AUDIO blocks.
+ * @param framesPerPeriod Frames per period.
+ * @return 0 on success, -1 on failure.
+ */
+int eventContainerOpen(EventContainer *container, const char *path, unsigned eventId, int64_t eventStartNs,
+                       int channels, int sampleRate, SampleFormat format, int framesPerPeriod)
+{
+    EventFileHeader header;
+
+    memset(container, 0, sizeof(*container));
+    container->file = fopen(path, "wb");
+    if (container->file == NULL)
+    {
+        perror("Failed to create event container");
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EVENT_FILE_MAGIC, sizeof(header.magic));
+    header.headerBytes = sizeof(EventFileHeader);
+    header.blockHeaderBytes = sizeof(EventBlockHeader);
+    header.channels = channels;
+    header.sampleRate = sampleRate;
+    header.sampleFormat = format;
+    header.framesPerPeriod = framesPerPeriod;
+    header.eventId = eventId;
+    header.eventStartNs = eventStartNs;
+    if (fwrite(&header, sizeof(header), 1, container->file) != 1)
+    {
+        perror("Failed to write event container header");
+        fclose(container->file);
+        container->file = NULL;
+        return -1;
+    }
+
+    pthread_mutex_init(&container->lock, NULL);
+    container->offset = sizeof(header);
+    container->eventId = eventId;
+    return 0;
+}
+
+/**
+ * @brief Appends a block.
+ *
+ * @param container Pointer to the container.
+ * @param type Type of the block.
+ * @param channel Channel of the block, or EVENT_CHANNEL_NONE.
+ * @param firstFrame Position of the block on the channel timeline.
+ * @param frames Frames (AUDIO) or records (TIMESTAMPS) in the block.
+ * @param payload Contents of the block.
+ * @param bytes Size of the contents.
+ * @return 0 on success, -1 on failure.
+ */
+int eventContainerAppend(EventContainer *container, EventBlockType type, uint32_t channel, uint64_t firstFrame,
+                         uint64_t frames, const void *payload, size_t bytes)
+{
+    EventIndexEntry entry;
+    int result = 0;
+
+    entry.block.type = type;
+    entry.block.channel = channel;
+    entry.block.payloadBytes = bytes;
+    entry.block.firstFrame = firstFrame;
+    entry.block.frames = frames;
+
+    pthread_mutex_lock(&container->lock);
+    if (container->indexCount == container->indexCapacity)
+    {
+        size_t capacity = container->indexCapacity > 0 ? container->indexCapacity * 2 : 256;
+        EventIndexEntry *index = realloc(container->index, capacity * sizeof(EventIndexEntry));
+        if (index == NULL)
+        {
+            pthread_mutex_unlock(&container->lock);
+            fprintf(stderr, "Could not grow the index of event %u.\n", container->eventId);
+            return -1;
+        }
+        container->index = index;
+        container->indexCapacity = capacity;
+    }
+
+    entry.offset = container->offset;
+    if (fwrite(&entry.block, sizeof(entry.block), 1, container->file) != 1 ||
+        (bytes > 0 && fwrite(payload, bytes, 1, container->file) != 1))
+    {
+        fprintf(stderr, "Could not write to the container of event %u.\n", container->eventId);
+        result = -1;
+    }
+    else
+    {
+        container->index[container->indexCount++] = entry;
+        container->offset += sizeof(entry.block) + bytes;
+    }
+    pthread_mutex_unlock(&container->lock);
+
+    return result;
+}
+
+/**
+ * @brief Writes the index and the trailer and closes the container.
+ *
+ * @param container Pointer to the container.
+ * @return 0 on success, -1 on failure.
+ */
+int eventContainerClose(EventContainer *container)
+{
+    EventBlockHeader block;
+    EventFileTrailer trailer;
+    int result = 0;
+
+    if (container->file == NULL)
+    {
+        return -1;
+    }
+
+    memset(&block, 0, sizeof(block));
+    block.type = EVENT_BLOCK_INDEX;
+    block.channel = EVENT_CHANNEL_NONE;
+    block.payloadBytes = container->indexCount * sizeof(EventIndexEntry);
+    block.frames = container->indexCount;
+
+    memcpy(trailer.magic, EVENT_TRAILER_MAGIC, sizeof(trailer.magic));
+    trailer.indexOffset = container->offset;
+    trailer.entries = container->indexCount;
+
+    if (fwrite(&block, sizeof(block), 1, container->file) != 1 ||
+        (container->indexCount > 0 && fwrite(container->index, sizeof(EventIndexEntry), container->indexCount, container->file) != container->indexCount) ||
+        fwrite(&trailer, sizeof(trailer), 1, container->file) != 1)
+    {
+        fprintf(stderr, "Could not write the index of event %u.\n", container->eventId);
+        result = -1;
+    }
+    if (fclose(container->file) != 0)
+    {
+        result = -1;
+    }
+
+    container->file = NULL;
+    free(container->index);
+    container->index = NULL;
+    pthread_mutex_destroy(&container->lock);
+    return result;
+}
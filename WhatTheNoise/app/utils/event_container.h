@@ -0,0 +1,125 @@
+/**
+ * ******************************
+ * ******* event_container.h *******
+ * ******************************
+ *
+ * Event container: a single file per event holding the samples and
+ * timestamps of every channel, their time models and the trigger metadata.
+ * Blocks are appended while the event is being recorded, and an index of
+ * every block is written at the end so readers can seek straight to any
+ * channel and frame range. A file whose index is missing (recorder killed)
+ * can still be read by walking the blocks. All fields are little-endian.
+ *
+ * Layout: EventFileHeader, blocks (EventBlockHeader + payload), an INDEX
+ * block with one EventIndexEntry per block, and an EventFileTrailer.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef EVENT_CONTAINER_H
+#define EVENT_CONTAINER_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sample_format.h"
+
+#define EVENT_FILE_MAGIC "WTNEVT01"
+#define EVENT_TRAILER_MAGIC "WTNIDX01"
+#define EVENT_CHANNEL_NONE 0xFFFFFFFFu // channel of the blocks that belong to the whole event
+
+/**
+ * @brief Type of a block.
+ *
+ * AUDIO holds frames of one channel, TIMESTAMPS one TimestampRecord per period of one channel,
+ * METADATA "key=value" lines (time model and levels of a channel, or trigger metadata of the
+ * event) and INDEX the EventIndexEntry of every previous block.
+ */
+typedef enum
+{
+    EVENT_BLOCK_AUDIO = 1,
+    EVENT_BLOCK_TIMESTAMPS = 2,
+    EVENT_BLOCK_METADATA = 3,
+    EVENT_BLOCK_INDEX = 4
+} EventBlockType;
+
+/**
+ * @brief Header at the start of every container.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t headerBytes;
+    uint32_t blockHeaderBytes;
+    uint32_t channels;
+    uint32_t sampleRate;
+    uint32_t sampleFormat;
+    uint32_t framesPerPeriod;
+    uint32_t eventId;
+    uint32_t reserved;
+    int64_t eventStartNs;
+    uint8_t padding[16];
+} EventFileHeader;
+
+/**
+ * @brief Header of a block. firstFrame and frames place AUDIO and TIMESTAMPS blocks on the
+ * channel timeline (frames is the number of records for TIMESTAMPS).
+ */
+typedef struct
+{
+    uint32_t type;
+    uint32_t channel;
+    uint64_t payloadBytes;
+    uint64_t firstFrame;
+    uint64_t frames;
+} EventBlockHeader;
+
+/**
+ * @brief Entry of the index: a block header and the file offset where the block starts.
+ */
+typedef struct
+{
+    EventBlockHeader block;
+    uint64_t offset;
+} EventIndexEntry;
+
+/**
+ * @brief Last bytes of a finished container, pointing to the INDEX block.
+ */
+typedef struct
+{
+    char magic[8];
+    uint64_t indexOffset;
+    uint64_t entries;
+} EventFileTrailer;
+
+_Static_assert(sizeof(EventFileHeader) == 64, "event file header must be 64 bytes");
+_Static_assert(sizeof(EventBlockHeader) == 32, "event block header must be 32 bytes");
+_Static_assert(sizeof(EventIndexEntry) == 40, "event index entry must be 40 bytes");
+_Static_assert(sizeof(EventFileTrailer) == 24, "event file trailer must be 24 bytes");
+
+/**
+ * @brief Container being written. Appends from different threads are serialized by lock.
+ */
+typedef struct
+{
+    FILE *file;
+    pthread_mutex_t lock;
+    uint64_t offset;
+    EventIndexEntry *index;
+    size_t indexCount;
+    size_t indexCapacity;
+    unsigned eventId;
+    int references;
+} EventContainer;
+
+int eventContainerOpen(EventContainer *container, const char *path, unsigned eventId, int64_t eventStartNs,
+                       int channels, int sampleRate, SampleFormat format, int framesPerPeriod);
+int eventContainerAppend(EventContainer *container, EventBlockType type, uint32_t channel, uint64_t firstFrame,
+                         uint64_t frames, const void *payload, size_t bytes);
+int eventContainerClose(EventContainer *container);
+
+#endif
@@ -0,0 +1,171 @@
+"""Reader of the event containers written by record_ALSA --container (see event_container.h).
+
+A container holds every channel of one event: AUDIO and TIMESTAMPS blocks appended while
+recording, METADATA blocks with the time model of each channel and the trigger metadata of
+the event, and an index at the end. Blocks are read through np.memmap, so only the frames
+asked for are touched. Containers without an index (recorder killed) are read by walking
+the blocks.
+
+Usage: python event_container.py event.wtn [--raw CHANNEL OUTPUT]
+Prints the contents of the container, or extracts the samples of a channel to a raw file.
+"""
+import argparse
+import os
+
+import numpy as np
+
+from timestamp_file import RECORD_DTYPE
+
+MAGIC = b'WTNEVT01'
+TRAILER_MAGIC = b'WTNIDX01'
+
+BLOCK_AUDIO = 1
+BLOCK_TIMESTAMPS = 2
+BLOCK_METADATA = 3
+BLOCK_INDEX = 4
+
+CHANNEL_NONE = 0xFFFFFFFF
+
+HEADER_DTYPE = np.dtype([('magic', 'S8'), ('header_bytes', '<u4'), ('block_header_bytes', '<u4'),
+                         ('channels', '<u4'), ('sample_rate', '<u4'), ('sample_format', '<u4'),
+                         ('frames_per_period', '<u4'), ('event_id', '<u4'), ('reserved', '<u4'),
+                         ('event_start_ns', '<i8'), ('padding', 'V16')])
+BLOCK_DTYPE = np.dtype([('type', '<u4'), ('channel', '<u4'), ('payload_bytes', '<u8'),
+                        ('first_frame', '<u8'), ('frames', '<u8')])
+INDEX_DTYPE = np.dtype([('type', '<u4'), ('channel', '<u4'), ('payload_bytes', '<u8'),
+                        ('first_frame', '<u8'), ('frames', '<u8'), ('offset', '<u8')])
+TRAILER_DTYPE = np.dtype([('magic', 'S8'), ('index_offset', '<u8'), ('entries', '<u8')])
+
+# Sample dtype, session info name and ffmpeg input format of each SampleFormat of sample_format.h
+SAMPLE_FORMATS = {0: (np.dtype('<i2'), 'S16_LE', 's16le'),
+                  1: (np.dtype('<i4'), 'S32_LE', 's32le'),
+                  2: (np.dtype('<f4'), 'FLOAT_LE', 'f32le')}
+
+def is_container(path):
+    """True if the file starts with the magic of an event container."""
+    with open(path, 'rb') as f:
+        return f.read(len(MAGIC)) == MAGIC
+
+def parse_metadata(lines):
+    """Dict of "key=value" lines. Keys that repeat (gap) are collected in a list."""
+    info = {}
+    for line in lines:
+        key, sep, value = line.strip().partition('=')
+        if not sep:
+            continue
+        if key == 'gap':
+            info.setdefault('gap', []).append(value)
+        else:
+            info[key] = value
+    return info
+
+class EventContainer:
+    def __init__(self, path):
+        self.path = path
+        self.size = os.path.getsize(path)
+        if self.size < HEADER_DTYPE.itemsize or not is_container(path):
+            raise ValueError(f"{path} is not an event container")
+        header = np.fromfile(path, dtype=HEADER_DTYPE, count=1)[0]
+        self.header_bytes = int(header['header_bytes'])
+        self.channels = int(header['channels'])
+        self.sample_rate = int(header['sample_rate'])
+        self.sample_format = int(header['sample_format'])
+        self.frames_per_period = int(header['frames_per_period'])
+        self.event_id = int(header['event_id'])
+        self.event_start_ns = int(header['event_start_ns'])
+        self.sample_dtype, self.format_name, self.ffmpeg_format = SAMPLE_FORMATS[self.sample_format]
+        self.index = self._read_index()
+        self.complete = self.index is not None
+        if self.index is None:
+            self.index = self._scan_blocks()
+
+    def _read_index(self):
+        """Index written when the container was closed, or None if there is none."""
+        if self.size < self.header_bytes + TRAILER_DTYPE.itemsize:
+            return None
+        trailer = np.fromfile(self.path, dtype=TRAILER_DTYPE, count=1, offset=self.size - TRAILER_DTYPE.itemsize)[0]
+        if trailer['magic'] != TRAILER_MAGIC:
+            return None
+        return np.fromfile(self.path, dtype=INDEX_DTYPE, count=int(trailer['entries']),
+                           offset=int(trailer['index_offset']) + BLOCK_DTYPE.itemsize)
+
+    def _scan_blocks(self):
+        """Index rebuilt by walking the blocks, stopping at the first truncated one."""
+        entries = []
+        offset = self.header_bytes
+        with open(self.path, 'rb') as f:
+            while offset + BLOCK_DTYPE.itemsize <= self.size:
+                f.seek(offset)
+                block = np.frombuffer(f.read(BLOCK_DTYPE.itemsize), dtype=BLOCK_DTYPE)[0]
+                end = offset + BLOCK_DTYPE.itemsize + int(block['payload_bytes'])
+                if end > self.size or block['type'] == BLOCK_INDEX:
+                    break
+                entries.append(tuple(block) + (offset,))
+                offset = end
+        return np.array(entries, dtype=INDEX_DTYPE)
+
+    def blocks(self, block_type, channel):
+        """Index entries of the blocks of a type and channel, in file order."""
+        return self.index[(self.index['type'] == block_type) & (self.index['channel'] == channel)]
+
+    def _payload(self, entry, dtype):
+        offset = int(entry['offset']) + BLOCK_DTYPE.itemsize
+        count = int(entry['payload_bytes']) // dtype.itemsize
+        if count == 0:
+            return np.zeros(0, dtype=dtype)
+        return np.memmap(self.path, dtype=dtype, mode='r', offset=offset, shape=(count,))
+
+    def num_frames(self, channel):
+        """Frames written for a channel."""
+        audio = self.blocks(BLOCK_AUDIO, channel)
+        return int((audio['first_frame'] + audio['frames']).max()) if len(audio) else 0
+
+    def samples(self, channel, start=0, frames=None):
+        """Samples of a channel from frame start, reading only the blocks that overlap the range."""
+        end = self.num_frames(channel) if frames is None else start + frames
+        out = np.zeros(max(end - start, 0), dtype=self.sample_dtype)
+        for entry in self.blocks(BLOCK_AUDIO, channel):
+            first = int(entry['first_frame'])
+            last = first + int(entry['frames'])
+            if last <= start or first >= end:
+                continue
+            data = self._payload(entry, self.sample_dtype)
+            lo, hi = max(first, start), min(last, end)
+            out[lo - start:hi - start] = data[lo - first:hi - first]
+        return out
+
+    def timestamps(self, channel):
+        """Timestamp records of a channel (fields time_ns, frame_offset, flags, as in timestamp_file.py)."""
+        parts = [self._payload(entry, RECORD_DTYPE) for entry in self.blocks(BLOCK_TIMESTAMPS, channel)]
+        return np.concatenate(parts) if parts else np.zeros(0, dtype=RECORD_DTYPE)
+
+    def metadata_lines(self, channel=CHANNEL_NONE):
+        """Lines of the METADATA blocks of a channel, or of the event for CHANNEL_NONE."""
+        lines = []
+        for entry in self.blocks(BLOCK_METADATA, channel):
+            text = bytes(self._payload(entry, np.dtype('u1'))).decode(errors='replace')
+            lines.extend(text.splitlines())
+        return lines
+
+    def metadata(self, channel=CHANNEL_NONE):
+        """METADATA of a channel, or of the event for CHANNEL_NONE, as a dict."""
+        return parse_metadata(self.metadata_lines(channel))
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Show the contents of an event container or extract a channel.")
+    parser.add_argument('file')
+    parser.add_argument('--raw', nargs=2, metavar=('CHANNEL', 'OUTPUT'), help="write the samples of a channel to a raw file")
+    args = parser.parse_args()
+
+    container = EventContainer(args.file)
+    if args.raw:
+        container.samples(int(args.raw[0])).tofile(args.raw[1])
+    else:
+        print(f"event {container.event_id}: {container.channels} channels, {container.sample_rate} Hz, "
+              f"{container.format_name}, {len(container.index)} blocks{'' if container.complete else ' (no index)'}")
+        for key, value in container.metadata().items():
+            print(f"  {key}={value}")
+        for channel in range(container.channels):
+            info = container.metadata(channel)
+            print(f"channel {channel} ({info.get('mic', '?')}): {container.num_frames(channel)} frames, "
+                  f"{len(container.timestamps(channel))} timestamps, {len(info.get('gap', []))} gaps")
@@ -0,0 +1,414 @@
+/**
+ * ******************************
+ * ************ fft.c ************
+ * ******************************
+ *
+ * Implementation of the real-input FFT declared in fft.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "fft.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FFT_KERNEL "avx"
+#define VECTOR_COMPLEX 4
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FFT_KERNEL "sse2"
+#define VECTOR_COMPLEX 2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FFT_KERNEL "neon"
+#define VECTOR_COMPLEX 2
+#else
+#define FFT_KERNEL "scalar"
+#define VECTOR_COMPLEX 1
+#endif
+
+#define PLAN_CACHE_SLOTS 31 // one per power of two up to FFT_MAX_SIZE
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+static FftPlan *plan_cache[PLAN_CACHE_SLOTS];
+static pthread_mutex_t plan_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief One radix-2 stage of the complex FFT: butterflies of half apart points, in place.
+ *
+ * Inlined with a constant inverse, so the forward and inverse transforms each get their own loop.
+ *
+ * @param data Interleaved complex points.
+ * @param points Number of complex points.
+ * @param half Distance between the two points of a butterfly; at least 4.
+ * @param re Twiddles of the stage, wr, wr per forward twiddle wr + i wi.
+ * @param im Twiddles of the stage, -wi, wi per forward twiddle.
+ * @param inverse 1 to use the conjugate twiddles.
+ */
+ALWAYS_INLINE void fftStage(float *data, uint32_t points, uint32_t half, const float *re, const float *im, const int inverse)
+{
+    for (uint32_t start = 0; start < points; start += 2 * half)
+    {
+        float *a = data + 2 * start;
+        float *b = a + 2 * half;
+        uint32_t k = 0;
+
+#if defined(__AVX__)
+        for (; k + VECTOR_COMPLEX <= half; k += VECTOR_COMPLEX)
+        {
+            __m256 va = _mm256_loadu_ps(a + 2 * k);
+            __m256 vb = _mm256_loadu_ps(b + 2 * k);
+            __m256 swapped = _mm256_permute_ps(vb, 0xB1);
+            __m256 real = _mm256_mul_ps(vb, _mm256_loadu_ps(re + 2 * k));
+            __m256 imag = _mm256_mul_ps(swapped, _mm256_loadu_ps(im + 2 * k));
+            __m256 t = inverse ? _mm256_sub_ps(real, imag) : _mm256_add_ps(real, imag);
+            _mm256_storeu_ps(a + 2 * k, _mm256_add_ps(va, t));
+            _mm256_storeu_ps(b + 2 * k, _mm256_sub_ps(va, t));
+        }
+#elif defined(__SSE2__)
+        for (; k + VECTOR_COMPLEX <= half; k += VECTOR_COMPLEX)
+        {
+            __m128 va = _mm_loadu_ps(a + 2 * k);
+            __m128 vb = _mm_loadu_ps(b + 2 * k);
+            __m128 swapped = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 3, 0, 1));
+            __m128 real = _mm_mul_ps(vb, _mm_loadu_ps(re + 2 * k));
+            __m128 imag = _mm_mul_ps(swapped, _mm_loadu_ps(im + 2 * k));
+            __m128 t = inverse ? _mm_sub_ps(real, imag) : _mm_add_ps(real, imag);
+            _mm_storeu_ps(a + 2 * k, _mm_add_ps(va, t));
+            _mm_storeu_ps(b + 2 * k, _mm_sub_ps(va, t));
+        }
+#elif defined(__ARM_NEON)
+        for (; k + VECTOR_COMPLEX <= half; k += VECTOR_COMPLEX)
+        {
+            float32x4_t va = vld1q_f32(a + 2 * k);
+            float32x4_t vb = vld1q_f32(b + 2 * k);
+            float32x4_t swapped = vrev64q_f32(vb);
+            float32x4_t real = vmulq_f32(vb, vld1q_f32(re + 2 * k));
+            float32x4_t imag = vmulq_f32(swapped, vld1q_f32(im + 2 * k));
+            float32x4_t t = inverse ? vsubq_f32(real, imag) : vaddq_f32(real, imag);
+            vst1q_f32(a + 2 * k, vaddq_f32(va, t));
+            vst1q_f32(b + 2 * k, vsubq_f32(va, t));
+        }
+#endif
+        for (; k < half; k++)
+        {
+            float br = b[2 * k], bi = b[2 * k + 1];
+            float wr = re[2 * k], wi = inverse ? -im[2 * k + 1] : im[2 * k + 1];
+            float tr = br * wr - bi * wi;
+            float ti = br * wi + bi * wr;
+            b[2 * k] = a[2 * k] - tr;
+            b[2 * k + 1] = a[2 * k + 1] - ti;
+            a[2 * k] += tr;
+            a[2 * k + 1] += ti;
+        }
+    }
+}
+
+/**
+ * @brief In-place complex FFT of the points of a plan, unnormalized.
+ *
+ * @param plan Pointer to the plan.
+ * @param data Interleaved complex points.
+ * @param inverse 0 for the forward transform (e^-i), 1 for the inverse one (e^+i).
+ */
+ALWAYS_INLINE void complexFft(const FftPlan *plan, float *data, const int inverse)
+{
+    uint32_t points = plan->points;
+    float sign = inverse ? 1.0f : -1.0f;
+
+    for (uint32_t i = 0; i < points; i++)
+    {
+        uint32_t j = plan->bitReverse[i];
+        if (j > i)
+        {
+            float re = data[2 * i], im = data[2 * i + 1];
+            data[2 * i] = data[2 * j];
+            data[2 * i + 1] = data[2 * j + 1];
+            data[2 * j] = re;
+            data[2 * j + 1] = im;
+        }
+    }
+
+    // The first two stages, whose twiddles are 1 and -i (i inverse), as one radix-4 pass
+    for (uint32_t start = 0; start < points; start += 4)
+    {
+        float *x = data + 2 * start;
+        float ar = x[0] + x[2], ai = x[1] + x[3];
+        float br = x[0] - x[2], bi = x[1] - x[3];
+        float cr = x[4] + x[6], ci = x[5] + x[7];
+        float dr = -sign * (x[5] - x[7]), di = sign * (x[4] - x[6]);
+        x[0] = ar + cr;
+        x[1] = ai + ci;
+        x[4] = ar - cr;
+        x[5] = ai - ci;
+        x[2] = br + dr;
+        x[3] = bi + di;
+        x[6] = br - dr;
+        x[7] = bi - di;
+    }
+
+    for (uint32_t half = 4; half < points; half *= 2)
+    {
+        // Twiddles of the stage start after the half - 4 of the stages before it
+        fftStage(data, points, half, plan->stageRe + 2 * (half - 4), plan->stageIm + 2 * (half - 4), inverse);
+    }
+}
+
+/**
+ * @brief Builds the tables of a size.
+ *
+ * @param size Real samples of the transform, a power of two.
+ * @return Pointer to the plan, or NULL if out of memory.
+ */
+static FftPlan *fftPlanCreate(uint32_t size)
+{
+    FftPlan *plan = calloc(1, sizeof(*plan));
+    uint32_t points = size / 2;
+
+    if (plan == NULL)
+    {
+        return NULL;
+    }
+    plan->size = size;
+    plan->points = points;
+    plan->bitReverse = malloc(points * sizeof(uint32_t));
+    plan->stageRe = malloc(2 * points * sizeof(float));
+    plan->stageIm = malloc(2 * points * sizeof(float));
+    plan->splitTwiddles = malloc(points * sizeof(float));
+    if (plan->bitReverse == NULL || plan->stageRe == NULL || plan->stageIm == NULL || plan->splitTwiddles == NULL)
+    {
+        free(plan->bitReverse);
+        free(plan->stageRe);
+        free(plan->stageIm);
+        free(plan->splitTwiddles);
+        free(plan);
+        return NULL;
+    }
+
+    uint32_t bits = 0;
+    while ((1u << bits) < points)
+    {
+        bits++;
+    }
+    for (uint32_t i = 0; i < points; i++)
+    {
+        uint32_t reversed = 0;
+        for (uint32_t b = 0; b < bits; b++)
+        {
+            reversed |= ((i >> b) & 1u) << (bits - 1 - b);
+        }
+        plan->bitReverse[i] = reversed;
+    }
+
+    for (uint32_t half = 4, offset = 0; half < points; offset += half, half *= 2)
+    {
+        for (uint32_t k = 0; k < half; k++)
+        {
+            // Forward twiddle e^(-i pi k / half) = wr + i wi
+            float wr = (float)cos(M_PI * k / half);
+            float wi = (float)-sin(M_PI * k / half);
+            plan->stageRe[2 * (offset + k)] = wr;
+            plan->stageRe[2 * (offset + k) + 1] = wr;
+            plan->stageIm[2 * (offset + k)] = -wi;
+            plan->stageIm[2 * (offset + k) + 1] = wi;
+        }
+    }
+    for (uint32_t k = 0; k < points / 2; k++)
+    {
+        plan->splitTwiddles[2 * k] = (float)cos(2.0 * M_PI * k / size);
+        plan->splitTwiddles[2 * k + 1] = (float)sin(2.0 * M_PI * k / size);
+    }
+
+    return plan;
+}
+
+/**
+ * @brief Returns the plan of a size, building it the first time it is asked for. Thread-safe.
+ *
+ * @param size Real samples of the transform: a power of two from FFT_MIN_SIZE to FFT_MAX_SIZE.
+ * @return Pointer to the plan, valid until fftPlanCacheClear, or NULL if the size is not supported
+ *         or out of memory.
+ */
+const FftPlan *fftPlanGet(uint32_t size)
+{
+    uint32_t slot = 0;
+    FftPlan *plan;
+
+    if (size < FFT_MIN_SIZE || size > FFT_MAX_SIZE || (size & (size - 1)) != 0)
+    {
+        return NULL;
+    }
+    while ((1u << slot) < size)
+    {
+        slot++;
+    }
+
+    pthread_mutex_lock(&plan_cache_mutex);
+    if (plan_cache[slot] == NULL)
+    {
+        plan_cache[slot] = fftPlanCreate(size);
+    }
+    plan = plan_cache[slot];
+    pthread_mutex_unlock(&plan_cache_mutex);
+    return plan;
+}
+
+/**
+ * @brief Frees every cached plan. No plan may be in use, or be used afterwards.
+ */
+void fftPlanCacheClear(void)
+{
+    pthread_mutex_lock(&plan_cache_mutex);
+    for (int i = 0; i < PLAN_CACHE_SLOTS; i++)
+    {
+        if (plan_cache[i] != NULL)
+        {
+            free(plan_cache[i]->bitReverse);
+            free(plan_cache[i]->stageRe);
+            free(plan_cache[i]->stageIm);
+            free(plan_cache[i]->splitTwiddles);
+            free(plan_cache[i]);
+            plan_cache[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&plan_cache_mutex);
+}
+
+/**
+ * @brief Spectrum of real samples: bins 0 to size / 2, as numpy's rfft.
+ *
+ * The samples, zero padded to the size of the plan, are transformed as size / 2 complex points
+ * made of their even and odd samples, and the two halves are then separated.
+ *
+ * @param plan Pointer to the plan.
+ * @param input Samples; may be the spectrum buffer itself.
+ * @param frames Number of samples, zero padded or truncated to the size of the plan.
+ * @param spectrum Buffer of size + 2 floats.
+ */
+void fftRealForward(const FftPlan *plan, const float *input, size_t frames, float *spectrum)
+{
+    uint32_t points = plan->points;
+
+    if (frames > plan->size)
+    {
+        frames = plan->size;
+    }
+    memmove(spectrum, input, frames * sizeof(float));
+    memset(spectrum + frames, 0, (plan->size + 2 - frames) * sizeof(float));
+    complexFft(plan, spectrum, 0);
+
+    float re0 = spectrum[0], im0 = spectrum[1];
+    spectrum[0] = re0 + im0;
+    spectrum[1] = 0.0f;
+    spectrum[2 * points] = re0 - im0;
+    spectrum[2 * points + 1] = 0.0f;
+    spectrum[points + 1] = -spectrum[points + 1]; // bin size / 4 is the conjugate of its point
+
+    for (uint32_t k = 1; k < points / 2; k++)
+    {
+        uint32_t j = points - k;
+        float *zk = spectrum + 2 * k, *zj = spectrum + 2 * j;
+        // Even part E = (Z[k] + conj(Z[j])) / 2, odd part O = -i (Z[k] - conj(Z[j])) / 2
+        float er = 0.5f * (zk[0] + zj[0]), ei = 0.5f * (zk[1] - zj[1]);
+        float orr = 0.5f * (zk[1] + zj[1]), oi = -0.5f * (zk[0] - zj[0]);
+        float wr = plan->splitTwiddles[2 * k], wi = -plan->splitTwiddles[2 * k + 1];
+        float tr = orr * wr - oi * wi, ti = orr * wi + oi * wr;
+        // X[k] = E + W^k O and X[j] = conj(E) + W^j conj(O) = conj(E - W^k O)
+        zk[0] = er + tr;
+        zk[1] = ei + ti;
+        zj[0] = er - tr;
+        zj[1] = -(ei - ti);
+    }
+}
+
+/**
+ * @brief Real samples of bins 0 to size / 2, as numpy's irfft.
+ *
+ * @param plan Pointer to the plan.
+ * @param spectrum size / 2 + 1 complex bins.
+ * @param output Buffer of size floats; may be the spectrum buffer itself.
+ */
+void fftRealInverse(const FftPlan *plan, const float *spectrum, float *output)
+{
+    uint32_t points = plan->points;
+    float scale = 1.0f / points;
+
+    float first = spectrum[0], last = spectrum[2 * points];
+    output[0] = 0.5f * scale * (first + last);
+    output[1] = 0.5f * scale * (first - last);
+    output[points] = scale * spectrum[points];
+    output[points + 1] = -scale * spectrum[points + 1];
+
+    for (uint32_t k = 1; k < points / 2; k++)
+    {
+        uint32_t j = points - k;
+        const float *xk = spectrum + 2 * k, *xj = spectrum + 2 * j;
+        // E = (X[k] + conj(X[j])) / 2 and O = (X[k] - conj(X[j])) / 2 conj(W^k), Z[k] = E + i O
+        float er = 0.5f * scale * (xk[0] + xj[0]), ei = 0.5f * scale * (xk[1] - xj[1]);
+        float dr = 0.5f * scale * (xk[0] - xj[0]), di = 0.5f * scale * (xk[1] + xj[1]);
+        float wr = plan->splitTwiddles[2 * k], wi = plan->splitTwiddles[2 * k + 1];
+        float orr = dr * wr - di * wi, oi = dr * wi + di * wr;
+        // Z[j] = conj(E) + i conj(O)
+        output[2 * k] = er - oi;
+        output[2 * k + 1] = ei + orr;
+        output[2 * j] = er + oi;
+        output[2 * j + 1] = -ei + orr;
+    }
+    complexFft(plan, output, 1);
+}
+
+/**
+ * @brief Spectra of count frames of the same size, such as the windows of a spectrogram.
+ *
+ * @param plan Pointer to the plan.
+ * @param input First sample of the first frame.
+ * @param inputStride Samples from the start of a frame to the start of the next; frames may overlap.
+ * @param frames Samples of each frame, zero padded or truncated to the size of the plan.
+ * @param spectra Output of the first frame, size + 2 floats.
+ * @param spectrumStride Floats from a spectrum to the next, at least size + 2.
+ * @param count Number of frames.
+ */
+void fftRealForwardBatch(const FftPlan *plan, const float *input, size_t inputStride, size_t frames, float *spectra,
+                         size_t spectrumStride, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        fftRealForward(plan, input + i * inputStride, frames, spectra + i * spectrumStride);
+    }
+}
+
+/**
+ * @brief Real samples of count spectra of the same size.
+ *
+ * @param plan Pointer to the plan.
+ * @param spectra First spectrum, size / 2 + 1 complex bins.
+ * @param spectrumStride Floats from a spectrum to the next.
+ * @param output Output of the first spectrum, size floats.
+ * @param outputStride Floats from an output to the next, at least size.
+ * @param count Number of spectra.
+ */
+void fftRealInverseBatch(const FftPlan *plan, const float *spectra, size_t spectrumStride, float *output, size_t outputStride,
+                         size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        fftRealInverse(plan, spectra + i * spectrumStride, output + i * outputStride);
+    }
+}
+
+/**
+ * @brief Name of the butterfly kernels.
+ *
+ * @return "avx", "sse2", "neon" or "scalar".
+ */
+const char *fftKernelName(void)
+{
+    return FFT_KERNEL;
+}
@@ -0,0 +1,59 @@
+/**
+ * ******************************
+ * ************ fft.h ************
+ * ******************************
+ *
+ * Real-input FFT for the DSP code of the recorders and the analyzer
+ * (GCC-PHAT, spectrograms, spectral features). A transform of n real
+ * samples is done as a complex FFT of n / 2 points, split into the n / 2 + 1
+ * bins of the real spectrum. Plans hold every table a size needs, are made
+ * once and cached by size, and are read-only afterwards, so any number of
+ * threads can share one. The butterflies use AVX/SSE2/NEON kernels selected
+ * at compile time, or a scalar loop.
+ *
+ * Spectra are interleaved real and imaginary parts, as numpy's rfft, and
+ * the inverse transform is normalized as numpy's irfft.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef FFT_H
+#define FFT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FFT_MIN_SIZE 8
+#define FFT_MAX_SIZE (1u << 30)
+
+/**
+ * @brief Tables of one transform size.
+ *
+ * Each stage of the complex FFT after the first radix-4 pass has its twiddles in order, one
+ * table after another, laid out for the butterflies: for the forward twiddle wr + i wi, stageRe
+ * holds wr, wr and stageIm holds -wi, wi, so a complex product is b * re + swap(b) * im.
+ */
+typedef struct
+{
+    uint32_t size;          // real samples, a power of two
+    uint32_t points;        // complex points of the inner FFT, size / 2
+    uint32_t *bitReverse;   // points entries
+    float *stageRe;
+    float *stageIm;
+    float *splitTwiddles;   // cos, sin pairs of 2 pi k / size that split the inner FFT into the real spectrum
+} FftPlan;
+
+const FftPlan *fftPlanGet(uint32_t size);
+void fftPlanCacheClear(void);
+
+void fftRealForward(const FftPlan *plan, const float *input, size_t frames, float *spectrum);
+void fftRealInverse(const FftPlan *plan, const float *spectrum, float *output);
+void fftRealForwardBatch(const FftPlan *plan, const float *input, size_t inputStride, size_t frames, float *spectra,
+                         size_t spectrumStride, size_t count);
+void fftRealInverseBatch(const FftPlan *plan, const float *spectra, size_t spectrumStride, float *output, size_t outputStride,
+                         size_t count);
+
+const char *fftKernelName(void);
+
+#endif
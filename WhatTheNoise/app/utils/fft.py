@@ -0,0 +1,122 @@
+"""Real FFT of fft.h from Python, through libfft.so (make libfft.so).
+
+rfft and irfft follow numpy's conventions, in single precision; rfft_frames transforms the
+overlapping frames of a signal, as for a spectrogram, in a single call to the batch API. Plans
+are cached by size inside the library, so only the first transform of a size builds its tables.
+
+Usage: python fft.py [--sizes N ...] [--frames FRAMES] [--hop HOP] [--seconds S]
+Checks the library against numpy and compares their time per transform and per spectrogram.
+"""
+import argparse
+import ctypes
+import os
+import time
+
+import numpy as np
+
+LIBRARY_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'libfft.so')
+
+def _load_library(path=LIBRARY_PATH):
+    """The native FFT, or None if it has not been built."""
+    try:
+        library = ctypes.CDLL(path)
+    except OSError:
+        return None
+    library.fftPlanGet.restype = ctypes.c_void_p
+    library.fftPlanGet.argtypes = [ctypes.c_uint32]
+    library.fftRealForwardBatch.restype = None
+    library.fftRealForwardBatch.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t,
+                                            ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t]
+    library.fftRealInverseBatch.restype = None
+    library.fftRealInverseBatch.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p,
+                                            ctypes.c_size_t, ctypes.c_size_t]
+    library.fftKernelName.restype = ctypes.c_char_p
+    library.fftKernelName.argtypes = []
+    return library
+
+_library = _load_library()
+
+def available():
+    """True if libfft.so is built."""
+    return _library is not None
+
+def kernel_name():
+    """Butterfly kernels the library was built with."""
+    return _library.fftKernelName().decode()
+
+def _plan(size):
+    if _library is None:
+        raise RuntimeError(f'{LIBRARY_PATH} is not built: run make libfft.so')
+    plan = _library.fftPlanGet(size)
+    if not plan:
+        raise ValueError(f'unsupported FFT size {size}: it must be a power of two from 8')
+    return plan
+
+def rfft(x, n=None):
+    """Spectrum of real samples as numpy.fft.rfft, zero padded or truncated to n, in complex64."""
+    x = np.ascontiguousarray(x, dtype=np.float32)
+    n = len(x) if n is None else int(n)
+    spectrum = np.empty(n + 2, dtype=np.float32)
+    _library.fftRealForwardBatch(_plan(n), x.ctypes.data, 0, min(len(x), n), spectrum.ctypes.data, n + 2, 1)
+    return spectrum.view(np.complex64)
+
+def irfft(spectrum, n=None):
+    """Real samples of a spectrum as numpy.fft.irfft, in float32."""
+    n = 2 * (len(spectrum) - 1) if n is None else int(n)
+    bins = np.zeros(n // 2 + 1, dtype=np.complex64)
+    bins[:min(len(spectrum), len(bins))] = spectrum[:len(bins)]
+    output = np.empty(n, dtype=np.float32)
+    _library.fftRealInverseBatch(_plan(n), bins.ctypes.data, n + 2, output.ctypes.data, n, 1)
+    return output
+
+def rfft_frames(signal, frame_frames, hop_frames):
+    """Spectra of the frames of frame_frames samples every hop_frames of a signal, one row per frame."""
+    signal = np.ascontiguousarray(signal, dtype=np.float32)
+    count = (len(signal) - frame_frames) // hop_frames + 1 if len(signal) >= frame_frames else 0
+    spectra = np.empty((count, frame_frames + 2), dtype=np.float32)
+    if count:
+        _library.fftRealForwardBatch(_plan(frame_frames), signal.ctypes.data, hop_frames, frame_frames,
+                                     spectra.ctypes.data, frame_frames + 2, count)
+    return spectra.view(np.complex64)
+
+def _time_per_call(function, target=0.2):
+    """Seconds per call of function, run for about target seconds."""
+    function()
+    calls, start = 0, time.perf_counter()
+    while (elapsed := time.perf_counter() - start) < target:
+        function()
+        calls += 1
+    return elapsed / calls
+
+def benchmark(sizes, frame_frames, hop_frames, seconds, sample_rate=44100):
+    """Prints the error against numpy and the time of both for each size and for a spectrogram."""
+    rng = np.random.default_rng(1)
+    print(f'libfft.so with {kernel_name()} kernels against numpy {np.__version__}')
+    print(f'{"size":>6} {"max error":>10} {"native us":>10} {"numpy us":>10}')
+    for size in sizes:
+        x = rng.uniform(-1, 1, size).astype(np.float32)
+        reference = np.fft.rfft(x)
+        error = np.abs(rfft(x) - reference).max() / np.abs(reference).max()
+        error = max(error, np.abs(irfft(rfft(x), size) - x).max())
+        native = _time_per_call(lambda: rfft(x))
+        numpy = _time_per_call(lambda: np.fft.rfft(x))
+        print(f'{size:6d} {error:10.2e} {native * 1e6:10.1f} {numpy * 1e6:10.1f}')
+
+    signal = rng.uniform(-1, 1, int(seconds * sample_rate)).astype(np.float32)
+    frames = np.lib.stride_tricks.sliding_window_view(signal, frame_frames)[::hop_frames]
+    error = np.abs(rfft_frames(signal, frame_frames, hop_frames) - np.fft.rfft(frames, axis=1)).max()
+    native = _time_per_call(lambda: rfft_frames(signal, frame_frames, hop_frames))
+    numpy = _time_per_call(lambda: np.fft.rfft(np.lib.stride_tricks.sliding_window_view(signal, frame_frames)[::hop_frames], axis=1))
+    print(f'Spectrogram of {seconds} s, {len(frames)} frames of {frame_frames}, hop {hop_frames}: '
+          f'native {native * 1e3:.2f} ms, numpy {numpy * 1e3:.2f} ms (max error {error:.2e})')
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Check libfft.so against numpy and compare their speed')
+    parser.add_argument('--sizes', type=int, nargs='+', default=[256, 1024, 2048, 4096], help='transform sizes')
+    parser.add_argument('--frames', type=int, default=1024, help='frame size of the spectrogram')
+    parser.add_argument('--hop', type=int, default=512, help='hop of the spectrogram')
+    parser.add_argument('--seconds', type=float, default=2.0, help='seconds of the spectrogram at 44100 Hz')
+    args = parser.parse_args()
+    if not available():
+        raise SystemExit(f'{LIBRARY_PATH} is not built: run make libfft.so')
+    benchmark(args.sizes, args.frames, args.hop, args.seconds)
@@ -0,0 +1,565 @@
+/**
+ * ******************************
+ * ********* flac_encoder.c ********
+ * ******************************
+ *
+ * Implementation of the streaming FLAC encoder declared in flac_encoder.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "flac_encoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAMINFO_BYTES 34
+#define STREAMINFO_OFFSET 8 // after "fLaC" and the metadata block header
+#define RICE_MAX_PARAMETER 14
+#define RICE2_MAX_PARAMETER 30
+
+/**
+ * @brief Writer of a big-endian bit stream into a byte buffer.
+ */
+typedef struct
+{
+    uint8_t *data;
+    size_t bytes;
+    uint64_t accumulator;
+    int bits;
+} BitWriter;
+
+static void putBits(BitWriter *writer, uint32_t value, int count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    writer->accumulator = (writer->accumulator << count) | (value & (uint32_t)(((uint64_t)1 << count) - 1));
+    writer->bits += count;
+    while (writer->bits >= 8)
+    {
+        writer->bits -= 8;
+        writer->data[writer->bytes++] = (uint8_t)(writer->accumulator >> writer->bits);
+    }
+}
+
+static void putUnary(BitWriter *writer, uint32_t zeros)
+{
+    while (zeros >= 31)
+    {
+        putBits(writer, 0, 31);
+        zeros -= 31;
+    }
+    putBits(writer, 1, zeros + 1);
+}
+
+static void padToByte(BitWriter *writer)
+{
+    if (writer->bits > 0)
+    {
+        putBits(writer, 0, 8 - writer->bits);
+    }
+}
+
+static uint8_t crc8(const uint8_t *data, size_t length)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint16_t crc16(const uint8_t *data, size_t length)
+{
+    uint16_t crc = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x8005) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Code of a block size in the frame header (6 and 7 store the size at the end of the header).
+ */
+static int blockSizeCode(uint32_t blockSize)
+{
+    for (int code = 8; code <= 15; code++)
+    {
+        if (blockSize == 256u << (code - 8))
+        {
+            return code;
+        }
+    }
+    return blockSize <= 256 ? 6 : 7;
+}
+
+/**
+ * @brief Code of a sample rate in the frame header, 0 to take it from STREAMINFO.
+ */
+static int sampleRateCode(uint32_t sampleRate)
+{
+    static const uint32_t rates[] = {0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000};
+
+    for (int code = 1; code < (int)(sizeof(rates) / sizeof(rates[0])); code++)
+    {
+        if (rates[code] == sampleRate)
+        {
+            return code;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes STREAMINFO with the sizes and sample count known so far.
+ */
+static int writeStreamInfo(FlacEncoder *encoder)
+{
+    uint8_t data[STREAMINFO_BYTES + 8];
+    BitWriter writer = {data, 0, 0, 0};
+    uint32_t blockSize = FLAC_BLOCK_SIZE;
+
+    if (encoder->totalSamples < FLAC_BLOCK_SIZE)
+    {
+        blockSize = encoder->totalSamples < 16 ? 16 : (uint32_t)encoder->totalSamples;
+    }
+
+    putBits(&writer, blockSize, 16);
+    putBits(&writer, blockSize, 16);
+    putBits(&writer, encoder->minFrameBytes == UINT32_MAX ? 0 : encoder->minFrameBytes, 24);
+    putBits(&writer, encoder->maxFrameBytes, 24);
+    putBits(&writer, encoder->sampleRate, 20);
+    putBits(&writer, 0, 3); // one channel
+    putBits(&writer, encoder->bitsPerSample - 1, 5);
+    putBits(&writer, (uint32_t)(encoder->totalSamples >> 32), 4);
+    putBits(&writer, (uint32_t)encoder->totalSamples, 32);
+    for (int i = 0; i < 4; i++)
+    {
+        putBits(&writer, 0, 32); // MD5 not computed
+    }
+
+    return fwrite(data, 1, STREAMINFO_BYTES, encoder->file) == STREAMINFO_BYTES ? 0 : -1;
+}
+
+/**
+ * @brief Returns whether a sample format can be encoded losslessly.
+ *
+ * @param format Sample format.
+ * @return 1 for S16 and S32, 0 for FLOAT.
+ */
+int flacEncoderSupports(SampleFormat format)
+{
+    return format == SAMPLE_S16 || format == SAMPLE_S32;
+}
+
+/**
+ * @brief Creates a FLAC file and writes its header.
+ *
+ * @param encoder Pointer to the encoder.
+ * @param path Path of the file.
+ * @param sampleRate Sample rate.
+ * @param format Format of the samples that will be written: S16 or S32.
+ * @return 0 on success, -1 on failure or if the format cannot be encoded losslessly.
+ */
+int flacEncoderOpen(FlacEncoder *encoder, const char *path, uint32_t sampleRate, SampleFormat format)
+{
+    static const uint8_t marker[8] = {'f', 'L', 'a', 'C', 0x80, 0, 0, STREAMINFO_BYTES};
+
+    encoder->file = NULL;
+    if (!flacEncoderSupports(format))
+    {
+        return -1;
+    }
+    encoder->format = format;
+    encoder->sampleRate = sampleRate;
+    encoder->bitsPerSample = format == SAMPLE_S16 ? 16 : 32;
+    encoder->blockFill = 0;
+    encoder->totalSamples = 0;
+    encoder->frameNumber = 0;
+    encoder->minFrameBytes = UINT32_MAX;
+    encoder->maxFrameBytes = 0;
+    encoder->file = fopen(path, "wb");
+    if (encoder->file == NULL)
+    {
+        return -1;
+    }
+    if (fwrite(marker, 1, sizeof(marker), encoder->file) != sizeof(marker) || writeStreamInfo(encoder) != 0)
+    {
+        fclose(encoder->file);
+        encoder->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Fixed predictor order with the smallest residual over a block.
+ */
+static int chooseFixedOrder(const int32_t *x, size_t n)
+{
+    uint64_t sums[FLAC_MAX_FIXED_ORDER + 1] = {0};
+    int maxOrder = n > FLAC_MAX_FIXED_ORDER ? FLAC_MAX_FIXED_ORDER : (int)n - 1;
+    int best = 0;
+
+    for (size_t i = FLAC_MAX_FIXED_ORDER; i < n; i++)
+    {
+        int64_t e0 = x[i];
+        int64_t e1 = e0 - x[i - 1];
+        int64_t e2 = e1 - ((int64_t)x[i - 1] - x[i - 2]);
+        int64_t e3 = e2 - ((int64_t)x[i - 1] - 2 * (int64_t)x[i - 2] + x[i - 3]);
+        int64_t e4 = e3 - ((int64_t)x[i - 1] - 3 * (int64_t)x[i - 2] + 3 * (int64_t)x[i - 3] - x[i - 4]);
+        sums[0] += llabs(e0);
+        sums[1] += llabs(e1);
+        sums[2] += llabs(e2);
+        sums[3] += llabs(e3);
+        sums[4] += llabs(e4);
+    }
+    for (int order = 1; order <= maxOrder; order++)
+    {
+        if (sums[order] < sums[best])
+        {
+            best = order;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Zigzag-coded residual of a fixed predictor, for samples order to n - 1.
+ *
+ * @return 0 on success, -1 if a residual does not fit in the 32 bits FLAC allows.
+ */
+static int fixedResidual(const int32_t *x, size_t n, int order, uint32_t *residual)
+{
+    for (size_t i = order; i < n; i++)
+    {
+        int64_t e;
+        switch (order)
+        {
+        case 0:
+            e = x[i];
+            break;
+        case 1:
+            e = (int64_t)x[i] - x[i - 1];
+            break;
+        case 2:
+            e = (int64_t)x[i] - 2 * (int64_t)x[i - 1] + x[i - 2];
+            break;
+        case 3:
+            e = (int64_t)x[i] - 3 * (int64_t)x[i - 1] + 3 * (int64_t)x[i - 2] - x[i - 3];
+            break;
+        default:
+            e = (int64_t)x[i] - 4 * (int64_t)x[i - 1] + 6 * (int64_t)x[i - 2] - 4 * (int64_t)x[i - 3] + x[i - 4];
+            break;
+        }
+        if (e > INT32_MAX || e <= INT32_MIN)
+        {
+            return -1;
+        }
+        residual[i - order] = (uint32_t)((uint64_t)e << 1) ^ (uint32_t)(e >> 63);
+    }
+    return 0;
+}
+
+/**
+ * @brief Rice parameter of a partition and an upper bound of the bits it takes.
+ */
+static int riceParameter(uint64_t sum, size_t count, uint64_t *bits)
+{
+    int k = 0;
+
+    if (count == 0)
+    {
+        *bits = 0;
+        return 0;
+    }
+    while (k < RICE2_MAX_PARAMETER && ((uint64_t)count << (k + 1)) < sum)
+    {
+        k++;
+    }
+    *bits = (uint64_t)count * (k + 1) + (sum >> k);
+    return k;
+}
+
+/**
+ * @brief Partition order and Rice parameters that code a residual in the fewest bits.
+ *
+ * @return Bits of the residual section (without the coding method).
+ */
+static uint64_t chooseRicePartitions(const uint32_t *residual, size_t n, int order, int *bestOrder, int *parameters, int *maxParameter)
+{
+    uint64_t bestBits = UINT64_MAX;
+
+    for (int p = 0; p <= FLAC_MAX_PARTITION_ORDER; p++)
+    {
+        size_t partitions = (size_t)1 << p;
+        size_t size = n >> p;
+        int candidate[1 << FLAC_MAX_PARTITION_ORDER];
+        uint64_t bits = 4;
+        int maxK = 0;
+
+        if ((n & (partitions - 1)) != 0 || size <= (size_t)order)
+        {
+            break;
+        }
+
+        const uint32_t *u = residual;
+        for (size_t j = 0; j < partitions; j++)
+        {
+            size_t count = size - (j == 0 ? order : 0);
+            uint64_t sum = 0, partitionBits;
+            for (size_t i = 0; i < count; i++)
+            {
+                sum += u[i];
+            }
+            u += count;
+            candidate[j] = riceParameter(sum, count, &partitionBits);
+            if (candidate[j] > maxK)
+            {
+                maxK = candidate[j];
+            }
+            bits += partitionBits;
+        }
+        bits += partitions * (maxK > RICE_MAX_PARAMETER ? 5 : 4);
+
+        if (bits < bestBits)
+        {
+            bestBits = bits;
+            *bestOrder = p;
+            *maxParameter = maxK;
+            memcpy(parameters, candidate, partitions * sizeof(int));
+        }
+    }
+    return bestBits;
+}
+
+/**
+ * @brief Number of low bits that are zero in every sample of a block, which FLAC can leave out.
+ */
+static int wastedBits(const int32_t *x, size_t n, int bps)
+{
+    uint32_t bits = 0;
+    int wasted = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        bits |= (uint32_t)x[i];
+    }
+    if (bits == 0)
+    {
+        return 0;
+    }
+    while (!(bits & 1) && wasted < bps - 1)
+    {
+        bits >>= 1;
+        wasted++;
+    }
+    return wasted;
+}
+
+/**
+ * @brief Encodes the samples of the block as one frame and writes it.
+ */
+static int encodeFrame(FlacEncoder *encoder)
+{
+    int32_t *x = encoder->block;
+    size_t n = encoder->blockFill;
+    int bps = encoder->bitsPerSample;
+    int wasted = 0;
+    BitWriter writer = {encoder->frame, 0, 0, 0};
+    int parameters[1 << FLAC_MAX_PARTITION_ORDER];
+    int partitionOrder = 0, maxParameter = 0, constant = 1;
+    uint32_t number = encoder->frameNumber;
+    int code = blockSizeCode((uint32_t)n);
+
+    // Header: sync code with fixed block sizes, sizes, mono, bits per sample and UTF-8 coded frame number
+    putBits(&writer, 0xFFF8, 16);
+    putBits(&writer, code, 4);
+    putBits(&writer, sampleRateCode(encoder->sampleRate), 4);
+    putBits(&writer, 0, 4);
+    putBits(&writer, bps == 16 ? 4 : 7, 3);
+    putBits(&writer, 0, 1);
+    if (number < 0x80)
+    {
+        putBits(&writer, number, 8);
+    }
+    else
+    {
+        int extra = number < 0x800 ? 1 : number < 0x10000 ? 2 : number < 0x200000 ? 3 : number < 0x4000000 ? 4 : 5;
+        putBits(&writer, (0xFF00u >> (extra + 1)) | (number >> (6 * extra)), 8);
+        for (int i = extra - 1; i >= 0; i--)
+        {
+            putBits(&writer, 0x80 | ((number >> (6 * i)) & 0x3F), 8);
+        }
+    }
+    if (code == 6)
+    {
+        putBits(&writer, (uint32_t)n - 1, 8);
+    }
+    else if (code == 7)
+    {
+        putBits(&writer, (uint32_t)n - 1, 16);
+    }
+    putBits(&writer, crc8(writer.data, writer.bytes), 8);
+
+    for (size_t i = 1; i < n && constant; i++)
+    {
+        constant = x[i] == x[0];
+    }
+
+    if (constant)
+    {
+        putBits(&writer, 0x00, 8);
+        putBits(&writer, (uint32_t)x[0], bps);
+    }
+    else
+    {
+        // The subframe codes the samples shifted right by the wasted bits, with as many fewer bits
+        wasted = wastedBits(x, n, bps);
+        if (wasted > 0)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                x[i] >>= wasted;
+            }
+            bps -= wasted;
+        }
+
+        int order = chooseFixedOrder(x, n);
+        uint64_t bits = UINT64_MAX;
+        if (fixedResidual(x, n, order, encoder->residual) == 0)
+        {
+            bits = order * (uint64_t)bps + 2 + chooseRicePartitions(encoder->residual, n, order, &partitionOrder, parameters, &maxParameter);
+        }
+
+        if (bits >= (uint64_t)n * bps)
+        {
+            putBits(&writer, 0x02 | (wasted > 0), 8); // verbatim
+            if (wasted > 0)
+            {
+                putUnary(&writer, wasted - 1);
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                putBits(&writer, (uint32_t)x[i], bps);
+            }
+        }
+        else
+        {
+            int rice2 = maxParameter > RICE_MAX_PARAMETER;
+            const uint32_t *u = encoder->residual;
+
+            putBits(&writer, ((0x08 | order) << 1) | (wasted > 0), 8);
+            if (wasted > 0)
+            {
+                putUnary(&writer, wasted - 1);
+            }
+            for (int i = 0; i < order; i++)
+            {
+                putBits(&writer, (uint32_t)x[i], bps);
+            }
+            putBits(&writer, rice2, 2);
+            putBits(&writer, partitionOrder, 4);
+            for (size_t j = 0; j < ((size_t)1 << partitionOrder); j++)
+            {
+                size_t count = (n >> partitionOrder) - (j == 0 ? order : 0);
+                int k = parameters[j];
+                putBits(&writer, k, rice2 ? 5 : 4);
+                for (size_t i = 0; i < count; i++)
+                {
+                    putUnary(&writer, u[i] >> k);
+                    putBits(&writer, u[i], k);
+                }
+                u += count;
+            }
+        }
+    }
+
+    padToByte(&writer);
+    uint16_t crc = crc16(writer.data, writer.bytes);
+    putBits(&writer, crc, 16);
+
+    if (writer.bytes < encoder->minFrameBytes)
+    {
+        encoder->minFrameBytes = (uint32_t)writer.bytes;
+    }
+    if (writer.bytes > encoder->maxFrameBytes)
+    {
+        encoder->maxFrameBytes = (uint32_t)writer.bytes;
+    }
+    encoder->frameNumber++;
+    encoder->blockFill = 0;
+    return fwrite(writer.data, 1, writer.bytes, encoder->file) == writer.bytes ? 0 : -1;
+}
+
+/**
+ * @brief Adds samples to the stream, encoding a frame every FLAC_BLOCK_SIZE samples.
+ *
+ * @param encoder Pointer to the encoder.
+ * @param samples Samples in the format given to flacEncoderOpen().
+ * @param frames Number of samples.
+ * @return 0 on success, -1 on write error.
+ */
+int flacEncoderWrite(FlacEncoder *encoder, const void *samples, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++)
+    {
+        if (encoder->format == SAMPLE_S16)
+        {
+            encoder->block[encoder->blockFill++] = ((const int16_t *)samples)[i];
+        }
+        else
+        {
+            encoder->block[encoder->blockFill++] = ((const int32_t *)samples)[i];
+        }
+        if (encoder->blockFill == FLAC_BLOCK_SIZE && encodeFrame(encoder) != 0)
+        {
+            return -1;
+        }
+    }
+    encoder->totalSamples += frames;
+    return 0;
+}
+
+/**
+ * @brief Encodes the last partial block, completes STREAMINFO and closes the file.
+ *
+ * @param encoder Pointer to the encoder.
+ * @return 0 on success, -1 on failure.
+ */
+int flacEncoderClose(FlacEncoder *encoder)
+{
+    int result = 0;
+
+    if (encoder->file == NULL)
+    {
+        return -1;
+    }
+    if (encoder->blockFill > 0 && encodeFrame(encoder) != 0)
+    {
+        result = -1;
+    }
+    if (fseek(encoder->file, STREAMINFO_OFFSET, SEEK_SET) != 0 || writeStreamInfo(encoder) != 0)
+    {
+        result = -1;
+    }
+    if (fclose(encoder->file) != 0)
+    {
+        result = -1;
+    }
+    encoder->file = NULL;
+    return result;
+}
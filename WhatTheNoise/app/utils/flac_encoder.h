@@ -0,0 +1,60 @@
+/**
+ * ******************************
+ * ********* flac_encoder.h ********
+ * ******************************
+ *
+ * Streaming FLAC encoder used by the writer threads to compress each
+ * recording while it is being captured, so the compressed file is complete
+ * as soon as the segment closes. Mono only, fixed blocks, fixed predictors
+ * (orders 0 to 4) with partitioned Rice coding: a small fraction of the
+ * work of libFLAC for most of its compression on microphone audio.
+ *
+ * Lossless: S16 is stored as 16-bit FLAC and S32 as 32-bit FLAC, whose
+ * frames drop the low bits that are zero in every sample (wasted bits), so
+ * the 24-bit converters behind most S32 devices cost no more than 24-bit
+ * FLAC. FLOAT cannot be stored losslessly in FLAC and is not accepted. The
+ * MD5 of STREAMINFO is left unset, which decoders take as "not computed".
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef FLAC_ENCODER_H
+#define FLAC_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sample_format.h"
+
+#define FLAC_BLOCK_SIZE 4096
+#define FLAC_MAX_FIXED_ORDER 4
+#define FLAC_MAX_PARTITION_ORDER 8
+#define FLAC_MAX_FRAME_BYTES (FLAC_BLOCK_SIZE * 4 + 64) // a verbatim frame of 32-bit samples and its header
+
+/**
+ * @brief State of the encoder of one file.
+ */
+typedef struct
+{
+    FILE *file;
+    SampleFormat format;
+    uint32_t sampleRate;
+    int bitsPerSample;
+    int32_t block[FLAC_BLOCK_SIZE];
+    size_t blockFill;
+    uint32_t residual[FLAC_BLOCK_SIZE];
+    uint8_t frame[FLAC_MAX_FRAME_BYTES];
+    uint64_t totalSamples;
+    uint32_t frameNumber;
+    uint32_t minFrameBytes;
+    uint32_t maxFrameBytes;
+} FlacEncoder;
+
+int flacEncoderSupports(SampleFormat format);
+int flacEncoderOpen(FlacEncoder *encoder, const char *path, uint32_t sampleRate, SampleFormat format);
+int flacEncoderWrite(FlacEncoder *encoder, const void *samples, size_t frames);
+int flacEncoderClose(FlacEncoder *encoder);
+
+#endif
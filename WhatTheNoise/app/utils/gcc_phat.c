@@ -0,0 +1,216 @@
+/**
+ * ******************************
+ * ********** gcc_phat.c **********
+ * ******************************
+ *
+ * Implementation of the GCC-PHAT engine declared in gcc_phat.h, on the
+ * real FFTs of fft.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "gcc_phat.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define GCC_PHAT_MIN_MAGNITUDE 1e-20f // bins below it carry no phase and are left out of the transform
+
+/**
+ * @brief Creates the plan of the engine for a window size and a lag range.
+ *
+ * @param windowFrames Samples of each window.
+ * @param maxLag Largest delay searched, in samples, either way.
+ * @return Pointer to the engine, or NULL on failure.
+ */
+GccPhat *gccPhatCreate(uint32_t windowFrames, uint32_t maxLag)
+{
+    GccPhat *phat;
+    uint32_t fftSize = FFT_MIN_SIZE;
+
+    if (windowFrames == 0 || (uint64_t)windowFrames + maxLag > FFT_MAX_SIZE)
+    {
+        return NULL;
+    }
+    while (fftSize < windowFrames + maxLag || fftSize < 2 * maxLag + 2)
+    {
+        fftSize *= 2;
+    }
+
+    phat = calloc(1, sizeof(*phat));
+    if (phat == NULL)
+    {
+        return NULL;
+    }
+    phat->windowFrames = windowFrames;
+    phat->maxLag = maxLag;
+    phat->fftSize = fftSize;
+    phat->plan = fftPlanGet(fftSize);
+    phat->spectrum1 = malloc((fftSize + 2) * sizeof(float));
+    phat->spectrum2 = malloc((fftSize + 2) * sizeof(float));
+    if (phat->plan == NULL || phat->spectrum1 == NULL || phat->spectrum2 == NULL)
+    {
+        gccPhatDestroy(phat);
+        return NULL;
+    }
+
+    return phat;
+}
+
+/**
+ * @brief Frees the engine.
+ *
+ * @param phat Pointer to the engine, or NULL.
+ */
+void gccPhatDestroy(GccPhat *phat)
+{
+    if (phat == NULL)
+    {
+        return;
+    }
+    free(phat->spectrum1);
+    free(phat->spectrum2);
+    free(phat);
+}
+
+/**
+ * @brief Returns whether a window holds any signal.
+ */
+static int hasSignal(const float *window, uint32_t frames)
+{
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        if (window[i] != 0.0f)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Delay of window2 with respect to window1, for windows that start at the same instant.
+ *
+ * A positive lag means the sound reached the second microphone later. The integer peak of the
+ * PHAT weighted cross-correlation within ±maxLag is refined with the vertex of the parabola
+ * through it and its two neighbours.
+ *
+ * @param phat Pointer to the engine.
+ * @param window1 windowFrames samples of the first microphone.
+ * @param window2 windowFrames samples of the second microphone.
+ * @param lag Pointer to where the delay, in fractional samples, will be stored.
+ * @param peak Pointer to where the height of the peak will be stored: 1 for identical delayed windows.
+ * @return 0 on success, -1 if a window is silent (zero-filled).
+ */
+int gccPhatLag(GccPhat *phat, const float *window1, const float *window2, double *lag, double *peak)
+{
+    uint32_t fftSize = phat->fftSize;
+    float *spectrum1 = phat->spectrum1, *spectrum2 = phat->spectrum2;
+    float *correlation = spectrum1;
+
+    if (!hasSignal(window1, phat->windowFrames) || !hasSignal(window2, phat->windowFrames))
+    {
+        return -1;
+    }
+
+    fftRealForward(phat->plan, window1, phat->windowFrames, spectrum1);
+    fftRealForward(phat->plan, window2, phat->windowFrames, spectrum2);
+
+    // Cross spectrum X2 conj(X1), whitened: only the phase, that is the delay, is left
+    for (uint32_t k = 0; k <= fftSize / 2; k++)
+    {
+        float ar = spectrum1[2 * k], ai = spectrum1[2 * k + 1];
+        float br = spectrum2[2 * k], bi = spectrum2[2 * k + 1];
+        float cr = br * ar + bi * ai;
+        float ci = bi * ar - br * ai;
+        float magnitude = sqrtf(cr * cr + ci * ci);
+        if (magnitude > GCC_PHAT_MIN_MAGNITUDE)
+        {
+            cr /= magnitude;
+            ci /= magnitude;
+        }
+        else
+        {
+            cr = ci = 0.0f;
+        }
+        spectrum1[2 * k] = cr;
+        spectrum1[2 * k + 1] = ci;
+    }
+    fftRealInverse(phat->plan, spectrum1, correlation);
+
+    // Lag d lives at correlation[d] and, when negative, at correlation[fftSize + d]
+    int32_t maxLag = (int32_t)phat->maxLag;
+    int32_t best = 0;
+    float bestValue = correlation[0];
+    for (int32_t d = -maxLag; d <= maxLag; d++)
+    {
+        float value = correlation[(uint32_t)(d + (int32_t)fftSize) & (fftSize - 1)];
+        if (value > bestValue)
+        {
+            bestValue = value;
+            best = d;
+        }
+    }
+
+    float before = correlation[(uint32_t)(best - 1 + (int32_t)fftSize) & (fftSize - 1)];
+    float after = correlation[(uint32_t)(best + 1 + (int32_t)fftSize) & (fftSize - 1)];
+    float curvature = before - 2.0f * bestValue + after;
+    double offset = 0.0;
+    if (curvature < 0.0f)
+    {
+        offset = 0.5 * (before - after) / curvature;
+        if (offset > 0.5)
+        {
+            offset = 0.5;
+        }
+        else if (offset < -0.5)
+        {
+            offset = -0.5;
+        }
+    }
+    *lag = best + offset;
+    *peak = bestValue - 0.25 * (before - after) * offset;
+    return 0;
+}
+
+/**
+ * @brief Delays of every window of an event, in one call.
+ *
+ * Window i takes windowFrames samples from starts1[i] of the first stream and from starts2[i]
+ * of the second one, which the caller chose to start at the same instant. Windows that fall
+ * outside a stream or are silent get a NaN lag and a zero peak.
+ *
+ * @param phat Pointer to the engine.
+ * @param samples1 Samples of the first microphone.
+ * @param frames1 Number of samples of the first microphone.
+ * @param samples2 Samples of the second microphone.
+ * @param frames2 Number of samples of the second microphone.
+ * @param starts1 First sample of each window in the first stream.
+ * @param starts2 First sample of each window in the second stream.
+ * @param windows Number of windows.
+ * @param lags Array of windows lags, in fractional samples.
+ * @param peaks Array of windows peak heights.
+ * @return Number of windows with a lag.
+ */
+size_t gccPhatEvent(GccPhat *phat, const float *samples1, size_t frames1, const float *samples2, size_t frames2,
+                    const int64_t *starts1, const int64_t *starts2, size_t windows, double *lags, double *peaks)
+{
+    size_t estimated = 0;
+
+    for (size_t i = 0; i < windows; i++)
+    {
+        lags[i] = NAN;
+        peaks[i] = 0.0;
+        if (starts1[i] < 0 || starts2[i] < 0 || (uint64_t)starts1[i] + phat->windowFrames > frames1 ||
+            (uint64_t)starts2[i] + phat->windowFrames > frames2)
+        {
+            continue;
+        }
+        if (gccPhatLag(phat, samples1 + starts1[i], samples2 + starts2[i], &lags[i], &peaks[i]) == 0)
+        {
+            estimated++;
+        }
+    }
+    return estimated;
+}
@@ -0,0 +1,47 @@
+/**
+ * ******************************
+ * ********** gcc_phat.h **********
+ * ******************************
+ *
+ * GCC-PHAT time difference of arrival between two microphones, on windows
+ * of their samples. The analyzer aligns the windows with the time models of
+ * the segments, so the engine only has to find the acoustic delay left
+ * between them: it searches the lags a sound can physically take between
+ * the microphones, ±d/c, and refines the peak with a parabola through its
+ * neighbours. Built as libgcc_phat.so and loaded by gcc_phat.py.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef GCC_PHAT_H
+#define GCC_PHAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fft.h"
+
+/**
+ * @brief Plan and work buffers of the engine, for one window size and lag range.
+ *
+ * The FFT is long enough for the lags searched not to wrap around: fftSize >= windowFrames + maxLag.
+ */
+typedef struct
+{
+    uint32_t windowFrames;
+    uint32_t maxLag;
+    uint32_t fftSize;
+    const FftPlan *plan;  // shared through the plan cache of fft.h
+    float *spectrum1;     // fftSize / 2 + 1 complex bins, then the cross-spectrum and the correlation
+    float *spectrum2;
+} GccPhat;
+
+GccPhat *gccPhatCreate(uint32_t windowFrames, uint32_t maxLag);
+void gccPhatDestroy(GccPhat *phat);
+
+int gccPhatLag(GccPhat *phat, const float *window1, const float *window2, double *lag, double *peak);
+size_t gccPhatEvent(GccPhat *phat, const float *samples1, size_t frames1, const float *samples2, size_t frames2,
+                    const int64_t *starts1, const int64_t *starts2, size_t windows, double *lags, double *peaks);
+
+#endif
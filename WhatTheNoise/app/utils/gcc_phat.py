@@ -0,0 +1,175 @@
+"""GCC-PHAT time differences of arrival between two microphones (see gcc_phat.h).
+
+The windows of both streams are aligned with the (t0, rate) time models of their segments, so
+only the acoustic delay is left between them, and each window is correlated within the lags a
+sound can physically take between the microphones: ±d/c, plus a few samples of slack for the
+error of the alignment. The correlation runs in libgcc_phat.so (make libgcc_phat.so), one call
+per event; without it the same algorithm runs on numpy, one window at a time.
+
+Usage: python gcc_phat.py event.wtn [--distance METERS] [--window FRAMES] [--hop FRAMES]
+Prints the TDOA of every window of an event container and the time it took.
+"""
+import argparse
+import ctypes
+import math
+import os
+import time
+
+import numpy as np
+
+SPEED_OF_SOUND = 343.0
+WINDOW_FRAMES = 1024
+LIBRARY_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'libgcc_phat.so')
+
+def _load_library(path=LIBRARY_PATH):
+    """The native engine, or None if it has not been built."""
+    try:
+        library = ctypes.CDLL(path)
+    except OSError:
+        return None
+    library.gccPhatCreate.restype = ctypes.c_void_p
+    library.gccPhatCreate.argtypes = [ctypes.c_uint32, ctypes.c_uint32]
+    library.gccPhatDestroy.restype = None
+    library.gccPhatDestroy.argtypes = [ctypes.c_void_p]
+    library.gccPhatEvent.restype = ctypes.c_size_t
+    library.gccPhatEvent.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_size_t,
+                                     ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_void_p]
+    return library
+
+_library = _load_library()
+_engines = {}
+
+class GccPhat:
+    """Engine for one window size and lag range, with its FFT plan made once."""
+
+    def __init__(self, window_frames, max_lag):
+        self.window_frames = int(window_frames)
+        self.max_lag = int(max_lag)
+        self.fft_size = 8
+        while self.fft_size < self.window_frames + self.max_lag or self.fft_size < 2 * self.max_lag + 2:
+            self.fft_size *= 2
+        self.handle = _library.gccPhatCreate(self.window_frames, self.max_lag) if _library else None
+        self.native = bool(self.handle)
+
+    def __del__(self):
+        if getattr(self, 'handle', None) and _library:
+            _library.gccPhatDestroy(self.handle)
+            self.handle = None
+
+    def lags(self, samples1, samples2, starts1, starts2):
+        """Delay in fractional samples of the second stream for every window, and the height of its peak.
+
+        Window i takes window_frames samples from starts1[i] and starts2[i]; windows out of range or
+        silent get a NaN lag.
+        """
+        samples1 = np.ascontiguousarray(samples1, dtype=np.float32)
+        samples2 = np.ascontiguousarray(samples2, dtype=np.float32)
+        starts1 = np.ascontiguousarray(starts1, dtype=np.int64)
+        starts2 = np.ascontiguousarray(starts2, dtype=np.int64)
+        lags = np.full(len(starts1), np.nan)
+        peaks = np.zeros(len(starts1))
+        if self.native:
+            _library.gccPhatEvent(self.handle, samples1.ctypes.data, len(samples1), samples2.ctypes.data, len(samples2),
+                                  starts1.ctypes.data, starts2.ctypes.data, len(starts1), lags.ctypes.data, peaks.ctypes.data)
+            return lags, peaks
+        for i, (start1, start2) in enumerate(zip(starts1, starts2)):
+            if start1 < 0 or start2 < 0 or start1 + self.window_frames > len(samples1) or start2 + self.window_frames > len(samples2):
+                continue
+            window1 = samples1[start1:start1 + self.window_frames]
+            window2 = samples2[start2:start2 + self.window_frames]
+            if not window1.any() or not window2.any():
+                continue
+            lags[i], peaks[i] = self._lag(window1, window2)
+        return lags, peaks
+
+    def _lag(self, window1, window2):
+        """numpy version of gccPhatLag."""
+        cross = np.fft.rfft(window2, self.fft_size) * np.conj(np.fft.rfft(window1, self.fft_size))
+        magnitude = np.abs(cross)
+        cross = np.where(magnitude > 1e-20, cross / np.maximum(magnitude, 1e-20), 0)
+        correlation = np.fft.irfft(cross, self.fft_size)
+        candidates = np.arange(-self.max_lag, self.max_lag + 1)
+        best = int(candidates[np.argmax(correlation[candidates % self.fft_size])])
+        before, value, after = correlation[np.array([best - 1, best, best + 1]) % self.fft_size]
+        curvature = before - 2 * value + after
+        offset = float(np.clip(0.5 * (before - after) / curvature, -0.5, 0.5)) if curvature < 0 else 0.0
+        return best + offset, value - 0.25 * (before - after) * offset
+
+def engine(window_frames, max_lag):
+    """Engine for a window size and lag range, kept for the next events."""
+    key = (int(window_frames), int(max_lag))
+    if key not in _engines:
+        _engines[key] = GccPhat(*key)
+    return _engines[key]
+
+def max_lag_frames(distance, sample_rate, slack_frames=1, speed_of_sound=SPEED_OF_SOUND):
+    """Largest delay in samples a sound can take between two microphones distance meters apart."""
+    return int(math.ceil(distance / speed_of_sound * sample_rate)) + int(slack_frames)
+
+def valid_windows(valid, starts, window_frames, frames_per_period):
+    """True for the windows that only cover periods marked as valid in a period mask."""
+    invalid_before = np.concatenate(([0], np.cumsum(~np.asarray(valid, dtype=bool))))
+    first = starts // frames_per_period
+    last = (starts + window_frames - 1) // frames_per_period
+    inside = last < len(valid)
+    last = np.minimum(last, len(valid) - 1)
+    return inside & (invalid_before[last + 1] - invalid_before[first] == 0)
+
+def event_tdoas(samples1, samples2, model1, model2, distance, window_frames=WINDOW_FRAMES, hop_frames=None,
+                valid=None, frames_per_period=128, slack_frames=1, speed_of_sound=SPEED_OF_SOUND):
+    """TDOAs (arrival at mic 1 - arrival at mic 2, in seconds) of the windows of an event, and their peaks.
+
+    model1 and model2 are the ((seconds, fraction), rate) time models of both segments: the window
+    of the second stream starts at the sample nearest to the instant the window of the first one
+    starts, and the fraction of a sample left over is added back to the lag. valid masks out the
+    periods with no real audio. TDOAs are limited to ±distance / speed_of_sound.
+    """
+    (seconds1, fraction1), rate1 = model1
+    (seconds2, fraction2), rate2 = model2
+    reference = min(seconds1, seconds2)
+    start1 = (seconds1 - reference) + fraction1
+    start2 = (seconds2 - reference) + fraction2
+    hop_frames = hop_frames or window_frames
+
+    starts1 = np.arange(0, len(samples1) - window_frames + 1, hop_frames, dtype=np.int64)
+    exact2 = (start1 + starts1 / rate1 - start2) * rate2
+    starts2 = np.round(exact2).astype(np.int64)
+    keep = (starts2 >= 0) & (starts2 + window_frames <= len(samples2))
+    if valid is not None and len(valid):
+        keep &= valid_windows(valid, starts1, window_frames, frames_per_period)
+        keep &= valid_windows(valid, np.maximum(starts2, 0), window_frames, frames_per_period)
+    if not keep.any():
+        return np.zeros(0), np.zeros(0)
+    starts1, starts2, exact2 = starts1[keep], starts2[keep], exact2[keep]
+
+    rate = (rate1 + rate2) / 2
+    phat = engine(window_frames, max_lag_frames(distance, rate, slack_frames, speed_of_sound))
+    lags, peaks = phat.lags(samples1, samples2, starts1, starts2)
+    found = np.isfinite(lags)
+    # Window 2 starts (starts2 - exact2) samples after window 1: that is part of the delay too
+    delays = (lags[found] + starts2[found] - exact2[found]) / rate
+    max_tdoa = distance / speed_of_sound
+    return np.clip(-delays, -max_tdoa, max_tdoa), peaks[found]
+
+if __name__ == '__main__':
+    from event_container import EventContainer
+    from analyzer import MIC_DISTANCE, time_model_from_info
+
+    parser = argparse.ArgumentParser(description='GCC-PHAT TDOAs of an event container')
+    parser.add_argument('container', help='event container written by record_ALSA --container')
+    parser.add_argument('--distance', type=float, default=MIC_DISTANCE, help='meters between the microphones')
+    parser.add_argument('--window', type=int, default=WINDOW_FRAMES, help='frames of each window')
+    parser.add_argument('--hop', type=int, default=None, help='frames between windows, the window by default')
+    args = parser.parse_args()
+
+    container = EventContainer(args.container)
+    models = [time_model_from_info(container.metadata(channel)) for channel in (0, 1)]
+    models = [model or ((0, 0.0), float(container.sample_rate)) for model in models]
+    samples1, samples2 = container.samples(0), container.samples(1)
+    begin = time.perf_counter()
+    tdoas, peaks = event_tdoas(samples1, samples2, models[0], models[1], args.distance, args.window, args.hop,
+                               frames_per_period=container.frames_per_period)
+    elapsed = time.perf_counter() - begin
+    for tdoa, peak in zip(tdoas, peaks):
+        print(f'{tdoa * 1e6:9.1f} us  peak {peak:.3f}')
+    print(f'{len(tdoas)} windows in {elapsed * 1e3:.2f} ms ({"native" if _library else "numpy"})')
@@ -3,10 +3,11 @@
  * ********* list_devices_info.c *********
  * **********************************
  *
- * Lists all available device's ID, name and supported sample rates.
+ * Lists all available device's ID, name, supported sample rates and input channels.
  * It is required to display data of the available devices in
- * the configuration form. It is limited to displaying single-channel recording devices,
- * as this is supported by USB microphones
+ * the configuration form. Multichannel interfaces are listed too, since the ALSA
+ * recorder can record each of their inputs as a microphone; their rates are probed
+ * with every channel open
  *
  * ~ Author: rubennmg
  *
@@ -51,14 +52,14 @@ int main(void)
     for (i = 0; i < numDevices; i++)
     {
         deviceInfo = Pa_GetDeviceInfo(i);
-        if (deviceInfo->maxInputChannels == 1)
+        if (deviceInfo->maxInputChannels >= 1)
         {
             printf("ID: %d, Name: %s", i, deviceInfo->name);
             // Common sample rates
             double sampleRates[] = {8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000, 176400, 192000, 384000};
             PaStreamParameters inputParameters;
             inputParameters.device = i;
-            inputParameters.channelCount = 1;
+            inputParameters.channelCount = deviceInfo->maxInputChannels;
             inputParameters.sampleFormat = paInt16;
             inputParameters.suggestedLatency = deviceInfo->defaultLowInputLatency;
             inputParameters.hostApiSpecificStreamInfo = NULL;
@@ -73,7 +74,7 @@ int main(void)
                     printf(" %.0f", sampleRates[j]);
                 }
             }
-            printf("\n");
+            printf(", Channels: %d\n", deviceInfo->maxInputChannels);
         }
     }
 
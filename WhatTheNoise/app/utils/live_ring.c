@@ -0,0 +1,257 @@
+/**
+ * ******************************
+ * ********** live_ring.c **********
+ * ******************************
+ *
+ * Implementation of the shared-memory live ring declared in live_ring.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "live_ring.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Returns the slot of a period.
+ *
+ * @param ring Pointer to the ring.
+ * @param period Number of the period.
+ * @return Pointer to the slot header; the samples follow it.
+ */
+static LiveSlotHeader *liveSlot(LiveRing *ring, uint64_t period)
+{
+    return (LiveSlotHeader *)(ring->slots + (period & (ring->header->slotCount - 1)) * ring->header->slotBytes);
+}
+
+/**
+ * @brief Creates the shared memory of a ring and maps it for writing.
+ *
+ * A ring left behind at the same name by a recorder that did not exit cleanly is replaced.
+ * The mapping is populated up front, so publishing never page faults on the capture path.
+ *
+ * @param ring Pointer to the ring.
+ * @param name Name of the shared memory object, starting with '/'.
+ * @param sampleRate Sample rate of the stream.
+ * @param framesPerPeriod Frames of each period.
+ * @param sampleFormat SampleFormat of the samples.
+ * @param sampleBytes Size in bytes of a sample.
+ * @param clock TimestampClock of the timestamps.
+ * @param device Name of the capture device.
+ * @return 0 on success, -1 on failure.
+ */
+int liveRingCreate(LiveRing *ring, const char *name, uint32_t sampleRate, uint32_t framesPerPeriod, uint32_t sampleFormat,
+                   uint32_t sampleBytes, uint32_t clock, const char *device)
+{
+    uint32_t periods = (uint32_t)((uint64_t)LIVE_RING_SECONDS * sampleRate / framesPerPeriod);
+    uint32_t slotCount = 2;
+    size_t slotBytes = (sizeof(LiveSlotHeader) + (size_t)framesPerPeriod * sampleBytes + 63) & ~(size_t)63;
+    int fd;
+
+    memset(ring, 0, sizeof(*ring));
+    if (name[0] != '/' || strlen(name) >= sizeof(ring->name) || strchr(name + 1, '/') != NULL)
+    {
+        fprintf(stderr, "Invalid live ring name %s: it must be /name.\n", name);
+        return -1;
+    }
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    while (slotCount < periods)
+    {
+        slotCount *= 2;
+    }
+    ring->mapBytes = sizeof(LiveRingHeader) + slotCount * slotBytes;
+
+    fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)ring->mapBytes) != 0)
+    {
+        perror(name);
+        if (fd >= 0)
+        {
+            close(fd);
+            shm_unlink(name);
+        }
+        return -1;
+    }
+    ring->header = mmap(NULL, ring->mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (ring->header == MAP_FAILED)
+    {
+        perror(name);
+        ring->header = NULL;
+        shm_unlink(name);
+        return -1;
+    }
+    ring->owner = 1;
+    ring->slots = (unsigned char *)ring->header + sizeof(LiveRingHeader);
+
+    ring->header->headerBytes = sizeof(LiveRingHeader);
+    ring->header->slotBytes = (uint32_t)slotBytes;
+    ring->header->slotCount = slotCount;
+    ring->header->sampleRate = sampleRate;
+    ring->header->framesPerPeriod = framesPerPeriod;
+    ring->header->sampleFormat = sampleFormat;
+    ring->header->sampleBytes = sampleBytes;
+    ring->header->clock = clock;
+    strncpy(ring->header->device, device != NULL ? device : "", sizeof(ring->header->device) - 1);
+    atomic_init(&ring->header->head, 0);
+    // The magic goes last: a reader attaching before it is there finds no ring yet
+    atomic_thread_fence(memory_order_release);
+    memcpy(ring->header->magic, LIVE_RING_MAGIC, sizeof(LIVE_RING_MAGIC));
+
+    return 0;
+}
+
+/**
+ * @brief Publishes a period. Called by the capture thread only.
+ *
+ * Wait-free and without system calls: a copy of the period and three stores.
+ *
+ * @param ring Pointer to the ring.
+ * @param samples Samples of the period.
+ * @param frames Frames of the period, at most the frames per period of the ring.
+ * @param frameIndex Position of the first frame in the device stream.
+ * @param time Timestamp of the period.
+ * @param flags LIVE_PERIOD_* flags.
+ * @param peak Peak level of the period.
+ */
+void liveRingPublish(LiveRing *ring, const void *samples, uint32_t frames, uint64_t frameIndex, struct timespec time, uint32_t flags, int32_t peak)
+{
+    uint64_t period = ring->next++;
+    LiveSlotHeader *slot = liveSlot(ring, period);
+
+    // Odd while writing: a reader of this slot, or of the period it held, sees it changing
+    atomic_store_explicit(&slot->sequence, 2 * period + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->frameIndex = frameIndex;
+    slot->timeNs = (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+    slot->frames = frames;
+    slot->flags = flags;
+    slot->peak = peak;
+    memcpy(slot + 1, samples, (size_t)frames * ring->header->sampleBytes);
+
+    atomic_store_explicit(&slot->sequence, 2 * period + 2, memory_order_release);
+    atomic_store_explicit(&ring->header->head, period + 1, memory_order_release);
+}
+
+/**
+ * @brief Unmaps the ring. The writer also removes the shared memory, so readers see no new periods.
+ *
+ * @param ring Pointer to the ring.
+ */
+void liveRingDestroy(LiveRing *ring)
+{
+    if (ring->header == NULL)
+    {
+        return;
+    }
+    munmap(ring->header, ring->mapBytes);
+    ring->header = NULL;
+    if (ring->owner)
+    {
+        shm_unlink(ring->name);
+    }
+}
+
+/**
+ * @brief Maps an existing ring read-only, positioned at the newest period.
+ *
+ * @param ring Pointer to the ring.
+ * @param name Name of the shared memory object.
+ * @return 0 on success, -1 if there is no valid ring with that name.
+ */
+int liveRingAttach(LiveRing *ring, const char *name)
+{
+    struct stat info;
+    int fd;
+
+    memset(ring, 0, sizeof(*ring));
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(LiveRingHeader))
+    {
+        close(fd);
+        return -1;
+    }
+    ring->mapBytes = (size_t)info.st_size;
+    ring->header = mmap(NULL, ring->mapBytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring->header == MAP_FAILED)
+    {
+        ring->header = NULL;
+        return -1;
+    }
+
+    if (memcmp(ring->header->magic, LIVE_RING_MAGIC, sizeof(LIVE_RING_MAGIC)) != 0 ||
+        ring->header->headerBytes + (size_t)ring->header->slotCount * ring->header->slotBytes > ring->mapBytes)
+    {
+        liveRingDestroy(ring);
+        return -1;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    ring->slots = (unsigned char *)ring->header + ring->header->headerBytes;
+    ring->next = atomic_load_explicit(&ring->header->head, memory_order_acquire);
+    return 0;
+}
+
+/**
+ * @brief Copies the next period of the stream, if it has been published.
+ *
+ * A reader that fell more than a ring behind skips to the oldest period still in the ring and a
+ * period overwritten while it was being copied is skipped too; both count in ring->lost.
+ *
+ * @param ring Pointer to a ring attached with liveRingAttach.
+ * @param slot Pointer to where the header of the period will be copied.
+ * @param samples Buffer with room for the frames per period of the ring.
+ * @return 1 if a period was copied, 0 if there is no new period yet.
+ */
+int liveRingRead(LiveRing *ring, LiveSlotHeader *slot, void *samples)
+{
+    uint64_t slotCount = ring->header->slotCount;
+
+    for (;;)
+    {
+        uint64_t head = atomic_load_explicit(&ring->header->head, memory_order_acquire);
+        if (ring->next >= head)
+        {
+            return 0;
+        }
+        if (head - ring->next > slotCount)
+        {
+            ring->lost += head - slotCount - ring->next;
+            ring->next = head - slotCount;
+        }
+
+        LiveSlotHeader *source = liveSlot(ring, ring->next);
+        uint64_t before = atomic_load_explicit(&source->sequence, memory_order_acquire);
+        if (before == 2 * ring->next + 2)
+        {
+            slot->frameIndex = source->frameIndex;
+            slot->timeNs = source->timeNs;
+            slot->frames = source->frames <= ring->header->framesPerPeriod ? source->frames : ring->header->framesPerPeriod;
+            slot->flags = source->flags;
+            slot->peak = source->peak;
+            memcpy(samples, source + 1, (size_t)slot->frames * ring->header->sampleBytes);
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&source->sequence, memory_order_relaxed) == before)
+            {
+                atomic_init(&slot->sequence, before);
+                ring->next++;
+                return 1;
+            }
+        }
+        // Overwritten by a newer period before or while it was copied
+        ring->lost++;
+        ring->next++;
+    }
+}
@@ -0,0 +1,105 @@
+/**
+ * ******************************
+ * ********** live_ring.h **********
+ * ******************************
+ *
+ * Live stream of a microphone in POSIX shared memory: the capture thread
+ * publishes every period it reads, with its frame index and timestamp, to a
+ * ring of slots in /dev/shm that any number of processes map read-only
+ * (live_ring.py for the analyzer, a level meter, a black-box recorder).
+ *
+ * Each slot carries a sequence number: 2n+1 while period n is being
+ * written, 2n+2 once it is complete. A reader checks it before and after
+ * reading a slot, and a reader that fell more than a ring behind sees the
+ * sequence of a newer period and knows what it lost. The writer never looks
+ * at the readers, so no reader can slow down or stall the capture thread.
+ * All fields are little-endian.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef LIVE_RING_H
+#define LIVE_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "timestamp_file.h"
+
+#define LIVE_RING_MAGIC "WTNLIV1"
+#define LIVE_RING_SECONDS 2 // audio kept in the ring, rounded up to a power of two of periods
+#define LIVE_RING_NAME_BYTES 64
+
+/**
+ * @brief Flags of a live period.
+ */
+#define LIVE_PERIOD_OVER 0x1u      // a sample of the period is over the threshold
+#define LIVE_PERIOD_RECORDING 0x2u // the period belongs to a segment being recorded to disk
+
+/**
+ * @brief Header at the start of the shared memory.
+ *
+ * head, on a cache line of its own, is the number of periods published so far: period n
+ * lives in slot n % slotCount, slotBytes apart starting at headerBytes.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t headerBytes;
+    uint32_t slotBytes;
+    uint32_t slotCount;
+    uint32_t sampleRate;
+    uint32_t framesPerPeriod;
+    uint32_t sampleFormat; // SampleFormat: 0 S16, 1 S32, 2 FLOAT
+    uint32_t sampleBytes;
+    uint32_t clock;        // TimestampClock of timeNs
+    char device[TIMESTAMP_DEVICE_BYTES];
+    _Alignas(64) _Atomic uint64_t head;
+} LiveRingHeader;
+
+/**
+ * @brief Header of a slot. The samples of the period follow it.
+ *
+ * frameIndex is the position of the first frame in the device stream, so a jump tells a reader
+ * how many frames an XRUN cost; timeNs is the time of the period on the clock of the header.
+ */
+typedef struct
+{
+    _Atomic uint64_t sequence;
+    uint64_t frameIndex;
+    int64_t timeNs;
+    uint32_t frames;
+    uint32_t flags;
+    int32_t peak;
+    uint32_t reserved[7];
+} LiveSlotHeader;
+
+_Static_assert(sizeof(LiveRingHeader) == 192, "live ring header must be 192 bytes");
+_Static_assert(sizeof(LiveSlotHeader) == 64, "live slot header must be 64 bytes");
+
+/**
+ * @brief Mapping of a live ring, on the side of the writer or of a reader.
+ */
+typedef struct
+{
+    LiveRingHeader *header;
+    unsigned char *slots;
+    size_t mapBytes;
+    uint64_t next; // writer: next period to publish, reader: next period to read
+    uint64_t lost; // reader: periods overwritten before it could read them
+    int owner;     // created by this process: the writer removes it on destroy
+    char name[LIVE_RING_NAME_BYTES];
+} LiveRing;
+
+int liveRingCreate(LiveRing *ring, const char *name, uint32_t sampleRate, uint32_t framesPerPeriod, uint32_t sampleFormat,
+                   uint32_t sampleBytes, uint32_t clock, const char *device);
+void liveRingPublish(LiveRing *ring, const void *samples, uint32_t frames, uint64_t frameIndex, struct timespec time, uint32_t flags, int32_t peak);
+void liveRingDestroy(LiveRing *ring);
+
+int liveRingAttach(LiveRing *ring, const char *name);
+int liveRingRead(LiveRing *ring, LiveSlotHeader *slot, void *samples);
+
+#endif
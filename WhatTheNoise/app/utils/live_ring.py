@@ -0,0 +1,135 @@
+"""Reader of the live rings published by record_ALSA and record_PortAudio --live (see live_ring.h).
+
+Each microphone has its own ring in POSIX shared memory (/dev/shm), mapped read-only: the
+recorder never waits for a reader, so a reader that falls behind loses the periods overwritten
+in the meantime, and counts them, instead of slowing down the capture.
+
+Usage: python live_ring.py /name_Mic1 [/name_Mic2 ...] [--interval SECONDS]
+Prints a level meter of each ring: peak in dBFS, periods over the threshold, recording state
+and periods lost by the reader.
+"""
+import argparse
+import math
+import mmap
+import os
+import time
+
+import numpy as np
+
+from event_container import SAMPLE_FORMATS
+
+MAGIC = b'WTNLIV1\x00'
+
+PERIOD_OVER = 0x1
+PERIOD_RECORDING = 0x2
+
+HEADER_DTYPE = np.dtype([('magic', 'S8'), ('header_bytes', '<u4'), ('slot_bytes', '<u4'), ('slot_count', '<u4'),
+                         ('sample_rate', '<u4'), ('frames_per_period', '<u4'), ('sample_format', '<u4'),
+                         ('sample_bytes', '<u4'), ('clock', '<u4'), ('device', 'S32'), ('padding', 'V56'),
+                         ('head', '<u8')])
+SLOT_DTYPE = np.dtype([('sequence', '<u8'), ('frame_index', '<u8'), ('time_ns', '<i8'), ('frames', '<u4'),
+                       ('flags', '<u4'), ('peak', '<i4'), ('reserved', 'V28')])
+# Peaks are on the 16-bit scale whatever the sample format (see detect.h)
+FULL_SCALE = 32767
+
+class LiveRing:
+    """Read-only mapping of the live ring of one microphone, positioned at the newest period."""
+
+    def __init__(self, name):
+        path = os.path.join('/dev/shm', name.lstrip('/'))
+        with open(path, 'rb') as f:
+            self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        header = np.frombuffer(self.map, dtype=HEADER_DTYPE, count=1)[0]
+        if header['magic'] != MAGIC.rstrip(b'\x00'):
+            raise ValueError(f'{name}: not a live ring')
+        self.name = name
+        self.slot_bytes = int(header['slot_bytes'])
+        self.slot_count = int(header['slot_count'])
+        self.sample_rate = int(header['sample_rate'])
+        self.frames_per_period = int(header['frames_per_period'])
+        self.dtype = SAMPLE_FORMATS[int(header['sample_format'])][0]
+        self.clock = int(header['clock'])
+        self.device = header['device'].decode(errors='replace')
+        self.header_bytes = int(header['header_bytes'])
+        # Live views on the shared memory: reading an element reads the value the recorder left there now
+        self.head_view = np.frombuffer(self.map, dtype='<u8', count=1, offset=HEADER_DTYPE.fields['head'][1])
+        self.slots = np.ndarray((self.slot_count,), dtype=SLOT_DTYPE, buffer=self.map, offset=self.header_bytes,
+                                strides=(self.slot_bytes,))
+        self.next = self.head()
+        self.lost = 0
+
+    def head(self):
+        """Number of periods published so far."""
+        return int(self.head_view[0])
+
+    def samples_view(self, period):
+        """Samples of the slot of a period, without copying them; valid while still_valid(period) holds."""
+        offset = self.header_bytes + (period % self.slot_count) * self.slot_bytes + SLOT_DTYPE.itemsize
+        return np.frombuffer(self.map, dtype=self.dtype, count=self.frames_per_period, offset=offset)
+
+    def still_valid(self, period):
+        """True while the slot of a period has not started to be overwritten."""
+        return int(self.slots['sequence'][period % self.slot_count]) == 2 * period + 2
+
+    def read(self, copy_samples=True):
+        """Next period as (slot record, samples), or None if there is no new one yet.
+
+        The slot record is always a copy. With copy_samples=False the samples are a view on the
+        ring, which the caller must check with still_valid() after using them.
+        """
+        while True:
+            head = self.head()
+            if self.next >= head:
+                return None
+            if head - self.next > self.slot_count:
+                self.lost += head - self.slot_count - self.next
+                self.next = head - self.slot_count
+
+            period = self.next
+            self.next += 1
+            if not self.still_valid(period):
+                self.lost += 1
+                continue
+            slot = self.slots[period % self.slot_count].copy()
+            samples = self.samples_view(period)[:int(slot['frames'])]
+            if copy_samples:
+                samples = samples.copy()
+            if self.still_valid(period):
+                return slot, samples
+            self.lost += 1
+
+    def close(self):
+        self.slots = self.head_view = None
+        self.map.close()
+
+def level_meter(names, interval):
+    """Prints a line per ring every interval seconds, from the levels the recorder already computed."""
+    rings = [LiveRing(name) for name in names]
+    for ring in rings:
+        print(f'{ring.name}: {ring.device}, {ring.sample_rate} Hz, {ring.frames_per_period} frames/period, '
+              f'{ring.slot_count} periods ({ring.slot_count * ring.frames_per_period / ring.sample_rate:.1f} s)')
+    try:
+        while True:
+            time.sleep(interval)
+            for ring in rings:
+                peak, over, recording, periods = 0, 0, False, 0
+                while (period := ring.read(copy_samples=False)) is not None:
+                    slot = period[0]
+                    peak = max(peak, int(slot['peak']))
+                    over += bool(slot['flags'] & PERIOD_OVER)
+                    recording = bool(slot['flags'] & PERIOD_RECORDING)
+                    periods += 1
+                level = 20 * math.log10(peak / FULL_SCALE) if peak > 0 else -math.inf
+                print(f'{ring.name}: {level:7.1f} dBFS  over {over:4d}/{periods:<4d} {"REC" if recording else "   "}  lost {ring.lost}')
+    except KeyboardInterrupt:
+        pass
+    finally:
+        for ring in rings:
+            ring.close()
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Level meter of the live rings of the recorders')
+    parser.add_argument('names', nargs='+', help='shared memory name of each ring, e.g. /whatthenoise_Mic1')
+    parser.add_argument('--interval', type=float, default=0.2, help='seconds between lines')
+    args = parser.parse_args()
+    level_meter(args.names, args.interval)
@@ -0,0 +1,394 @@
+/**
+ * ******************************
+ * ******** period_ring.c **********
+ * ******************************
+ *
+ * Implementation of the single-producer/single-consumer period ring
+ * declared in period_ring.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "period_ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+/**
+ * @brief Rounds a value up to the next power of two.
+ *
+ * @param value Value to round.
+ * @return Smallest power of two greater or equal than value.
+ */
+static size_t roundUpPowerOfTwo(size_t value)
+{
+    size_t result = 1;
+    while (result < value)
+    {
+        result <<= 1;
+    }
+    return result;
+}
+
+/**
+ * @brief Initializes the ring, allocating and prefaulting every slot up front.
+ *
+ * @param ring Pointer to the ring.
+ * @param capacity Number of period slots (rounded up to a power of two).
+ * @param periodBytes Size in bytes of the samples of one period.
+ * @param useWakeup If non-zero, an eventfd is used to wake up an idle consumer. If zero the
+ *                  producer never makes a system call and the consumer polls with a short sleep.
+ * @return 0 on success, -1 on failure.
+ */
+int periodRingInit(PeriodRing *ring, size_t capacity, size_t periodBytes, int useWakeup)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->capacity = roundUpPowerOfTwo(capacity);
+    ring->mask = ring->capacity - 1;
+    ring->periodBytes = periodBytes;
+    ring->slotStride = (PERIOD_SLOT_HEADER_BYTES + periodBytes + PERIOD_RING_CACHE_LINE - 1) & ~(size_t)(PERIOD_RING_CACHE_LINE - 1);
+    ring->eventFd = -1;
+
+    ring->slots = aligned_alloc(PERIOD_RING_CACHE_LINE, ring->capacity * ring->slotStride);
+    if (ring->slots == NULL)
+    {
+        perror("Failed to allocate memory for period ring");
+        return -1;
+    }
+    memset(ring->slots, 0, ring->capacity * ring->slotStride);
+
+    if (useWakeup)
+    {
+        ring->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (ring->eventFd < 0)
+        {
+            perror("Failed to create eventfd for period ring");
+            free(ring->slots);
+            ring->slots = NULL;
+            return -1;
+        }
+    }
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->consumerWaiting, 0);
+    atomic_init(&ring->stop, 0);
+    atomic_init(&ring->overflows, 0);
+
+    return 0;
+}
+
+/**
+ * @brief Frees the memory and the eventfd owned by the ring.
+ *
+ * @param ring Pointer to the ring.
+ */
+void periodRingDestroy(PeriodRing *ring)
+{
+    if (ring->eventFd >= 0)
+    {
+        close(ring->eventFd);
+        ring->eventFd = -1;
+    }
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+/**
+ * @brief Returns the next free slot for the producer to fill.
+ *
+ * The slot is not visible to the consumer until periodRingCommit() is called.
+ *
+ * @param ring Pointer to the ring.
+ * @return Pointer to the free slot, or NULL if the ring is full (the overflow is counted).
+ */
+PeriodSlot *periodRingAcquire(PeriodRing *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (head - ring->cachedTail >= ring->capacity)
+    {
+        ring->cachedTail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - ring->cachedTail >= ring->capacity)
+        {
+            atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+            return NULL;
+        }
+    }
+
+    return (PeriodSlot *)(ring->slots + (head & ring->mask) * ring->slotStride);
+}
+
+/**
+ * @brief Publishes the slot returned by the last periodRingAcquire().
+ *
+ * The eventfd is only written when the consumer announced that it is going to sleep.
+ *
+ * @param ring Pointer to the ring.
+ */
+void periodRingCommit(PeriodRing *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    if (ring->eventFd < 0)
+    {
+        return;
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->consumerWaiting, memory_order_relaxed) &&
+        atomic_exchange_explicit(&ring->consumerWaiting, 0, memory_order_relaxed))
+    {
+        uint64_t one = 1;
+        ssize_t written = write(ring->eventFd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+/**
+ * @brief Returns the oldest published slot without removing it.
+ *
+ * @param ring Pointer to the ring.
+ * @return Pointer to the slot, or NULL if the ring is empty.
+ */
+PeriodSlot *periodRingPeek(PeriodRing *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (tail == ring->cachedHead)
+    {
+        ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == ring->cachedHead)
+        {
+            return NULL;
+        }
+    }
+
+    return (PeriodSlot *)(ring->slots + (tail & ring->mask) * ring->slotStride);
+}
+
+/**
+ * @brief Returns a published slot after the oldest one without releasing any.
+ *
+ * Lets the consumer work on several periods in place and release them together.
+ *
+ * @param ring Pointer to the ring.
+ * @param index Position of the slot counting from the oldest unreleased one.
+ * @return Pointer to the slot, or NULL if fewer than index + 1 slots are published.
+ */
+PeriodSlot *periodRingPeekAt(PeriodRing *ring, size_t index)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (ring->cachedHead - tail <= index)
+    {
+        ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (ring->cachedHead - tail <= index)
+        {
+            return NULL;
+        }
+    }
+
+    return (PeriodSlot *)(ring->slots + ((tail + index) & ring->mask) * ring->slotStride);
+}
+
+/**
+ * @brief Gives the slot returned by the last periodRingPeek() back to the producer.
+ *
+ * @param ring Pointer to the ring.
+ */
+void periodRingRelease(PeriodRing *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * @brief Gives the oldest count slots back to the producer at once.
+ *
+ * @param ring Pointer to the ring.
+ * @param count Number of slots to release.
+ */
+void periodRingReleaseMany(PeriodRing *ring, size_t count)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
+
+/**
+ * @brief Returns the number of published slots not yet released.
+ *
+ * @param ring Pointer to the ring.
+ * @return Number of slots pending for the consumer.
+ */
+size_t periodRingCount(PeriodRing *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return head - tail;
+}
+
+/**
+ * @brief Blocks the consumer until there is data, the ring is stopped or the timeout expires.
+ *
+ * @param ring Pointer to the ring.
+ * @param timeoutMs Maximum time to wait in milliseconds, -1 to wait forever.
+ * @return 1 if there are slots available, 0 on timeout, -1 if the ring is stopped and empty.
+ */
+int periodRingWait(PeriodRing *ring, int timeoutMs)
+{
+    if (periodRingCount(ring) > 0)
+    {
+        return 1;
+    }
+    if (atomic_load(&ring->stop))
+    {
+        return periodRingCount(ring) > 0 ? 1 : -1;
+    }
+
+    if (ring->eventFd < 0)
+    {
+        // Producer never signals: poll with a short sleep so it stays free of system calls
+        poll(NULL, 0, (timeoutMs < 0 || timeoutMs > 2) ? 2 : timeoutMs);
+        return periodRingCount(ring) > 0 ? 1 : 0;
+    }
+
+    atomic_store(&ring->consumerWaiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (periodRingCount(ring) == 0 && !atomic_load(&ring->stop))
+    {
+        struct pollfd pfd = {.fd = ring->eventFd, .events = POLLIN};
+        if (poll(&pfd, 1, timeoutMs) > 0)
+        {
+            uint64_t value;
+            ssize_t readBytes = read(ring->eventFd, &value, sizeof(value));
+            (void)readBytes;
+        }
+    }
+
+    atomic_store(&ring->consumerWaiting, 0);
+
+    if (periodRingCount(ring) > 0)
+    {
+        return 1;
+    }
+    return atomic_load(&ring->stop) ? -1 : 0;
+}
+
+/**
+ * @brief Blocks a consumer draining several rings until one of them has data.
+ *
+ * Rings that are stopped and empty are left out of the wait; once every ring is, there is
+ * nothing left to drain.
+ *
+ * @param rings Rings of the consumer, at most PERIOD_RING_MAX_WAIT.
+ * @param count Number of rings.
+ * @param timeoutMs Maximum time to wait in milliseconds, -1 to wait forever.
+ * @return 1 if some ring has slots available, 0 on timeout, -1 if every ring is stopped and empty.
+ */
+int periodRingWaitAny(PeriodRing **rings, int count, int timeoutMs)
+{
+    struct pollfd pfds[PERIOD_RING_MAX_WAIT];
+    int waiting[PERIOD_RING_MAX_WAIT];
+    nfds_t nfds = 0;
+    int polled = 1;
+
+    if (count > PERIOD_RING_MAX_WAIT)
+    {
+        count = PERIOD_RING_MAX_WAIT;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        // stop is read before the count: a ring seen stopped and then empty has nothing left
+        int stopped = atomic_load(&rings[i]->stop);
+        if (periodRingCount(rings[i]) > 0)
+        {
+            return 1;
+        }
+        if (!stopped)
+        {
+            waiting[nfds] = i;
+            pfds[nfds].fd = rings[i]->eventFd;
+            pfds[nfds].events = POLLIN;
+            polled = polled && rings[i]->eventFd >= 0;
+            nfds++;
+        }
+    }
+    if (nfds == 0)
+    {
+        return -1;
+    }
+
+    if (!polled)
+    {
+        // Some producer never signals: poll with a short sleep as periodRingWait() does
+        poll(NULL, 0, (timeoutMs < 0 || timeoutMs > 2) ? 2 : timeoutMs);
+    }
+    else
+    {
+        int ready = 0;
+        for (nfds_t i = 0; i < nfds; i++)
+        {
+            atomic_store(&rings[waiting[i]]->consumerWaiting, 1);
+        }
+        atomic_thread_fence(memory_order_seq_cst);
+        for (nfds_t i = 0; i < nfds; i++)
+        {
+            ready = ready || periodRingCount(rings[waiting[i]]) > 0 || atomic_load(&rings[waiting[i]]->stop);
+        }
+
+        if (!ready && poll(pfds, nfds, timeoutMs) > 0)
+        {
+            for (nfds_t i = 0; i < nfds; i++)
+            {
+                uint64_t value;
+                if (pfds[i].revents & POLLIN)
+                {
+                    ssize_t readBytes = read(pfds[i].fd, &value, sizeof(value));
+                    (void)readBytes;
+                }
+            }
+        }
+        for (nfds_t i = 0; i < nfds; i++)
+        {
+            atomic_store(&rings[waiting[i]]->consumerWaiting, 0);
+        }
+    }
+
+    int running = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int stopped = atomic_load(&rings[i]->stop);
+        if (periodRingCount(rings[i]) > 0)
+        {
+            return 1;
+        }
+        running += !stopped;
+    }
+    return running > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Tells the consumer that no more slots will be produced.
+ *
+ * Slots already published can still be drained after this call.
+ *
+ * @param ring Pointer to the ring.
+ */
+void periodRingStop(PeriodRing *ring)
+{
+    atomic_store(&ring->stop, 1);
+    if (ring->eventFd >= 0)
+    {
+        uint64_t one = 1;
+        ssize_t written = write(ring->eventFd, &one, sizeof(one));
+        (void)written;
+    }
+}
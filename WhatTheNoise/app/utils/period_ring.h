@@ -0,0 +1,118 @@
+/**
+ * ******************************
+ * ******** period_ring.h **********
+ * ******************************
+ *
+ * Preallocated single-producer/single-consumer ring of audio periods.
+ * Used between a capture thread (producer) and its file writer thread
+ * (consumer). Push and pop are wait-free: the producer never allocates,
+ * never locks and only touches the kernel when the consumer is asleep.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef PERIOD_RING_H
+#define PERIOD_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "time_model.h"
+#include "detect.h"
+
+#define PERIOD_RING_CACHE_LINE 64
+#define PERIOD_RING_MAX_WAIT 16 // rings a single consumer can wait on with periodRingWaitAny()
+
+/**
+ * @brief Flags attached to a period slot.
+ *
+ * Segment boundaries travel through the ring together with the samples, so the
+ * writer sees them in the same order the capture thread produced them.
+ */
+#define PERIOD_SEGMENT_START 0x1u
+#define PERIOD_SEGMENT_END 0x2u
+#define PERIOD_AFTER_XRUN 0x4u // first period after frames were lost to an XRUN
+
+/**
+ * @brief Bytes reserved for the slot header, keeping the samples 16-byte aligned.
+ */
+#define PERIOD_SLOT_HEADER_BYTES ((sizeof(PeriodSlot) + 15) & ~(size_t)15)
+
+/**
+ * @brief Header of a period slot. The samples follow it in memory.
+ *
+ * frameIndex is the position of the first frame of the period in the device stream,
+ * model the capture time model of the device when the period was published, levels
+ * the output of the level detector for the period and eventId / eventStart the event the
+ * period was recorded for (nanoseconds on the timestamp clock).
+ */
+typedef struct
+{
+    struct timespec timestamp;
+    uint32_t flags;
+    uint32_t frames;
+    uint64_t frameIndex;
+    TimeModel model;
+    PeriodLevels levels;
+    uint32_t eventId;
+    int64_t eventStart;
+} PeriodSlot;
+
+/**
+ * @brief Single-producer/single-consumer ring of fixed-size period slots.
+ *
+ * head is only written by the producer and tail only by the consumer. Each index lives
+ * on its own cache line next to the private copy of the other side's index, so in the
+ * common case push and pop do not touch a cache line owned by the other thread.
+ */
+typedef struct
+{
+    _Alignas(PERIOD_RING_CACHE_LINE) atomic_size_t head;
+    size_t cachedTail;
+
+    _Alignas(PERIOD_RING_CACHE_LINE) atomic_size_t tail;
+    size_t cachedHead;
+
+    _Alignas(PERIOD_RING_CACHE_LINE) atomic_int consumerWaiting;
+    atomic_int stop;
+    atomic_ulong overflows;
+
+    _Alignas(PERIOD_RING_CACHE_LINE) unsigned char *slots;
+    size_t capacity;
+    size_t mask;
+    size_t slotStride;
+    size_t periodBytes;
+    int eventFd;
+} PeriodRing;
+
+int periodRingInit(PeriodRing *ring, size_t capacity, size_t periodBytes, int useWakeup);
+void periodRingDestroy(PeriodRing *ring);
+
+PeriodSlot *periodRingAcquire(PeriodRing *ring);
+void periodRingCommit(PeriodRing *ring);
+
+PeriodSlot *periodRingPeek(PeriodRing *ring);
+PeriodSlot *periodRingPeekAt(PeriodRing *ring, size_t index);
+void periodRingRelease(PeriodRing *ring);
+void periodRingReleaseMany(PeriodRing *ring, size_t count);
+int periodRingWait(PeriodRing *ring, int timeoutMs);
+int periodRingWaitAny(PeriodRing **rings, int count, int timeoutMs);
+
+void periodRingStop(PeriodRing *ring);
+size_t periodRingCount(PeriodRing *ring);
+
+/**
+ * @brief Returns a pointer to the samples stored after a slot header.
+ *
+ * @param slot Pointer to the slot.
+ * @return Pointer to the period samples.
+ */
+static inline void *periodSlotData(PeriodSlot *slot)
+{
+    return (unsigned char *)slot + PERIOD_SLOT_HEADER_BYTES;
+}
+
+#endif
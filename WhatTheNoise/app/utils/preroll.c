@@ -0,0 +1,110 @@
+/**
+ * ******************************
+ * ********** preroll.c ************
+ * ******************************
+ *
+ * Implementation of the pre-trigger buffer declared in preroll.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "preroll.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Allocates a pre-roll of a number of periods. A pre-roll of 0 periods is disabled.
+ *
+ * @param preRoll Pointer to the pre-roll.
+ * @param periods Number of periods kept.
+ * @param periodBytes Size in bytes of the samples of a period.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int preRollInit(PreRoll *preRoll, size_t periods, size_t periodBytes)
+{
+    memset(preRoll, 0, sizeof(*preRoll));
+    preRoll->slotStride = (PERIOD_SLOT_HEADER_BYTES + periodBytes + PERIOD_RING_CACHE_LINE - 1) & ~(size_t)(PERIOD_RING_CACHE_LINE - 1);
+
+    if (periods == 0)
+    {
+        return 0;
+    }
+
+    preRoll->slots = aligned_alloc(PERIOD_RING_CACHE_LINE, periods * preRoll->slotStride);
+    if (preRoll->slots == NULL)
+    {
+        perror("Failed to allocate memory for pre-roll");
+        return -1;
+    }
+    // Touch every page now so filling the pre-roll never faults
+    memset(preRoll->slots, 0, periods * preRoll->slotStride);
+    preRoll->capacity = periods;
+
+    return 0;
+}
+
+/**
+ * @brief Frees the memory of a pre-roll.
+ *
+ * @param preRoll Pointer to the pre-roll.
+ */
+void preRollDestroy(PreRoll *preRoll)
+{
+    free(preRoll->slots);
+    preRoll->slots = NULL;
+    preRoll->capacity = 0;
+    preRoll->count = 0;
+}
+
+/**
+ * @brief Returns the slot where the next period must be stored, overwriting the oldest one if full.
+ *
+ * @param preRoll Pointer to the pre-roll.
+ * @return Slot to fill, or NULL if the pre-roll is disabled.
+ */
+PeriodSlot *preRollStore(PreRoll *preRoll)
+{
+    if (preRoll->capacity == 0)
+    {
+        return NULL;
+    }
+
+    PeriodSlot *slot = (PeriodSlot *)(preRoll->slots + preRoll->next * preRoll->slotStride);
+    preRoll->next = preRoll->next + 1 == preRoll->capacity ? 0 : preRoll->next + 1;
+    if (preRoll->count < preRoll->capacity)
+    {
+        preRoll->count++;
+    }
+    return slot;
+}
+
+/**
+ * @brief Returns a stored period, 0 being the oldest.
+ *
+ * @param preRoll Pointer to the pre-roll.
+ * @param index Index of the period, lower than count.
+ * @return Slot of the period.
+ */
+PeriodSlot *preRollGet(PreRoll *preRoll, size_t index)
+{
+    size_t position = preRoll->next + preRoll->capacity - preRoll->count + index;
+    if (position >= preRoll->capacity)
+    {
+        position -= preRoll->capacity;
+    }
+    return (PeriodSlot *)(preRoll->slots + position * preRoll->slotStride);
+}
+
+/**
+ * @brief Forgets every stored period.
+ *
+ * @param preRoll Pointer to the pre-roll.
+ */
+void preRollClear(PreRoll *preRoll)
+{
+    preRoll->count = 0;
+    preRoll->next = 0;
+}
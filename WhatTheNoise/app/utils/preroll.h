@@ -0,0 +1,41 @@
+/**
+ * ******************************
+ * ********** preroll.h ************
+ * ******************************
+ *
+ * Fixed circular buffer with the last periods captured while a microphone
+ * is not recording. When a trigger fires they are flushed into the segment,
+ * so the attack of the sound that crossed the threshold is not lost.
+ * All memory is allocated once at startup.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef PREROLL_H
+#define PREROLL_H
+
+#include <stddef.h>
+
+#include "period_ring.h"
+
+/**
+ * @brief Circular buffer of period slots. Owned by the capture thread only.
+ */
+typedef struct
+{
+    unsigned char *slots;
+    size_t capacity;
+    size_t slotStride;
+    size_t count;
+    size_t next;
+} PreRoll;
+
+int preRollInit(PreRoll *preRoll, size_t periods, size_t periodBytes);
+void preRollDestroy(PreRoll *preRoll);
+
+PeriodSlot *preRollStore(PreRoll *preRoll);
+PeriodSlot *preRollGet(PreRoll *preRoll, size_t index);
+void preRollClear(PreRoll *preRoll);
+
+#endif
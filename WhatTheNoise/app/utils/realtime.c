@@ -0,0 +1,235 @@
+/**
+ * ******************************
+ * ********* realtime.c ************
+ * ******************************
+ *
+ * Implementation of the real-time mode and latency statistics declared in
+ * realtime.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "realtime.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PREFAULT_STACK_BYTES (256 * 1024)
+
+/**
+ * @brief Locks the current and future memory of the process in RAM.
+ *
+ * Also stops malloc from returning memory to the system or serving allocations with fresh
+ * mmaps, so memory freed and allocated again never page faults.
+ *
+ * @return 0 on success, -1 if the memory could not be locked (the process keeps running).
+ */
+int realtimeLockMemory(void)
+{
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        fprintf(stderr, "WARNING: Can't lock memory (%s), page faults may delay capture. Raise RLIMIT_MEMLOCK or grant CAP_IPC_LOCK.\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Touches every page of a buffer so it is backed by RAM before capture starts.
+ *
+ * The contents of the buffer are preserved.
+ *
+ * @param buffer Buffer to prefault.
+ * @param bytes Size of the buffer.
+ */
+void realtimePrefault(void *buffer, size_t bytes)
+{
+    volatile unsigned char *bytesPtr = buffer;
+    long pageSize = sysconf(_SC_PAGESIZE);
+
+    if (buffer == NULL || bytes == 0)
+    {
+        return;
+    }
+    for (size_t i = 0; i < bytes; i += (size_t)pageSize)
+    {
+        bytesPtr[i] = bytesPtr[i];
+    }
+    bytesPtr[bytes - 1] = bytesPtr[bytes - 1];
+}
+
+/**
+ * @brief Prefaults the stack of the calling thread.
+ */
+void realtimePrefaultStack(void)
+{
+    volatile unsigned char stack[PREFAULT_STACK_BYTES];
+
+    for (size_t i = 0; i < sizeof(stack); i += 1024)
+    {
+        stack[i] = 0;
+    }
+}
+
+/**
+ * @brief Applies the scheduling priority and the CPU affinity to the calling thread.
+ *
+ * @param label Name of the thread, used in the messages.
+ * @param priority SCHED_FIFO priority, or 0 to keep the default scheduler.
+ * @param cpu CPU to pin the thread to, or -1 to let it run on any CPU.
+ * @return 0 if everything requested was applied, -1 if something was not (the thread keeps running).
+ */
+int realtimeConfigureThread(const char *label, int priority, int cpu)
+{
+    int result = 0;
+    int err;
+
+    if (cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if ((err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) != 0)
+        {
+            fprintf(stderr, "WARNING: Can't pin %s to CPU %d (%s).\n", label, cpu, strerror(err));
+            result = -1;
+        }
+    }
+
+    if (priority > 0)
+    {
+        struct sched_param param = {.sched_priority = priority};
+        if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0)
+        {
+            fprintf(stderr, "WARNING: Can't give %s SCHED_FIFO priority %d (%s), it keeps the default scheduler. Raise RLIMIT_RTPRIO or grant CAP_SYS_NICE.\n",
+                    label, priority, strerror(err));
+            result = -1;
+        }
+    }
+
+    if (result == 0 && (priority > 0 || cpu >= 0))
+    {
+        printf("%s: %s", label, priority > 0 ? "SCHED_FIFO" : "default scheduler");
+        if (priority > 0)
+        {
+            printf(" %d", priority);
+        }
+        if (cpu >= 0)
+        {
+            printf(", CPU %d", cpu);
+        }
+        printf("\n");
+    }
+    return result;
+}
+
+/**
+ * @brief Parses a comma-separated list of CPUs, such as "2,3".
+ *
+ * @param text Text to parse.
+ * @param cpus Array where the CPUs will be stored.
+ * @param maxCpus Size of the array.
+ * @return Number of CPUs parsed, or -1 if the text is not a valid list.
+ */
+int realtimeParseCpus(const char *text, int *cpus, int maxCpus)
+{
+    long configured = sysconf(_SC_NPROCESSORS_CONF);
+    int count = 0;
+    char *end;
+
+    while (*text != '\0')
+    {
+        long cpu = strtol(text, &end, 10);
+        if (end == text || cpu < 0 || cpu >= configured || count == maxCpus)
+        {
+            return -1;
+        }
+        cpus[count++] = (int)cpu;
+        if (*end == ',')
+        {
+            end++;
+        }
+        else if (*end != '\0')
+        {
+            return -1;
+        }
+        text = end;
+    }
+    return count;
+}
+
+/**
+ * @brief Adds the wakeup latency of a period to the statistics.
+ *
+ * @param stats Pointer to the statistics.
+ * @param latencyNs Latency in nanoseconds; negative values (model noise) count as 0.
+ */
+void latencyStatsAdd(LatencyStats *stats, int64_t latencyNs)
+{
+    if (latencyNs < 0)
+    {
+        latencyNs = 0;
+    }
+
+    int64_t bucket = latencyNs / LATENCY_BUCKET_NS;
+    stats->buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+    stats->count++;
+    stats->sumNs += latencyNs;
+    stats->maxNs = latencyNs > stats->maxNs ? latencyNs : stats->maxNs;
+}
+
+/**
+ * @brief Latency below which a percentage of the periods were serviced.
+ *
+ * @param stats Pointer to the statistics.
+ * @param percentile Percentage, between 0 and 100.
+ * @return Upper edge of the bucket holding the percentile, in nanoseconds.
+ */
+int64_t latencyStatsPercentile(const LatencyStats *stats, double percentile)
+{
+    unsigned long target = (unsigned long)(stats->count * percentile / 100.0);
+    unsigned long seen = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += stats->buckets[i];
+        if (seen > target)
+        {
+            // The last bucket is open-ended
+            return i == LATENCY_BUCKETS - 1 ? stats->maxNs : (int64_t)(i + 1) * LATENCY_BUCKET_NS;
+        }
+    }
+    return stats->maxNs;
+}
+
+/**
+ * @brief Prints the mean, the 99th and 99.9th percentiles and the maximum wakeup latency.
+ *
+ * @param label Name of the capture thread.
+ * @param stats Pointer to the statistics.
+ */
+void latencyStatsPrint(const char *label, const LatencyStats *stats)
+{
+    if (stats->count == 0)
+    {
+        printf("%s wakeup latency: no periods measured\n", label);
+        return;
+    }
+
+    printf("%s wakeup latency: mean %.1f us, p99 < %.0f us, p99.9 < %.0f us, max %.1f us over %lu periods\n",
+           label, stats->sumNs / 1e3 / stats->count, latencyStatsPercentile(stats, 99.0) / 1e3,
+           latencyStatsPercentile(stats, 99.9) / 1e3, stats->maxNs / 1e3, stats->count);
+}
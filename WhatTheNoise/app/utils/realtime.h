@@ -0,0 +1,50 @@
+/**
+ * ******************************
+ * ********* realtime.h ************
+ * ******************************
+ *
+ * Opt-in real-time mode for the capture threads: SCHED_FIFO priority, CPU
+ * pinning, locked memory and prefaulted buffers. Every step degrades to a
+ * warning when the process lacks the permission for it. Also keeps the
+ * wakeup latency statistics used to check that the mode is effective.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REALTIME_MAX_PRIORITY 99
+#define LATENCY_BUCKETS 1000
+#define LATENCY_BUCKET_NS 10000 // 10 us per bucket, up to 10 ms
+
+/**
+ * @brief Histogram of the wakeup latency of a capture thread.
+ *
+ * The latency of a period is the time between the moment its last frame was captured, as
+ * predicted by the time model of the device, and the moment the capture thread got to it.
+ * Latencies beyond the last bucket are counted in it.
+ */
+typedef struct
+{
+    unsigned long count;
+    int64_t sumNs;
+    int64_t maxNs;
+    unsigned long buckets[LATENCY_BUCKETS];
+} LatencyStats;
+
+int realtimeLockMemory(void);
+void realtimePrefault(void *buffer, size_t bytes);
+void realtimePrefaultStack(void);
+int realtimeConfigureThread(const char *label, int priority, int cpu);
+int realtimeParseCpus(const char *text, int *cpus, int maxCpus);
+
+void latencyStatsAdd(LatencyStats *stats, int64_t latencyNs);
+int64_t latencyStatsPercentile(const LatencyStats *stats, double percentile);
+void latencyStatsPrint(const char *label, const LatencyStats *stats);
+
+#endif
@@ -10,672 +10,2866 @@
  * 
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <alsa/asoundlib.h>
 #include <pthread.h>
 #include <time.h>
 #include <sys/stat.h>
-#include <dirent.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h>
 #include <unistd.h>
 #include <stdatomic.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/resource.h>
+
+#include "period_ring.h"
+#include "time_model.h"
+#include "resampler.h"
+#include "detect.h"
+#include "preroll.h"
+#include "trigger.h"
+#include "sample_format.h"
+#include "realtime.h"
+#include "timestamp_file.h"
+#include "event_container.h"
+#include "batch_writer.h"
+#include "flac_encoder.h"
+#include "deinterleave.h"
+#include "control_socket.h"
+#include "live_ring.h"
 
-#define SAMPLE_FORMAT SND_PCM_FORMAT_S16_LE
 #define MAX_AMPLITUDE 32768
-#define CHANNELS 1
-#define FRAMES_PER_BUFFER 128
-#define LATENCY 8707
+#define DEFAULT_FRAMES_PER_BUFFER 128
+#define DEFAULT_LATENCY 8707 // buffer time in microseconds
+#define MAX_FRAMES_PER_BUFFER 8192
+#define MAX_SEGMENT_GAPS 32
+#define MAX_GAP_FILL_SECONDS 60
+#define RING_SECONDS 2 // audio each ring holds besides the pre-roll, many WRITE_INTERVAL_MS sleeps
+#define MAX_MICS TRIGGER_MAX_MICS
+#define MAX_POLL_FDS (MAX_MICS * 2)
+#define SESSION_INFO_FILE "session_info.txt"
+#define TIME_FIT_WINDOW 8192 // periods remembered by the time model fit (~22 s at 48 kHz)
+#define ALIGN_BUFFER_FRAMES 1024
+#define DEFAULT_PREROLL_MS 100
+#define MAX_PREROLL_MS 2000
+#define DEFAULT_TRIGGER_WINDOW_MS 50
+#define CONTAINER_DIR "events"
+#define CONTAINER_BLOCK_FRAMES 4096 // frames of a microphone per AUDIO block of an event container
+#define MAX_OPEN_CONTAINERS 4
+#define PREALLOC_SECONDS 4 // audio reserved ahead of each raw file with fallocate
+#define WRITE_BATCH_PERIODS 64 // periods written with one writev before their slots are released
+#define WRITE_INTERVAL_MS 100 // time the writer lets periods pile up when it is keeping up
+#define SESSION_CLOSE_TIMEOUT_MS 10000 // time a daemon waits for the files of a session to be closed
+#define SESSION_POLL_MS 5
 
 int sample_rate;
+int frames_per_buffer = DEFAULT_FRAMES_PER_BUFFER;
+unsigned int latency_us = DEFAULT_LATENCY;
+SampleFormat sample_format = SAMPLE_S16;
+size_t sample_bytes = 2;
+DetectFunction detect_period;
+int realtime_priority = 0; // SCHED_FIFO priority of the capture threads, 0 keeps the default scheduler
+int capture_cpus[MAX_MICS];
+int capture_cpu_count = 0;
+int writer_cpus[MAX_MICS];
+int writer_cpu_count = 0;
 float threshold_percentage;
 float min_silence_time;
-int threshold;
-int min_silence_frames;
-
-/**
- * @brief Node in the buffer queue that stores audio buffers and their timestamps.
- */
-typedef struct BufferNode
-{
-    int16_t buffer[FRAMES_PER_BUFFER];
-    struct timespec timestamp;
-    struct BufferNode *next;
-} BufferNode;
+atomic_int threshold; // changed by the control socket while the capture threads read it
+int use_poll;
+pthread_t poll_thread_id;
+int pcm_linked;
+int align_clocks;
+int preroll_ms = DEFAULT_PREROLL_MS;
+TriggerPolicy trigger_policy = TRIGGER_OR;
+int trigger_quorum = 1;
+int trigger_window_ms = DEFAULT_TRIGGER_WINDOW_MS;
+TriggerCoordinator trigger_coordinator;
+int use_container;
+EventContainer open_containers[MAX_OPEN_CONTAINERS];
+pthread_mutex_t containers_mutex = PTHREAD_MUTEX_INITIALIZER;
+FsyncPolicy fsync_policy = FSYNC_NONE;
+int fsync_interval_ms;
+int encode_flac = 1;
+const char *control_path; // set with --control: the recorder is driven through this socket instead of stdin
+ControlSocket control_socket;
+int run_as_daemon; // set with --daemon: capture never stops, start and stop only open and close sessions
+atomic_uint session_state = 1; // bumped on every start and stop of the daemon; odd while a session is open
+struct timespec capture_trigger[MAX_MICS]; // trigger timestamp of each device, written to every session info
+const char *live_name; // set with --live: every period is also published to the shared-memory ring <name>_MicN
+int device_channels = 1; // inputs captured from a single multichannel device, each recorded as a microphone
+void *interleaved_buffer;
 
 /**
- * @brief Queue to store audio buffers.
+ * @brief Frames missing from a segment, because of an XRUN or because the ring was full.
+ *
+ * offset is the position in the written segment where the gap starts.
  */
 typedef struct
 {
-    BufferNode *front;
-    BufferNode *rear;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    int stop;
-} BufferQueue;
+    uint64_t offset;
+    uint64_t frames;
+    uint64_t filled;
+    int xrun;
+} SegmentGap;
 
 /**
  * @brief Structure to store data for each microphone.
  */
-typedef struct
+typedef struct MicData
 {
     snd_pcm_t *pcm_handle;
+    int channel; // input of the device this microphone records; only channel 0 owns the PCM handle
     int recording;
-    int silenceCounter;
     int fileIndex;
+    int triggerIndex;
+    unsigned eventId;
+    int64_t eventStartNs;
     char fileName[100];
     char timestampFileName[100];
+    char deviceName[TIMESTAMP_DEVICE_BYTES];
+    char modelFileName[100];
     char micName[20];
-    FILE *file;
+    BatchWriter sampleFile;
+    FlacEncoder *encoder;
+    char encodedFileName[100];
     FILE *timestampFile;
+    int segmentOpen;
+    EventContainer *container;
+    unsigned char *containerAudio;
+    uint64_t containerAudioFirst;
+    size_t containerAudioFrames;
+    TimestampRecord *containerStamps;
+    size_t containerStampCount;
+    size_t containerStampCapacity;
     pthread_t threadId;
     pthread_mutex_t *startMutex;
     pthread_cond_t *startCond;
     int *startFlag;
     int *stopFlag;
-    BufferQueue bufferQueue;
-    pthread_mutex_t fileMutex;
-    pthread_cond_t fileCond;
-    int newRecording;
-    int recordingFinished;
+    PeriodRing ring;
+    PreRoll preRoll;
+    LiveRing live;
+    void *scratch;
+    uint32_t pendingFlags;
+    struct timespec lastTimestamp;
+    uint64_t framesCaptured;
+    uint64_t periodFrame;
+    TimeFit timeFit;
+    TimeModel timeModel;
+    uint64_t segmentFirstFrame;
+    uint64_t segmentFrames;
+    uint64_t segmentNextFrame;
+    SegmentGap segmentGaps[MAX_SEGMENT_GAPS];
+    int segmentGapCount;
+    TimeModel segmentModel;
+    int64_t segmentEventStart;
+    PeriodLevels levels;
+    int32_t segmentPeak;
+    uint64_t segmentEnergy;
+    uint64_t segmentEnergyFrames;
+    int segmentOnsetFound;
+    struct timespec segmentOnset;
+    SharedTimeModel sharedModel;
+    struct MicData *clockReference;
+    Resampler *resampler;
+    int segmentAligned;
+    uint64_t segmentOutFrame;
+    double driftPpm;
+    int useMmap;
+    int captureCpu;
+    LatencyStats wakeupLatency;
+    int xrunPending;
+    unsigned session;        // session state seen by the capture thread on its last period
+    atomic_uint sessionAck;  // last closed session state the capture thread has nothing pending for
+    atomic_ulong xruns;
+    atomic_ulong xrunLostFrames;
+    struct rusage captureUsage;
+    double captureSeconds;
+    unsigned long wakeups;
+    unsigned long writeCalls;
+    unsigned long syncCalls;
+    uint64_t bytesWritten;
 } MicData;
 
 /**
- * @brief Initializes the buffer queue.
- *
- * @param queue Pointer to the buffer queue.
+ * @brief Writer thread and the microphones whose rings it drains.
  */
-void bufferQueueInit(BufferQueue *queue)
+typedef struct
 {
-    queue->front = queue->rear = NULL;
-    pthread_mutex_init(&queue->mutex, NULL);
-    pthread_cond_init(&queue->cond, NULL);
-    queue->stop = 0;
-}
+    pthread_t threadId;
+    int index;
+    int cpu;
+    MicData *mics[MAX_MICS];
+    PeriodRing *rings[MAX_MICS];
+    int micCount;
+} WriterThread;
+
+WriterThread writer_threads[MAX_MICS];
+int writer_count;
 
 /**
- * @brief Adds a buffer to the queue.
+ * @brief Writes the trigger metadata of an event at the start of its container.
  *
- * @param queue Pointer to the buffer queue.
- * @param buffer Pointer to the audio buffer.
- * @param timestamp Timestamp associated with the buffer.
+ * @param container Pointer to the container.
+ * @param eventStartNs Start time of the event.
  */
-void bufferQueuePush(BufferQueue *queue, int16_t *buffer, struct timespec timestamp)
+static void writeEventMetadata(EventContainer *container, int64_t eventStartNs)
 {
-    BufferNode *newNode = (BufferNode *)malloc(sizeof(BufferNode));
-    if (!newNode)
-    {
-        perror("Failed to allocate memory for buffer node");
-        return;
-    }
-    memcpy(newNode->buffer, buffer, FRAMES_PER_BUFFER * sizeof(int16_t));
-    newNode->timestamp = timestamp;
-    newNode->next = NULL;
+    char text[256];
+    int length = snprintf(text, sizeof(text),
+                          "event=%u\nevent_start=%lld.%09lld\ntrigger=%s\nquorum=%d\ntrigger_window_ms=%d\npreroll_ms=%d\nsample_format=%s\n",
+                          container->eventId, (long long)(eventStartNs / 1000000000LL), (long long)(eventStartNs % 1000000000LL),
+                          triggerPolicyName(trigger_policy), trigger_quorum, trigger_window_ms, preroll_ms, sampleFormatName(sample_format));
 
-    pthread_mutex_lock(&queue->mutex);
-    if (queue->rear == NULL)
-    {
-        queue->front = queue->rear = newNode;
-    }
-    else
-    {
-        queue->rear->next = newNode;
-        queue->rear = newNode;
-    }
-    pthread_cond_signal(&queue->cond);
-    pthread_mutex_unlock(&queue->mutex);
+    eventContainerAppend(container, EVENT_BLOCK_METADATA, EVENT_CHANNEL_NONE, 0, 0, text, length);
 }
 
 /**
- * @brief Pops a buffer from the queue.
+ * @brief Gets the container of an event, creating it when this is the first microphone to record it.
  *
- * @param queue Pointer to the buffer queue.
- * @param buffer Pointer to the audio buffer where data will be copied.
- * @param timestamp Pointer to where the timestamp of the buffer will be copied.
- * @return 0 if a buffer is popped, -1 if the queue is empty and should stop.
+ * A new container expects one release from every microphone, so it stays open until the
+ * slowest writer has finished the event.
+ *
+ * @param eventId ID of the event.
+ * @param eventStartNs Start time of the event.
+ * @return Pointer to the container, or NULL if it could not be created.
  */
-int bufferQueuePop(BufferQueue *queue, int16_t *buffer, struct timespec *timestamp)
+static EventContainer *acquireEventContainer(unsigned eventId, int64_t eventStartNs)
 {
-    pthread_mutex_lock(&queue->mutex);
-    while (queue->front == NULL && !queue->stop)
+    EventContainer *container = NULL;
+    char path[100];
+
+    pthread_mutex_lock(&containers_mutex);
+    for (int i = 0; i < MAX_OPEN_CONTAINERS && container == NULL; i++)
     {
-        pthread_cond_wait(&queue->cond, &queue->mutex);
+        if (open_containers[i].references > 0 && open_containers[i].eventId == eventId)
+        {
+            container = &open_containers[i];
+        }
     }
-    if (queue->stop && queue->front == NULL)
+    for (int i = 0; i < MAX_OPEN_CONTAINERS && container == NULL; i++)
     {
-        pthread_mutex_unlock(&queue->mutex);
-        return -1;
+        if (open_containers[i].references == 0)
+        {
+            snprintf(path, sizeof(path), CONTAINER_DIR "/event_%u.wtn", eventId);
+            if (eventContainerOpen(&open_containers[i], path, eventId, eventStartNs, trigger_coordinator.micCount,
+                                   sample_rate, sample_format, frames_per_buffer) != 0)
+            {
+                break;
+            }
+            container = &open_containers[i];
+            container->references = trigger_coordinator.micCount;
+            writeEventMetadata(container, eventStartNs);
+            printf("Starting new recording: %s\n", path);
+        }
     }
-
-    BufferNode *temp = queue->front;
-    memcpy(buffer, temp->buffer, FRAMES_PER_BUFFER * sizeof(int16_t));
-    *timestamp = temp->timestamp;
-    queue->front = queue->front->next;
-
-    if (queue->front == NULL)
+    if (container == NULL)
     {
-        queue->rear = NULL;
+        fprintf(stderr, "No container for event %u, it is not recorded.\n", eventId);
     }
-    free(temp);
-    pthread_mutex_unlock(&queue->mutex);
+    pthread_mutex_unlock(&containers_mutex);
 
-    return 0;
+    return container;
 }
 
 /**
- * @brief Cleans the buffer queue, freeing associated memory.
+ * @brief Releases a microphone's hold on the container of an event, closing it after the last one.
  *
- * @param queue Pointer to the buffer queue.
+ * @param container Pointer to the container.
  */
-void cleanBufferQueue(BufferQueue *queue)
+static void releaseEventContainer(EventContainer *container)
 {
-    pthread_mutex_lock(&queue->mutex);
-    BufferNode *current = queue->front;
-    while (current != NULL)
+    pthread_mutex_lock(&containers_mutex);
+    if (--container->references == 0)
     {
-        BufferNode *temp = current;
-        current = current->next;
-        free(temp);
+        eventContainerClose(container);
+        printf("Recording stopped: event %u\n", container->eventId);
     }
-    queue->front = queue->rear = NULL;
-    pthread_mutex_unlock(&queue->mutex);
+    pthread_mutex_unlock(&containers_mutex);
 }
 
 /**
- * @brief Opens files for recording audio and timestamps.
+ * @brief Closes the containers of events some microphone never finished.
  *
- * @param data Pointer to the microphone data structure.
+ * Called once the writer threads have been joined.
  */
-void openFilesForRecording(MicData *data)
+void closeEventContainers(void)
 {
-    data->fileIndex++;
-    sprintf(data->fileName, "samples_threads_%s/samples_%s_%d.raw", data->micName, data->micName, data->fileIndex);
-    sprintf(data->timestampFileName, "samples_threads_%s/timestamps_%s_%d.ts", data->micName, data->micName, data->fileIndex);
-    data->file = fopen(data->fileName, "wb");
-    data->timestampFile = fopen(data->timestampFileName, "w");
-    if (data->file == NULL || data->timestampFile == NULL)
+    for (int i = 0; i < MAX_OPEN_CONTAINERS; i++)
     {
-        fprintf(stderr, "Could not open files %s or %s.\n", data->fileName, data->timestampFileName);
-        exit(EXIT_FAILURE);
+        if (open_containers[i].references > 0)
+        {
+            eventContainerClose(&open_containers[i]);
+            open_containers[i].references = 0;
+        }
     }
-    printf("Starting new recording: %s\n", data->fileName);
 }
 
 /**
- * @brief Closes the recording files.
+ * @brief Appends the staged samples and timestamps of a microphone to the event container.
  *
  * @param data Pointer to the microphone data structure.
  */
-void closeFilesForRecording(MicData *data)
+static void flushContainerBlocks(MicData *data)
 {
-    if (data->file != NULL)
+    uint32_t channel = (uint32_t)data->triggerIndex;
+
+    if (data->containerStampCount > 0)
     {
-        fclose(data->file);
-        data->file = NULL;
+        eventContainerAppend(data->container, EVENT_BLOCK_TIMESTAMPS, channel, data->containerStamps[0].frameOffset,
+                             data->containerStampCount, data->containerStamps, data->containerStampCount * sizeof(TimestampRecord));
+        data->containerStampCount = 0;
     }
-    if (data->timestampFile != NULL)
+    if (data->containerAudioFrames > 0)
     {
-        fclose(data->timestampFile);
-        data->timestampFile = NULL;
+        eventContainerAppend(data->container, EVENT_BLOCK_AUDIO, channel, data->containerAudioFirst,
+                             data->containerAudioFrames, data->containerAudio, data->containerAudioFrames * sample_bytes);
+        data->containerAudioFirst += data->containerAudioFrames;
+        data->containerAudioFrames = 0;
     }
-    printf("Recording stopped: %s\n", data->fileName);
 }
 
 /**
- * @brief Encodes raw files to mp4 using ffmpeg.
+ * @brief Writes samples of the segment, to the raw file or staged into CONTAINER_BLOCK_FRAMES blocks of the container.
  *
- * @param arg Pointer to the directory name.
- * @return NULL.
+ * Samples for the raw file are queued in place for the next writev, so unless transient is set
+ * they must stay valid until the writer flushes (ring slots are only released after that).
+ * They are also fed to the FLAC encoder of the segment.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param samples Samples to write.
+ * @param frames Number of frames.
+ * @param transient Whether samples is a temporary buffer that has to be copied.
  */
-void *encodeRawFilesToMp4(void *arg)
+static void writeSegmentSamples(MicData *data, const void *samples, size_t frames, int transient)
 {
-    const char *directory = (const char *)arg;
-    DIR *dir;
-    struct dirent *ent;
-    char inputFilePath[256];
-    char outputFilePath[256];
-    char command[512];
+    const unsigned char *bytes = samples;
 
-    if ((dir = opendir(directory)) != NULL)
+    if (data->container == NULL)
     {
-        while ((ent = readdir(dir)) != NULL)
+        if (transient)
         {
-            if (strstr(ent->d_name, ".raw") != NULL)
-            {
-                snprintf(inputFilePath, sizeof(inputFilePath), "%s/%s", directory, ent->d_name);
-                snprintf(outputFilePath, sizeof(outputFilePath), "%s/%s.mp4", directory, strtok(ent->d_name, "."));
-                snprintf(command, sizeof(command), "ffmpeg -f s16le -ar %d -ac %d -i %s %s", sample_rate, CHANNELS, inputFilePath, outputFilePath);
-                printf("Encoding file: %s to %s\n", inputFilePath, outputFilePath);
-                system(command);
-            }
+            batchWriterCopy(&data->sampleFile, samples, frames * sample_bytes);
         }
-        closedir(dir);
-    }
-    else
-    {
-        perror("Could not open directory");
+        else
+        {
+            batchWriterAdd(&data->sampleFile, samples, frames * sample_bytes);
+        }
+        if (data->encoder != NULL)
+        {
+            flacEncoderWrite(data->encoder, samples, frames);
+        }
+        return;
     }
-    return NULL;
-}
-
-/**
- * @brief Records audio from a microphone.
- * 
- * This functions handles the recording logic for each microphone.
- *
- * @param arg Pointer to the microphone data structure.
- * @return NULL.
- */
-void *recordAudio(void *arg)
-{
-    MicData *data = (MicData *)arg;
-    snd_pcm_uframes_t frames = FRAMES_PER_BUFFER;
-    int pcm;
-    int16_t buffer[FRAMES_PER_BUFFER];
-    int aboveThreshold;
-    struct timespec hw_timestamp;
-    snd_pcm_status_t *status;
-    snd_pcm_status_alloca(&status);
 
-    bufferQueueInit(&data->bufferQueue);
-
-    while (1)
+    while (frames > 0)
     {
-        pthread_mutex_lock(data->startMutex);
-        while (!(*data->startFlag))
+        size_t chunk = CONTAINER_BLOCK_FRAMES - data->containerAudioFrames;
+        if (chunk > frames)
         {
-            pthread_cond_wait(data->startCond, data->startMutex);
+            chunk = frames;
         }
-        pthread_mutex_unlock(data->startMutex);
-
-        while (!(*data->stopFlag))
+        memcpy(data->containerAudio + data->containerAudioFrames * sample_bytes, bytes, chunk * sample_bytes);
+        data->containerAudioFrames += chunk;
+        bytes += chunk * sample_bytes;
+        frames -= chunk;
+        if (data->containerAudioFrames == CONTAINER_BLOCK_FRAMES)
         {
-            aboveThreshold = 0;
-            pcm = snd_pcm_readi(data->pcm_handle, buffer, frames);
-            if (pcm == -EPIPE)
-            {
-                fprintf(stderr, "XRUN.\n");
-                snd_pcm_prepare(data->pcm_handle);
-                continue;
-            }
-            else if (pcm < 0)
-            {
-                fprintf(stderr, "ERROR: Can't read from PCM device. %s\n", snd_strerror(pcm));
-                break;
-            }
-            else if (pcm != (int)frames)
-            {
-                fprintf(stderr, "Short read: read %d frames\n", pcm);
-                continue;
-            }
-
-            snd_pcm_status(data->pcm_handle, status);
-            snd_pcm_status_get_htstamp(status, &hw_timestamp);
-
-            for (int i = 0; i < FRAMES_PER_BUFFER; i++)
-            {
-                if (abs(buffer[i]) > threshold)
-                {
-                    aboveThreshold = 1;
-                    break;
-                }
-            }
-
-            if (aboveThreshold)
-            {
-                if (!data->recording)
-                {
-                    data->recording = 1;
-                    data->silenceCounter = 0;
-                    pthread_mutex_lock(&data->fileMutex);
-                    data->newRecording = 1;
-                    pthread_cond_signal(&data->fileCond);
-                    pthread_mutex_unlock(&data->fileMutex);
-                }
-            }
-
-            if (data->recording)
-            {
-                bufferQueuePush(&data->bufferQueue, buffer, hw_timestamp);
-            }
-
-            if (!aboveThreshold)
-            {
-                data->silenceCounter++;
-                if (data->recording && data->silenceCounter > min_silence_frames)
-                {
-                    pthread_mutex_lock(&data->fileMutex);
-                    data->recordingFinished = 1;
-                    data->recording = 0;
-                    pthread_cond_signal(&data->fileCond);
-                    pthread_mutex_unlock(&data->fileMutex);
-                }
-            }
-            else
-            {
-                data->silenceCounter = 0;
-            }
-
-            if (*data->stopFlag)
-            {
-                if (data->recording)
-                {
-                    pthread_mutex_lock(&data->fileMutex);
-                    data->recordingFinished = 1;
-                    data->recording = 0;
-                    pthread_cond_signal(&data->fileCond);
-                    pthread_mutex_unlock(&data->fileMutex);
-                }
-                break;
-            }
+            flushContainerBlocks(data);
         }
     }
-
-    snd_pcm_close(data->pcm_handle);
-    pthread_exit(NULL);
 }
 
 /**
- * @brief Thread function for writing to files.
- * 
- * This function is called from separate threads to write audio buffers and timestamps to corresponding files.
+ * @brief Writes the timestamp of a period of the segment, to the timestamp file or staged for the container.
  *
- * @param arg Pointer to the MicData structure.
- * @return NULL.
+ * @param data Pointer to the microphone data structure.
+ * @param time Time of the period.
+ * @param frameOffset Position of the first sample of the period in the segment.
+ * @param flags TIMESTAMP_RECORD_* flags.
  */
-void *writeAudioToFile(void *arg)
+static void writeSegmentTimestamp(MicData *data, struct timespec time, uint64_t frameOffset, uint32_t flags)
 {
-    MicData *data = (MicData *)arg;
-    int16_t buffer[FRAMES_PER_BUFFER];
-    struct timespec timestamp;
+    TimestampRecord *record;
 
-    while (!(*data->stopFlag) || data->bufferQueue.front != NULL)
+    if (data->container == NULL)
     {
-        pthread_mutex_lock(&data->fileMutex);
-        while (!data->newRecording && !data->recordingFinished && !(*data->stopFlag))
-        {
-            pthread_cond_wait(&data->fileCond, &data->fileMutex);
-        }
-
-        if (data->newRecording)
-        {
-            openFilesForRecording(data);
-            data->newRecording = 0;
-        }
-
-        pthread_mutex_unlock(&data->fileMutex);
-
-        while (bufferQueuePop(&data->bufferQueue, buffer, &timestamp) == 0 && !data->recordingFinished)
-        {
-            if (data->file != NULL)
-            {
-                fwrite(buffer, sizeof(int16_t), FRAMES_PER_BUFFER, data->file);
-                fprintf(data->timestampFile, "%ld.%09ld\n", timestamp.tv_sec, timestamp.tv_nsec);
-            }
-        }
-
-        pthread_mutex_lock(&data->fileMutex);
-        if (data->recordingFinished)
-        {
-            closeFilesForRecording(data);
-            data->recordingFinished = 0;
-        }
-        pthread_mutex_unlock(&data->fileMutex);
+        timestampFileWriteRecord(data->timestampFile, time, frameOffset, flags);
+        return;
     }
 
-    return NULL;
+    if (data->containerStampCount == data->containerStampCapacity)
+    {
+        flushContainerBlocks(data);
+    }
+    record = &data->containerStamps[data->containerStampCount++];
+    record->timeNs = (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+    record->frameOffset = (uint32_t)frameOffset;
+    record->flags = flags;
 }
 
 /**
- * @brief Sets up the PCM device for audio capture.
+ * @brief Opens files for recording audio and timestamps.
  *
- * This function configures the PCM device with the specified parameters for audio capture, including 
- * sample format, sample rate, channels, and latency. It also sets the timestamp mode and type for the PCM device.
+ * Files are numbered by event ID, so the files of every microphone for the same event share
+ * the same index. With containers enabled the microphone joins the container of the event instead.
  *
- * @param data Pointer to the MicData structure that holds the PCM handle.
- * @param device Name of the PCM device to be opened.
- * @return 0 on success, or a negative error code on failure.
+ * @param data Pointer to the microphone data structure.
+ * @param eventId ID of the event being recorded.
+ * @param eventStartNs Start time of the event.
  */
-int setup_pcm(MicData *data, const char *device)
+void openFilesForRecording(MicData *data, unsigned eventId, int64_t eventStartNs)
 {
-    snd_pcm_hw_params_t *params;
-    snd_pcm_hw_params_alloca(&params);
-    snd_pcm_uframes_t frames = FRAMES_PER_BUFFER;
-    unsigned int sample_rate = sample_rate;
-    unsigned int latency = LATENCY;
-    int err;
-
-    if ((err = snd_pcm_open(&data->pcm_handle, device, SND_PCM_STREAM_CAPTURE, 0)) < 0)
+    data->fileIndex = (int)eventId;
+    if (use_container)
     {
-        fprintf(stderr, "ERROR: Can't open \"%s\" PCM device. %s\n", device, snd_strerror(err));
-        return err;
+        data->container = acquireEventContainer(eventId, eventStartNs);
+        data->containerAudioFirst = 0;
+        data->containerAudioFrames = 0;
+        data->containerStampCount = 0;
+        data->segmentOpen = data->container != NULL;
+        return;
     }
 
-    snd_pcm_hw_params_any(data->pcm_handle, params);
-    snd_pcm_hw_params_set_access(data->pcm_handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(data->pcm_handle, params, SAMPLE_FORMAT);
-    snd_pcm_hw_params_set_channels(data->pcm_handle, params, CHANNELS);
-    snd_pcm_hw_params_set_rate_near(data->pcm_handle, params, &sample_rate, 0);
-    snd_pcm_hw_params_set_period_size_near(data->pcm_handle, params, &frames, 0);
-    snd_pcm_hw_params_set_buffer_time_near(data->pcm_handle, params, &latency, 0);
-    if ((err = snd_pcm_hw_params(data->pcm_handle, params)) < 0)
+    sprintf(data->fileName, "samples_threads_%s/samples_%s_%d.raw", data->micName, data->micName, data->fileIndex);
+    sprintf(data->timestampFileName, "samples_threads_%s/timestamps_%s_%d.ts", data->micName, data->micName, data->fileIndex);
+    sprintf(data->modelFileName, "samples_threads_%s/model_%s_%d.tm", data->micName, data->micName, data->fileIndex);
+    data->timestampFile = fopen(data->timestampFileName, "wb");
+    if (batchWriterOpen(&data->sampleFile, data->fileName, (off_t)PREALLOC_SECONDS * sample_rate * sample_bytes, fsync_policy, fsync_interval_ms) != 0 ||
+        data->timestampFile == NULL || setvbuf(data->timestampFile, NULL, _IOFBF, TIMESTAMP_FILE_BUFFER_BYTES) != 0 ||
+        timestampFileWriteHeader(data->timestampFile, sample_rate, frames_per_buffer, TIMESTAMP_CLOCK_REALTIME, data->deviceName) != 0)
     {
-        fprintf(stderr, "ERROR: Can't set hardware parameters for PCM device. %s\n", snd_strerror(err));
-        return err;
+        fprintf(stderr, "Could not open files %s or %s.\n", data->fileName, data->timestampFileName);
+        exit(EXIT_FAILURE);
     }
-
-    snd_pcm_sw_params_t *swparams;
-    snd_pcm_sw_params_alloca(&swparams);
-    snd_pcm_sw_params_current(data->pcm_handle, swparams);
-    snd_pcm_sw_params_set_tstamp_mode(data->pcm_handle, swparams, SND_PCM_TSTAMP_ENABLE);
-    snd_pcm_sw_params_set_tstamp_type(data->pcm_handle, swparams, SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY);
-    if ((err = snd_pcm_sw_params(data->pcm_handle, swparams)) < 0)
+    if (data->encoder != NULL)
     {
-        fprintf(stderr, "ERROR: Can't set software parameters for PCM device. %s\n", snd_strerror(err));
-        return err;
+        sprintf(data->encodedFileName, "samples_threads_%s/samples_%s_%d.flac", data->micName, data->micName, data->fileIndex);
+        if (flacEncoderOpen(data->encoder, data->encodedFileName, sample_rate, sample_format) != 0)
+        {
+            fprintf(stderr, "Could not open file %s.\n", data->encodedFileName);
+            exit(EXIT_FAILURE);
+        }
     }
-
-    return 0;
+    data->segmentOpen = 1;
+    printf("Starting new recording: %s\n", data->fileName);
 }
 
 /**
- * @brief Initializes the microphone data structure.
+ * @brief Prints the time model and levels of the segment being closed as "key=value" lines.
  *
- * This function sets the initial values for the MicData structure, including recording flags, file names, 
- * mutexes, and condition variables.
+ * The model maps the segment's sample i to t0 + i / rate. onset is the time of the first sample
+ * over the threshold. Each gap line gives the position, the length and the frames zero-filled
+ * of a stretch of audio lost to an XRUN or dropped because the ring was full.
  *
- * @param data Pointer to the MicData structure to be initialized.
- * @param micNumber Microphone number (identifier).
- * @param startMutex Pointer to the start mutex.
- * @param startCond Pointer to the start condition variable.
- * @param startFlag Pointer to the start flag.
- * @param stopFlag Pointer to the stop flag.
+ * @param data Pointer to the microphone data structure.
+ * @param modelFile Stream to print to.
  */
-void initializeMicData(MicData *data, int micNumber, pthread_mutex_t *startMutex, pthread_cond_t *startCond, int *startFlag, int *stopFlag)
+static void printSegmentTimeModel(MicData *data, FILE *modelFile)
 {
-    data->recording = 0;
-    data->fileIndex = 0;
-    data->silenceCounter = 0;
-    sprintf(data->micName, "Mic%d", micNumber);
-    data->startMutex = startMutex;
-    data->startCond = startCond;
-    data->startFlag = startFlag;
-    data->stopFlag = stopFlag;
-    data->file = NULL;
-    data->timestampFile = NULL;
-    pthread_mutex_init(&data->fileMutex, NULL);
-    pthread_cond_init(&data->fileCond, NULL);
-    data->newRecording = 0;
-    data->recordingFinished = 0;
+    struct timespec t0;
+
+    timeModelFrameTime(&data->segmentModel, data->segmentFirstFrame, &t0);
+    fprintf(modelFile, "t0=%ld.%09ld\n", t0.tv_sec, t0.tv_nsec);
+    fprintf(modelFile, "rate=%.6f\n", data->segmentModel.rate);
+    fprintf(modelFile, "first_frame=%llu\n", (unsigned long long)data->segmentFirstFrame);
+    fprintf(modelFile, "frames=%llu\n", (unsigned long long)data->segmentFrames);
+    fprintf(modelFile, "event=%d\n", data->fileIndex);
+    fprintf(modelFile, "event_start=%lld.%09lld\n", (long long)(data->segmentEventStart / 1000000000LL), (long long)(data->segmentEventStart % 1000000000LL));
+    fprintf(modelFile, "peak=%d\n", data->segmentPeak);
+    fprintf(modelFile, "rms=%.1f\n", data->segmentEnergyFrames > 0 ? sqrt((double)data->segmentEnergy / data->segmentEnergyFrames) : 0.0);
+    if (data->segmentOnsetFound)
+    {
+        fprintf(modelFile, "onset=%ld.%09ld\n", data->segmentOnset.tv_sec, data->segmentOnset.tv_nsec);
+    }
+    fprintf(modelFile, "device_xruns=%lu\n", atomic_load_explicit(&data->xruns, memory_order_relaxed));
+    fprintf(modelFile, "gaps=%d\n", data->segmentGapCount);
+    for (int i = 0; i < data->segmentGapCount && i < MAX_SEGMENT_GAPS; i++)
+    {
+        const SegmentGap *gap = &data->segmentGaps[i];
+        fprintf(modelFile, "gap=%llu,%llu,%llu,%s\n", (unsigned long long)gap->offset, (unsigned long long)gap->frames,
+                (unsigned long long)gap->filled, gap->xrun ? "xrun" : "dropped");
+    }
+    if (data->clockReference != NULL)
+    {
+        fprintf(modelFile, "drift_ppm=%.3f\n", data->driftPpm);
+        if (data->segmentAligned)
+        {
+            fprintf(modelFile, "aligned_to=%s\n", data->clockReference->micName);
+        }
+    }
 }
 
 /**
- * @brief Starts the recording and writing threads.
+ * @brief Writes the time model and levels of the segment being closed.
  *
- * This function creates and starts the threads for recording audio and writing audio to files for both microphones.
+ * The model file is written before the timestamp file is closed, so it is already there when
+ * the analyzer picks the segment up. In a container it becomes a METADATA block of the
+ * microphone's channel, also naming the microphone and its device.
  *
- * @param dataMic1 Pointer to the MicData structure for microphone 1.
- * @param dataMic2 Pointer to the MicData structure for microphone 2.
+ * @param data Pointer to the microphone data structure.
  */
-void startThreads(MicData *dataMic1, MicData *dataMic2)
+void writeSegmentTimeModel(MicData *data)
 {
-    pthread_t writeThreadMic1, writeThreadMic2;
+    FILE *modelFile;
+    char *text = NULL;
+    size_t length = 0;
 
-    if (pthread_create(&dataMic1->threadId, NULL, recordAudio, (void *)dataMic1) != 0)
+    if (data->segmentModel.rate <= 0)
     {
-        fprintf(stderr, "Error creating thread for Mic1.\n");
-        exit(1);
-    }
-
-    if (pthread_create(&dataMic2->threadId, NULL, recordAudio, (void *)dataMic2) != 0)
-    {
-        fprintf(stderr, "Error creating thread for Mic2.\n");
-        exit(1);
+        return;
     }
 
-    if (pthread_create(&writeThreadMic1, NULL, writeAudioToFile, (void *)dataMic1) != 0)
+    if (data->container != NULL)
     {
-        fprintf(stderr, "Error creating thread for writing Mic1.\n");
-        exit(1);
+        modelFile = open_memstream(&text, &length);
+        if (modelFile == NULL)
+        {
+            perror("Could not build the time model");
+            return;
+        }
+        fprintf(modelFile, "mic=%s\ndevice=%s\n", data->micName, data->deviceName);
+        printSegmentTimeModel(data, modelFile);
+        fclose(modelFile);
+        eventContainerAppend(data->container, EVENT_BLOCK_METADATA, (uint32_t)data->triggerIndex, 0, data->segmentFrames, text, length);
+        free(text);
+        return;
     }
 
-    if (pthread_create(&writeThreadMic2, NULL, writeAudioToFile, (void *)dataMic2) != 0)
+    modelFile = fopen(data->modelFileName, "w");
+    if (modelFile == NULL)
     {
-        fprintf(stderr, "Error creating thread for writing Mic2.\n");
-        exit(1);
+        fprintf(stderr, "Could not open file %s.\n", data->modelFileName);
+        return;
     }
-
-    dataMic1->bufferQueue.stop = 0;
-    dataMic2->bufferQueue.stop = 0;
+    printSegmentTimeModel(data, modelFile);
+    fclose(modelFile);
 }
 
 /**
- * @brief Stops the recording threads for both microphones.
+ * @brief Closes the recording files, or hands the segment over to the event container.
  *
- * @param dataMic1 Pointer to the MicData structure for microphone 1.
- * @param dataMic2 Pointer to the MicData structure for microphone 2.
+ * @param data Pointer to the microphone data structure.
  */
-void stopRecordingThreads(MicData *dataMic1, MicData *dataMic2)
+void closeFilesForRecording(MicData *data)
 {
-    *(dataMic1->stopFlag) = 1;
-    *(dataMic2->stopFlag) = 1;
-
-    pthread_cond_broadcast(&dataMic1->bufferQueue.cond);
-    pthread_cond_broadcast(&dataMic2->bufferQueue.cond);
+    data->segmentOpen = 0;
+    if (data->container != NULL)
+    {
+        flushContainerBlocks(data);
+        writeSegmentTimeModel(data);
+        releaseEventContainer(data->container);
+        data->container = NULL;
+        return;
+    }
 
-    pthread_join(dataMic1->threadId, NULL);
-    pthread_join(dataMic2->threadId, NULL);
+    writeSegmentTimeModel(data);
+    batchWriterClose(&data->sampleFile);
+    if (data->encoder != NULL)
+    {
+        flacEncoderClose(data->encoder);
+    }
+    data->writeCalls += data->sampleFile.writeCalls;
+    data->syncCalls += data->sampleFile.syncCalls;
+    data->bytesWritten += data->sampleFile.offset;
+    if (data->timestampFile != NULL)
+    {
+        fclose(data->timestampFile);
+        data->timestampFile = NULL;
+    }
+    printf("Recording stopped: %s\n", data->fileName);
 }
 
 /**
- * @brief Cleans up the buffer queues for both microphones.
+ * @brief Fills the header of a slot with the state of the period just captured.
  *
- * @param dataMic1 Pointer to the MicData structure for microphone 1.
- * @param dataMic2 Pointer to the MicData structure for microphone 2.
+ * @param data Pointer to the microphone data structure.
+ * @param slot Slot holding the period.
+ * @param frames Number of frames in the period.
+ * @param timestamp Timestamp associated with the period.
  */
-void cleanUp(MicData *dataMic1, MicData *dataMic2)
+static void fillSlotHeader(MicData *data, PeriodSlot *slot, uint32_t frames, struct timespec timestamp)
 {
-    cleanBufferQueue(&dataMic1->bufferQueue);
-    cleanBufferQueue(&dataMic2->bufferQueue);
+    slot->timestamp = timestamp;
+    slot->frames = frames;
+    slot->flags = 0;
+    slot->frameIndex = data->periodFrame;
+    slot->model = data->timeModel;
+    slot->levels = data->levels;
+    slot->eventId = data->eventId;
+    slot->eventStart = data->eventStartNs;
 }
 
 /**
- * @brief Main function.
+ * @brief Publishes a captured period to the writer ring.
  *
- * Initializes the microphone data structures, sets up the PCM devices, and launches the recording and writing threads.
- * Waits for user input to stop recording and then starts encoding the stored files to MP4.
+ * Segment flags that could not be delivered because the ring was full are kept in
+ * pendingFlags and attached to the next period that fits, so the writer never misses
+ * a segment boundary.
  *
- * @param argc Number of command-line arguments.
- * @param argv Array of command-line arguments.
- * @return int Exit code of the program.
+ * @param data Pointer to the microphone data structure.
+ * @param slot Slot the period was read into, or NULL if the ring was full.
+ * @param frames Number of frames in the period (0 for a marker-only slot).
+ * @param timestamp Timestamp associated with the period.
+ * @return 0 if the period was published, -1 if it was dropped.
  */
-int main(int argc, char *argv[])
+int publishPeriod(MicData *data, PeriodSlot *slot, uint32_t frames, struct timespec timestamp)
 {
-    if (argc != 6) 
+    if (slot == NULL)
     {
-        fprintf(stderr, "Usage: %s <mic1_device> <mic2_device> <sample_rate> <threshold> <min_silence_time>\n", argv[0]);
-        return 1;
+        return -1;
     }
 
-    const char *mic1_device = argv[1];
-    const char *mic2_device = argv[2];
-    sample_rate = atoi(argv[3]);
-    threshold_percentage = atof(argv[4]);
-    min_silence_time = atof(argv[5]);
+    fillSlotHeader(data, slot, frames, timestamp);
+    slot->flags = data->pendingFlags;
+    periodRingCommit(&data->ring);
+    data->pendingFlags = 0;
 
-    threshold = MAX_AMPLITUDE * threshold_percentage;
-    min_silence_frames = sample_rate / FRAMES_PER_BUFFER * min_silence_time;
+    return 0;
+}
 
-    int err;
-    MicData dataMic1, dataMic2;
-    char dir1[256];
-    char dir2[256];
-    pthread_mutex_t startMutex = PTHREAD_MUTEX_INITIALIZER;
-    pthread_cond_t startCond = PTHREAD_COND_INITIALIZER;
-    int stopFlag = 0;
-    int startFlag = 0;
+/**
+ * @brief Feeds the device time model with the position of the hardware at a status timestamp.
+ *
+ * The hardware had captured every frame already consumed plus the frames still available in
+ * the buffer when the timestamp was taken.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param status Status read right after the period was captured.
+ * @param timestamp Hardware timestamp of the status.
+ */
+static void updateTimeModel(MicData *data, snd_pcm_status_t *status, struct timespec timestamp)
+{
+    uint64_t hwFrames = data->framesCaptured + snd_pcm_status_get_avail(status);
+
+    // Wakeup latency: how long after its last frame was captured the period was picked up
+    if (data->timeModel.rate > 0)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        int64_t nowNs = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+        latencyStatsAdd(&data->wakeupLatency, nowNs - timeModelFrameNs(&data->timeModel, data->periodFrame + frames_per_buffer));
+    }
+
+    timeFitAdd(&data->timeFit, hwFrames, timestamp);
+    timeFitModel(&data->timeFit, &data->timeModel);
+    sharedTimeModelPublish(&data->sharedModel, &data->timeModel);
+}
+
+/**
+ * @brief Runs the level detector on a period and checks if any sample is above the threshold.
+ *
+ * The levels are kept in the microphone data and published with the period. While the recorder
+ * is paused through the control socket no period counts as above the threshold.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param samples Samples of the period.
+ * @param frames Number of frames in the period.
+ * @return 1 if the period is above the threshold, 0 otherwise.
+ */
+static int periodAboveThreshold(MicData *data, const void *samples, snd_pcm_uframes_t frames)
+{
+    detect_period(samples, frames, atomic_load_explicit(&threshold, memory_order_relaxed), &data->levels);
+    return data->levels.firstOver >= 0 && !controlSocketPaused(&control_socket);
+}
+
+/**
+ * @brief Updates the recording state of a microphone with the result of a new period.
+ *
+ * Crossings are reported to the trigger coordinator, which decides when events start and
+ * end for all microphones. The microphone follows the active event and sets the segment
+ * flags to be attached to the next published period. Once the daemon closes its session the
+ * segment ends with this period, whatever the coordinator says.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param aboveThreshold Whether the period is above the threshold.
+ * @return 1 if the period belongs to a segment and must be published, 0 otherwise.
+ */
+static int updateRecordingState(MicData *data, int aboveThreshold)
+{
+    int64_t periodEnd = timeModelFrameNs(&data->timeModel, data->periodFrame + frames_per_buffer);
+    int64_t eventStart = 0;
+    unsigned event;
+
+    data->session = atomic_load_explicit(&session_state, memory_order_acquire);
+    if (!(data->session & 1))
+    {
+        // Between sessions of the daemon: the segment in progress ends now and periods only feed the pre-roll
+        triggerEnd(&trigger_coordinator, periodEnd);
+        if (data->recording)
+        {
+            data->recording = 0;
+            data->pendingFlags |= PERIOD_SEGMENT_END;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (aboveThreshold)
+    {
+        int64_t onset = timeModelFrameNs(&data->timeModel, data->periodFrame + data->levels.firstOver);
+        triggerReportOver(&trigger_coordinator, data->triggerIndex, onset, periodEnd);
+    }
+
+    event = triggerPoll(&trigger_coordinator, periodEnd, &eventStart);
+
+    if (data->recording && event != data->eventId)
+    {
+        data->recording = 0;
+        data->pendingFlags |= PERIOD_SEGMENT_END;
+        if (event == 0)
+        {
+            return 1;
+        }
+    }
+
+    if (!data->recording && event != 0 && event != data->eventId)
+    {
+        data->recording = 1;
+        data->eventId = event;
+        data->eventStartNs = eventStart;
+        // A new segment makes the writer close any previous file, so a pending end is implied
+        data->pendingFlags = PERIOD_SEGMENT_START;
+    }
+
+    return data->recording;
+}
+
+/**
+ * @brief Publishes an empty marker if the end of the last segment is still pending.
+ *
+ * This happens when the closing period of a segment was dropped because the ring was full.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param timestamp Timestamp of the current period.
+ */
+static void publishPendingEnd(MicData *data, struct timespec timestamp)
+{
+    if (!data->recording && (data->pendingFlags & PERIOD_SEGMENT_END))
+    {
+        publishPeriod(data, periodRingAcquire(&data->ring), 0, timestamp);
+    }
+}
+
+/**
+ * @brief Checks if the period that just fired the trigger must be delivered through the pre-roll.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @return 1 if a segment starts with this period and the pre-roll is enabled, 0 otherwise.
+ */
+static int triggerUsesPreRoll(const MicData *data)
+{
+    return data->preRoll.capacity > 0 && (data->pendingFlags & PERIOD_SEGMENT_START);
+}
+
+/**
+ * @brief Keeps a period in the pre-roll, overwriting the oldest one.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param samples Samples of the period.
+ * @param timestamp Timestamp associated with the period.
+ */
+static void storePreRoll(MicData *data, const void *samples, struct timespec timestamp)
+{
+    PeriodSlot *slot = preRollStore(&data->preRoll);
+
+    if (slot != NULL)
+    {
+        memcpy(periodSlotData(slot), samples, frames_per_buffer * sample_bytes);
+        fillSlotHeader(data, slot, frames_per_buffer, timestamp);
+    }
+}
+
+/**
+ * @brief Starts a segment with the periods kept in the pre-roll.
+ *
+ * Periods that ended before the start of the event are skipped. The segment flags go on the
+ * oldest period left that fits in the writer ring.
+ *
+ * @param data Pointer to the microphone data structure.
+ */
+static void flushPreRoll(MicData *data)
+{
+    for (size_t i = 0; i < data->preRoll.count; i++)
+    {
+        PeriodSlot *source = preRollGet(&data->preRoll, i);
+        if (timeModelFrameNs(&source->model, source->frameIndex + source->frames) <= data->eventStartNs)
+        {
+            continue;
+        }
+
+        PeriodSlot *slot = periodRingAcquire(&data->ring);
+        if (slot == NULL)
+        {
+            continue;
+        }
+        memcpy(slot, source, PERIOD_SLOT_HEADER_BYTES + source->frames * sample_bytes);
+        slot->flags = data->pendingFlags;
+        slot->eventId = data->eventId;
+        slot->eventStart = data->eventStartNs;
+        periodRingCommit(&data->ring);
+        data->pendingFlags = 0;
+    }
+    preRollClear(&data->preRoll);
+}
+
+/**
+ * @brief Delivers a captured period according to the recording state.
+ *
+ * Periods of a segment are published to the writer ring. When a segment starts, the pre-roll
+ * and the period that fired the trigger are published first. Periods outside a segment are
+ * kept in the pre-roll. With --live every period also goes to the live ring, recorded or not.
+ * Between sessions of the daemon, the capture thread acknowledges the closed session once the
+ * end of its last segment is in the ring.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param slot Ring slot already holding the samples, or NULL.
+ * @param samples Samples of the period.
+ * @param keep Whether the period belongs to a segment.
+ * @param timestamp Timestamp associated with the period.
+ */
+static void deliverPeriod(MicData *data, PeriodSlot *slot, const void *samples, int keep, struct timespec timestamp)
+{
+    if (data->live.header != NULL)
+    {
+        uint32_t flags = (data->levels.firstOver >= 0 ? LIVE_PERIOD_OVER : 0) | (keep ? LIVE_PERIOD_RECORDING : 0);
+        liveRingPublish(&data->live, samples, frames_per_buffer, data->periodFrame, timestamp, flags, data->levels.peak);
+    }
+
+    if (keep && triggerUsesPreRoll(data))
+    {
+        storePreRoll(data, samples, timestamp);
+        flushPreRoll(data);
+    }
+    else if (keep)
+    {
+        publishPeriod(data, slot, frames_per_buffer, timestamp);
+    }
+    else
+    {
+        storePreRoll(data, samples, timestamp);
+        publishPendingEnd(data, timestamp);
+    }
+
+    if (!(data->session & 1) && !(data->pendingFlags & PERIOD_SEGMENT_END))
+    {
+        // Nothing of the closed session is left to publish: the daemon only waits for the writer now
+        atomic_store_explicit(&data->sessionAck, data->session, memory_order_release);
+    }
+}
+
+/**
+ * @brief Notes an XRUN on a microphone.
+ *
+ * The time model is kept, so the frames lost can be measured on the device clock once
+ * capture resumes. The frames of a partially gathered period are lost too.
+ *
+ * @param data Pointer to the microphone data structure.
+ */
+static void beginXrun(MicData *data)
+{
+    fprintf(stderr, "XRUN on %s.\n", data->micName);
+    atomic_fetch_add_explicit(&data->xruns, 1, memory_order_relaxed);
+    data->framesCaptured = data->periodFrame;
+    data->xrunPending = 1;
+    preRollClear(&data->preRoll);
+    if (data->timeModel.rate <= 0)
+    {
+        // Nothing to measure the gap against: the frame count restarts with a new fit
+        timeFitReset(&data->timeFit);
+    }
+}
+
+/**
+ * @brief Measures the frames lost to an XRUN with the first status after capture resumed.
+ *
+ * The frame count is advanced by the frames lost, so frame indexes keep following the
+ * device clock and the writer can fill the gap.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param status Status read after the first period captured since the XRUN.
+ * @param timestamp Hardware timestamp of the status.
+ */
+static void accountXrun(MicData *data, snd_pcm_status_t *status, struct timespec timestamp)
+{
+    if (!data->xrunPending)
+    {
+        return;
+    }
+    data->xrunPending = 0;
+    if (data->timeModel.rate <= 0)
+    {
+        return;
+    }
+
+    double elapsed = (timestamp.tv_sec - data->timeModel.anchorTime.tv_sec) + (timestamp.tv_nsec - data->timeModel.anchorTime.tv_nsec) / 1e9;
+    double deviceFrame = data->timeModel.anchorFrame + elapsed * data->timeModel.rate;
+    double lost = deviceFrame - (double)(data->framesCaptured + snd_pcm_status_get_avail(status));
+    if (lost >= 0.5)
+    {
+        uint64_t frames = (uint64_t)llround(lost);
+        data->framesCaptured += frames;
+        data->periodFrame += frames;
+        atomic_fetch_add_explicit(&data->xrunLostFrames, frames, memory_order_relaxed);
+        if (data->recording)
+        {
+            data->pendingFlags |= PERIOD_AFTER_XRUN;
+        }
+    }
+}
+
+/**
+ * @brief Hands a period read with snd_pcm_readi to the time model, the trigger and the writer.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param slot Ring slot the period was read into, or NULL if it was read into the scratch buffer.
+ * @param buffer Samples of the period.
+ * @param status Status read right after the period.
+ * @param hw_timestamp Hardware timestamp of the status.
+ */
+static void completePeriod(MicData *data, PeriodSlot *slot, const void *buffer, snd_pcm_status_t *status, struct timespec hw_timestamp)
+{
+    int keep;
+
+    data->framesCaptured += frames_per_buffer;
+    data->lastTimestamp = hw_timestamp;
+    accountXrun(data, status, hw_timestamp);
+    updateTimeModel(data, status, hw_timestamp);
+
+    keep = updateRecordingState(data, periodAboveThreshold(data, buffer, frames_per_buffer));
+    deliverPeriod(data, slot, buffer, keep, hw_timestamp);
+}
+
+/**
+ * @brief Captures one period with snd_pcm_readi.
+ *
+ * The period is read straight into the next free slot of the writer ring, so the only
+ * copy is the one made by the kernel. Periods outside a segment are copied into the pre-roll.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param status Status structure used to read the hardware timestamp.
+ * @return 0 on success or recoverable error, -1 on fatal error.
+ */
+static int capturePeriodReadi(MicData *data, snd_pcm_status_t *status)
+{
+    PeriodSlot *slot = periodRingAcquire(&data->ring);
+    void *buffer = slot != NULL ? periodSlotData(slot) : data->scratch;
+    struct timespec hw_timestamp;
+    int pcm;
+
+    data->periodFrame = data->framesCaptured;
+    pcm = snd_pcm_readi(data->pcm_handle, buffer, frames_per_buffer);
+    if (pcm == -EPIPE)
+    {
+        beginXrun(data);
+        snd_pcm_prepare(data->pcm_handle);
+        return 0;
+    }
+    else if (pcm == -EAGAIN)
+    {
+        return 0;
+    }
+    else if (pcm < 0)
+    {
+        fprintf(stderr, "ERROR: Can't read from PCM device. %s\n", snd_strerror(pcm));
+        return -1;
+    }
+    else if (pcm != frames_per_buffer)
+    {
+        fprintf(stderr, "Short read: read %d frames\n", pcm);
+        data->framesCaptured += pcm;
+        return 0;
+    }
+
+    snd_pcm_status(data->pcm_handle, status);
+    snd_pcm_status_get_htstamp(status, &hw_timestamp);
+    completePeriod(data, slot, buffer, status, hw_timestamp);
+
+    return 0;
+}
+
+/**
+ * @brief Captures one period of every channel of a multichannel device with snd_pcm_readi.
+ *
+ * The interleaved period is read once and split into the ring slot of each channel, so every
+ * channel goes through the trigger and the writer like a microphone of its own. All of them
+ * share the status and the hardware timestamp of the read, since they share the sample clock.
+ *
+ * @param mics Array of the microphones of the device, one per channel.
+ * @param channels Number of channels.
+ * @param status Status structure used to read the hardware timestamp.
+ * @return 0 on success or recoverable error, -1 on fatal error.
+ */
+static int captureChannelsReadi(MicData *mics, int channels, snd_pcm_status_t *status)
+{
+    PeriodSlot *slots[MAX_MICS];
+    void *planes[MAX_MICS];
+    struct timespec hw_timestamp;
+    int pcm;
+
+    for (int c = 0; c < channels; c++)
+    {
+        slots[c] = periodRingAcquire(&mics[c].ring);
+        planes[c] = slots[c] != NULL ? periodSlotData(slots[c]) : mics[c].scratch;
+        mics[c].periodFrame = mics[c].framesCaptured;
+    }
+
+    pcm = snd_pcm_readi(mics[0].pcm_handle, interleaved_buffer, frames_per_buffer);
+    if (pcm == -EPIPE)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            beginXrun(&mics[c]);
+        }
+        snd_pcm_prepare(mics[0].pcm_handle);
+        return 0;
+    }
+    else if (pcm == -EAGAIN)
+    {
+        return 0;
+    }
+    else if (pcm < 0)
+    {
+        fprintf(stderr, "ERROR: Can't read from PCM device. %s\n", snd_strerror(pcm));
+        return -1;
+    }
+    else if (pcm != frames_per_buffer)
+    {
+        fprintf(stderr, "Short read: read %d frames\n", pcm);
+        for (int c = 0; c < channels; c++)
+        {
+            mics[c].framesCaptured += pcm;
+        }
+        return 0;
+    }
+
+    deinterleave(interleaved_buffer, planes, channels, frames_per_buffer, sample_bytes);
+    snd_pcm_status(mics[0].pcm_handle, status);
+    snd_pcm_status_get_htstamp(status, &hw_timestamp);
+    for (int c = 0; c < channels; c++)
+    {
+        completePeriod(&mics[c], slots[c], planes[c], status, hw_timestamp);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Captures one period through the mmap interface.
+ *
+ * The threshold is evaluated directly on the DMA area and the period is only copied, once,
+ * into the writer ring when it belongs to a segment or into the pre-roll when it does not.
+ * If the period wraps around the end of
+ * the DMA buffer it is gathered into the ring slot first and evaluated there.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param status Status structure used to read the hardware timestamp.
+ * @return 0 on success or recoverable error, -1 on fatal error.
+ */
+static int capturePeriodMmap(MicData *data, snd_pcm_status_t *status)
+{
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset, chunk, gathered = 0;
+    snd_pcm_sframes_t avail;
+    PeriodSlot *slot = NULL;
+    unsigned char *period = NULL;
+    struct timespec hw_timestamp;
+    int err, keep;
+
+    data->periodFrame = data->framesCaptured;
+
+    while (gathered < (snd_pcm_uframes_t)frames_per_buffer)
+    {
+        avail = snd_pcm_avail_update(data->pcm_handle);
+        if (avail < 0)
+        {
+            if (avail == -EPIPE)
+            {
+                beginXrun(data);
+            }
+            else
+            {
+                // Suspended or failed: the frame count no longer matches the device clock
+                timeFitReset(&data->timeFit);
+                preRollClear(&data->preRoll);
+            }
+            if ((err = snd_pcm_recover(data->pcm_handle, (int)avail, 1)) < 0)
+            {
+                fprintf(stderr, "ERROR: Can't recover PCM device. %s\n", snd_strerror(err));
+                return -1;
+            }
+            return 0;
+        }
+
+        if ((snd_pcm_uframes_t)avail < frames_per_buffer - gathered)
+        {
+            // Capture through mmap is not started implicitly by a read
+            if (snd_pcm_state(data->pcm_handle) == SND_PCM_STATE_PREPARED)
+            {
+                snd_pcm_start(data->pcm_handle);
+            }
+            if (*data->stopFlag)
+            {
+                return 0;
+            }
+            snd_pcm_wait(data->pcm_handle, 100);
+            continue;
+        }
+
+        chunk = frames_per_buffer - gathered;
+        if ((err = snd_pcm_mmap_begin(data->pcm_handle, &areas, &offset, &chunk)) < 0)
+        {
+            fprintf(stderr, "ERROR: Can't access the mmap area. %s\n", snd_strerror(err));
+            return -1;
+        }
+
+        const unsigned char *dma = (const unsigned char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+
+        if (gathered == 0 && chunk == (snd_pcm_uframes_t)frames_per_buffer)
+        {
+            // Common case: the whole period is contiguous in the DMA buffer
+            snd_pcm_status(data->pcm_handle, status);
+            snd_pcm_status_get_htstamp(status, &hw_timestamp);
+            data->lastTimestamp = hw_timestamp;
+            accountXrun(data, status, hw_timestamp);
+            updateTimeModel(data, status, hw_timestamp);
+
+            keep = updateRecordingState(data, periodAboveThreshold(data, dma, frames_per_buffer));
+            if (keep && !triggerUsesPreRoll(data) && (slot = periodRingAcquire(&data->ring)) != NULL)
+            {
+                memcpy(periodSlotData(slot), dma, frames_per_buffer * sample_bytes);
+            }
+            deliverPeriod(data, slot, dma, keep, hw_timestamp);
+            snd_pcm_mmap_commit(data->pcm_handle, offset, chunk);
+            data->framesCaptured += chunk;
+            return 0;
+        }
+
+        // The period wraps around the end of the DMA buffer: gather it piece by piece
+        if (period == NULL)
+        {
+            slot = periodRingAcquire(&data->ring);
+            period = slot != NULL ? periodSlotData(slot) : data->scratch;
+        }
+        memcpy(period + gathered * sample_bytes, dma, chunk * sample_bytes);
+        snd_pcm_mmap_commit(data->pcm_handle, offset, chunk);
+        data->framesCaptured += chunk;
+        gathered += chunk;
+    }
+
+    snd_pcm_status(data->pcm_handle, status);
+    snd_pcm_status_get_htstamp(status, &hw_timestamp);
+    data->lastTimestamp = hw_timestamp;
+    accountXrun(data, status, hw_timestamp);
+    updateTimeModel(data, status, hw_timestamp);
+
+    keep = updateRecordingState(data, periodAboveThreshold(data, period, frames_per_buffer));
+    deliverPeriod(data, slot, period, keep, hw_timestamp);
+
+    return 0;
+}
+
+/**
+ * @brief Blocks until recording is started or stopped.
+ *
+ * @param data Pointer to the microphone data structure.
+ */
+static void waitForStart(MicData *data)
+{
+    pthread_mutex_lock(data->startMutex);
+    while (!(*data->startFlag) && !(*data->stopFlag))
+    {
+        pthread_cond_wait(data->startCond, data->startMutex);
+    }
+    pthread_mutex_unlock(data->startMutex);
+}
+
+/**
+ * @brief Returns the seconds elapsed since a CLOCK_MONOTONIC instant.
+ *
+ * @param start Start instant.
+ * @return Elapsed seconds.
+ */
+static double secondsSince(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Closes the capture side of a microphone.
+ *
+ * Delivers the end of an open segment to the writer, stops the ring and closes the PCM device.
+ * The channels of a multichannel device share its handle, which is closed by the first one.
+ *
+ * @param data Pointer to the microphone data structure.
+ */
+static void finishCapture(MicData *data)
+{
+    if (data->recording || (data->pendingFlags & PERIOD_SEGMENT_END))
+    {
+        data->recording = 0;
+        data->pendingFlags |= PERIOD_SEGMENT_END;
+        while (publishPeriod(data, periodRingAcquire(&data->ring), 0, data->lastTimestamp) != 0)
+        {
+            usleep(1000);
+        }
+    }
+    periodRingStop(&data->ring);
+
+    if (data->channel == 0)
+    {
+        snd_pcm_close(data->pcm_handle);
+    }
+}
+
+/**
+ * @brief Applies the real-time settings to the calling capture thread.
+ *
+ * @param label Name of the capture thread.
+ * @param cpu CPU to pin the thread to, or -1.
+ */
+static void configureCaptureThread(const char *label, int cpu)
+{
+    realtimeConfigureThread(label, realtime_priority, cpu);
+    if (realtime_priority > 0)
+    {
+        realtimePrefaultStack();
+    }
+}
+
+/**
+ * @brief Records audio from a microphone.
+ * 
+ * This functions handles the recording logic for each microphone, capturing with snd_pcm_readi
+ * or through the mmap interface depending on how the device was configured.
+ *
+ * @param arg Pointer to the microphone data structure.
+ * @return NULL.
+ */
+void *recordAudio(void *arg)
+{
+    MicData *data = (MicData *)arg;
+    struct timespec start;
+    snd_pcm_status_t *status;
+    snd_pcm_status_alloca(&status);
+    char label[32];
+
+    snprintf(label, sizeof(label), "Capture %s", data->micName);
+    configureCaptureThread(label, data->captureCpu);
+    waitForStart(data);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (!(*data->stopFlag))
+    {
+        int err = data->useMmap ? capturePeriodMmap(data, status) : capturePeriodReadi(data, status);
+        if (err != 0)
+        {
+            break;
+        }
+        data->wakeups++;
+    }
+
+    getrusage(RUSAGE_THREAD, &data->captureUsage);
+    data->captureSeconds = secondsSince(&start);
+    finishCapture(data);
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Records every channel of a multichannel device.
+ *
+ * One thread reads the device and splits each period into the channels, so the capture cost
+ * of the device does not grow with the number of inputs.
+ *
+ * @param arg Array of the microphones of the device, device_channels of them.
+ * @return NULL.
+ */
+void *recordChannels(void *arg)
+{
+    MicData *mics = (MicData *)arg;
+    unsigned long wakeups = 0;
+    struct rusage usage;
+    struct timespec start;
+    snd_pcm_status_t *status;
+    snd_pcm_status_alloca(&status);
+
+    configureCaptureThread("Capture (channels)", mics[0].captureCpu);
+    waitForStart(&mics[0]);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (!(*mics[0].stopFlag))
+    {
+        if (captureChannelsReadi(mics, device_channels, status) != 0)
+        {
+            break;
+        }
+        wakeups++;
+    }
+
+    getrusage(RUSAGE_THREAD, &usage);
+    for (int c = 0; c < device_channels; c++)
+    {
+        mics[c].captureUsage = usage;
+        mics[c].captureSeconds = secondsSince(&start);
+        mics[c].wakeups = wakeups;
+        finishCapture(&mics[c]);
+    }
+
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Records audio from every microphone in a single thread.
+ *
+ * The PCM devices are opened in non-blocking mode and multiplexed with poll() on their
+ * descriptors, so the number of capture threads does not grow with the number of
+ * microphones and the periods of all devices are serviced in the same loop iteration.
+ *
+ * @param arg Array of pointers to the microphone data structures, terminated by NULL.
+ * @return NULL.
+ */
+void *recordAllMics(void *arg)
+{
+    MicData **mics = (MicData **)arg;
+    struct pollfd fds[MAX_POLL_FDS];
+    int fdStart[MAX_MICS], fdCount[MAX_MICS], active[MAX_MICS];
+    int micCount = 0, totalFds = 0, activeCount = 0;
+    unsigned long wakeups = 0;
+    struct rusage usage;
+    struct timespec start;
+    snd_pcm_status_t *status;
+    snd_pcm_status_alloca(&status);
+
+    while (micCount < MAX_MICS && mics[micCount] != NULL)
+    {
+        MicData *data = mics[micCount];
+        int count = snd_pcm_poll_descriptors_count(data->pcm_handle);
+        if (count <= 0 || totalFds + count > MAX_POLL_FDS)
+        {
+            fprintf(stderr, "ERROR: Can't poll %s PCM device.\n", data->micName);
+            count = 0;
+        }
+        else
+        {
+            snd_pcm_poll_descriptors(data->pcm_handle, &fds[totalFds], count);
+        }
+        fdStart[micCount] = totalFds;
+        fdCount[micCount] = count;
+        active[micCount] = count > 0;
+        activeCount += active[micCount];
+        totalFds += count;
+        micCount++;
+    }
+
+    configureCaptureThread("Capture (poll)", mics[0]->captureCpu);
+    waitForStart(mics[0]);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (!(*mics[0]->stopFlag) && activeCount > 0)
+    {
+        for (int i = 0; i < micCount; i++)
+        {
+            // Capture is never started by poll(): start it explicitly, also after recovering from an XRUN
+            if (active[i] && snd_pcm_state(mics[i]->pcm_handle) == SND_PCM_STATE_PREPARED)
+            {
+                snd_pcm_start(mics[i]->pcm_handle);
+            }
+        }
+
+        if (poll(fds, totalFds, 100) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error polling PCM devices");
+            break;
+        }
+        wakeups++;
+
+        for (int i = 0; i < micCount; i++)
+        {
+            MicData *data = mics[i];
+            unsigned short revents = 0;
+
+            if (!active[i])
+            {
+                continue;
+            }
+
+            snd_pcm_poll_descriptors_revents(data->pcm_handle, &fds[fdStart[i]], fdCount[i], &revents);
+            if (!(revents & (POLLIN | POLLERR)))
+            {
+                continue;
+            }
+
+            // Drain every complete period; a negative avail is an error handled by the capture functions
+            for (;;)
+            {
+                snd_pcm_sframes_t avail = snd_pcm_avail_update(data->pcm_handle);
+                if (avail >= 0 && avail < frames_per_buffer)
+                {
+                    break;
+                }
+                if ((data->useMmap ? capturePeriodMmap(data, status) : capturePeriodReadi(data, status)) != 0)
+                {
+                    active[i] = 0;
+                    activeCount--;
+                    break;
+                }
+                if (avail < 0)
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    getrusage(RUSAGE_THREAD, &usage);
+    for (int i = 0; i < micCount; i++)
+    {
+        mics[i]->captureUsage = usage;
+        mics[i]->captureSeconds = secondsSince(&start);
+        mics[i]->wakeups = wakeups;
+        finishCapture(mics[i]);
+    }
+
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Number of frames at the beginning of a period captured before its event started.
+ *
+ * @param slot Slot of the period.
+ * @return Frames to skip so the segment starts at the start time of the event.
+ */
+static uint32_t framesBeforeEventStart(const PeriodSlot *slot)
+{
+    if (slot->model.rate <= 0 || slot->frames == 0)
+    {
+        return 0;
+    }
+
+    int64_t first = timeModelFrameNs(&slot->model, slot->frameIndex);
+    if (slot->eventStart <= first)
+    {
+        return 0;
+    }
+
+    double frames = ceil((slot->eventStart - first) * slot->model.rate / 1e9);
+    return frames >= slot->frames ? slot->frames : (uint32_t)frames;
+}
+
+/**
+ * @brief Starts a segment on the sample grid of the reference microphone.
+ *
+ * The first output sample is the first reference frame captured after the segment started.
+ * If the reference has no time model yet the segment is written unaligned.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param slot Slot that starts the segment.
+ * @param skip Frames of the slot before the start of the segment.
+ */
+static void startAlignedSegment(MicData *data, const PeriodSlot *slot, uint32_t skip)
+{
+    TimeModel reference;
+
+    sharedTimeModelRead(&data->clockReference->sharedModel, &reference);
+    data->segmentAligned = data->resampler != NULL && reference.rate > 0 && slot->model.rate > 0;
+    if (!data->segmentAligned)
+    {
+        return;
+    }
+
+    data->segmentOutFrame = (uint64_t)ceil(timeModelMapFrame(&slot->model, &reference, slot->frameIndex + skip));
+    data->segmentFirstFrame = data->segmentOutFrame;
+    resamplerReset(data->resampler, slot->frameIndex);
+}
+
+/**
+ * @brief Resamples a period onto the sample grid of the reference microphone and writes it.
+ *
+ * Every output sample n is interpolated at the position of this device's stream that was
+ * captured at the same time as frame n of the reference, so both files share one clock.
+ * Dropped periods come out as silence, keeping the alignment.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param slot Slot to write (may be an empty end marker).
+ */
+static void writeAlignedPeriod(MicData *data, PeriodSlot *slot)
+{
+    float aligned[ALIGN_BUFFER_FRAMES];
+    TimeModel reference;
+    size_t produced;
+
+    if (slot->frames > 0)
+    {
+        resamplerPush(data->resampler, slot->frameIndex, periodSlotData(slot), slot->frames, sample_format);
+    }
+    if (slot->flags & PERIOD_SEGMENT_END)
+    {
+        resamplerFlush(data->resampler);
+    }
+
+    sharedTimeModelRead(&data->clockReference->sharedModel, &reference);
+    double step = slot->model.rate / reference.rate;
+
+    do
+    {
+        double position = timeModelMapFrame(&reference, &slot->model, data->segmentOutFrame);
+        produced = resamplerPull(data->resampler, position, step, aligned, ALIGN_BUFFER_FRAMES, sample_format);
+        writeSegmentSamples(data, aligned, produced, 1);
+        data->segmentOutFrame += produced;
+        data->segmentFrames += produced;
+    } while (produced == ALIGN_BUFFER_FRAMES);
+
+    data->segmentModel = reference;
+}
+
+/**
+ * @brief Adds the levels of a period to the levels of the segment being written.
+ *
+ * The onset of the segment is the time of the first sample over the threshold, taken from
+ * the device time model so it is sample accurate.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param slot Slot with the period and its levels.
+ */
+static void accumulateSegmentLevels(MicData *data, const PeriodSlot *slot)
+{
+    if (slot->levels.peak > data->segmentPeak)
+    {
+        data->segmentPeak = slot->levels.peak;
+    }
+    data->segmentEnergy += slot->levels.sumSquares;
+    data->segmentEnergyFrames += slot->frames;
+
+    if (!data->segmentOnsetFound && slot->levels.firstOver >= 0)
+    {
+        data->segmentOnsetFound = 1;
+        if (slot->model.rate > 0)
+        {
+            timeModelFrameTime(&slot->model, slot->frameIndex + slot->levels.firstOver, &data->segmentOnset);
+        }
+        else
+        {
+            data->segmentOnset = slot->timestamp;
+        }
+    }
+}
+
+/**
+ * @brief Records the frames missing before a period and, for unaligned segments, zero-fills them.
+ *
+ * Filling keeps sample i of the file at t0 + i / rate, so the segment stays aligned with the
+ * other microphone after an XRUN. A timestamp line is written for every whole period filled,
+ * so the timestamp file keeps one line per period. Aligned segments come out of the
+ * resampler already filled with silence.
+ *
+ * @param data Pointer to the microphone data structure.
+ * @param slot Slot about to be written.
+ */
+static void fillSegmentGap(MicData *data, const PeriodSlot *slot)
+{
+    static const unsigned char zeros[4096];
+    uint64_t frames, filled, maxFill = (uint64_t)MAX_GAP_FILL_SECONDS * sample_rate;
+
+    if (slot->frameIndex <= data->segmentNextFrame)
+    {
+        return;
+    }
+
+    frames = slot->frameIndex - data->segmentNextFrame;
+    filled = data->segmentAligned ? 0 : frames < maxFill ? frames : maxFill;
+    if (data->segmentGapCount < MAX_SEGMENT_GAPS)
+    {
+        SegmentGap *gap = &data->segmentGaps[data->segmentGapCount];
+        gap->offset = data->segmentFrames;
+        gap->frames = frames;
+        gap->filled = data->segmentAligned ? frames : filled;
+        gap->xrun = (slot->flags & PERIOD_AFTER_XRUN) != 0;
+    }
+    data->segmentGapCount++;
+
+    for (uint64_t done = 0; done < filled;)
+    {
+        size_t chunk = sizeof(zeros) / sample_bytes;
+        if (chunk > filled - done)
+        {
+            chunk = filled - done;
+        }
+        writeSegmentSamples(data, zeros, chunk, 0);
+        done += chunk;
+    }
+    for (uint64_t period = 0; period < filled / frames_per_buffer; period++)
+    {
+        struct timespec time = slot->timestamp;
+        if (slot->model.rate > 0)
+        {
+            timeModelFrameTime(&slot->model, data->segmentNextFrame + period * frames_per_buffer, &time);
+        }
+        writeSegmentTimestamp(data, time, data->segmentFrames + period * frames_per_buffer, TIMESTAMP_RECORD_FILLED);
+    }
+    data->segmentFrames += filled;
+}
+
+/**
+ * @brief Writes the samples queued by the periods of a batch.
+ *
+ * @param data Pointer to the microphone data structure.
+ */
+static void flushSegmentWrites(MicData *data)
+{
+    if (data->segmentOpen && data->container == NULL)
+    {
+        batchWriterFlush(&data->sampleFile);
+    }
+}
+
+/**
+ * @brief Writes every period available in the ring of a microphone.
+ *
+ * Opens and closes files at the segment boundaries marked by the capture thread. The periods are
+ * written straight from their slots with a single writev, and the slots are released together
+ * once it is done, in batches of WRITE_BATCH_PERIODS so a long backlog does not keep the ring full.
+ * At most a quarter of the ring is drained per call.
+ *
+ * @param data Pointer to the MicData structure.
+ * @return Number of periods drained.
+ */
+static size_t drainMicRing(MicData *data)
+{
+    PeriodSlot *slot;
+    uint32_t skip;
+    size_t held = 0, drained = 0;
+
+    // Bounded so the backlog of one microphone does not starve the others sharing the writer
+    while (drained < data->ring.capacity / 4 && (slot = periodRingPeekAt(&data->ring, held)) != NULL)
+    {
+        drained++;
+        skip = 0;
+        if (slot->flags & PERIOD_SEGMENT_START)
+        {
+            if (data->segmentOpen)
+            {
+                closeFilesForRecording(data);
+            }
+            openFilesForRecording(data, slot->eventId, slot->eventStart);
+            // Every microphone starts the segment at the start time of the event
+            skip = framesBeforeEventStart(slot);
+            data->segmentEventStart = slot->eventStart;
+            data->segmentFirstFrame = slot->frameIndex + skip;
+            data->segmentFrames = 0;
+            data->segmentNextFrame = slot->frameIndex;
+            data->segmentGapCount = 0;
+            data->segmentAligned = 0;
+            data->segmentPeak = 0;
+            data->segmentEnergy = 0;
+            data->segmentEnergyFrames = 0;
+            data->segmentOnsetFound = 0;
+            if (data->clockReference != NULL)
+            {
+                startAlignedSegment(data, slot, skip);
+            }
+        }
+
+        if (data->clockReference != NULL && slot->model.rate > 0)
+        {
+            TimeModel reference;
+            sharedTimeModelRead(&data->clockReference->sharedModel, &reference);
+            if (reference.rate > 0)
+            {
+                data->driftPpm = timeModelDriftPpm(&slot->model, &reference);
+            }
+        }
+
+        if (data->segmentOpen && slot->frames > 0)
+        {
+            accumulateSegmentLevels(data, slot);
+            fillSegmentGap(data, slot);
+            data->segmentNextFrame = slot->frameIndex + slot->frames;
+        }
+
+        if (data->segmentOpen && data->segmentAligned)
+        {
+            uint64_t offset = data->segmentFrames;
+            writeAlignedPeriod(data, slot);
+            if (slot->frames > 0)
+            {
+                writeSegmentTimestamp(data, slot->timestamp, offset, 0);
+            }
+        }
+        else if (data->segmentOpen)
+        {
+            data->segmentModel = slot->model;
+            if (slot->frames > skip)
+            {
+                writeSegmentTimestamp(data, slot->timestamp, data->segmentFrames, 0);
+                data->segmentFrames += slot->frames - skip;
+                writeSegmentSamples(data, (unsigned char *)periodSlotData(slot) + skip * sample_bytes, slot->frames - skip, 0);
+            }
+        }
+
+        if ((slot->flags & PERIOD_SEGMENT_END) && data->segmentOpen)
+        {
+            closeFilesForRecording(data);
+        }
+
+        if (++held == WRITE_BATCH_PERIODS)
+        {
+            flushSegmentWrites(data);
+            periodRingReleaseMany(&data->ring, held);
+            held = 0;
+        }
+    }
+    flushSegmentWrites(data);
+    periodRingReleaseMany(&data->ring, held);
+
+    return drained;
+}
+
+/**
+ * @brief Thread function for writing to files.
+ * 
+ * A single writer drains the rings of several microphones, so the number of threads does not grow
+ * with the size of the array. It sleeps on all the rings at once and, while it keeps up, only wakes
+ * up every WRITE_INTERVAL_MS, so each writev carries a batch of periods.
+ *
+ * @param arg Pointer to the WriterThread structure.
+ * @return NULL.
+ */
+void *writeAudioToFile(void *arg)
+{
+    WriterThread *writer = (WriterThread *)arg;
+    char label[32];
+
+    // Writers keep the default scheduler: they only need to keep up on average
+    snprintf(label, sizeof(label), "Writer %d", writer->index + 1);
+    realtimeConfigureThread(label, 0, writer->cpu);
+
+    while (periodRingWaitAny(writer->rings, writer->micCount, -1) >= 0)
+    {
+        size_t drained = 0;
+        for (int i = 0; i < writer->micCount; i++)
+        {
+            drained += drainMicRing(writer->mics[i]);
+        }
+
+        // Waking up for every period would mean one small write each: sleep so the next wakeup has a batch
+        if (drained < WRITE_BATCH_PERIODS)
+        {
+            usleep(WRITE_INTERVAL_MS * 1000);
+        }
+    }
+
+    for (int i = 0; i < writer->micCount; i++)
+    {
+        if (writer->mics[i]->segmentOpen)
+        {
+            closeFilesForRecording(writer->mics[i]);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Sets up the PCM device for audio capture.
+ *
+ * This function configures the PCM device with the specified parameters for audio capture, including 
+ * sample format, sample rate, channels, and latency. It also sets the timestamp mode and type for the PCM device.
+ * If mmap capture was requested and the device refuses it, it falls back to snd_pcm_readi.
+ *
+ * @param data Pointer to the MicData structure that holds the PCM handle.
+ * @param device Name of the PCM device to be opened.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int setup_pcm(MicData *data, const char *device)
+{
+    snd_pcm_hw_params_t *params;
+    snd_pcm_hw_params_alloca(&params);
+    snd_pcm_uframes_t frames = frames_per_buffer;
+    unsigned int rate = sample_rate;
+    unsigned int latency = latency_us;
+    snd_pcm_format_t format = sample_format == SAMPLE_S16 ? SND_PCM_FORMAT_S16_LE : sample_format == SAMPLE_S32 ? SND_PCM_FORMAT_S32_LE : SND_PCM_FORMAT_FLOAT_LE;
+    int err;
+
+    snprintf(data->deviceName, sizeof(data->deviceName), "%s", device);
+    if ((err = snd_pcm_open(&data->pcm_handle, device, SND_PCM_STREAM_CAPTURE, use_poll ? SND_PCM_NONBLOCK : 0)) < 0)
+    {
+        fprintf(stderr, "ERROR: Can't open \"%s\" PCM device. %s\n", device, snd_strerror(err));
+        return err;
+    }
+
+    snd_pcm_hw_params_any(data->pcm_handle, params);
+    if (data->useMmap && snd_pcm_hw_params_set_access(data->pcm_handle, params, SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0)
+    {
+        fprintf(stderr, "WARNING: \"%s\" does not support mmap access, falling back to read.\n", device);
+        data->useMmap = 0;
+    }
+    if (!data->useMmap)
+    {
+        snd_pcm_hw_params_set_access(data->pcm_handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+    }
+    if ((err = snd_pcm_hw_params_set_format(data->pcm_handle, params, format)) < 0)
+    {
+        fprintf(stderr, "ERROR: \"%s\" does not support the %s format. %s\n", device, sampleFormatName(sample_format), snd_strerror(err));
+        return err;
+    }
+    if ((err = snd_pcm_hw_params_set_channels(data->pcm_handle, params, device_channels)) < 0)
+    {
+        fprintf(stderr, "ERROR: \"%s\" can't capture %d channel%s. %s\n", device, device_channels, device_channels > 1 ? "s" : "", snd_strerror(err));
+        return err;
+    }
+    snd_pcm_hw_params_set_rate_near(data->pcm_handle, params, &rate, 0);
+    snd_pcm_hw_params_set_period_size_near(data->pcm_handle, params, &frames, 0);
+    snd_pcm_hw_params_set_buffer_time_near(data->pcm_handle, params, &latency, 0);
+    if ((err = snd_pcm_hw_params(data->pcm_handle, params)) < 0)
+    {
+        fprintf(stderr, "ERROR: Can't set hardware parameters for PCM device. %s\n", snd_strerror(err));
+        return err;
+    }
+
+    snd_pcm_sw_params_t *swparams;
+    snd_pcm_sw_params_alloca(&swparams);
+    snd_pcm_sw_params_current(data->pcm_handle, swparams);
+    snd_pcm_sw_params_set_tstamp_mode(data->pcm_handle, swparams, SND_PCM_TSTAMP_ENABLE);
+    snd_pcm_sw_params_set_tstamp_type(data->pcm_handle, swparams, SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY);
+    snd_pcm_sw_params_set_avail_min(data->pcm_handle, swparams, frames_per_buffer);
+    if ((err = snd_pcm_sw_params(data->pcm_handle, swparams)) < 0)
+    {
+        fprintf(stderr, "ERROR: Can't set software parameters for PCM device. %s\n", snd_strerror(err));
+        return err;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Links the capture devices so they start, stop and prepare together.
+ *
+ * Every device is linked to the first one. If any of them refuses, the ones already linked are
+ * unlinked again and the start skew is measured instead.
+ *
+ * @param mics Array of microphones.
+ * @param micCount Number of microphones.
+ * @return 1 if the devices were linked, 0 if the devices do not support it.
+ */
+int linkCaptureDevices(MicData *mics, int micCount)
+{
+    for (int i = 1; i < micCount; i++)
+    {
+        int err = snd_pcm_link(mics[0].pcm_handle, mics[i].pcm_handle);
+        if (err < 0)
+        {
+            fprintf(stderr, "WARNING: Can't link PCM devices, start skew will be measured instead. %s\n", snd_strerror(err));
+            for (int j = 1; j < i; j++)
+            {
+                snd_pcm_unlink(mics[j].pcm_handle);
+            }
+            return 0;
+        }
+    }
+
+    if (micCount > 1)
+    {
+        printf("PCM devices linked: all microphones start on the same trigger.\n");
+    }
+    return micCount > 1;
+}
+
+/**
+ * @brief Seconds between the start of a device and the start of Mic1.
+ *
+ * @param mic Index of the microphone.
+ * @return Skew measured from the trigger timestamps.
+ */
+static double startSkew(int mic)
+{
+    return (capture_trigger[mic].tv_sec - capture_trigger[0].tv_sec) + (capture_trigger[mic].tv_nsec - capture_trigger[0].tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Writes the capture parameters, trigger timestamps and start skews to SESSION_INFO_FILE.
+ *
+ * @param mics Array of microphones.
+ * @param micCount Number of microphones.
+ */
+static void writeSessionInfo(MicData *mics, int micCount)
+{
+    FILE *info = fopen(SESSION_INFO_FILE, "w");
+
+    if (info == NULL)
+    {
+        perror("Could not write session info");
+        return;
+    }
+    fprintf(info, "sample_rate=%d\n", sample_rate);
+    fprintf(info, "frames_per_period=%d\n", frames_per_buffer);
+    fprintf(info, "buffer_time_us=%u\n", latency_us);
+    fprintf(info, "sample_format=%s\n", sampleFormatName(sample_format));
+    fprintf(info, "realtime_priority=%d\n", realtime_priority);
+    fprintf(info, "fsync=%s\n", batchWriterFsyncName(fsync_policy));
+    fprintf(info, "encoding=%s\n", encode_flac && !use_container ? "flac" : "none");
+    fprintf(info, "preroll_ms=%d\n", preroll_ms);
+    fprintf(info, "trigger_policy=%s\n", triggerPolicyName(trigger_policy));
+    fprintf(info, "trigger_quorum=%d\n", trigger_coordinator.quorum);
+    fprintf(info, "trigger_window_ms=%d\n", trigger_window_ms);
+    fprintf(info, "linked=%d\n", pcm_linked);
+    fprintf(info, "mics=%d\n", micCount);
+    fprintf(info, "channels=%d\n", device_channels);
+    fprintf(info, "writers=%d\n", writer_count);
+    fprintf(info, "daemon=%d\n", run_as_daemon);
+    for (int i = 0; i < micCount; i++)
+    {
+        fprintf(info, "device_%s=%s\n", mics[i].micName, mics[i].deviceName);
+        fprintf(info, "trigger_%s=%ld.%09ld\n", mics[i].micName, capture_trigger[i].tv_sec, capture_trigger[i].tv_nsec);
+        if (i > 0)
+        {
+            fprintf(info, "start_skew_%s=%.9f\n", mics[i].micName, startSkew(i));
+        }
+    }
+    // Skew of the pair the analyzer localizes with
+    fprintf(info, "start_skew=%.9f\n", micCount > 1 ? startSkew(1) : 0.0);
+    fclose(info);
+}
+
+/**
+ * @brief Starts every capture device and records their trigger timestamps.
+ *
+ * Linked devices are started with a single trigger. Otherwise they are started back to back and
+ * the skew of each start against Mic1 is measured from the trigger timestamps. Either way the
+ * timestamps and the measured skews are written to SESSION_INFO_FILE so the analyzer does not
+ * have to assume them; a daemon writes it when each session opens instead.
+ *
+ * @param mics Array of microphones.
+ * @param micCount Number of microphones.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int startCaptureDevices(MicData *mics, int micCount)
+{
+    snd_pcm_status_t *status;
+    snd_pcm_status_alloca(&status);
+    int err;
+
+    for (int i = 0; i < micCount; i++)
+    {
+        // Starting one linked device starts the whole group
+        if ((i == 0 || !pcm_linked) && (err = snd_pcm_start(mics[i].pcm_handle)) < 0)
+        {
+            fprintf(stderr, "ERROR: Can't start %s PCM device. %s\n", mics[i].micName, snd_strerror(err));
+            return err;
+        }
+    }
+
+    for (int i = 0; i < micCount; i++)
+    {
+        snd_pcm_status(mics[i].pcm_handle, status);
+        snd_pcm_status_get_trigger_htstamp(status, &capture_trigger[i]);
+    }
+
+    for (int i = 1; i < micCount; i++)
+    {
+        printf("Start skew %s - %s: %.9f s%s\n", mics[i].micName, mics[0].micName, startSkew(i), pcm_linked ? " (linked)" : "");
+    }
+
+    if (!run_as_daemon)
+    {
+        writeSessionInfo(mics, micCount);
+    }
+    return 0;
+}
+
+/**
+ * @brief Initializes the microphone data structure.
+ *
+ * This function sets the initial values for the MicData structure, including recording flags, file names, 
+ * mutexes, and condition variables.
+ *
+ * @param data Pointer to the MicData structure to be initialized.
+ * @param micNumber Microphone number (identifier).
+ * @param startMutex Pointer to the start mutex.
+ * @param startCond Pointer to the start condition variable.
+ * @param startFlag Pointer to the start flag.
+ * @param stopFlag Pointer to the stop flag.
+ * @param useMmap Whether to capture through the mmap interface.
+ */
+void initializeMicData(MicData *data, int micNumber, pthread_mutex_t *startMutex, pthread_cond_t *startCond, int *startFlag, int *stopFlag, int useMmap)
+{
+    data->recording = 0;
+    data->fileIndex = 0;
+    data->triggerIndex = micNumber - 1;
+    data->eventId = 0;
+    data->eventStartNs = 0;
+    data->segmentEventStart = 0;
+    sprintf(data->micName, "Mic%d", micNumber);
+    data->channel = 0;
+    data->deviceName[0] = '\0';
+    data->startMutex = startMutex;
+    data->startCond = startCond;
+    data->startFlag = startFlag;
+    data->stopFlag = stopFlag;
+    data->sampleFile.fd = -1;
+    data->encoder = NULL;
+    data->timestampFile = NULL;
+    data->segmentOpen = 0;
+    data->container = NULL;
+    data->containerAudio = NULL;
+    data->containerAudioFirst = 0;
+    data->containerAudioFrames = 0;
+    data->containerStamps = NULL;
+    data->containerStampCount = 0;
+    data->containerStampCapacity = 0;
+    data->pendingFlags = 0;
+    data->lastTimestamp.tv_sec = 0;
+    data->lastTimestamp.tv_nsec = 0;
+    data->useMmap = useMmap;
+    data->captureCpu = micNumber <= capture_cpu_count ? capture_cpus[micNumber - 1] : -1;
+    memset(&data->wakeupLatency, 0, sizeof(data->wakeupLatency));
+    data->xrunPending = 0;
+    atomic_init(&data->xruns, 0);
+    atomic_init(&data->xrunLostFrames, 0);
+    data->framesCaptured = 0;
+    data->periodFrame = 0;
+    timeFitInit(&data->timeFit, sample_rate, TIME_FIT_WINDOW);
+    memset(&data->timeModel, 0, sizeof(data->timeModel));
+    memset(&data->segmentModel, 0, sizeof(data->segmentModel));
+    data->segmentFirstFrame = 0;
+    data->segmentFrames = 0;
+    memset(&data->levels, 0, sizeof(data->levels));
+    data->levels.firstOver = -1;
+    data->segmentPeak = 0;
+    data->segmentEnergy = 0;
+    data->segmentEnergyFrames = 0;
+    data->segmentOnsetFound = 0;
+    atomic_init(&data->sharedModel.sequence, 0);
+    memset(&data->sharedModel.model, 0, sizeof(data->sharedModel.model));
+    data->clockReference = NULL;
+    data->resampler = NULL;
+    data->segmentAligned = 0;
+    data->segmentOutFrame = 0;
+    data->driftPpm = 0;
+    memset(&data->captureUsage, 0, sizeof(data->captureUsage));
+    data->captureSeconds = 0;
+    data->wakeups = 0;
+    data->writeCalls = 0;
+    data->syncCalls = 0;
+    data->bytesWritten = 0;
+    // The pre-roll also covers the trigger window, since an event may start up to a window before it is detected
+    size_t prerollPeriods = ((size_t)(preroll_ms + trigger_window_ms) * sample_rate / 1000 + frames_per_buffer - 1) / frames_per_buffer;
+
+    // Sized in time, not periods: with short periods or high rates a fixed count would not last one
+    // sleep of the writer. The pre-roll is flushed into the ring in one go, so it gets room of its own
+    size_t ringPeriods = ((size_t)RING_SECONDS * sample_rate + frames_per_buffer - 1) / frames_per_buffer + prerollPeriods;
+    if (periodRingInit(&data->ring, ringPeriods, frames_per_buffer * sample_bytes, 1) != 0)
+    {
+        fprintf(stderr, "Could not allocate the buffer ring for %s.\n", data->micName);
+        exit(EXIT_FAILURE);
+    }
+    if (preRollInit(&data->preRoll, prerollPeriods, frames_per_buffer * sample_bytes) != 0)
+    {
+        fprintf(stderr, "Could not allocate the pre-roll for %s.\n", data->micName);
+        exit(EXIT_FAILURE);
+    }
+
+    // Periods dropped because the ring is full are still read and analyzed here
+    data->scratch = calloc(frames_per_buffer, sample_bytes);
+    if (data->scratch == NULL)
+    {
+        fprintf(stderr, "Could not allocate the capture buffer for %s.\n", data->micName);
+        exit(EXIT_FAILURE);
+    }
+
+    // Recordings are compressed by the writer while they are captured, finished when the segment closes
+    if (encode_flac && !use_container)
+    {
+        data->encoder = malloc(sizeof(FlacEncoder));
+        if (data->encoder == NULL)
+        {
+            fprintf(stderr, "Could not allocate the encoder for %s.\n", data->micName);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (use_container)
+    {
+        data->containerStampCapacity = CONTAINER_BLOCK_FRAMES / frames_per_buffer + 2;
+        data->containerAudio = malloc(CONTAINER_BLOCK_FRAMES * sample_bytes);
+        data->containerStamps = malloc(data->containerStampCapacity * sizeof(TimestampRecord));
+        if (data->containerAudio == NULL || data->containerStamps == NULL)
+        {
+            fprintf(stderr, "Could not allocate the container blocks for %s.\n", data->micName);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * @brief Turns the microphones into the channels of the device opened by the first one.
+ *
+ * Every channel shares the PCM handle of the first microphone and records under the device
+ * name with its channel number.
+ *
+ * @param mics Array of microphones, one per channel.
+ * @param channels Number of channels.
+ * @param device Name of the PCM device.
+ */
+void shareCaptureDevice(MicData *mics, int channels, const char *device)
+{
+    for (int c = 0; c < channels; c++)
+    {
+        mics[c].channel = c;
+        mics[c].pcm_handle = mics[0].pcm_handle;
+        snprintf(mics[c].deviceName, sizeof(mics[c].deviceName), "%.*s ch%d", TIMESTAMP_DEVICE_BYTES - 14, device, c + 1);
+    }
+    printf("Capturing %d channels of \"%s\": every microphone shares the same sample clock.\n", channels, device);
+}
+
+/**
+ * @brief Makes a microphone estimate its clock drift against a reference microphone.
+ *
+ * With clock alignment enabled the microphone's samples are also resampled onto the
+ * reference's sample grid before being written.
+ *
+ * @param data Pointer to the MicData structure of the microphone.
+ * @param reference Pointer to the MicData structure of the reference microphone.
+ */
+void setClockReference(MicData *data, MicData *reference)
+{
+    data->clockReference = reference;
+    if (align_clocks)
+    {
+        resamplerInit();
+        data->resampler = malloc(sizeof(Resampler));
+        if (data->resampler == NULL)
+        {
+            fprintf(stderr, "Could not allocate the resampler for %s.\n", data->micName);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * @brief Touches the buffers the capture thread writes to so they never page fault during capture.
+ *
+ * The ring is already zeroed when it is created.
+ *
+ * @param data Pointer to the MicData structure of the microphone.
+ */
+void prefaultBuffers(MicData *data)
+{
+    realtimePrefault(data->preRoll.slots, data->preRoll.capacity * data->preRoll.slotStride);
+    realtimePrefault(data->scratch, frames_per_buffer * sample_bytes);
+    realtimePrefault(data->resampler, data->resampler != NULL ? sizeof(Resampler) : 0);
+}
+
+/**
+ * @brief Starts the recording and writing threads.
+ *
+ * This function creates and starts a capture thread per microphone, or a single one for all of them
+ * in poll mode or when they are the channels of one device. The microphones are shared out among writer_count writer threads: one per CPU given
+ * with --writer-cpus, or a single writer for the whole array.
+ *
+ * @param mics Array of microphones.
+ * @param micCount Number of microphones.
+ */
+void startThreads(MicData *mics, int micCount)
+{
+    static MicData *pollMics[MAX_MICS + 1];
+
+    if (device_channels > 1)
+    {
+        if (pthread_create(&mics[0].threadId, NULL, recordChannels, (void *)mics) != 0)
+        {
+            fprintf(stderr, "Error creating capture thread.\n");
+            exit(1);
+        }
+    }
+    else if (use_poll)
+    {
+        for (int i = 0; i < micCount; i++)
+        {
+            pollMics[i] = &mics[i];
+        }
+        pollMics[micCount] = NULL;
+        if (pthread_create(&poll_thread_id, NULL, recordAllMics, (void *)pollMics) != 0)
+        {
+            fprintf(stderr, "Error creating capture thread.\n");
+            exit(1);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < micCount; i++)
+        {
+            if (pthread_create(&mics[i].threadId, NULL, recordAudio, (void *)&mics[i]) != 0)
+            {
+                fprintf(stderr, "Error creating thread for %s.\n", mics[i].micName);
+                exit(1);
+            }
+        }
+    }
+
+    writer_count = writer_cpu_count > 0 ? (writer_cpu_count < micCount ? writer_cpu_count : micCount) : 1;
+    for (int w = 0; w < writer_count; w++)
+    {
+        writer_threads[w].index = w;
+        writer_threads[w].cpu = writer_cpu_count > 0 ? writer_cpus[w] : -1;
+        writer_threads[w].micCount = 0;
+    }
+    for (int i = 0; i < micCount; i++)
+    {
+        WriterThread *writer = &writer_threads[i % writer_count];
+        writer->mics[writer->micCount] = &mics[i];
+        writer->rings[writer->micCount] = &mics[i].ring;
+        writer->micCount++;
+    }
+    for (int w = 0; w < writer_count; w++)
+    {
+        if (pthread_create(&writer_threads[w].threadId, NULL, writeAudioToFile, (void *)&writer_threads[w]) != 0)
+        {
+            fprintf(stderr, "Error creating writer thread %d.\n", w + 1);
+            exit(1);
+        }
+    }
+}
 
-    sprintf(dir1, "samples_threads_Mic%d", 1);
-    sprintf(dir2, "samples_threads_Mic%d", 2);
+/**
+ * @brief Stops the recording threads of every microphone.
+ *
+ * The writer threads are joined after the recorders, once they have drained their rings
+ * and closed any open file.
+ *
+ * @param mics Array of microphones.
+ * @param micCount Number of microphones.
+ */
+void stopRecordingThreads(MicData *mics, int micCount)
+{
+    *(mics[0].stopFlag) = 1;
 
-    if (mkdir(dir1, 0777) != 0 && errno != EEXIST)
+    if (device_channels > 1)
     {
-        perror("Error creating directory for Mic1");
-        return 1;
+        pthread_join(mics[0].threadId, NULL);
     }
-    if (mkdir(dir2, 0777) != 0 && errno != EEXIST)
+    else if (use_poll)
     {
-        perror("Error creating directory for Mic2");
-        return 1;
+        pthread_join(poll_thread_id, NULL);
+    }
+    else
+    {
+        for (int i = 0; i < micCount; i++)
+        {
+            pthread_join(mics[i].threadId, NULL);
+        }
+    }
+
+    for (int w = 0; w < writer_count; w++)
+    {
+        pthread_join(writer_threads[w].threadId, NULL);
+    }
+}
+
+/**
+ * @brief Prints the CPU time and wakeups spent capturing audio.
+ *
+ * Used to compare the per-microphone thread design with the poll() design.
+ *
+ * @param label Name of the capture thread.
+ * @param data Pointer to a MicData structure captured by that thread.
+ */
+void printCaptureUsage(const char *label, const MicData *data)
+{
+    double cpu = data->captureUsage.ru_utime.tv_sec + data->captureUsage.ru_utime.tv_usec / 1e6 +
+                 data->captureUsage.ru_stime.tv_sec + data->captureUsage.ru_stime.tv_usec / 1e6;
+    double seconds = data->captureSeconds > 0 ? data->captureSeconds : 1;
+
+    printf("%s: %.3f s CPU (%.2f%%), %lu wakeups (%.1f/s), %ld voluntary / %ld involuntary context switches\n",
+           label, cpu, 100.0 * cpu / seconds, data->wakeups, data->wakeups / seconds,
+           data->captureUsage.ru_nvcsw, data->captureUsage.ru_nivcsw);
+}
+
+/**
+ * @brief Releases the buffer rings and pre-rolls of every microphone, reporting any dropped periods.
+ *
+ * @param mics Array of microphones.
+ * @param micCount Number of microphones.
+ */
+void cleanUp(MicData *mics, int micCount)
+{
+    char label[32];
+
+    if (device_channels > 1)
+    {
+        printCaptureUsage("Capture (channels)", &mics[0]);
+    }
+    else if (use_poll)
+    {
+        printCaptureUsage("Capture (poll)", &mics[0]);
+    }
+    else
+    {
+        for (int i = 0; i < micCount; i++)
+        {
+            snprintf(label, sizeof(label), "Capture %s", mics[i].micName);
+            printCaptureUsage(label, &mics[i]);
+        }
+    }
+
+    for (int i = 0; i < micCount; i++)
+    {
+        unsigned long xruns = atomic_load(&mics[i].xruns);
+        unsigned long lost = atomic_load(&mics[i].xrunLostFrames);
+
+        latencyStatsPrint(mics[i].micName, &mics[i].wakeupLatency);
+        printf("%s: %lu XRUNs, %lu frames lost (%.1f ms)\n", mics[i].micName, xruns, lost, 1000.0 * lost / sample_rate);
+        if (mics[i].writeCalls > 0)
+        {
+            printf("%s: %llu bytes of audio in %lu writes (%.0f bytes/write), %lu syncs\n", mics[i].micName,
+                   (unsigned long long)mics[i].bytesWritten, mics[i].writeCalls,
+                   (double)mics[i].bytesWritten / mics[i].writeCalls, mics[i].syncCalls);
+        }
+    }
+
+    for (int i = 0; i < micCount; i++)
+    {
+        unsigned long overflows = atomic_load(&mics[i].ring.overflows);
+        if (overflows > 0)
+        {
+            fprintf(stderr, "%s: %lu periods dropped because the writer could not keep up.\n", mics[i].micName, overflows);
+        }
+        periodRingDestroy(&mics[i].ring);
+        preRollDestroy(&mics[i].preRoll);
+        liveRingDestroy(&mics[i].live);
+        free(mics[i].scratch);
+        free(mics[i].containerAudio);
+        free(mics[i].containerStamps);
+        free(mics[i].encoder);
+    }
+
+    for (int i = 0; i < micCount; i++)
+    {
+        if (mics[i].clockReference != NULL && mics[i].driftPpm != 0)
+        {
+            printf("Clock drift %s vs %s: %+.3f ppm%s\n", mics[i].micName, mics[i].clockReference->micName,
+                   mics[i].driftPpm, mics[i].resampler != NULL ? " (compensated)" : "");
+        }
+        free(mics[i].resampler);
+    }
+}
+
+/**
+ * @brief Creates the directories the recordings are written to, if they do not exist.
+ *
+ * @param micCount Number of microphones.
+ * @return 0 on success, -1 on failure.
+ */
+static int createOutputDirectories(int micCount)
+{
+    char dir[256];
+
+    for (int i = 0; i < micCount; i++)
+    {
+        snprintf(dir, sizeof(dir), "samples_threads_Mic%d", i + 1);
+        if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "Error creating directory for Mic%d: %s\n", i + 1, strerror(errno));
+            return -1;
+        }
+    }
+    if (use_container && mkdir(CONTAINER_DIR, 0777) != 0 && errno != EEXIST)
+    {
+        perror("Error creating directory for the event containers");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Opens a session of the daemon, the start command of the control socket.
+ *
+ * The devices have been capturing since launch, so nothing is opened or configured: the output
+ * directories, which the previous session may have left removed, and the session info are written
+ * and the capture threads start following the trigger again, with a full pre-roll.
+ *
+ * @param arg Array of microphones.
+ * @return 0 on success, -1 on failure.
+ */
+static int beginSession(void *arg)
+{
+    MicData *mics = (MicData *)arg;
+    int micCount = trigger_coordinator.micCount;
+
+    if (createOutputDirectories(micCount) != 0)
+    {
+        return -1;
+    }
+    writeSessionInfo(mics, micCount);
+    atomic_fetch_add_explicit(&session_state, 1, memory_order_release);
+    printf("Session opened.\n");
+    return 0;
+}
+
+/**
+ * @brief Closes the session of the daemon, the stop command of the control socket.
+ *
+ * Each capture thread ends its segment on its next period and acknowledges the closed session once
+ * the end is in its ring. The writer releases the slots of a ring after handling them, so an empty
+ * ring means every file of the session is closed. Capture goes on into the pre-roll.
+ *
+ * @param arg Array of microphones.
+ * @return 0 once every file is closed, -1 if that takes longer than SESSION_CLOSE_TIMEOUT_MS.
+ */
+static int endSession(void *arg)
+{
+    MicData *mics = (MicData *)arg;
+    int micCount = trigger_coordinator.micCount;
+    unsigned closed = atomic_fetch_add_explicit(&session_state, 1, memory_order_acq_rel) + 1;
+
+    for (int waited = 0; waited < SESSION_CLOSE_TIMEOUT_MS; waited += SESSION_POLL_MS)
+    {
+        int pending = 0;
+        for (int i = 0; i < micCount; i++)
+        {
+            pending += atomic_load_explicit(&mics[i].sessionAck, memory_order_acquire) != closed || periodRingCount(&mics[i].ring) > 0;
+        }
+        if (pending == 0)
+        {
+            printf("Session closed.\n");
+            return 0;
+        }
+        usleep(SESSION_POLL_MS * 1000);
+    }
+
+    fprintf(stderr, "The session did not close within %d ms.\n", SESSION_CLOSE_TIMEOUT_MS);
+    return -1;
+}
+
+/**
+ * @brief Applies the threshold command of the control socket.
+ *
+ * @param value New threshold, as a fraction of full scale.
+ * @param arg Unused.
+ * @return 0.
+ */
+static int applyThreshold(double value, void *arg)
+{
+    (void)arg;
+    threshold_percentage = value;
+    atomic_store(&threshold, (int)(MAX_AMPLITUDE * value));
+    printf("Threshold set to %.4f\n", value);
+    return 0;
+}
+
+/**
+ * @brief Writes the counters of the status command of the control socket.
+ *
+ * Only atomic counters are read, since the capture and writer threads keep running.
+ *
+ * @param reply Buffer for the counters.
+ * @param size Size of the buffer.
+ * @param arg Array of microphones.
+ */
+static void reportStatus(char *reply, size_t size, void *arg)
+{
+    MicData *mics = (MicData *)arg;
+    unsigned long xruns = 0, lost = 0, dropped = 0;
+
+    for (int i = 0; i < trigger_coordinator.micCount; i++)
+    {
+        xruns += atomic_load(&mics[i].xruns);
+        lost += atomic_load(&mics[i].xrunLostFrames);
+        dropped += atomic_load(&mics[i].ring.overflows);
     }
+    snprintf(reply, size, "mics=%d threshold=%.4f sessions=%u events=%u event=%u xruns=%lu lost_frames=%lu dropped_periods=%lu",
+             trigger_coordinator.micCount, threshold_percentage, (atomic_load(&session_state) + 1) / 2, atomic_load(&trigger_coordinator.eventCount),
+             atomic_load(&trigger_coordinator.activeEvent), xruns, lost, dropped);
+}
+
+/**
+ * @brief Prints the command line usage of the program.
+ *
+ * @param program Name of the executable.
+ */
+void printUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options] <mic1_device> [<mic2_device> ...] <sample_rate> <threshold> <min_silence_time>\n", program);
+    fprintf(stderr, "       %s [options] --channels <N> <device> <sample_rate> <threshold> <min_silence_time>\n", program);
+    fprintf(stderr, "Up to %d devices, recorded as Mic1, Mic2, ... in the order given, or up to %d inputs of one device.\n", MAX_MICS, MAX_MICS);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -m, --mmap    Capture through the mmap interface (falls back to read if unsupported)\n");
+    fprintf(stderr, "  -p, --poll    Capture from all microphones in a single poll() thread\n");
+    fprintf(stderr, "  -a, --align   Resample every microphone onto the sample clock of Mic1 to compensate clock drift\n");
+    fprintf(stderr, "  -r, --preroll <ms>  Audio kept before the trigger and prepended to each recording (default %d, 0 disables)\n", DEFAULT_PREROLL_MS);
+    fprintf(stderr, "  -t, --trigger <or|and|quorum:K>  Microphones that must cross the threshold to start an event (default or)\n");
+    fprintf(stderr, "  -w, --trigger-window <ms>  Window in which crossings of different microphones count together (default %d)\n", DEFAULT_TRIGGER_WINDOW_MS);
+    fprintf(stderr, "  -P, --period <frames>  Frames per period (default %d)\n", DEFAULT_FRAMES_PER_BUFFER);
+    fprintf(stderr, "  -b, --buffer-time <us>  Size of the device buffer (default %d)\n", DEFAULT_LATENCY);
+    fprintf(stderr, "  -f, --format <S16|S32|FLOAT>  Sample format captured and stored (default S16)\n");
+    fprintf(stderr, "  -R, --realtime <priority>  Run the capture threads with SCHED_FIFO priority (1-%d), with memory locked and prefaulted\n", REALTIME_MAX_PRIORITY);
+    fprintf(stderr, "  -C, --capture-cpus <cpu,...>  Pin the capture thread of each microphone to a CPU (poll mode uses the first)\n");
+    fprintf(stderr, "  -W, --writer-cpus <cpu,...>  Run one writer thread per CPU listed, pinned to it (default a single writer for all microphones)\n");
+    fprintf(stderr, "  -S, --fsync <none|close|interval:MS>  When recordings are synced to storage (default none)\n");
+    fprintf(stderr, "  -n, --no-encode  Do not write the lossless FLAC copy of each recording (encode_backlog can do it later);\n");
+    fprintf(stderr, "                   FLOAT recordings are never encoded, as FLAC cannot store them losslessly\n");
+    fprintf(stderr, "  -c, --channels <N>  Record the first N inputs of a single multichannel device as Mic1..MicN, on one clock\n");
+    fprintf(stderr, "  -k, --control <path>  Wait for commands on this Unix socket (start, pause, threshold, status, stop, shutdown) instead of ENTER\n");
+    fprintf(stderr, "  -D, --daemon  With --control: keep the devices capturing into the pre-roll from launch, start and stop only open and\n");
+    fprintf(stderr, "                close sessions and the recorder stays up until shutdown\n");
+    fprintf(stderr, "  -L, --live </name>  Also publish every period of MicN to the shared-memory ring /name_MicN (see live_ring.py)\n");
+    fprintf(stderr, "  -E, --container  Write each event to a single container in %s/ instead of raw and timestamp files per microphone\n", CONTAINER_DIR);
+}
 
-    initializeMicData(&dataMic1, 1, &startMutex, &startCond, &startFlag, &stopFlag);
-    initializeMicData(&dataMic2, 2, &startMutex, &startCond, &startFlag, &stopFlag);
+/**
+ * @brief Main function.
+ *
+ * Initializes the microphone data structures, sets up the PCM devices, and launches the recording and writing threads.
+ * Waits for user input, or for the stop command of the control socket, to stop recording. Every
+ * recording has already been closed and encoded by then. As a daemon it only exits on shutdown.
+ * The devices are given as a list, any number from 1 to MAX_MICS, or a single multichannel device
+ * whose channels are recorded as the microphones.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line arguments.
+ * @return int Exit code of the program.
+ */
+int main(int argc, char *argv[])
+{
+    static const struct option longOptions[] = {
+        {"mmap", no_argument, NULL, 'm'},
+        {"poll", no_argument, NULL, 'p'},
+        {"align", no_argument, NULL, 'a'},
+        {"preroll", required_argument, NULL, 'r'},
+        {"trigger", required_argument, NULL, 't'},
+        {"trigger-window", required_argument, NULL, 'w'},
+        {"period", required_argument, NULL, 'P'},
+        {"buffer-time", required_argument, NULL, 'b'},
+        {"format", required_argument, NULL, 'f'},
+        {"realtime", required_argument, NULL, 'R'},
+        {"capture-cpus", required_argument, NULL, 'C'},
+        {"writer-cpus", required_argument, NULL, 'W'},
+        {"container", no_argument, NULL, 'E'},
+        {"fsync", required_argument, NULL, 'S'},
+        {"no-encode", no_argument, NULL, 'n'},
+        {"channels", required_argument, NULL, 'c'},
+        {"control", required_argument, NULL, 'k'},
+        {"daemon", no_argument, NULL, 'D'},
+        {"live", required_argument, NULL, 'L'},
+        {NULL, 0, NULL, 0}};
+    int useMmap = 0;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "mpar:t:w:P:b:f:R:C:W:ES:nc:k:DL:", longOptions, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            useMmap = 1;
+            break;
+        case 'p':
+            use_poll = 1;
+            break;
+        case 'a':
+            align_clocks = 1;
+            break;
+        case 'r':
+            preroll_ms = atoi(optarg);
+            if (preroll_ms < 0 || preroll_ms > MAX_PREROLL_MS)
+            {
+                fprintf(stderr, "The pre-roll must be between 0 and %d ms.\n", MAX_PREROLL_MS);
+                return 1;
+            }
+            break;
+        case 't':
+            if (triggerParsePolicy(optarg, &trigger_policy, &trigger_quorum) != 0)
+            {
+                fprintf(stderr, "Unknown trigger policy: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'w':
+            trigger_window_ms = atoi(optarg);
+            if (trigger_window_ms < 0 || trigger_window_ms > MAX_PREROLL_MS)
+            {
+                fprintf(stderr, "The trigger window must be between 0 and %d ms.\n", MAX_PREROLL_MS);
+                return 1;
+            }
+            break;
+        case 'P':
+            frames_per_buffer = atoi(optarg);
+            if (frames_per_buffer < 16 || frames_per_buffer > MAX_FRAMES_PER_BUFFER)
+            {
+                fprintf(stderr, "The period must be between 16 and %d frames.\n", MAX_FRAMES_PER_BUFFER);
+                return 1;
+            }
+            break;
+        case 'b':
+            latency_us = (unsigned int)atoi(optarg);
+            break;
+        case 'f':
+            if (sampleFormatParse(optarg, &sample_format) != 0)
+            {
+                fprintf(stderr, "Unknown sample format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'R':
+            realtime_priority = atoi(optarg);
+            if (realtime_priority < 1 || realtime_priority > REALTIME_MAX_PRIORITY)
+            {
+                fprintf(stderr, "The real-time priority must be between 1 and %d.\n", REALTIME_MAX_PRIORITY);
+                return 1;
+            }
+            break;
+        case 'C':
+            if ((capture_cpu_count = realtimeParseCpus(optarg, capture_cpus, MAX_MICS)) < 0)
+            {
+                fprintf(stderr, "Invalid CPU list: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'E':
+            use_container = 1;
+            break;
+        case 'n':
+            encode_flac = 0;
+            break;
+        case 'k':
+            control_path = optarg;
+            break;
+        case 'D':
+            run_as_daemon = 1;
+            break;
+        case 'L':
+            live_name = optarg;
+            break;
+        case 'c':
+            device_channels = atoi(optarg);
+            if (device_channels < 1 || device_channels > MAX_MICS)
+            {
+                fprintf(stderr, "The number of channels must be between 1 and %d.\n", MAX_MICS);
+                return 1;
+            }
+            break;
+        case 'S':
+            if (batchWriterParseFsync(optarg, &fsync_policy, &fsync_interval_ms) != 0)
+            {
+                fprintf(stderr, "Unknown fsync policy: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'W':
+            if ((writer_cpu_count = realtimeParseCpus(optarg, writer_cpus, MAX_MICS)) < 0)
+            {
+                fprintf(stderr, "Invalid CPU list: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
 
-    if ((err = setup_pcm(&dataMic1, mic1_device)) != 0)
+    // The devices come first, then the three numeric arguments
+    int deviceCount = argc - optind - 3;
+    if (deviceCount < 1 || deviceCount > MAX_MICS || (device_channels > 1 && deviceCount != 1))
     {
+        printUsage(argv[0]);
         return 1;
     }
+    int micCount = device_channels > 1 ? device_channels : deviceCount;
 
-    if ((err = setup_pcm(&dataMic2, mic2_device)) != 0)
+    // Sessions of a daemon are only opened and closed through the socket
+    if (run_as_daemon && control_path == NULL)
     {
+        fprintf(stderr, "--daemon needs --control.\n");
         return 1;
     }
+    atomic_store(&session_state, run_as_daemon ? 0 : 1);
 
-    startThreads(&dataMic1, &dataMic2);
+    // The channels of one device are read together and already share their sample clock
+    if (device_channels > 1 && (useMmap || use_poll || align_clocks))
+    {
+        fprintf(stderr, "WARNING: --mmap, --poll and --align do not apply to the channels of a single device.\n");
+        useMmap = 0;
+        use_poll = 0;
+        align_clocks = 0;
+    }
 
-    pthread_mutex_lock(&startMutex);
-    startFlag = 1;
-    pthread_cond_broadcast(&startCond);
-    pthread_mutex_unlock(&startMutex);
+    char **devices = &argv[optind];
+    sample_rate = atoi(argv[argc - 3]);
+    threshold_percentage = atof(argv[argc - 2]);
+    min_silence_time = atof(argv[argc - 1]);
 
-    printf("Press ENTER to stop recording...\n");
-    getchar();
+    threshold = MAX_AMPLITUDE * threshold_percentage;
+    sample_bytes = sampleFormatBytes(sample_format);
+    detect_period = detectForFormat(sample_format);
 
-    pthread_mutex_lock(&startMutex);
-    stopFlag = 1;
-    pthread_cond_broadcast(&startCond);
-    pthread_mutex_unlock(&startMutex);
+    if (encode_flac && !flacEncoderSupports(sample_format))
+    {
+        fprintf(stderr, "WARNING: FLAC cannot store %s samples losslessly: only the raw recordings are written.\n", sampleFormatName(sample_format));
+        encode_flac = 0;
+    }
+
+    if (sample_rate <= 0)
+    {
+        fprintf(stderr, "Invalid sample rate: %s\n", argv[argc - 3]);
+        return 1;
+    }
+    // The device needs at least two periods in its buffer
+    if (latency_us < 2000000ULL * frames_per_buffer / sample_rate)
+    {
+        fprintf(stderr, "The buffer time must hold at least two periods (%llu us).\n", 2000000ULL * frames_per_buffer / sample_rate);
+        return 1;
+    }
 
-    stopRecordingThreads(&dataMic1, &dataMic2);
-    cleanUp(&dataMic1, &dataMic2);
+    if (triggerInit(&trigger_coordinator, trigger_policy, trigger_quorum, micCount, trigger_window_ms / 1000.0, min_silence_time, preroll_ms / 1000.0) != 0)
+    {
+        return 1;
+    }
+
+    int err;
+    MicData *mics;
+    pthread_mutex_t startMutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t startCond = PTHREAD_COND_INITIALIZER;
+    int stopFlag = 0;
+    int startFlag = 0;
+
+    if (createOutputDirectories(micCount) != 0)
+    {
+        return 1;
+    }
+
+    // Locking before allocating makes every later allocation resident as well
+    if (realtime_priority > 0)
+    {
+        realtimeLockMemory();
+    }
 
-    if (pthread_create(&dataMic1.threadId, NULL, encodeRawFilesToMp4, dir1) != 0)
+    // Per-device state lives in one contiguous array
+    mics = calloc(micCount, sizeof(MicData));
+    if (mics == NULL)
     {
-        fprintf(stderr, "Error creating thread for encoding Mic1.\n");
+        fprintf(stderr, "Could not allocate the microphone data.\n");
         return 1;
     }
+    for (int i = 0; i < micCount; i++)
+    {
+        initializeMicData(&mics[i], i + 1, &startMutex, &startCond, &startFlag, &stopFlag, useMmap);
+        if (i > 0 && device_channels == 1)
+        {
+            setClockReference(&mics[i], &mics[0]);
+        }
+        if (realtime_priority > 0)
+        {
+            prefaultBuffers(&mics[i]);
+        }
+    }
 
-    if (pthread_create(&dataMic2.threadId, NULL, encodeRawFilesToMp4, dir2) != 0)
+    // Before any device is opened, so that no thread is created before SIGINT and SIGTERM are blocked
+    if (control_path != NULL &&
+        controlSocketOpen(&control_socket, control_path, applyThreshold, reportStatus, run_as_daemon ? beginSession : NULL,
+                          run_as_daemon ? endSession : NULL, mics) != 0)
     {
-        fprintf(stderr, "Error creating thread for encoding Mic2.\n");
         return 1;
     }
 
-    pthread_join(dataMic1.threadId, NULL);
-    pthread_join(dataMic2.threadId, NULL);
+    if (device_channels > 1)
+    {
+        // Periods are read interleaved and split into the rings of the channels
+        interleaved_buffer = calloc((size_t)frames_per_buffer * device_channels, sample_bytes);
+        if (interleaved_buffer == NULL)
+        {
+            fprintf(stderr, "Could not allocate the capture buffer of the device.\n");
+            return 1;
+        }
+        if (realtime_priority > 0)
+        {
+            realtimePrefault(interleaved_buffer, (size_t)frames_per_buffer * device_channels * sample_bytes);
+        }
+        if ((err = setup_pcm(&mics[0], devices[0])) != 0)
+        {
+            return 1;
+        }
+        shareCaptureDevice(mics, micCount, devices[0]);
+        pcm_linked = 1; // a single device: every channel starts on the same trigger
+    }
+    else
+    {
+        for (int i = 0; i < micCount; i++)
+        {
+            if ((err = setup_pcm(&mics[i], devices[i])) != 0)
+            {
+                return 1;
+            }
+        }
+        pcm_linked = linkCaptureDevices(mics, micCount);
+    }
+
+    for (int i = 0; live_name != NULL && i < micCount; i++)
+    {
+        char name[LIVE_RING_NAME_BYTES];
+        snprintf(name, sizeof(name), "%.40s_%s", live_name, mics[i].micName);
+        if (liveRingCreate(&mics[i].live, name, sample_rate, frames_per_buffer, sample_format, sample_bytes, TIMESTAMP_CLOCK_REALTIME, mics[i].deviceName) != 0)
+        {
+            return 1;
+        }
+    }
+
+    startThreads(mics, micCount);
+
+    // Driven through the socket, the devices stay open but idle until a client sends start; those of a daemon start right away
+    if (control_path != NULL)
+    {
+        printf("Waiting for commands on %s...\n", control_path);
+    }
+    if (control_path == NULL || run_as_daemon || controlSocketWaitStart(&control_socket))
+    {
+        if ((err = startCaptureDevices(mics, micCount)) != 0)
+        {
+            return 1;
+        }
+
+        pthread_mutex_lock(&startMutex);
+        startFlag = 1;
+        pthread_cond_broadcast(&startCond);
+        pthread_mutex_unlock(&startMutex);
+
+        if (control_path != NULL)
+        {
+            controlSocketCapturing(&control_socket);
+            controlSocketWaitStop(&control_socket);
+        }
+        else
+        {
+            printf("Press ENTER to stop recording...\n");
+            getchar();
+        }
+    }
+
+    pthread_mutex_lock(&startMutex);
+    stopFlag = 1;
+    pthread_cond_broadcast(&startCond);
+    pthread_mutex_unlock(&startMutex);
+
+    stopRecordingThreads(mics, micCount);
+    closeEventContainers();
+    // Every file is closed: the stop command can be answered
+    if (control_path != NULL)
+    {
+        controlSocketClose(&control_socket);
+    }
+    cleanUp(mics, micCount);
+    free(mics);
+    free(interleaved_buffer);
 
     return 0;
 }
@@ -17,45 +17,49 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/stat.h>
-#include <dirent.h>
 #include <errno.h>
 #include <portaudio.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <getopt.h>
+
+#include "period_ring.h"
+#include "detect.h"
+#include "sample_format.h"
+#include "timestamp_file.h"
+#include "batch_writer.h"
+#include "flac_encoder.h"
+#include "control_socket.h"
+#include "live_ring.h"
 
-#define SAMPLE_FORMAT (paInt16)
 #define MAX_AMPLITUDE 32768
-#define FRAMES_PER_BUFFER (128)
+#define DEFAULT_FRAMES_PER_BUFFER (128)
+#define MAX_FRAMES_PER_BUFFER (8192)
 #define NUM_CHANNELS (1)
-
-int mic1_index;
-int mic2_index;
+#define MAX_MICS (8)
+#define RING_SECONDS (2) // audio each ring holds, many WRITE_INTERVAL_MS sleeps
+#define WRITER_POLL_MS (5)
+#define PREALLOC_SECONDS (4) // audio reserved ahead of each raw file with fallocate
+#define WRITE_BATCH_PERIODS (64) // periods written with one writev before their slots are released
+#define WRITE_INTERVAL_MS (100) // time the writer lets periods pile up when it is keeping up
+
+int mic_count;
 int sample_rate;
+int frames_per_buffer = DEFAULT_FRAMES_PER_BUFFER;
+unsigned int latency_us = 0; // 0 uses the default low input latency of the device
+SampleFormat sample_format = SAMPLE_S16;
+size_t sample_bytes = 2;
+DetectFunction detect_period;
 float threshold_percentage;
 float min_silence_time;
-int threshold;
+atomic_int threshold; // changed by the control socket while the audio callbacks read it
 int min_silence_frames;
-
-/**
- * @brief Node in the buffer queue that stores audio buffers and their timestamps.
- */
-typedef struct BufferNode
-{
-    int16_t buffer[FRAMES_PER_BUFFER];
-    double timestamp;
-    struct BufferNode *next;
-} BufferNode;
-
-/**
- * @brief Queue to store audio buffers.
- */
-typedef struct
-{
-    BufferNode *front;
-    BufferNode *rear;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    int stop;
-} BufferQueue;
+FsyncPolicy fsync_policy = FSYNC_NONE;
+int fsync_interval_ms;
+int encode_flac = 1;
+const char *control_path; // set with --control: the recorder is driven through this socket instead of stdin
+ControlSocket control_socket;
+const char *live_name; // set with --live: every period is also published to the shared-memory ring <name>_MicN
 
 /**
  * @brief Structure to store data for each microphone.
@@ -70,199 +74,175 @@ typedef struct
     char timestampFileName[100];
     char micName[20];
     int micIndex;
-    FILE *file;
+    BatchWriter sampleFile;
+    FlacEncoder *encoder;
+    char encodedFileName[100];
+    int segmentOpen;
     FILE *timestampFile;
+    uint64_t segmentFrames;
     pthread_t threadId;
     pthread_mutex_t *startMutex;
     pthread_cond_t *startCond;
     int *startFlag;
     int *stopFlag;
-    BufferQueue bufferQueue;
-    pthread_mutex_t fileMutex;
-    pthread_cond_t fileCond;
-    int newRecording;
-    int recordingFinished;
+    PeriodRing ring;
+    LiveRing live;
+    uint64_t framesCaptured;
+    uint32_t pendingFlags;
+    atomic_ulong inputOverflows;
 } MicData;
 
 /**
- * @brief Initializes the buffer queue.
- *
- * @param queue Pointer to the buffer queue.
+ * @brief Writer thread that drains the rings of every microphone.
  */
-void bufferQueueInit(BufferQueue *queue)
+typedef struct
 {
-    queue->front = queue->rear = NULL;
-    pthread_mutex_init(&queue->mutex, NULL);
-    pthread_cond_init(&queue->cond, NULL);
-    queue->stop = 0;
-}
+    pthread_t threadId;
+    MicData *mics;
+    PeriodRing *rings[MAX_MICS];
+    int micCount;
+} WriterThread;
+
+WriterThread writer_thread;
 
 /**
- * @brief Adds a buffer to the queue.
+ * @brief Opens files for recording audio and timestamps.
  *
- * @param queue Pointer to the buffer queue.
- * @param buffer Pointer to the audio buffer.
- * @param timestamp Timestamp associated with the buffer.
+ * @param data Pointer to the microphone data structure.
  */
-void bufferQueuePush(BufferQueue *queue, int16_t *buffer, double timestamp)
+void openFilesForRecording(MicData *data)
 {
-    BufferNode *newNode = (BufferNode *)malloc(sizeof(BufferNode));
-    if (!newNode)
-    {
-        perror("Failed to allocate memory for buffer node");
-        return;
-    }
-    memcpy(newNode->buffer, buffer, FRAMES_PER_BUFFER * sizeof(int16_t));
-    newNode->timestamp = timestamp;
-    newNode->next = NULL;
-
-    pthread_mutex_lock(&queue->mutex);
-    if (queue->rear == NULL)
+    data->fileIndex++;
+    snprintf(data->fileName, sizeof(data->fileName), "samples_threads_%s/samples_%s_%d.raw", data->micName, data->micName, data->fileIndex);
+    snprintf(data->timestampFileName, sizeof(data->timestampFileName), "samples_threads_%s/timestamps_%s_%d.ts", data->micName, data->micName, data->fileIndex);
+    data->timestampFile = fopen(data->timestampFileName, "wb");
+    data->segmentFrames = 0;
+    if (batchWriterOpen(&data->sampleFile, data->fileName, (off_t)PREALLOC_SECONDS * sample_rate * sample_bytes, fsync_policy, fsync_interval_ms) != 0 ||
+        data->timestampFile == NULL || setvbuf(data->timestampFile, NULL, _IOFBF, TIMESTAMP_FILE_BUFFER_BYTES) != 0 ||
+        timestampFileWriteHeader(data->timestampFile, sample_rate, frames_per_buffer, TIMESTAMP_CLOCK_PORTAUDIO, Pa_GetDeviceInfo(data->micIndex)->name) != 0)
     {
-        queue->front = queue->rear = newNode;
+        fprintf(stderr, "Could not open files %s or %s.\n", data->fileName, data->timestampFileName);
+        exit(EXIT_FAILURE);
     }
-    else
+    if (data->encoder != NULL)
     {
-        queue->rear->next = newNode;
-        queue->rear = newNode;
+        snprintf(data->encodedFileName, sizeof(data->encodedFileName), "samples_threads_%s/samples_%s_%d.flac", data->micName, data->micName, data->fileIndex);
+        if (flacEncoderOpen(data->encoder, data->encodedFileName, sample_rate, sample_format) != 0)
+        {
+            fprintf(stderr, "Could not open file %s.\n", data->encodedFileName);
+            exit(EXIT_FAILURE);
+        }
     }
-    pthread_cond_signal(&queue->cond);
-    pthread_mutex_unlock(&queue->mutex);
+    data->segmentOpen = 1;
+    printf("Starting new recording: %s\n", data->fileName);
 }
 
 /**
- * @brief Pops a buffer from the queue.
+ * @brief Closes the recording files.
  *
- * @param queue Pointer to the buffer queue.
- * @param buffer Pointer to the audio buffer where data will be copied.
- * @param timestamp Pointer to where the timestamp of the buffer will be copied.
- * @return 0 if a buffer is popped, -1 if the queue is empty and should stop.
+ * @param data Pointer to the microphone data structure.
  */
-int bufferQueuePop(BufferQueue *queue, int16_t *buffer, double *timestamp)
+void closeFilesForRecording(MicData *data)
 {
-    pthread_mutex_lock(&queue->mutex);
-    while (queue->front == NULL && !queue->stop)
-    {
-        pthread_cond_wait(&queue->cond, &queue->mutex);
-    }
-    if (queue->stop && queue->front == NULL)
+    batchWriterClose(&data->sampleFile);
+    if (data->encoder != NULL)
     {
-        pthread_mutex_unlock(&queue->mutex);
-        return -1;
+        flacEncoderClose(data->encoder);
     }
-    BufferNode *temp = queue->front;
-    memcpy(buffer, temp->buffer, FRAMES_PER_BUFFER * sizeof(int16_t));
-    *timestamp = temp->timestamp;
-    queue->front = queue->front->next;
-    if (queue->front == NULL)
+    data->segmentOpen = 0;
+    if (data->timestampFile != NULL)
     {
-        queue->rear = NULL;
+        fclose(data->timestampFile);
+        data->timestampFile = NULL;
     }
-    free(temp);
-    pthread_mutex_unlock(&queue->mutex);
-    return 0;
+    printf("Recording stopped: %s\n", data->fileName);
 }
 
 /**
- * @brief Cleans the buffer queue, freeing associated memory.
+ * @brief Converts a PortAudio time in seconds to a timespec.
  *
- * @param queue Pointer to the buffer queue.
+ * @param seconds Time in seconds.
+ * @return Equivalent timespec.
  */
-void cleanBufferQueue(BufferQueue *queue)
+static struct timespec paTimeToTimespec(PaTime seconds)
 {
-    pthread_mutex_lock(&queue->mutex);
-    BufferNode *current = queue->front;
-    while (current != NULL)
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (PaTime)ts.tv_sec) * 1e9);
+    if (ts.tv_nsec >= 1000000000L)
     {
-        BufferNode *temp = current;
-        current = current->next;
-        free(temp);
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
     }
-    queue->front = queue->rear = NULL;
-    pthread_mutex_unlock(&queue->mutex);
+    return ts;
 }
 
 /**
- * @brief Opens files for recording audio and timestamps.
+ * @brief Publishes a captured period to the writer ring.
+ *
+ * Segment flags that could not be delivered because the ring was full are kept in
+ * pendingFlags and attached to the next period that fits. Safe to call from the
+ * audio callback: it never allocates, locks or makes a system call.
  *
  * @param data Pointer to the microphone data structure.
+ * @param buffer Samples of the period, or NULL for a marker-only slot.
+ * @param frames Number of frames in the period.
+ * @param levels Output of the level detector for the period.
+ * @param timestamp Timestamp associated with the period.
+ * @return 0 if the period was published, -1 if it was dropped.
  */
-void openFilesForRecording(MicData *data)
+static int publishPeriod(MicData *data, const void *buffer, uint32_t frames, const PeriodLevels *levels, struct timespec timestamp)
 {
-    data->fileIndex++;
-    snprintf(data->fileName, sizeof(data->fileName), "samples_threads_%s/samples_%s_%d.raw", data->micName, data->micName, data->fileIndex);
-    snprintf(data->timestampFileName, sizeof(data->timestampFileName), "samples_threads_%s/timestamps_%s_%d.ts", data->micName, data->micName, data->fileIndex);
-    data->file = fopen(data->fileName, "wb");
-    data->timestampFile = fopen(data->timestampFileName, "w");
-    if (data->file == NULL || data->timestampFile == NULL)
+    PeriodSlot *slot = periodRingAcquire(&data->ring);
+    if (slot == NULL)
     {
-        fprintf(stderr, "Could not open files %s or %s.\n", data->fileName, data->timestampFileName);
-        exit(EXIT_FAILURE);
+        return -1;
     }
-    printf("Starting new recording: %s\n", data->fileName);
-}
 
-/**
- * @brief Closes the recording files.
- *
- * @param data Pointer to the microphone data structure.
- */
-void closeFilesForRecording(MicData *data)
-{
-    if (data->file != NULL)
+    if (buffer != NULL)
     {
-        fclose(data->file);
-        data->file = NULL;
+        memcpy(periodSlotData(slot), buffer, frames * sample_bytes);
     }
-    if (data->timestampFile != NULL)
+    else
     {
-        fclose(data->timestampFile);
-        data->timestampFile = NULL;
+        frames = 0;
     }
-    printf("Recording stopped: %s\n", data->fileName);
+    slot->timestamp = timestamp;
+    slot->frames = frames;
+    slot->flags = data->pendingFlags;
+    slot->levels = *levels;
+    periodRingCommit(&data->ring);
+    data->pendingFlags = 0;
+
+    return 0;
 }
 
 /**
- * @brief Encodes raw files to mp4 using ffmpeg.
+ * @brief Publishes a period to the live ring of the microphone, if --live was given.
  *
- * @param arg Pointer to the directory name.
- * @return NULL.
+ * @param data Pointer to the microphone data structure.
+ * @param samples Samples of the period.
+ * @param frames Number of frames in the period.
+ * @param levels Levels of the period.
+ * @param flags LIVE_PERIOD_RECORDING if the period belongs to a segment, 0 otherwise.
+ * @param timestamp ADC time of the period.
  */
-void *encodeRawFilesToMp4(void *arg)
+static void publishLivePeriod(MicData *data, const void *samples, unsigned long frames, const PeriodLevels *levels, uint32_t flags, struct timespec timestamp)
 {
-    const char *directory = (const char *)arg;
-    DIR *dir;
-    struct dirent *ent;
-    char inputFilePath[256];
-    char outputFilePath[256];
-    char command[512];
-
-    if ((dir = opendir(directory)) != NULL)
-    {
-        while ((ent = readdir(dir)) != NULL)
-        {
-            if (strstr(ent->d_name, ".raw") != NULL)
-            {
-                snprintf(inputFilePath, sizeof(inputFilePath), "%s/%s", directory, ent->d_name);
-                snprintf(outputFilePath, sizeof(outputFilePath), "%s/%s.mp4", directory, strtok(ent->d_name, "."));
-                snprintf(command, sizeof(command), "ffmpeg -f s16le -ar %d -ac %d -i %s %s", sample_rate, NUM_CHANNELS, inputFilePath, outputFilePath);
-                printf("Encoding file: %s to %s\n", inputFilePath, outputFilePath);
-                system(command);
-            }
-        }
-        closedir(dir);
-    }
-    else
+    if (data->live.header != NULL)
     {
-        perror("Could not open directory");
+        flags |= levels->firstOver >= 0 ? LIVE_PERIOD_OVER : 0;
+        liveRingPublish(&data->live, samples, (uint32_t)frames, data->framesCaptured - frames, timestamp, flags, levels->peak);
     }
-    return NULL;
 }
 
 /**
  * @brief Function to handle the recording logic for each microphone
  * 
- * This function is called by PortAudio when audio is detected.
+ * This function is called by PortAudio when audio is detected. It runs on the real-time
+ * audio thread, so it only copies the period into the preallocated ring and updates atomic
+ * counters: no allocations, no locks and no file operations. Opening and closing files is
+ * left to the writer thread, which sees the segment boundaries as flags on the periods.
  * 
  * @param inputBuffer audio buffer when audio is captured
  * @param outputBuffer audio buffer when audio is played
@@ -276,54 +256,58 @@ static int recordCallback(const void *inputBuffer, void *outputBuffer, unsigned
                           const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, void *userData)
 {
     MicData *data = (MicData *)userData;
-    const int16_t *buffer = (const int16_t *)inputBuffer;
-    int aboveThreshold = 0;
-    double timestamp = timeInfo->inputBufferAdcTime;
+    const void *buffer = inputBuffer;
+    PeriodLevels levels;
+    struct timespec timestamp = paTimeToTimespec(timeInfo->inputBufferAdcTime);
 
-    if (inputBuffer == NULL)
-    {
-        return paContinue;
-    }
+    (void)outputBuffer;
 
-    for (int i = 0; i < FRAMES_PER_BUFFER; i++)
+    if (statusFlags & paInputOverflow)
     {
-        if (abs(buffer[i]) > threshold)
-        {
-            aboveThreshold = 1;
-            break;
-        }
+        atomic_fetch_add_explicit(&data->inputOverflows, 1, memory_order_relaxed);
     }
 
-    if (aboveThreshold && !data->recording)
+    if (inputBuffer == NULL)
     {
-        data->recording = 1;
-        data->silenceCounter = 0;
-        pthread_mutex_lock(&data->fileMutex);
-        data->newRecording = 1;
-        pthread_cond_signal(&data->fileCond);
-        pthread_mutex_unlock(&data->fileMutex);
+        return paContinue;
     }
 
-    if (data->recording)
+    detect_period(buffer, framesPerBuffer, atomic_load_explicit(&threshold, memory_order_relaxed), &levels);
+    data->framesCaptured += framesPerBuffer;
+
+    // While paused no new segment starts; one in progress ends after the silence time
+    if (levels.firstOver >= 0 && !controlSocketPaused(&control_socket))
     {
-        bufferQueuePush(&data->bufferQueue, (int16_t *)buffer, timestamp);
+        data->silenceCounter = 0;
+        if (!data->recording)
+        {
+            data->recording = 1;
+            // A new segment makes the writer close any previous file, so a pending end is implied
+            data->pendingFlags = PERIOD_SEGMENT_START;
+        }
     }
-
-    if (!aboveThreshold)
+    else
     {
         data->silenceCounter++;
         if (data->recording && data->silenceCounter > min_silence_frames)
         {
             data->recording = 0;
-            pthread_mutex_lock(&data->fileMutex);
-            data->recordingFinished = 1;
-            pthread_cond_signal(&data->fileCond);
-            pthread_mutex_unlock(&data->fileMutex);
+            data->pendingFlags |= PERIOD_SEGMENT_END;
+            publishLivePeriod(data, buffer, framesPerBuffer, &levels, LIVE_PERIOD_RECORDING, timestamp);
+            publishPeriod(data, buffer, framesPerBuffer, &levels, timestamp);
+            return paContinue;
         }
     }
-    else
+
+    publishLivePeriod(data, buffer, framesPerBuffer, &levels, data->recording ? LIVE_PERIOD_RECORDING : 0, timestamp);
+    if (data->recording)
     {
-        data->silenceCounter = 0;
+        publishPeriod(data, buffer, framesPerBuffer, &levels, timestamp);
+    }
+    else if (data->pendingFlags & PERIOD_SEGMENT_END)
+    {
+        // The closing period was dropped: deliver the end of the segment as an empty marker
+        publishPeriod(data, NULL, 0, &levels, timestamp);
     }
 
     return paContinue;
@@ -333,7 +317,8 @@ static int recordCallback(const void *inputBuffer, void *outputBuffer, unsigned
  * @brief Thread function for recording audio.
  * 
  * Configures audio parameters for each microphone and
- * PortAudio stream recording.
+ * PortAudio stream recording. The stream is opened right away but only started
+ * when recording starts, and never if the recorder is stopped first.
  *
  * @param arg Pointer to the MicData structure.
  * @return NULL.
@@ -346,41 +331,62 @@ void *recordAudio(void *arg)
 
     inputParameters.device = data->micIndex;
     inputParameters.channelCount = NUM_CHANNELS;
-    inputParameters.sampleFormat = SAMPLE_FORMAT;
-    inputParameters.suggestedLatency = Pa_GetDeviceInfo(inputParameters.device)->defaultLowInputLatency;
+    inputParameters.sampleFormat = sample_format == SAMPLE_S16 ? paInt16 : sample_format == SAMPLE_S32 ? paInt32 : paFloat32;
+    inputParameters.suggestedLatency = latency_us > 0 ? latency_us / 1e6 : Pa_GetDeviceInfo(inputParameters.device)->defaultLowInputLatency;
     inputParameters.hostApiSpecificStreamInfo = NULL;
 
-    err = Pa_OpenStream(&data->stream, &inputParameters, NULL, sample_rate, FRAMES_PER_BUFFER, paClipOff, recordCallback, data);
+    err = Pa_OpenStream(&data->stream, &inputParameters, NULL, sample_rate, frames_per_buffer, paClipOff, recordCallback, data);
     if (err != paNoError)
     {
         fprintf(stderr, "Error opening audio stream: %s\n", Pa_GetErrorText(err));
-        pthread_exit(NULL);
-    }
-
-    err = Pa_StartStream(data->stream);
-    if (err != paNoError)
-    {
-        fprintf(stderr, "Error starting audio stream: %s\n", Pa_GetErrorText(err));
+        periodRingStop(&data->ring);
         pthread_exit(NULL);
     }
 
     pthread_mutex_lock(data->startMutex);
-    while (!(*data->startFlag))
+    while (!(*data->startFlag) && !(*data->stopFlag))
     {
         pthread_cond_wait(data->startCond, data->startMutex);
     }
     pthread_mutex_unlock(data->startMutex);
 
-    while (!(*data->stopFlag))
+    if (!(*data->stopFlag))
     {
-        Pa_Sleep(100);
+        err = Pa_StartStream(data->stream);
+        if (err != paNoError)
+        {
+            fprintf(stderr, "Error starting audio stream: %s\n", Pa_GetErrorText(err));
+            Pa_CloseStream(data->stream);
+            periodRingStop(&data->ring);
+            pthread_exit(NULL);
+        }
+
+        while (!(*data->stopFlag))
+        {
+            Pa_Sleep(100);
+        }
+
+        err = Pa_StopStream(data->stream);
+        if (err != paNoError)
+        {
+            fprintf(stderr, "Error stopping audio stream: %s\n", Pa_GetErrorText(err));
+        }
     }
 
-    err = Pa_StopStream(data->stream);
-    if (err != paNoError)
+    // The callback is no longer running, so this thread now owns the producer side of the ring
+    if (data->recording || (data->pendingFlags & PERIOD_SEGMENT_END))
     {
-        fprintf(stderr, "Error stopping audio stream: %s\n", Pa_GetErrorText(err));
+        struct timespec now;
+        PeriodLevels silence = {0, 0, -1};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        data->recording = 0;
+        data->pendingFlags |= PERIOD_SEGMENT_END;
+        while (publishPeriod(data, NULL, 0, &silence, now) != 0)
+        {
+            Pa_Sleep(1);
+        }
     }
+    periodRingStop(&data->ring);
 
     err = Pa_CloseStream(data->stream);
     if (err != paNoError)
@@ -392,53 +398,105 @@ void *recordAudio(void *arg)
 }
 
 /**
- * @brief Thread function for writing to files.
- * 
- * This function is called from separate threads to write audio buffers and timestamps to corresponding files.
+ * @brief Writes every period available in the ring of a microphone.
  *
- * @param arg Pointer to the MicData structure.
- * @return NULL.
+ * Opens and closes files at the segment boundaries marked by the callback. The periods are
+ * written straight from their slots with a single writev, and the slots are released together
+ * once it is done, in batches of WRITE_BATCH_PERIODS so a long backlog does not keep the ring full.
+ * At most a quarter of the ring is drained per call.
+ *
+ * @param data Pointer to the MicData structure.
+ * @return Number of periods drained.
  */
-void *writeAudioToFile(void *arg)
+static size_t drainMicRing(MicData *data)
 {
-    MicData *data = (MicData *)arg;
-    int16_t buffer[FRAMES_PER_BUFFER];
-    double timestamp;
+    PeriodSlot *slot;
+    size_t held = 0, drained = 0;
 
-    while (!(*data->stopFlag) || data->bufferQueue.front != NULL)
+    // Bounded so the backlog of one microphone does not starve the others sharing the writer
+    while (drained < data->ring.capacity / 4 && (slot = periodRingPeekAt(&data->ring, held)) != NULL)
     {
-        pthread_mutex_lock(&data->fileMutex);
-        while (!data->newRecording && !data->recordingFinished && !(*data->stopFlag))
+        drained++;
+        if (slot->flags & PERIOD_SEGMENT_START)
         {
-            pthread_cond_wait(&data->fileCond, &data->fileMutex);
+            if (data->segmentOpen)
+            {
+                closeFilesForRecording(data);
+            }
+            openFilesForRecording(data);
         }
 
-        if (data->newRecording)
+        if (data->segmentOpen && slot->frames > 0)
         {
-            openFilesForRecording(data);
-            data->newRecording = 0;
+            batchWriterAdd(&data->sampleFile, periodSlotData(slot), slot->frames * sample_bytes);
+            if (data->encoder != NULL)
+            {
+                flacEncoderWrite(data->encoder, periodSlotData(slot), slot->frames);
+            }
+            timestampFileWriteRecord(data->timestampFile, slot->timestamp, data->segmentFrames, 0);
+            data->segmentFrames += slot->frames;
         }
 
-        pthread_mutex_unlock(&data->fileMutex);
+        if ((slot->flags & PERIOD_SEGMENT_END) && data->segmentOpen)
+        {
+            closeFilesForRecording(data);
+        }
 
-        while (bufferQueuePop(&data->bufferQueue, buffer, &timestamp) == 0 && !data->recordingFinished)
+        if (++held == WRITE_BATCH_PERIODS)
         {
-            pthread_mutex_lock(data->startMutex); // Lock when writing to the file
-            if (data->file != NULL)
+            if (data->segmentOpen)
             {
-                fwrite(buffer, sizeof(int16_t), FRAMES_PER_BUFFER, data->file);
-                fprintf(data->timestampFile, "%.9f\n", timestamp);
+                batchWriterFlush(&data->sampleFile);
             }
-            pthread_mutex_unlock(data->startMutex);
+            periodRingReleaseMany(&data->ring, held);
+            held = 0;
+        }
+    }
+    if (data->segmentOpen)
+    {
+        batchWriterFlush(&data->sampleFile);
+    }
+    periodRingReleaseMany(&data->ring, held);
+
+    return drained;
+}
+
+/**
+ * @brief Thread function for writing to files.
+ * 
+ * A single writer drains the rings of every microphone, so the number of threads does not grow
+ * with the size of the array. The audio callbacks never wake it up, so it polls the rings every
+ * few milliseconds; while it keeps up it sleeps WRITE_INTERVAL_MS between wakeups, so each writev
+ * carries a batch of periods.
+ *
+ * @param arg Pointer to the WriterThread structure.
+ * @return NULL.
+ */
+void *writeAudioToFile(void *arg)
+{
+    WriterThread *writer = (WriterThread *)arg;
+
+    while (periodRingWaitAny(writer->rings, writer->micCount, WRITER_POLL_MS) >= 0)
+    {
+        size_t drained = 0;
+        for (int i = 0; i < writer->micCount; i++)
+        {
+            drained += drainMicRing(&writer->mics[i]);
         }
 
-        pthread_mutex_lock(&data->fileMutex);
-        if (data->recordingFinished)
+        // Polling every few milliseconds would mean one small write each: sleep so the next wakeup has a batch
+        if (drained < WRITE_BATCH_PERIODS)
         {
-            closeFilesForRecording(data);
-            data->recordingFinished = 0;
+            Pa_Sleep(WRITE_INTERVAL_MS);
+        }
+    }
+
+    for (int i = 0; i < writer->micCount; i++)
+    {
+        if (writer->mics[i].segmentOpen)
+        {
+            closeFilesForRecording(&writer->mics[i]);
         }
-        pthread_mutex_unlock(&data->fileMutex);
     }
 
     return NULL;
@@ -448,106 +506,193 @@ void *writeAudioToFile(void *arg)
  * @brief Initializes the microphone data structure.
  *
  * @param data Pointer to the MicData structure.
- * @param micIndex Index of the microphone.
- * @param micName Name of the microphone.
+ * @param micNumber Number of the microphone, from 1: it is recorded as MicN.
+ * @param micIndex PortAudio index of the device.
  * @param startMutex Pointer to the start mutex.
  * @param startCond Pointer to the start condition variable.
  * @param startFlag Pointer to the start flag.
  * @param stopFlag Pointer to the stop flag.
  */
-void initializeMicData(MicData *data, int micIndex, const char *micName, pthread_mutex_t *startMutex, pthread_cond_t *startCond, int *startFlag, int *stopFlag)
+void initializeMicData(MicData *data, int micNumber, int micIndex, pthread_mutex_t *startMutex, pthread_cond_t *startCond, int *startFlag, int *stopFlag)
 {
     data->recording = 0;
     data->fileIndex = 0;
     data->silenceCounter = 0;
-    snprintf(data->micName, sizeof(data->micName), "%s", micName);
+    snprintf(data->micName, sizeof(data->micName), "Mic%d", micNumber);
     data->startMutex = startMutex;
     data->startCond = startCond;
     data->startFlag = startFlag;
     data->stopFlag = stopFlag;
-    data->file = NULL;
+    data->sampleFile.fd = -1;
+    data->encoder = NULL;
+    data->segmentOpen = 0;
     data->timestampFile = NULL;
-    pthread_mutex_init(&data->fileMutex, NULL);
-    pthread_cond_init(&data->fileCond, NULL);
-    data->newRecording = 0;
-    data->recordingFinished = 0;
+    data->pendingFlags = 0;
+    data->live.header = NULL;
+    data->framesCaptured = 0;
+    atomic_init(&data->inputOverflows, 0);
     data->micIndex = micIndex;
-    bufferQueueInit(&data->bufferQueue);
+    // Sized in time, not periods: with short periods or high rates a fixed count would not last one
+    // sleep of the writer. No eventfd wakeup: the audio callback must not make system calls
+    size_t ringPeriods = ((size_t)RING_SECONDS * sample_rate + frames_per_buffer - 1) / frames_per_buffer;
+    if (periodRingInit(&data->ring, ringPeriods, frames_per_buffer * sample_bytes, 0) != 0)
+    {
+        fprintf(stderr, "Could not allocate the buffer ring for %s.\n", data->micName);
+        exit(EXIT_FAILURE);
+    }
+    // Recordings are compressed by the writer while they are captured, finished when the segment closes
+    if (encode_flac)
+    {
+        data->encoder = malloc(sizeof(FlacEncoder));
+        if (data->encoder == NULL)
+        {
+            fprintf(stderr, "Could not allocate the encoder for %s.\n", data->micName);
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
 /**
- * @brief Starts the recording and writing threads.
+ * @brief Starts the recording thread of each microphone and the writer thread shared by all of them.
  *
- * @param dataMic1 Pointer to the MicData structure for microphone 1.
- * @param dataMic2 Pointer to the MicData structure for microphone 2.
+ * @param mics Array of microphones.
+ * @param micCount Number of microphones.
  */
-void startThreads(MicData *dataMic1, MicData *dataMic2)
+void startThreads(MicData *mics, int micCount)
 {
-    pthread_t writeThreadMic1, writeThreadMic2;
-
-    if (pthread_create(&dataMic1->threadId, NULL, recordAudio, (void *)dataMic1) != 0)
+    for (int i = 0; i < micCount; i++)
     {
-        fprintf(stderr, "Error creating thread for Mic1.\n");
-        exit(1);
+        if (pthread_create(&mics[i].threadId, NULL, recordAudio, (void *)&mics[i]) != 0)
+        {
+            fprintf(stderr, "Error creating thread for %s.\n", mics[i].micName);
+            exit(1);
+        }
     }
 
-    if (pthread_create(&dataMic2->threadId, NULL, recordAudio, (void *)dataMic2) != 0)
+    writer_thread.mics = mics;
+    writer_thread.micCount = micCount;
+    for (int i = 0; i < micCount; i++)
     {
-        fprintf(stderr, "Error creating thread for Mic2.\n");
-        exit(1);
+        writer_thread.rings[i] = &mics[i].ring;
     }
-
-    if (pthread_create(&writeThreadMic1, NULL, writeAudioToFile, (void *)dataMic1) != 0)
+    if (pthread_create(&writer_thread.threadId, NULL, writeAudioToFile, (void *)&writer_thread) != 0)
     {
-        fprintf(stderr, "Error creating thread for writing Mic1.\n");
+        fprintf(stderr, "Error creating writer thread.\n");
         exit(1);
     }
+}
+
+/**
+ * @brief Stops the recording threads of every microphone.
+ *
+ * The writer thread is joined after the recorders, once it has drained every ring and closed
+ * any open file.
+ *
+ * @param mics Array of microphones.
+ * @param micCount Number of microphones.
+ */
+void stopRecordingThreads(MicData *mics, int micCount)
+{
+    *(mics[0].stopFlag) = 1;
 
-    if (pthread_create(&writeThreadMic2, NULL, writeAudioToFile, (void *)dataMic2) != 0)
+    for (int i = 0; i < micCount; i++)
     {
-        fprintf(stderr, "Error creating thread for writing Mic2.\n");
-        exit(1);
+        pthread_join(mics[i].threadId, NULL);
     }
 
-    dataMic1->bufferQueue.stop = 0;
-    dataMic2->bufferQueue.stop = 0;
+    pthread_join(writer_thread.threadId, NULL);
 }
 
 /**
- * @brief Stops the recording threads for two microphones.
+ * @brief Releases the buffer rings from each microphone, reporting dropped periods and input overflows.
  *
- * @param dataMic1 Pointer to the MicData structure for microphone 1.
- * @param dataMic2 Pointer to the MicData structure for microphone 2.
+ * @param mics Array of microphones.
+ * @param micCount Number of microphones.
  */
-void stopRecordingThreads(MicData *dataMic1, MicData *dataMic2)
+void cleanUp(MicData *mics, int micCount)
 {
-    *(dataMic1->stopFlag) = 1;
-    *(dataMic2->stopFlag) = 1;
+    for (int i = 0; i < micCount; i++)
+    {
+        unsigned long overflows = atomic_load(&mics[i].ring.overflows);
+        unsigned long inputOverflows = atomic_load(&mics[i].inputOverflows);
+        if (overflows > 0)
+        {
+            fprintf(stderr, "%s: %lu periods dropped because the writer could not keep up.\n", mics[i].micName, overflows);
+        }
+        if (inputOverflows > 0)
+        {
+            fprintf(stderr, "%s: %lu input overflows reported by PortAudio.\n", mics[i].micName, inputOverflows);
+        }
+        periodRingDestroy(&mics[i].ring);
+        liveRingDestroy(&mics[i].live);
+        free(mics[i].encoder);
+    }
+}
 
-    pthread_cond_broadcast(&dataMic1->bufferQueue.cond);
-    pthread_cond_broadcast(&dataMic2->bufferQueue.cond);
+/**
+ * @brief Creates the directories the recordings are written to, if they do not exist.
+ *
+ * @param micCount Number of microphones.
+ * @return 0 on success, -1 on failure.
+ */
+static int createOutputDirectories(int micCount)
+{
+    char dir[256];
 
-    pthread_join(dataMic1->threadId, NULL);
-    pthread_join(dataMic2->threadId, NULL);
+    for (int i = 0; i < micCount; i++)
+    {
+        snprintf(dir, sizeof(dir), "samples_threads_Mic%d", i + 1);
+        if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "Error creating directory for Mic%d: %s\n", i + 1, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Applies the threshold command of the control socket.
+ *
+ * @param value New threshold, as a fraction of full scale.
+ * @param arg Unused.
+ * @return 0.
+ */
+static int applyThreshold(double value, void *arg)
+{
+    (void)arg;
+    threshold_percentage = value;
+    atomic_store(&threshold, (int)(MAX_AMPLITUDE * value));
+    printf("Threshold set to %.4f\n", value);
+    return 0;
 }
 
 /**
- * @brief Cleans up the buffer queues from each microphone.
+ * @brief Writes the counters of the status command of the control socket.
  *
- * @param dataMic1 Pointer to the MicData structure for microphone 1.
- * @param dataMic2 Pointer to the MicData structure for microphone 2.
+ * @param reply Buffer for the counters.
+ * @param size Size of the buffer.
+ * @param arg Array of microphones.
  */
-void cleanUp(MicData *dataMic1, MicData *dataMic2)
+static void reportStatus(char *reply, size_t size, void *arg)
 {
-    cleanBufferQueue(&dataMic1->bufferQueue);
-    cleanBufferQueue(&dataMic2->bufferQueue);
+    MicData *mics = (MicData *)arg;
+    unsigned long overflows = 0, dropped = 0;
+
+    for (int i = 0; i < mic_count; i++)
+    {
+        overflows += atomic_load(&mics[i].inputOverflows);
+        dropped += atomic_load(&mics[i].ring.overflows);
+    }
+    snprintf(reply, size, "mics=%d threshold=%.4f input_overflows=%lu dropped_periods=%lu", mic_count, threshold_percentage, overflows, dropped);
 }
 
 /**
  * @brief Main function.
  *
  * Initializes the microphone data structures, sets up the recording devices, and launches the recording and file writing threads.
- * Waits for user input to stop recording and then initiates the encoding of stored files.
+ * Waits for user input, or for the stop command of the control socket, to stop recording.
+ * Every recording has already been closed and encoded by then.
  *
  * @param argc Number of command-line arguments.
  * @param argv Array of command-line arguments.
@@ -555,46 +700,114 @@ void cleanUp(MicData *dataMic1, MicData *dataMic2)
  */
 int main(int argc, char *argv[])
 {
-    if (argc != 6)
+    static const struct option longOptions[] = {
+        {"period", required_argument, NULL, 'P'},
+        {"buffer-time", required_argument, NULL, 'b'},
+        {"format", required_argument, NULL, 'f'},
+        {"fsync", required_argument, NULL, 'S'},
+        {"no-encode", no_argument, NULL, 'n'},
+        {"control", required_argument, NULL, 'k'},
+        {"live", required_argument, NULL, 'L'},
+        {NULL, 0, NULL, 0}};
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "P:b:f:S:nk:L:", longOptions, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'P':
+            frames_per_buffer = atoi(optarg);
+            if (frames_per_buffer < 16 || frames_per_buffer > MAX_FRAMES_PER_BUFFER)
+            {
+                fprintf(stderr, "The period must be between 16 and %d frames.\n", MAX_FRAMES_PER_BUFFER);
+                return 1;
+            }
+            break;
+        case 'b':
+            latency_us = (unsigned int)atoi(optarg);
+            break;
+        case 'f':
+            if (sampleFormatParse(optarg, &sample_format) != 0)
+            {
+                fprintf(stderr, "Unknown sample format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            encode_flac = 0;
+            break;
+        case 'k':
+            control_path = optarg;
+            break;
+        case 'L':
+            live_name = optarg;
+            break;
+        case 'S':
+            if (batchWriterParseFsync(optarg, &fsync_policy, &fsync_interval_ms) != 0)
+            {
+                fprintf(stderr, "Unknown fsync policy: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            // getopt has already reported the unknown option
+            return 1;
+        }
+    }
+
+    // The last three arguments are the recording parameters, every one before them is a device
+    mic_count = argc - optind - 3;
+    if (mic_count < 1 || mic_count > MAX_MICS)
     {
-        fprintf(stderr, "Usage: %s <mic1_index> <mic2_index> <sample_rate> <threshold_percentage> <min_silence_time>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-P frames] [-b buffer_time_us] [-f S16|S32|FLOAT] [-S none|close|interval:MS] [-n] [-k control_socket] [-L /live_ring] <mic1_index> [<mic2_index> ...] <sample_rate> <threshold_percentage> <min_silence_time>\n", argv[0]);
+        fprintf(stderr, "Up to %d devices, recorded as Mic1, Mic2, ... in the order given\n", MAX_MICS);
         return 1;
     }
 
-    mic1_index = atoi(argv[1]);
-    mic2_index = atoi(argv[2]);
-    sample_rate = atoi(argv[3]);
-    threshold_percentage = atof(argv[4]);
-    min_silence_time = atof(argv[5]);
+    char **deviceArgs = &argv[optind];
+    sample_rate = atoi(argv[optind + mic_count]);
+    threshold_percentage = atof(argv[optind + mic_count + 1]);
+    min_silence_time = atof(argv[optind + mic_count + 2]);
 
     threshold = MAX_AMPLITUDE * threshold_percentage;
-    min_silence_frames = sample_rate / FRAMES_PER_BUFFER * min_silence_time;
+    min_silence_frames = sample_rate / frames_per_buffer * min_silence_time;
+    sample_bytes = sampleFormatBytes(sample_format);
+    detect_period = detectForFormat(sample_format);
+
+    if (encode_flac && !flacEncoderSupports(sample_format))
+    {
+        fprintf(stderr, "WARNING: FLAC cannot store %s samples losslessly: only the raw recordings are written.\n", sampleFormatName(sample_format));
+        encode_flac = 0;
+    }
 
     PaError err;
-    MicData dataMic1, dataMic2;
-    char dir1[256];
-    char dir2[256];
+    MicData *mics;
     pthread_mutex_t startMutex = PTHREAD_MUTEX_INITIALIZER;
     pthread_cond_t startCond = PTHREAD_COND_INITIALIZER;
     int stopFlag = 0;
     int startFlag = 0;
 
-    snprintf(dir1, sizeof(dir1), "samples_threads_Mic%d", 1);
-    snprintf(dir2, sizeof(dir2), "samples_threads_Mic%d", 2);
-
-    if (mkdir(dir1, 0777) != 0 && errno != EEXIST)
+    if (createOutputDirectories(mic_count) != 0)
     {
-        perror("Error creating directory for Mic1");
         return 1;
     }
-    if (mkdir(dir2, 0777) != 0 && errno != EEXIST)
+
+    mics = calloc(mic_count, sizeof(MicData));
+    if (mics == NULL)
     {
-        perror("Error creating directory for Mic2");
+        fprintf(stderr, "Out of memory.\n");
         return 1;
     }
+    for (int i = 0; i < mic_count; i++)
+    {
+        initializeMicData(&mics[i], i + 1, atoi(deviceArgs[i]), &startMutex, &startCond, &startFlag, &stopFlag);
+    }
 
-    initializeMicData(&dataMic1, mic1_index, "Mic1", &startMutex, &startCond, &startFlag, &stopFlag);
-    initializeMicData(&dataMic2, mic2_index, "Mic2", &startMutex, &startCond, &startFlag, &stopFlag);
+    // Before PortAudio creates any thread, so all of them inherit SIGINT and SIGTERM blocked
+    if (control_path != NULL && controlSocketOpen(&control_socket, control_path, applyThreshold, reportStatus, NULL, NULL, mics) != 0)
+    {
+        return 1;
+    }
 
     err = Pa_Initialize();
     if (err != paNoError)
@@ -603,38 +816,58 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    startThreads(&dataMic1, &dataMic2);
+    for (int i = 0; live_name != NULL && i < mic_count; i++)
+    {
+        const PaDeviceInfo *info = Pa_GetDeviceInfo(mics[i].micIndex);
+        char name[LIVE_RING_NAME_BYTES];
+        snprintf(name, sizeof(name), "%.40s_%s", live_name, mics[i].micName);
+        if (liveRingCreate(&mics[i].live, name, sample_rate, frames_per_buffer, sample_format, sample_bytes,
+                           TIMESTAMP_CLOCK_PORTAUDIO, info != NULL ? info->name : NULL) != 0)
+        {
+            Pa_Terminate();
+            return 1;
+        }
+    }
 
-    pthread_mutex_lock(&startMutex);
-    startFlag = 1;
-    pthread_cond_broadcast(&startCond);
-    pthread_mutex_unlock(&startMutex);
+    startThreads(mics, mic_count);
 
-    printf("Press ENTER to stop recording...\n");
-    getchar();
+    // Driven through the socket, the streams stay open but stopped until a client sends start
+    if (control_path != NULL)
+    {
+        printf("Waiting for commands on %s...\n", control_path);
+    }
+    if (control_path == NULL || controlSocketWaitStart(&control_socket))
+    {
+        pthread_mutex_lock(&startMutex);
+        startFlag = 1;
+        pthread_cond_broadcast(&startCond);
+        pthread_mutex_unlock(&startMutex);
+
+        if (control_path != NULL)
+        {
+            controlSocketCapturing(&control_socket);
+            controlSocketWaitStop(&control_socket);
+        }
+        else
+        {
+            printf("Press ENTER to stop recording...\n");
+            getchar();
+        }
+    }
 
     pthread_mutex_lock(&startMutex);
     stopFlag = 1;
     pthread_cond_broadcast(&startCond);
     pthread_mutex_unlock(&startMutex);
 
-    stopRecordingThreads(&dataMic1, &dataMic2);
-    cleanUp(&dataMic1, &dataMic2);
-
-    if (pthread_create(&dataMic1.threadId, NULL, encodeRawFilesToMp4, dir1) != 0)
+    stopRecordingThreads(mics, mic_count);
+    // Every file is closed: the stop command can be answered
+    if (control_path != NULL)
     {
-        fprintf(stderr, "Error creating thread for encoding Mic1.\n");
-        return 1;
+        controlSocketClose(&control_socket);
     }
-
-    if (pthread_create(&dataMic2.threadId, NULL, encodeRawFilesToMp4, dir2) != 0)
-    {
-        fprintf(stderr, "Error creating thread for encoding Mic2.\n");
-        return 1;
-    }
-
-    pthread_join(dataMic1.threadId, NULL);
-    pthread_join(dataMic2.threadId, NULL);
+    cleanUp(mics, mic_count);
+    free(mics);
 
     Pa_Terminate();
 
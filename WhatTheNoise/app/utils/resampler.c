@@ -0,0 +1,253 @@
+/**
+ * ******************************
+ * ********* resampler.c ***********
+ * ******************************
+ *
+ * Implementation of the streaming fractional resampler declared in resampler.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "resampler.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define HALF_TAPS (RESAMPLER_TAPS / 2)
+#define CUTOFF 0.92 // fraction of Nyquist kept by the interpolation filter
+
+static float filterTable[RESAMPLER_PHASES + 1][RESAMPLER_TAPS] __attribute__((aligned(16)));
+static int filterTableReady = 0;
+
+/**
+ * @brief Builds the Blackman-windowed sinc polyphase table.
+ *
+ * Phase p holds the taps to interpolate at fractional offset p / RESAMPLER_PHASES after
+ * sample HALF_TAPS - 1 of the window. Must be called once before any resampler is used.
+ */
+void resamplerInit(void)
+{
+    if (filterTableReady)
+    {
+        return;
+    }
+
+    for (int phase = 0; phase <= RESAMPLER_PHASES; phase++)
+    {
+        double fraction = (double)phase / RESAMPLER_PHASES;
+        double sum = 0;
+
+        for (int k = 0; k < RESAMPLER_TAPS; k++)
+        {
+            double x = (k - (HALF_TAPS - 1)) - fraction;
+            double sinc = fabs(x) < 1e-12 ? 1.0 : sin(M_PI * CUTOFF * x) / (M_PI * CUTOFF * x);
+            double n = (x + HALF_TAPS) / RESAMPLER_TAPS;
+            double window = (n <= 0 || n >= 1) ? 0 : 0.42 - 0.5 * cos(2 * M_PI * n) + 0.08 * cos(4 * M_PI * n);
+            filterTable[phase][k] = (float)(sinc * window);
+            sum += sinc * window;
+        }
+        // Unity gain at DC for every phase
+        for (int k = 0; k < RESAMPLER_TAPS; k++)
+        {
+            filterTable[phase][k] = (float)(filterTable[phase][k] / sum);
+        }
+    }
+
+    filterTableReady = 1;
+}
+
+/**
+ * @brief Dot product of RESAMPLER_TAPS samples with a filter phase.
+ *
+ * @param samples Input samples (any alignment).
+ * @param taps Filter taps (16-byte aligned).
+ * @return Dot product.
+ */
+static inline float dotProduct(const float *samples, const float *taps)
+{
+#if defined(__SSE2__)
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < RESAMPLER_TAPS; k += 4)
+    {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(samples + k), _mm_load_ps(taps + k)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#elif defined(__ARM_NEON)
+    float32x4_t acc = vdupq_n_f32(0);
+    for (int k = 0; k < RESAMPLER_TAPS; k += 4)
+    {
+        acc = vmlaq_f32(acc, vld1q_f32(samples + k), vld1q_f32(taps + k));
+    }
+    float32x2_t half = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(half, half), 0);
+#else
+    float acc = 0;
+    for (int k = 0; k < RESAMPLER_TAPS; k++)
+    {
+        acc += samples[k] * taps[k];
+    }
+    return acc;
+#endif
+}
+
+/**
+ * @brief Empties the resampler. Samples before firstFrame are treated as silence.
+ *
+ * @param resampler Pointer to the resampler.
+ * @param firstFrame Source frame index of the next sample to be pushed.
+ */
+void resamplerReset(Resampler *resampler, uint64_t firstFrame)
+{
+    memset(resampler->buffer, 0, HALF_TAPS * sizeof(float));
+    resampler->length = HALF_TAPS;
+    resampler->firstFrame = firstFrame - HALF_TAPS;
+}
+
+/**
+ * @brief Appends source samples.
+ *
+ * A gap in the frame indices (e.g. a dropped period) restarts the stream.
+ *
+ * @param resampler Pointer to the resampler.
+ * @param firstFrame Source frame index of the first sample.
+ * @param samples Samples to append.
+ * @param frames Number of samples.
+ * @param format Sample format of the samples.
+ * @return 0 on success, -1 if the samples do not fit.
+ */
+int resamplerPush(Resampler *resampler, uint64_t firstFrame, const void *samples, size_t frames, SampleFormat format)
+{
+    if (firstFrame != resampler->firstFrame + resampler->length)
+    {
+        resamplerReset(resampler, firstFrame);
+    }
+    if (resampler->length + frames > RESAMPLER_CAPACITY)
+    {
+        return -1;
+    }
+
+    float *dest = resampler->buffer + resampler->length;
+    if (format == SAMPLE_S16)
+    {
+        for (size_t i = 0; i < frames; i++)
+        {
+            dest[i] = ((const int16_t *)samples)[i];
+        }
+    }
+    else if (format == SAMPLE_S32)
+    {
+        for (size_t i = 0; i < frames; i++)
+        {
+            dest[i] = (float)((const int32_t *)samples)[i];
+        }
+    }
+    else
+    {
+        memcpy(dest, samples, frames * sizeof(float));
+    }
+    resampler->length += frames;
+
+    return 0;
+}
+
+/**
+ * @brief Pads the end of the stream with silence so the last samples can be interpolated.
+ *
+ * @param resampler Pointer to the resampler.
+ */
+void resamplerFlush(Resampler *resampler)
+{
+    if (resampler->length + HALF_TAPS <= RESAMPLER_CAPACITY)
+    {
+        memset(resampler->buffer + resampler->length, 0, HALF_TAPS * sizeof(float));
+        resampler->length += HALF_TAPS;
+    }
+}
+
+/**
+ * @brief Stores an interpolated value in the output format, saturating integer formats.
+ *
+ * @param output Output buffer.
+ * @param index Index of the sample.
+ * @param value Interpolated value.
+ * @param format Sample format of the output.
+ */
+static inline void storeSample(void *output, size_t index, float value, SampleFormat format)
+{
+    if (format == SAMPLE_S16)
+    {
+        long rounded = lrintf(value);
+        ((int16_t *)output)[index] = (int16_t)(rounded > 32767 ? 32767 : rounded < -32768 ? -32768 : rounded);
+    }
+    else if (format == SAMPLE_S32)
+    {
+        long long rounded = llrintf(value);
+        ((int32_t *)output)[index] = (int32_t)(rounded > INT32_MAX ? INT32_MAX : rounded < INT32_MIN ? INT32_MIN : rounded);
+    }
+    else
+    {
+        ((float *)output)[index] = value;
+    }
+}
+
+/**
+ * @brief Produces output samples at source positions position, position + step, ...
+ *
+ * Stops when the next output would need source samples not pushed yet. Source samples no
+ * longer needed are discarded.
+ *
+ * @param resampler Pointer to the resampler.
+ * @param position Fractional source frame index of the first output sample.
+ * @param step Source frames advanced per output sample.
+ * @param output Buffer for the output samples.
+ * @param maxFrames Capacity of the output buffer.
+ * @param format Sample format of the output, the same as the input.
+ * @return Number of output samples produced.
+ */
+size_t resamplerPull(Resampler *resampler, double position, double step, void *output, size_t maxFrames, SampleFormat format)
+{
+    size_t produced = 0;
+    double relative = position - (double)resampler->firstFrame;
+
+    while (produced < maxFrames)
+    {
+        double base = floor(relative);
+        long start = (long)base - (HALF_TAPS - 1);
+
+        if (start + RESAMPLER_TAPS > (long)resampler->length)
+        {
+            break;
+        }
+
+        float value = 0;
+        if (start >= 0)
+        {
+            int phase = (int)((relative - base) * RESAMPLER_PHASES + 0.5);
+            value = dotProduct(resampler->buffer + start, filterTable[phase]);
+        }
+
+        storeSample(output, produced++, value, format);
+        relative += step;
+    }
+
+    // Keep only the history still needed by the next output
+    long keepFrom = (long)floor(relative) - (HALF_TAPS - 1);
+    if (keepFrom > 0)
+    {
+        size_t discard = (size_t)keepFrom < resampler->length ? (size_t)keepFrom : resampler->length;
+        memmove(resampler->buffer, resampler->buffer + discard, (resampler->length - discard) * sizeof(float));
+        resampler->length -= discard;
+        resampler->firstFrame += discard;
+    }
+
+    return produced;
+}
@@ -0,0 +1,46 @@
+/**
+ * ******************************
+ * ********* resampler.h ***********
+ * ******************************
+ *
+ * Streaming fractional resampler used to put the samples of one microphone
+ * on the sample grid of another. Windowed-sinc polyphase interpolation with
+ * SSE/NEON dot products and a scalar fallback.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sample_format.h"
+
+#define RESAMPLER_TAPS 16
+#define RESAMPLER_PHASES 512
+#define RESAMPLER_CAPACITY 8192
+
+/**
+ * @brief State of a streaming resampler.
+ *
+ * Input samples are addressed by their absolute frame index in the source stream, so the
+ * caller can ask for any fractional source position still held in the buffer. Samples are
+ * kept as floats in the units of their capture format.
+ */
+typedef struct
+{
+    float buffer[RESAMPLER_CAPACITY];
+    size_t length;
+    uint64_t firstFrame;
+} Resampler;
+
+void resamplerInit(void);
+void resamplerReset(Resampler *resampler, uint64_t firstFrame);
+int resamplerPush(Resampler *resampler, uint64_t firstFrame, const void *samples, size_t frames, SampleFormat format);
+void resamplerFlush(Resampler *resampler);
+size_t resamplerPull(Resampler *resampler, double position, double step, void *output, size_t maxFrames, SampleFormat format);
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * ******************************
+ * ******* sample_format.c *********
+ * ******************************
+ *
+ * Implementation of the sample format helpers declared in sample_format.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "sample_format.h"
+
+#include <strings.h>
+
+/**
+ * @brief Parses a format given on the command line: "S16", "S32" or "FLOAT" (any case).
+ *
+ * @param text Text to parse.
+ * @param format Pointer to where the format will be stored.
+ * @return 0 on success, -1 if the text is not a format.
+ */
+int sampleFormatParse(const char *text, SampleFormat *format)
+{
+    if (strcasecmp(text, "S16") == 0 || strcasecmp(text, "S16_LE") == 0)
+    {
+        *format = SAMPLE_S16;
+    }
+    else if (strcasecmp(text, "S32") == 0 || strcasecmp(text, "S32_LE") == 0)
+    {
+        *format = SAMPLE_S32;
+    }
+    else if (strcasecmp(text, "FLOAT") == 0 || strcasecmp(text, "FLOAT_LE") == 0)
+    {
+        *format = SAMPLE_FLOAT;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Name of a format, as written in the session info.
+ *
+ * @param format Sample format.
+ * @return "S16_LE", "S32_LE" or "FLOAT_LE".
+ */
+const char *sampleFormatName(SampleFormat format)
+{
+    return format == SAMPLE_S16 ? "S16_LE" : format == SAMPLE_S32 ? "S32_LE" : "FLOAT_LE";
+}
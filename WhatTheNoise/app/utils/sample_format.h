@@ -0,0 +1,41 @@
+/**
+ * ******************************
+ * ******* sample_format.h *********
+ * ******************************
+ *
+ * Sample formats the recorders can capture in, chosen at runtime.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef SAMPLE_FORMAT_H
+#define SAMPLE_FORMAT_H
+
+#include <stddef.h>
+
+/**
+ * @brief Little-endian interleaved sample formats.
+ */
+typedef enum
+{
+    SAMPLE_S16,
+    SAMPLE_S32,
+    SAMPLE_FLOAT
+} SampleFormat;
+
+int sampleFormatParse(const char *text, SampleFormat *format);
+const char *sampleFormatName(SampleFormat format);
+
+/**
+ * @brief Size in bytes of one sample.
+ *
+ * @param format Sample format.
+ * @return 2 for S16, 4 for S32 and FLOAT.
+ */
+static inline size_t sampleFormatBytes(SampleFormat format)
+{
+    return format == SAMPLE_S16 ? 2 : 4;
+}
+
+#endif
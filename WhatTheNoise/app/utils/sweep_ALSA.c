@@ -0,0 +1,284 @@
+/**
+ * ******************************
+ * ********* sweep_ALSA.c **********
+ * ******************************
+ *
+ * Latency/CPU sweep of the capture parameters of record_ALSA. Captures from
+ * one device for every combination of period size, buffer time and sample
+ * format, running the level detector on each period like the recorder, and
+ * reports the XRUNs, the CPU used and the jitter of the hardware timestamps
+ * around a straight line fitted over the run.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <alsa/asoundlib.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "detect.h"
+#include "sample_format.h"
+
+#define DEFAULT_SECONDS 2
+#define DEFAULT_THRESHOLD 3276
+
+static const int periods[] = {64, 128, 256, 512, 1024};
+static const int bufferPeriods[] = {2, 4, 8};
+static const SampleFormat formats[] = {SAMPLE_S16, SAMPLE_S32, SAMPLE_FLOAT};
+
+/**
+ * @brief Result of one capture run.
+ */
+typedef struct
+{
+    unsigned long xruns;
+    double cpuPercent;
+    double jitterUs;
+    double maxJitterUs;
+    unsigned int bufferTimeUs;
+    snd_pcm_uframes_t periodFrames;
+} SweepResult;
+
+/**
+ * @brief Opens and configures the device for one run.
+ *
+ * @param handle Pointer to where the PCM handle will be stored.
+ * @param device Name of the ALSA device.
+ * @param rate Sample rate.
+ * @param format Sample format.
+ * @param frames Requested period size; the one granted by the device is stored back.
+ * @param bufferTime Requested buffer time in microseconds; the one granted is stored back.
+ * @return 0 on success, or a negative error code.
+ */
+static int openDevice(snd_pcm_t **handle, const char *device, unsigned int rate, SampleFormat format,
+                      snd_pcm_uframes_t *frames, unsigned int *bufferTime)
+{
+    snd_pcm_hw_params_t *params;
+    snd_pcm_sw_params_t *swparams;
+    snd_pcm_format_t pcmFormat = format == SAMPLE_S16 ? SND_PCM_FORMAT_S16_LE : format == SAMPLE_S32 ? SND_PCM_FORMAT_S32_LE : SND_PCM_FORMAT_FLOAT_LE;
+    int err;
+
+    snd_pcm_hw_params_alloca(&params);
+    snd_pcm_sw_params_alloca(&swparams);
+
+    if ((err = snd_pcm_open(handle, device, SND_PCM_STREAM_CAPTURE, 0)) < 0)
+    {
+        return err;
+    }
+
+    snd_pcm_hw_params_any(*handle, params);
+    snd_pcm_hw_params_set_access(*handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+    if ((err = snd_pcm_hw_params_set_format(*handle, params, pcmFormat)) < 0 ||
+        (err = snd_pcm_hw_params_set_channels(*handle, params, 1)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate_near(*handle, params, &rate, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_period_size_near(*handle, params, frames, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_buffer_time_near(*handle, params, bufferTime, 0)) < 0 ||
+        (err = snd_pcm_hw_params(*handle, params)) < 0)
+    {
+        snd_pcm_close(*handle);
+        return err;
+    }
+
+    snd_pcm_sw_params_current(*handle, swparams);
+    snd_pcm_sw_params_set_tstamp_mode(*handle, swparams, SND_PCM_TSTAMP_ENABLE);
+    snd_pcm_sw_params_set_tstamp_type(*handle, swparams, SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY);
+    snd_pcm_sw_params_set_avail_min(*handle, swparams, *frames);
+    if ((err = snd_pcm_sw_params(*handle, swparams)) < 0)
+    {
+        snd_pcm_close(*handle);
+        return err;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Jitter of the timestamps around the least-squares line through them.
+ *
+ * @param frames Frame position of each timestamp.
+ * @param times Timestamps in nanoseconds, relative to the first one.
+ * @param count Number of timestamps.
+ * @param maxJitter Pointer to where the largest deviation in microseconds will be stored.
+ * @return Standard deviation of the residuals in microseconds.
+ */
+static double timestampJitter(const double *frames, const double *times, size_t count, double *maxJitter)
+{
+    double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0, sumRR = 0;
+
+    *maxJitter = 0;
+    if (count < 3)
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        sumX += frames[i];
+        sumY += times[i];
+        sumXX += frames[i] * frames[i];
+        sumXY += frames[i] * times[i];
+    }
+    double slope = (count * sumXY - sumX * sumY) / (count * sumXX - sumX * sumX);
+    double intercept = (sumY - slope * sumX) / count;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        double residual = fabs(times[i] - (intercept + slope * frames[i])) / 1000.0;
+        sumRR += residual * residual;
+        *maxJitter = residual > *maxJitter ? residual : *maxJitter;
+    }
+    return sqrt(sumRR / count);
+}
+
+/**
+ * @brief Captures for a number of seconds with one combination of parameters.
+ *
+ * @param device Name of the ALSA device.
+ * @param rate Sample rate.
+ * @param format Sample format.
+ * @param frames Period size in frames.
+ * @param buffered Periods in the device buffer.
+ * @param seconds Length of the run.
+ * @param result Pointer to where the result will be stored.
+ * @return 0 on success, or a negative error code if the device rejected the combination.
+ */
+static int runCombination(const char *device, unsigned int rate, SampleFormat format, int frames, int buffered,
+                          int seconds, SweepResult *result)
+{
+    snd_pcm_t *handle;
+    snd_pcm_status_t *status;
+    DetectFunction detect = detectForFormat(format);
+    PeriodLevels levels;
+    struct rusage before, after;
+    struct timespec start, now, stamp, firstStamp;
+    uint64_t framesCaptured = 0;
+    size_t count = 0;
+    int err;
+
+    result->periodFrames = frames;
+    result->bufferTimeUs = (unsigned int)(1000000ULL * frames * buffered / rate);
+    if ((err = openDevice(&handle, device, rate, format, &result->periodFrames, &result->bufferTimeUs)) < 0)
+    {
+        return err;
+    }
+
+    size_t capacity = (size_t)seconds * rate / result->periodFrames + 16;
+    void *buffer = malloc(result->periodFrames * sampleFormatBytes(format));
+    double *stampFrames = malloc(capacity * sizeof(double));
+    double *stampTimes = malloc(capacity * sizeof(double));
+    if (buffer == NULL || stampFrames == NULL || stampTimes == NULL)
+    {
+        fprintf(stderr, "Could not allocate the capture buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    snd_pcm_status_alloca(&status);
+    result->xruns = 0;
+
+    getrusage(RUSAGE_SELF, &before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec - start.tv_sec >= seconds)
+        {
+            break;
+        }
+
+        snd_pcm_sframes_t pcm = snd_pcm_readi(handle, buffer, result->periodFrames);
+        if (pcm < 0)
+        {
+            if (pcm == -EPIPE)
+            {
+                result->xruns++;
+            }
+            if ((err = snd_pcm_recover(handle, (int)pcm, 1)) < 0)
+            {
+                break;
+            }
+            continue;
+        }
+
+        detect(buffer, pcm, DEFAULT_THRESHOLD, &levels);
+        framesCaptured += pcm;
+
+        snd_pcm_status(handle, status);
+        snd_pcm_status_get_htstamp(status, &stamp);
+        if (count == 0)
+        {
+            firstStamp = stamp;
+        }
+        // Timestamps after an XRUN belong to a new stream position: only keep the first stretch
+        if (result->xruns == 0 && count < capacity)
+        {
+            stampFrames[count] = (double)(framesCaptured + snd_pcm_status_get_avail(status));
+            stampTimes[count] = (stamp.tv_sec - firstStamp.tv_sec) * 1e9 + (stamp.tv_nsec - firstStamp.tv_nsec);
+            count++;
+        }
+    }
+    getrusage(RUSAGE_SELF, &after);
+
+    double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+    double cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) + (after.ru_utime.tv_usec - before.ru_utime.tv_usec) / 1e6 +
+                 (after.ru_stime.tv_sec - before.ru_stime.tv_sec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e6;
+    result->cpuPercent = elapsed > 0 ? 100.0 * cpu / elapsed : 0;
+    result->jitterUs = timestampJitter(stampFrames, stampTimes, count, &result->maxJitterUs);
+
+    snd_pcm_close(handle);
+    free(buffer);
+    free(stampFrames);
+    free(stampTimes);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <device> <sample_rate> [seconds_per_run]\n", argv[0]);
+        return 1;
+    }
+
+    const char *device = argv[1];
+    unsigned int rate = (unsigned int)atoi(argv[2]);
+    int seconds = argc > 3 ? atoi(argv[3]) : DEFAULT_SECONDS;
+
+    if (rate == 0 || seconds <= 0)
+    {
+        fprintf(stderr, "Invalid sample rate or run length.\n");
+        return 1;
+    }
+
+    printf("%s at %u Hz, %d s per run, %s kernels\n", device, rate, seconds, detectKernelName());
+    printf("%-9s %8s %12s %7s %8s %12s %12s\n", "format", "period", "buffer (us)", "xruns", "cpu %", "jitter (us)", "max (us)");
+
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    {
+        for (size_t p = 0; p < sizeof(periods) / sizeof(periods[0]); p++)
+        {
+            for (size_t b = 0; b < sizeof(bufferPeriods) / sizeof(bufferPeriods[0]); b++)
+            {
+                SweepResult result;
+                int err = runCombination(device, rate, formats[f], periods[p], bufferPeriods[b], seconds, &result);
+
+                if (err < 0)
+                {
+                    printf("%-9s %8d %4d periods rejected: %s\n", sampleFormatName(formats[f]), periods[p], bufferPeriods[b], snd_strerror(err));
+                    continue;
+                }
+                printf("%-9s %8lu %12u %7lu %8.2f %12.1f %12.1f\n", sampleFormatName(formats[f]), result.periodFrames,
+                       result.bufferTimeUs, result.xruns, result.cpuPercent, result.jitterUs, result.maxJitterUs);
+                fflush(stdout);
+            }
+        }
+    }
+
+    return 0;
+}
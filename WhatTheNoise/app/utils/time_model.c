@@ -0,0 +1,241 @@
+/**
+ * ******************************
+ * ******** time_model.c **********
+ * ******************************
+ *
+ * Implementation of the online time model fit declared in time_model.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "time_model.h"
+
+#include <math.h>
+#include <string.h>
+
+#define MIN_OBSERVATIONS_TO_REJECT 32
+#define MAX_RATE_DEVIATION 0.05
+
+/**
+ * @brief Adds a number of seconds (possibly negative) to a timespec.
+ *
+ * @param base Base time.
+ * @param seconds Seconds to add.
+ * @return Resulting normalized timespec.
+ */
+static struct timespec addSeconds(struct timespec base, double seconds)
+{
+    double whole = floor(seconds);
+    struct timespec result;
+
+    result.tv_sec = base.tv_sec + (time_t)whole;
+    result.tv_nsec = base.tv_nsec + (long)llround((seconds - whole) * 1e9);
+    while (result.tv_nsec >= 1000000000L)
+    {
+        result.tv_sec++;
+        result.tv_nsec -= 1000000000L;
+    }
+    return result;
+}
+
+/**
+ * @brief Initializes a time fit.
+ *
+ * @param fit Pointer to the fit.
+ * @param nominalRate Configured sample rate, used until the fit has enough observations.
+ * @param windowObservations Effective number of observations remembered by the fit.
+ */
+void timeFitInit(TimeFit *fit, double nominalRate, double windowObservations)
+{
+    memset(fit, 0, sizeof(*fit));
+    fit->nominalRate = nominalRate;
+    fit->forgetting = windowObservations > 1 ? 1.0 - 1.0 / windowObservations : 0.0;
+    fit->maxResidual = 0.002;
+}
+
+/**
+ * @brief Discards every observation, e.g. after an XRUN broke the frame count.
+ *
+ * @param fit Pointer to the fit.
+ */
+void timeFitReset(TimeFit *fit)
+{
+    TimeFit fresh;
+    timeFitInit(&fresh, fit->nominalRate, fit->forgetting > 0 ? 1.0 / (1.0 - fit->forgetting) : 0);
+    fresh.maxResidual = fit->maxResidual;
+    fresh.rejected = fit->rejected;
+    *fit = fresh;
+}
+
+/**
+ * @brief Returns the current slope of the fit in seconds per frame.
+ *
+ * @param fit Pointer to the fit.
+ * @return Seconds per frame, or the nominal period if the fit is not reliable yet.
+ */
+static double timeFitSlope(const TimeFit *fit)
+{
+    double nominal = 1.0 / fit->nominalRate;
+
+    if (fit->observations < 2 || fit->covXX <= 0)
+    {
+        return nominal;
+    }
+
+    double slope = fit->covXY / fit->covXX;
+    if (fabs(slope - nominal) > nominal * MAX_RATE_DEVIATION)
+    {
+        return nominal;
+    }
+    return slope;
+}
+
+/**
+ * @brief Adds an observation: the hardware had captured frame frames at time timestamp.
+ *
+ * Once the fit is established, observations too far from the fitted line (scheduling
+ * outliers) are rejected.
+ *
+ * @param fit Pointer to the fit.
+ * @param frame Number of frames captured by the device.
+ * @param timestamp Hardware timestamp of that position.
+ * @return 1 if the observation was used, 0 if it was rejected.
+ */
+int timeFitAdd(TimeFit *fit, uint64_t frame, struct timespec timestamp)
+{
+    if (fit->observations == 0)
+    {
+        fit->originFrame = frame;
+        fit->originTime = timestamp;
+    }
+
+    double x = (double)(int64_t)(frame - fit->originFrame);
+    double y = (timestamp.tv_sec - fit->originTime.tv_sec) + (timestamp.tv_nsec - fit->originTime.tv_nsec) / 1e9;
+
+    if (fit->observations >= MIN_OBSERVATIONS_TO_REJECT)
+    {
+        double predicted = fit->meanY + timeFitSlope(fit) * (x - fit->meanX);
+        if (fabs(y - predicted) > fit->maxResidual)
+        {
+            fit->rejected++;
+            return 0;
+        }
+    }
+
+    fit->weight = fit->forgetting * fit->weight + 1.0;
+    double dx = x - fit->meanX;
+    fit->meanX += dx / fit->weight;
+    fit->meanY += (y - fit->meanY) / fit->weight;
+    fit->covXX = fit->forgetting * fit->covXX + dx * (x - fit->meanX);
+    fit->covXY = fit->forgetting * fit->covXY + dx * (y - fit->meanY);
+    fit->observations++;
+
+    return 1;
+}
+
+/**
+ * @brief Extracts the current linear model from the fit.
+ *
+ * The model is anchored at the centroid of the observations, where the fit is most accurate.
+ *
+ * @param fit Pointer to the fit.
+ * @param model Pointer to where the model will be stored.
+ */
+void timeFitModel(const TimeFit *fit, TimeModel *model)
+{
+    double slope = timeFitSlope(fit);
+    double anchorX = fit->meanX > 0 ? floor(fit->meanX + 0.5) : 0;
+
+    model->anchorFrame = fit->originFrame + (uint64_t)anchorX;
+    model->anchorTime = addSeconds(fit->originTime, fit->meanY + slope * (anchorX - fit->meanX));
+    model->rate = 1.0 / slope;
+}
+
+/**
+ * @brief Maps a frame index to time using a model.
+ *
+ * @param model Pointer to the model.
+ * @param frame Frame index in the device stream.
+ * @param time Pointer to where the time will be stored.
+ */
+void timeModelFrameTime(const TimeModel *model, uint64_t frame, struct timespec *time)
+{
+    *time = addSeconds(model->anchorTime, (double)(int64_t)(frame - model->anchorFrame) / model->rate);
+}
+
+/**
+ * @brief Maps a frame index to time in nanoseconds, for comparisons between devices.
+ *
+ * @param model Pointer to the model.
+ * @param frame Frame index in the device stream.
+ * @return Time in nanoseconds since the epoch of the timestamps.
+ */
+int64_t timeModelFrameNs(const TimeModel *model, uint64_t frame)
+{
+    int64_t anchor = (int64_t)model->anchorTime.tv_sec * 1000000000LL + model->anchorTime.tv_nsec;
+    return anchor + llround((double)(int64_t)(frame - model->anchorFrame) * 1e9 / model->rate);
+}
+
+/**
+ * @brief Maps a frame of one device to the (fractional) frame of another captured at the same time.
+ *
+ * @param from Model of the device the frame belongs to.
+ * @param to Model of the device to map into.
+ * @param frame Frame index in the stream of from.
+ * @return Fractional frame index in the stream of to.
+ */
+double timeModelMapFrame(const TimeModel *from, const TimeModel *to, uint64_t frame)
+{
+    double anchorOffset = (from->anchorTime.tv_sec - to->anchorTime.tv_sec) + (from->anchorTime.tv_nsec - to->anchorTime.tv_nsec) / 1e9;
+    double seconds = anchorOffset + (double)(int64_t)(frame - from->anchorFrame) / from->rate;
+
+    return (double)to->anchorFrame + seconds * to->rate;
+}
+
+/**
+ * @brief Clock drift of a device relative to a reference device.
+ *
+ * @param model Model of the device.
+ * @param reference Model of the reference device.
+ * @return Drift in parts per million; positive if the device samples faster than the reference.
+ */
+double timeModelDriftPpm(const TimeModel *model, const TimeModel *reference)
+{
+    return (model->rate / reference->rate - 1.0) * 1e6;
+}
+
+/**
+ * @brief Publishes a new model. Only one thread may publish to a given shared model.
+ *
+ * @param shared Pointer to the shared model.
+ * @param model Model to publish.
+ */
+void sharedTimeModelPublish(SharedTimeModel *shared, const TimeModel *model)
+{
+    unsigned sequence = atomic_load_explicit(&shared->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&shared->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    shared->model = *model;
+    atomic_store_explicit(&shared->sequence, sequence + 2, memory_order_release);
+}
+
+/**
+ * @brief Copies the latest published model, retrying if it was being updated.
+ *
+ * @param shared Pointer to the shared model.
+ * @param model Pointer to where the model will be stored.
+ */
+void sharedTimeModelRead(SharedTimeModel *shared, TimeModel *model)
+{
+    unsigned before, after;
+
+    do
+    {
+        before = atomic_load_explicit(&shared->sequence, memory_order_acquire);
+        *model = shared->model;
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&shared->sequence, memory_order_relaxed);
+    } while ((before & 1u) || before != after);
+}
@@ -0,0 +1,79 @@
+/**
+ * ******************************
+ * ******** time_model.h **********
+ * ******************************
+ *
+ * Sample-accurate time model of a capture device. An online linear fit of
+ * (frames captured -> hardware timestamp) turns the jittery per-period
+ * timestamps into a (time, rate) pair that maps any frame index to time
+ * with sub-sample precision.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef TIME_MODEL_H
+#define TIME_MODEL_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Linear mapping from frame index to time: t(k) = anchorTime + (k - anchorFrame) / rate.
+ */
+typedef struct
+{
+    struct timespec anchorTime;
+    uint64_t anchorFrame;
+    double rate;
+} TimeModel;
+
+/**
+ * @brief Latest model of a device, published by its capture thread for other threads.
+ *
+ * Sequence lock: the writer makes sequence odd while it updates the model, so readers can
+ * copy it without ever blocking the capture thread.
+ */
+typedef struct
+{
+    atomic_uint sequence;
+    TimeModel model;
+} SharedTimeModel;
+
+/**
+ * @brief State of the online least-squares fit of time against frame index.
+ *
+ * Coordinates are relative to the first observation to keep the sums well conditioned, and
+ * older observations are exponentially forgotten so the fit follows slow clock drift.
+ */
+typedef struct
+{
+    double nominalRate;
+    double forgetting;
+    double maxResidual;
+    uint64_t originFrame;
+    struct timespec originTime;
+    double weight;
+    double meanX;
+    double meanY;
+    double covXX;
+    double covXY;
+    unsigned long observations;
+    unsigned long rejected;
+} TimeFit;
+
+void timeFitInit(TimeFit *fit, double nominalRate, double windowObservations);
+void timeFitReset(TimeFit *fit);
+int timeFitAdd(TimeFit *fit, uint64_t frame, struct timespec timestamp);
+void timeFitModel(const TimeFit *fit, TimeModel *model);
+
+void timeModelFrameTime(const TimeModel *model, uint64_t frame, struct timespec *time);
+int64_t timeModelFrameNs(const TimeModel *model, uint64_t frame);
+double timeModelMapFrame(const TimeModel *from, const TimeModel *to, uint64_t frame);
+double timeModelDriftPpm(const TimeModel *model, const TimeModel *reference);
+
+void sharedTimeModelPublish(SharedTimeModel *shared, const TimeModel *model);
+void sharedTimeModelRead(SharedTimeModel *shared, TimeModel *model);
+
+#endif
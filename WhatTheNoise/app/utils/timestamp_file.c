@@ -0,0 +1,68 @@
+/**
+ * ******************************
+ * ******* timestamp_file.c ********
+ * ******************************
+ *
+ * Writer of the binary timestamp files declared in timestamp_file.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "timestamp_file.h"
+
+#include <string.h>
+
+/**
+ * @brief Writes the header of a new timestamp file.
+ *
+ * @param file File opened for binary writing, positioned at the start.
+ * @param sampleRate Sample rate of the recording.
+ * @param framesPerPeriod Frames per period.
+ * @param clock Clock the timestamps are taken with.
+ * @param device Name of the capture device (truncated to fit the header).
+ * @return 0 on success, -1 on write error.
+ */
+int timestampFileWriteHeader(FILE *file, uint32_t sampleRate, uint32_t framesPerPeriod, TimestampClock clock, const char *device)
+{
+    TimestampFileHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TIMESTAMP_FILE_MAGIC, sizeof(header.magic));
+    header.headerBytes = sizeof(TimestampFileHeader);
+    header.recordBytes = sizeof(TimestampRecord);
+    header.sampleRate = sampleRate;
+    header.framesPerPeriod = framesPerPeriod;
+    header.clock = clock;
+    if (device != NULL)
+    {
+        strncpy(header.device, device, sizeof(header.device) - 1);
+    }
+
+    return fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -1;
+}
+
+/**
+ * @brief Appends the timestamp of a period.
+ *
+ * Records go through the stdio buffer without taking its lock (each file has a single writer
+ * thread), so most calls are a 16-byte copy.
+ *
+ * @param file Timestamp file.
+ * @param time Time of the period.
+ * @param frameOffset Position of the first sample of the period in the raw file.
+ * @param flags TIMESTAMP_RECORD_* flags.
+ * @return 0 on success, -1 on write error.
+ */
+int timestampFileWriteRecord(FILE *file, struct timespec time, uint64_t frameOffset, uint32_t flags)
+{
+    TimestampRecord record;
+
+    record.timeNs = (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+    record.frameOffset = (uint32_t)frameOffset;
+    record.flags = flags;
+
+    return fwrite_unlocked(&record, sizeof(record), 1, file) == 1 ? 0 : -1;
+}
@@ -0,0 +1,76 @@
+/**
+ * ******************************
+ * ******* timestamp_file.h ********
+ * ******************************
+ *
+ * Binary format of the timestamp files (.ts) written next to each recording:
+ * a 64-byte header followed by one fixed-size record per period, so a
+ * reader can map the whole file (np.memmap in analyzer.py) instead of
+ * parsing it. All fields are little-endian.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef TIMESTAMP_FILE_H
+#define TIMESTAMP_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define TIMESTAMP_FILE_MAGIC "WTNTS01"
+#define TIMESTAMP_DEVICE_BYTES 32
+#define TIMESTAMP_FILE_BUFFER_BYTES 65536 // stdio buffer of a timestamp file, 4096 records per write
+
+/**
+ * @brief Flags of a timestamp record.
+ */
+#define TIMESTAMP_RECORD_FILLED 0x1u // period zero-filled after an XRUN, its time comes from the time model
+
+/**
+ * @brief Clock the timestamps were taken with.
+ */
+typedef enum
+{
+    TIMESTAMP_CLOCK_UNKNOWN = 0,
+    TIMESTAMP_CLOCK_REALTIME = 1,  // ALSA hardware timestamps of type GETTIMEOFDAY
+    TIMESTAMP_CLOCK_MONOTONIC = 2, // ALSA hardware timestamps of type MONOTONIC
+    TIMESTAMP_CLOCK_PORTAUDIO = 3  // PortAudio stream time (ADC time of the buffer)
+} TimestampClock;
+
+/**
+ * @brief Header at the start of every timestamp file.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t headerBytes;
+    uint32_t recordBytes;
+    uint32_t sampleRate;
+    uint32_t framesPerPeriod;
+    uint32_t clock;
+    uint32_t reserved;
+    char device[TIMESTAMP_DEVICE_BYTES];
+} TimestampFileHeader;
+
+/**
+ * @brief Timestamp of one period.
+ *
+ * timeNs is the time of the period in nanoseconds on the clock of the header and frameOffset
+ * the position of its first sample in the raw file of the segment.
+ */
+typedef struct
+{
+    int64_t timeNs;
+    uint32_t frameOffset;
+    uint32_t flags;
+} TimestampRecord;
+
+_Static_assert(sizeof(TimestampFileHeader) == 64, "timestamp file header must be 64 bytes");
+_Static_assert(sizeof(TimestampRecord) == 16, "timestamp record must be 16 bytes");
+
+int timestampFileWriteHeader(FILE *file, uint32_t sampleRate, uint32_t framesPerPeriod, TimestampClock clock, const char *device);
+int timestampFileWriteRecord(FILE *file, struct timespec time, uint64_t frameOffset, uint32_t flags);
+
+#endif
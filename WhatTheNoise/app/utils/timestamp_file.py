@@ -0,0 +1,113 @@
+"""Reader of the binary timestamp files written by the recorders (see timestamp_file.h),
+and converter of the legacy text .ts files, one "seconds.nanoseconds" line per period.
+
+Usage: python timestamp_file.py [--rate R] [--period P] [--device NAME] legacy.ts [...]
+Converts each legacy file in place; files already in the binary format are left as they are.
+"""
+import argparse
+import os
+import sys
+
+import numpy as np
+
+MAGIC = b'WTNTS01\x00'
+HEADER_BYTES = 64
+
+CLOCK_UNKNOWN = 0
+CLOCK_REALTIME = 1
+CLOCK_MONOTONIC = 2
+CLOCK_PORTAUDIO = 3
+
+RECORD_FILLED = 0x1
+
+HEADER_DTYPE = np.dtype([('magic', 'S8'), ('header_bytes', '<u4'), ('record_bytes', '<u4'),
+                         ('sample_rate', '<u4'), ('frames_per_period', '<u4'), ('clock', '<u4'),
+                         ('reserved', '<u4'), ('device', 'S32')])
+RECORD_DTYPE = np.dtype([('time_ns', '<i8'), ('frame_offset', '<u4'), ('flags', '<u4')])
+
+def is_binary(path):
+    """True if the file starts with the magic of the binary format."""
+    with open(path, 'rb') as f:
+        return f.read(len(MAGIC)) == MAGIC
+
+def read_header(path):
+    """Header of a binary timestamp file as a dict."""
+    header = np.fromfile(path, dtype=HEADER_DTYPE, count=1)[0]
+    return {'sample_rate': int(header['sample_rate']), 'frames_per_period': int(header['frames_per_period']),
+            'clock': int(header['clock']), 'device': header['device'].decode(errors='replace'),
+            'header_bytes': int(header['header_bytes']), 'record_bytes': int(header['record_bytes'])}
+
+def parse_legacy(path):
+    """Nanosecond times of a legacy text file, parsed without going through a double."""
+    times = []
+    with open(path, 'r') as f:
+        for line in f:
+            seconds, _, fraction = line.strip().partition('.')
+            if seconds:
+                times.append(int(seconds) * 1000000000 + int((fraction + '000000000')[:9]))
+    return np.array(times, dtype=np.int64)
+
+def read_timestamps(path, frames_per_period=128):
+    """Records of a timestamp file (fields time_ns, frame_offset, flags) and its header.
+
+    Binary files are mapped with np.memmap, without copying or parsing. Legacy text files are
+    parsed into the same record layout, with frame offsets assumed one period apart, and a None header.
+    """
+    if is_binary(path):
+        header = read_header(path)
+        if header['record_bytes'] != RECORD_DTYPE.itemsize:
+            raise ValueError(f"{path}: unsupported record size {header['record_bytes']}")
+        if os.path.getsize(path) <= header['header_bytes']:
+            return np.zeros(0, dtype=RECORD_DTYPE), header
+        return np.memmap(path, dtype=RECORD_DTYPE, mode='r', offset=header['header_bytes']), header
+
+    times = parse_legacy(path)
+    records = np.zeros(len(times), dtype=RECORD_DTYPE)
+    records['time_ns'] = times
+    records['frame_offset'] = np.arange(len(times)) * frames_per_period
+    return records, None
+
+def write_timestamps(path, times_ns, sample_rate, frames_per_period, clock=CLOCK_UNKNOWN, device='', frame_offsets=None, flags=None):
+    """Write a binary timestamp file."""
+    header = np.zeros(1, dtype=HEADER_DTYPE)
+    header['magic'] = MAGIC
+    header['header_bytes'] = HEADER_BYTES
+    header['record_bytes'] = RECORD_DTYPE.itemsize
+    header['sample_rate'] = sample_rate
+    header['frames_per_period'] = frames_per_period
+    header['clock'] = clock
+    header['device'] = device.encode()[:31]
+
+    records = np.zeros(len(times_ns), dtype=RECORD_DTYPE)
+    records['time_ns'] = times_ns
+    records['frame_offset'] = frame_offsets if frame_offsets is not None else np.arange(len(times_ns)) * frames_per_period
+    if flags is not None:
+        records['flags'] = flags
+
+    with open(path, 'wb') as f:
+        header.tofile(f)
+        records.tofile(f)
+
+def convert_legacy(path, sample_rate, frames_per_period, device=''):
+    """Convert a legacy text file to the binary format in place. Returns False if it already was binary."""
+    if is_binary(path):
+        return False
+    times = parse_legacy(path)
+    tmp_path = path + '.tmp'
+    write_timestamps(tmp_path, times, sample_rate, frames_per_period, CLOCK_UNKNOWN, device)
+    os.replace(tmp_path, path)
+    return True
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Convert legacy text .ts files to the binary timestamp format.")
+    parser.add_argument('--rate', type=int, default=44100, help="sample rate of the recordings")
+    parser.add_argument('--period', type=int, default=128, help="frames per period")
+    parser.add_argument('--device', default='', help="name of the capture device")
+    parser.add_argument('files', nargs='+')
+    args = parser.parse_args()
+
+    for ts_path in args.files:
+        if convert_legacy(ts_path, args.rate, args.period, args.device):
+            print(f"Converted {ts_path}")
+        else:
+            print(f"{ts_path} is already binary", file=sys.stderr)
@@ -0,0 +1,228 @@
+/**
+ * ******************************
+ * ********** trigger.c ************
+ * ******************************
+ *
+ * Implementation of the trigger coordinator declared in trigger.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "trigger.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRIGGER_OPENING UINT_MAX
+#define TRIGGER_NEVER (INT64_MIN / 2)
+
+/**
+ * @brief Initializes the coordinator.
+ *
+ * @param trigger Pointer to the coordinator.
+ * @param policy Policy deciding when an event starts.
+ * @param quorum Microphones needed to start an event with the QUORUM policy.
+ * @param micCount Number of microphones.
+ * @param windowSeconds Window in which the crossings of different microphones count together.
+ * @param silenceSeconds Time every microphone must stay below the threshold to end an event.
+ * @param prerollSeconds Time recorded before the first crossing of an event.
+ * @return 0 on success, -1 if the configuration is not valid.
+ */
+int triggerInit(TriggerCoordinator *trigger, TriggerPolicy policy, int quorum, int micCount, double windowSeconds, double silenceSeconds, double prerollSeconds)
+{
+    if (micCount < 1 || micCount > TRIGGER_MAX_MICS)
+    {
+        fprintf(stderr, "The trigger coordinator supports between 1 and %d microphones.\n", TRIGGER_MAX_MICS);
+        return -1;
+    }
+
+    memset(trigger, 0, sizeof(*trigger));
+    trigger->policy = policy;
+    trigger->micCount = micCount;
+    trigger->quorum = policy == TRIGGER_OR ? 1 : policy == TRIGGER_AND ? micCount : quorum;
+    if (trigger->quorum < 1 || trigger->quorum > micCount)
+    {
+        fprintf(stderr, "The trigger quorum must be between 1 and %d.\n", micCount);
+        return -1;
+    }
+    trigger->windowNs = (int64_t)(windowSeconds * 1e9);
+    trigger->silenceNs = (int64_t)(silenceSeconds * 1e9);
+    trigger->prerollNs = (int64_t)(prerollSeconds * 1e9);
+
+    for (int i = 0; i < TRIGGER_MAX_MICS; i++)
+    {
+        atomic_init(&trigger->lastOver[i], TRIGGER_NEVER);
+        atomic_init(&trigger->onset[i], TRIGGER_NEVER);
+    }
+    atomic_init(&trigger->activeEvent, 0);
+    atomic_init(&trigger->eventCount, 0);
+    atomic_init(&trigger->eventStart, 0);
+    atomic_init(&trigger->lastEventEnd, TRIGGER_NEVER);
+
+    return 0;
+}
+
+/**
+ * @brief Parses a policy given on the command line: "or", "and" or "quorum:K".
+ *
+ * @param text Text to parse.
+ * @param policy Pointer to where the policy will be stored.
+ * @param quorum Pointer to where the quorum will be stored (only for "quorum:K").
+ * @return 0 on success, -1 if the text is not a policy.
+ */
+int triggerParsePolicy(const char *text, TriggerPolicy *policy, int *quorum)
+{
+    if (strcmp(text, "or") == 0)
+    {
+        *policy = TRIGGER_OR;
+        return 0;
+    }
+    if (strcmp(text, "and") == 0)
+    {
+        *policy = TRIGGER_AND;
+        return 0;
+    }
+    if (strncmp(text, "quorum:", 7) == 0 && atoi(text + 7) > 0)
+    {
+        *policy = TRIGGER_QUORUM;
+        *quorum = atoi(text + 7);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Name of a policy, as written in the session info.
+ *
+ * @param policy Policy.
+ * @return "or", "and" or "quorum".
+ */
+const char *triggerPolicyName(TriggerPolicy policy)
+{
+    return policy == TRIGGER_OR ? "or" : policy == TRIGGER_AND ? "and" : "quorum";
+}
+
+/**
+ * @brief Reports that a period of a microphone had samples over the threshold.
+ *
+ * Only called by the capture thread of that microphone.
+ *
+ * @param trigger Pointer to the coordinator.
+ * @param mic Index of the microphone.
+ * @param onsetNs Time of the first sample over the threshold.
+ * @param periodEndNs Time of the end of the period.
+ */
+void triggerReportOver(TriggerCoordinator *trigger, int mic, int64_t onsetNs, int64_t periodEndNs)
+{
+    int64_t previous = atomic_load_explicit(&trigger->lastOver[mic], memory_order_relaxed);
+
+    // A crossing after a quiet window starts a new burst
+    if (periodEndNs - previous > trigger->windowNs)
+    {
+        atomic_store_explicit(&trigger->onset[mic], onsetNs, memory_order_relaxed);
+    }
+    atomic_store_explicit(&trigger->lastOver[mic], periodEndNs, memory_order_release);
+}
+
+/**
+ * @brief Starts or ends the event according to the policy and returns the active event.
+ *
+ * Called by every capture thread after each period. Whichever thread first sees the
+ * condition opens or closes the event; the rest follow on their next period.
+ *
+ * @param trigger Pointer to the coordinator.
+ * @param nowNs Time of the end of the period just captured by the calling thread.
+ * @param eventStartNs Pointer to where the start time of the active event will be stored.
+ * @return ID of the active event (starting at 1), or 0 if there is none.
+ */
+unsigned triggerPoll(TriggerCoordinator *trigger, int64_t nowNs, int64_t *eventStartNs)
+{
+    unsigned event = atomic_load_explicit(&trigger->activeEvent, memory_order_acquire);
+
+    if (event == TRIGGER_OPENING)
+    {
+        return 0;
+    }
+
+    if (event == 0)
+    {
+        int64_t since = nowNs - trigger->windowNs;
+        int64_t lastEnd = atomic_load_explicit(&trigger->lastEventEnd, memory_order_relaxed);
+        int64_t earliest = INT64_MAX;
+        int count = 0;
+
+        if (lastEnd > since)
+        {
+            since = lastEnd;
+        }
+        for (int i = 0; i < trigger->micCount; i++)
+        {
+            if (atomic_load_explicit(&trigger->lastOver[i], memory_order_acquire) > since)
+            {
+                int64_t onset = atomic_load_explicit(&trigger->onset[i], memory_order_relaxed);
+                earliest = onset < earliest ? onset : earliest;
+                count++;
+            }
+        }
+        if (count < trigger->quorum)
+        {
+            return 0;
+        }
+
+        unsigned expected = 0;
+        if (!atomic_compare_exchange_strong(&trigger->activeEvent, &expected, TRIGGER_OPENING))
+        {
+            return 0;
+        }
+        event = atomic_fetch_add_explicit(&trigger->eventCount, 1, memory_order_relaxed) + 1;
+        atomic_store_explicit(&trigger->eventStart, earliest - trigger->prerollNs, memory_order_relaxed);
+        atomic_store_explicit(&trigger->activeEvent, event, memory_order_release);
+        *eventStartNs = earliest - trigger->prerollNs;
+        return event;
+    }
+
+    int64_t latest = TRIGGER_NEVER;
+    for (int i = 0; i < trigger->micCount; i++)
+    {
+        int64_t over = atomic_load_explicit(&trigger->lastOver[i], memory_order_relaxed);
+        latest = over > latest ? over : latest;
+    }
+    if (nowNs - latest > trigger->silenceNs)
+    {
+        atomic_store_explicit(&trigger->lastEventEnd, nowNs, memory_order_relaxed);
+        atomic_compare_exchange_strong(&trigger->activeEvent, &event, 0);
+        return 0;
+    }
+
+    *eventStartNs = atomic_load_explicit(&trigger->eventStart, memory_order_relaxed);
+    if (atomic_load_explicit(&trigger->activeEvent, memory_order_acquire) != event)
+    {
+        // The event changed while reading its start: pick it up on the next period
+        return 0;
+    }
+    return event;
+}
+
+/**
+ * @brief Ends the active event at once, whatever the policy says.
+ *
+ * Called by the capture threads on every period between two sessions of the daemon, so a
+ * session never picks up the event of the previous one, nor crossings reported before it.
+ *
+ * @param trigger Pointer to the coordinator.
+ * @param nowNs Time of the end of the period just captured by the calling thread.
+ */
+void triggerEnd(TriggerCoordinator *trigger, int64_t nowNs)
+{
+    unsigned event = atomic_load_explicit(&trigger->activeEvent, memory_order_acquire);
+
+    atomic_store_explicit(&trigger->lastEventEnd, nowNs, memory_order_relaxed);
+    // An event being opened is ended on the next period, once it has its ID
+    if (event != 0 && event != TRIGGER_OPENING)
+    {
+        atomic_compare_exchange_strong(&trigger->activeEvent, &event, 0);
+    }
+}
@@ -0,0 +1,69 @@
+/**
+ * ******************************
+ * ********** trigger.h ************
+ * ******************************
+ *
+ * Trigger coordinator shared by the capture threads of every microphone.
+ * Each microphone reports when it crosses the threshold; the coordinator
+ * decides, with an OR, AND or quorum-within-window policy, when an event
+ * starts and ends. Every microphone then records the same event, under the
+ * same event ID and from the same start time. Lock-free: capture threads
+ * only use atomics.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define TRIGGER_MAX_MICS 8
+
+/**
+ * @brief Policy deciding when an event starts.
+ *
+ * OR starts an event when any microphone crosses the threshold, AND when all of them do and
+ * QUORUM when at least quorum of them do, in every case within the trigger window.
+ */
+typedef enum
+{
+    TRIGGER_OR,
+    TRIGGER_AND,
+    TRIGGER_QUORUM
+} TriggerPolicy;
+
+/**
+ * @brief State shared by the capture threads.
+ *
+ * Times are nanoseconds on the clock of the hardware timestamps. lastOver is the time of the
+ * last period of each microphone with a sample over the threshold and onset the time of the
+ * first sample over the threshold of its current burst.
+ */
+typedef struct
+{
+    TriggerPolicy policy;
+    int micCount;
+    int quorum;
+    int64_t windowNs;
+    int64_t silenceNs;
+    int64_t prerollNs;
+    _Atomic int64_t lastOver[TRIGGER_MAX_MICS];
+    _Atomic int64_t onset[TRIGGER_MAX_MICS];
+    atomic_uint activeEvent;
+    atomic_uint eventCount;
+    _Atomic int64_t eventStart;
+    _Atomic int64_t lastEventEnd;
+} TriggerCoordinator;
+
+int triggerInit(TriggerCoordinator *trigger, TriggerPolicy policy, int quorum, int micCount, double windowSeconds, double silenceSeconds, double prerollSeconds);
+int triggerParsePolicy(const char *text, TriggerPolicy *policy, int *quorum);
+const char *triggerPolicyName(TriggerPolicy policy);
+
+void triggerReportOver(TriggerCoordinator *trigger, int mic, int64_t onsetNs, int64_t periodEndNs);
+unsigned triggerPoll(TriggerCoordinator *trigger, int64_t nowNs, int64_t *eventStartNs);
+void triggerEnd(TriggerCoordinator *trigger, int64_t nowNs);
+
+#endif
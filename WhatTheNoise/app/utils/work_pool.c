@@ -0,0 +1,333 @@
+/**
+ * ******************************
+ * ********* work_pool.c ***********
+ * ******************************
+ *
+ * Implementation of the work-stealing pool declared in work_pool.h.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#include "work_pool.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * @brief Whether job a has to run before job b.
+ */
+static int runsBefore(const WorkJob *a, const WorkJob *b)
+{
+    return a->priority > b->priority || (a->priority == b->priority && a->sequence < b->sequence);
+}
+
+/**
+ * @brief Adds a job to a queue. The caller holds the queue mutex and has checked there is room.
+ */
+static void heapPush(WorkQueue *queue, const WorkJob *job)
+{
+    int i = queue->count++;
+
+    while (i > 0 && runsBefore(job, &queue->heap[(i - 1) / 2]))
+    {
+        queue->heap[i] = queue->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue->heap[i] = *job;
+}
+
+/**
+ * @brief Removes the most urgent job of a queue.
+ *
+ * @param queue Queue, locked here.
+ * @param job Removed job.
+ * @return 1 if a job was removed, 0 if the queue was empty.
+ */
+static int heapPop(WorkQueue *queue, WorkJob *job)
+{
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->count == 0)
+    {
+        pthread_mutex_unlock(&queue->mutex);
+        return 0;
+    }
+
+    *job = queue->heap[0];
+    WorkJob last = queue->heap[--queue->count];
+    int i = 0;
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= queue->count)
+        {
+            break;
+        }
+        if (child + 1 < queue->count && runsBefore(&queue->heap[child + 1], &queue->heap[child]))
+        {
+            child++;
+        }
+        if (!runsBefore(&queue->heap[child], &last))
+        {
+            break;
+        }
+        queue->heap[i] = queue->heap[child];
+        i = child;
+    }
+    queue->heap[i] = last;
+    pthread_mutex_unlock(&queue->mutex);
+    return 1;
+}
+
+/**
+ * @brief Steals the most urgent job found at the top of the other queues.
+ *
+ * @param pool Pointer to the pool.
+ * @param thief Index of the worker stealing.
+ * @param job Stolen job.
+ * @return 1 if a job was stolen, 0 if every other queue was empty.
+ */
+static int steal(WorkPool *pool, int thief, WorkJob *job)
+{
+    for (;;)
+    {
+        WorkJob best;
+        int victim = -1;
+
+        for (int i = 1; i < pool->workers; i++)
+        {
+            WorkQueue *queue = &pool->queues[(thief + i) % pool->workers];
+            pthread_mutex_lock(&queue->mutex);
+            if (queue->count > 0 && (victim < 0 || runsBefore(&queue->heap[0], &best)))
+            {
+                best = queue->heap[0];
+                victim = queue->index;
+            }
+            pthread_mutex_unlock(&queue->mutex);
+        }
+        if (victim < 0)
+        {
+            return 0;
+        }
+        // The victim may have taken its job meanwhile; look again if it was its last one
+        if (heapPop(&pool->queues[victim], job))
+        {
+            return 1;
+        }
+    }
+}
+
+/**
+ * @brief Body of each worker: runs its own jobs first, then steals, and sleeps when there is nothing left.
+ *
+ * @param arg Pointer to the queue of the worker.
+ * @return NULL.
+ */
+static void *workerMain(void *arg)
+{
+    WorkQueue *own = (WorkQueue *)arg;
+    WorkPool *pool = own->pool;
+    WorkJob job;
+
+    for (;;)
+    {
+        int stolen = 0;
+        int found = heapPop(own, &job);
+        if (!found)
+        {
+            found = stolen = steal(pool, own->index, &job);
+        }
+
+        if (found)
+        {
+            pthread_mutex_lock(&pool->mutex);
+            pool->queued--;
+            pool->stolen += stolen;
+            pthread_cond_broadcast(&pool->spaceCond);
+            pthread_mutex_unlock(&pool->mutex);
+
+            job.run(job.arg, own->index);
+
+            pthread_mutex_lock(&pool->mutex);
+            pool->completed++;
+            if (pool->progress != NULL)
+            {
+                pool->progress(pool->completed, pool->submitted, pool->progressArg);
+            }
+            pthread_cond_broadcast(&pool->doneCond);
+            pthread_mutex_unlock(&pool->mutex);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->queued == 0 && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->workCond, &pool->mutex);
+        }
+        int done = pool->queued == 0 && pool->stopping;
+        pthread_mutex_unlock(&pool->mutex);
+        if (done)
+        {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * @brief Number of workers to use by default: one per online CPU.
+ */
+int workPoolDefaultWorkers(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpus < 1)
+    {
+        return 1;
+    }
+    return cpus > WORK_POOL_MAX_WORKERS ? WORK_POOL_MAX_WORKERS : (int)cpus;
+}
+
+/**
+ * @brief Creates the queues and starts the workers.
+ *
+ * @param pool Pointer to the pool.
+ * @param workers Number of workers, 1 to WORK_POOL_MAX_WORKERS.
+ * @param queueCapacity Jobs each worker queue can hold before workPoolSubmit() blocks.
+ * @param progress Called every time a job completes. May be NULL.
+ * @param progressArg Argument of progress.
+ * @return 0 on success, -1 on failure.
+ */
+int workPoolCreate(WorkPool *pool, int workers, int queueCapacity, WorkProgress progress, void *progressArg)
+{
+    if (workers < 1 || workers > WORK_POOL_MAX_WORKERS || queueCapacity < 1)
+    {
+        return -1;
+    }
+
+    pool->workers = 0;
+    pool->started = 0;
+    pool->queueCapacity = queueCapacity;
+    pool->queued = 0;
+    pool->stopping = 0;
+    pool->nextQueue = 0;
+    pool->sequence = 0;
+    pool->submitted = 0;
+    pool->completed = 0;
+    pool->stolen = 0;
+    pool->progress = progress;
+    pool->progressArg = progressArg;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->workCond, NULL);
+    pthread_cond_init(&pool->spaceCond, NULL);
+    pthread_cond_init(&pool->doneCond, NULL);
+
+    for (int i = 0; i < workers; i++)
+    {
+        WorkQueue *queue = &pool->queues[i];
+        queue->heap = malloc(sizeof(WorkJob) * queueCapacity);
+        if (queue->heap == NULL)
+        {
+            workPoolDestroy(pool);
+            return -1;
+        }
+        pthread_mutex_init(&queue->mutex, NULL);
+        queue->count = 0;
+        queue->pool = pool;
+        queue->index = i;
+        pool->workers++;
+    }
+
+    for (int i = 0; i < workers; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, workerMain, &pool->queues[i]) != 0)
+        {
+            workPoolDestroy(pool);
+            return -1;
+        }
+        pool->started++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Queues a job on the next worker with room, blocking while every queue is full.
+ *
+ * @param pool Pointer to the pool.
+ * @param run Function of the job.
+ * @param arg Argument of the job.
+ * @param priority Priority of the job, higher runs first.
+ */
+void workPoolSubmit(WorkPool *pool, WorkFunction run, void *arg, int priority)
+{
+    WorkJob job = {run, arg, priority, 0};
+
+    pthread_mutex_lock(&pool->mutex);
+    // queued only drops after a job has left its queue, so below the total some queue has room
+    while (pool->queued >= pool->workers * pool->queueCapacity)
+    {
+        pthread_cond_wait(&pool->spaceCond, &pool->mutex);
+    }
+    job.sequence = pool->sequence++;
+
+    for (int i = 0; i < pool->workers; i++)
+    {
+        WorkQueue *queue = &pool->queues[(pool->nextQueue + i) % pool->workers];
+        pthread_mutex_lock(&queue->mutex);
+        if (queue->count < pool->queueCapacity)
+        {
+            heapPush(queue, &job);
+            pthread_mutex_unlock(&queue->mutex);
+            pool->nextQueue = (queue->index + 1) % pool->workers;
+            break;
+        }
+        pthread_mutex_unlock(&queue->mutex);
+    }
+
+    pool->queued++;
+    pool->submitted++;
+    pthread_cond_broadcast(&pool->workCond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * @brief Waits until every submitted job has completed.
+ *
+ * @param pool Pointer to the pool.
+ */
+void workPoolWait(WorkPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->completed < pool->submitted)
+    {
+        pthread_cond_wait(&pool->doneCond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * @brief Lets the workers finish the queued jobs, stops them and frees the queues.
+ *
+ * @param pool Pointer to the pool.
+ */
+void workPoolDestroy(WorkPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->workCond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->started; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i < pool->workers; i++)
+    {
+        free(pool->queues[i].heap);
+        pthread_mutex_destroy(&pool->queues[i].mutex);
+    }
+
+    pthread_cond_destroy(&pool->doneCond);
+    pthread_cond_destroy(&pool->spaceCond);
+    pthread_cond_destroy(&pool->workCond);
+    pthread_mutex_destroy(&pool->mutex);
+}
@@ -0,0 +1,95 @@
+/**
+ * ******************************
+ * ********* work_pool.h ***********
+ * ******************************
+ *
+ * Bounded pool of worker threads for batch jobs such as encoding the
+ * recordings of a session. Every worker owns a priority queue: jobs are
+ * spread over the queues as they are submitted, each worker runs the most
+ * urgent job of its own queue and, when it runs dry, steals the most urgent
+ * job of the others. Submitting blocks while every queue is full.
+ *
+ * ~ Author: rubennmg
+ *
+ */
+
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define WORK_POOL_MAX_WORKERS 64
+
+/**
+ * @brief Function run by a job.
+ *
+ * @param arg Argument given when the job was submitted.
+ * @param worker Index of the worker running it, for per-worker state.
+ */
+typedef void (*WorkFunction)(void *arg, int worker);
+
+/**
+ * @brief Called by the worker that completed a job, with the pool lock held so reports come in order.
+ *
+ * @param completed Jobs completed so far.
+ * @param submitted Jobs submitted so far.
+ * @param arg Argument given to workPoolCreate().
+ */
+typedef void (*WorkProgress)(unsigned long completed, unsigned long submitted, void *arg);
+
+/**
+ * @brief Queued job. Higher priorities run first, equal ones in submission order.
+ */
+typedef struct
+{
+    WorkFunction run;
+    void *arg;
+    int priority;
+    uint64_t sequence;
+} WorkJob;
+
+/**
+ * @brief Priority queue (binary heap) of one worker.
+ */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    WorkJob *heap;
+    int count;
+    struct WorkPool *pool;
+    int index;
+} WorkQueue;
+
+/**
+ * @brief Pool of workers and their queues.
+ */
+typedef struct WorkPool
+{
+    pthread_t threads[WORK_POOL_MAX_WORKERS];
+    WorkQueue queues[WORK_POOL_MAX_WORKERS];
+    int workers;
+    int started;
+    int queueCapacity;
+    pthread_mutex_t mutex;
+    pthread_cond_t workCond;  // a job was queued or the pool is stopping
+    pthread_cond_t spaceCond; // a queue has room again
+    pthread_cond_t doneCond;  // a job completed
+    int queued;
+    int stopping;
+    int nextQueue;
+    uint64_t sequence;
+    unsigned long submitted;
+    unsigned long completed;
+    unsigned long stolen;
+    WorkProgress progress;
+    void *progressArg;
+} WorkPool;
+
+int workPoolDefaultWorkers(void);
+int workPoolCreate(WorkPool *pool, int workers, int queueCapacity, WorkProgress progress, void *progressArg);
+void workPoolSubmit(WorkPool *pool, WorkFunction run, void *arg, int priority);
+void workPoolWait(WorkPool *pool);
+void workPoolDestroy(WorkPool *pool);
+
+#endif